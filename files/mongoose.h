@@ -69,7 +69,22 @@ union socket_address {
 };
 
 struct mg_connection;
-struct mbuf { };
+struct mbuf {
+  char *buf;   /* Buffer pointer */
+  size_t len;  /* Data length. Data is located between offset 0 and len. */
+  size_t size; /* Buffer size allocated by realloc(1). Must be >= len */
+};
+
+/* Removes `data_size` bytes from the beginning of the buffer. */
+void mbuf_remove(struct mbuf *, size_t data_size);
+
+/*
+ * Sends data to the connection.
+ *
+ * Note that sending functions do not actually push data to the socket.
+ * They just append data to the output buffer.
+ */
+void mg_send(struct mg_connection *, const void *buf, int len);
 
 /*
  * Sends `printf`-style formatted data to the connection.
@@ -80,6 +95,9 @@ int mg_printf(struct mg_connection *, const char *fmt, ...);
 
 struct mg_str mg_mk_str_n(const char *s, size_t len);
 int mg_vcmp(const struct mg_str *str2, const char *str1);
+int mg_vcasecmp(const struct mg_str *str2, const char *str1);
+int mg_url_decode(const char *src, int src_len, char *dst, int dst_len,
+		  int is_form_url_encoded);
 
 /*
  * Callback function (event handler) prototype. Must be defined by the user.
@@ -466,3 +484,9 @@ void mg_mgr_free(struct mg_mgr *);
 time_t mg_mgr_poll(struct mg_mgr *, int milli);
 
 void mg_set_protocol_http_websocket(struct mg_connection *nc);
+
+/*
+ * Creates a connection, associates it with the given socket and event
+ * handler and adds it to the manager.
+ */
+struct mg_connection *mg_add_sock(struct mg_mgr *, sock_t, mg_event_handler_t);
@@ -0,0 +1,157 @@
+#!/bin/sh
+# SPDX-License-Identifier: DUAL GPL-2.0/BSD
+#
+# Builds an emulated copy of the kernel interfaces the SC and HAC read, for
+# running them with -R <root> on a machine without nvmet or a fabric.
+#
+#   <root>/sys/kernel/config/nvmet/	subsystems, namespaces, ports, hosts
+#   <root>/sys/class/nvme/		local pcie controllers and namespaces
+#   <root>/sys/class/nvme-fabrics/ctl/	fabrics controllers of a host
+#   <root>/dev/nullb0, <root>/dev/nvme-fabrics
+#
+# The tree is plain directories and files.  Objects made here come with the
+# default groups and attributes configfs would give them, but ones made or
+# removed later do not behave like configfs, so the daemons can take the
+# tree for inventory, state walks and HAC scans but not for applying config.
+# test/configfs_emu.h gives the SC's configfs.c those semantics on the tree
+# for the benchmarks in test/sc_apply.c and test/hac_scan.c.
+
+usage() {
+  echo "usage: $0 -r <root> [-d <pcie ctrls>] [-m <ns per ctrl>] [-b]"
+  echo "       [-s <subsystems>] [-n <ns per subsys>] [-p <ports>]"
+  echo "       [-H <hosts>] [-c <fabrics ctrls>] [-t <trtype>]"
+  echo "  -r  root of the tree, its sys and dev are replaced"
+  echo "  -d  local pcie nvme controllers (default 0)"
+  echo "  -m  namespaces per pcie controller (default 1)"
+  echo "  -b  add /dev/nullb0"
+  echo "  -s  nvmet subsystems (default 0)"
+  echo "  -n  namespaces per subsystem (default 1)"
+  echo "  -p  nvmet ports, each linked to every subsystem (default 0)"
+  echo "  -H  hosts, each allowed on every subsystem (default 0)"
+  echo "  -c  fabrics controllers on the host side, spread over the"
+  echo "      subsystems (default 0)"
+  echo "  -t  transport of ports and fabrics controllers (default rdma)"
+  exit 1
+}
+
+ROOT=
+PCIE=0
+PCIE_NS=1
+NULLB=0
+SUBSYS=0
+SUBSYS_NS=1
+PORTS=0
+HOSTS=0
+CTRLS=0
+TRTYPE=rdma
+
+while getopts "r:d:m:bs:n:p:H:c:t:" opt ; do
+  case $opt in
+    r) ROOT=$OPTARG ;;
+    d) PCIE=$OPTARG ;;
+    m) PCIE_NS=$OPTARG ;;
+    b) NULLB=1 ;;
+    s) SUBSYS=$OPTARG ;;
+    n) SUBSYS_NS=$OPTARG ;;
+    p) PORTS=$OPTARG ;;
+    H) HOSTS=$OPTARG ;;
+    c) CTRLS=$OPTARG ;;
+    t) TRTYPE=$OPTARG ;;
+    *) usage ;;
+  esac
+done
+
+[ -n "$ROOT" ] || usage
+[ "$ROOT" != "/" ] || usage
+
+CFS=$ROOT/sys/kernel/config/nvmet
+SYSFS=$ROOT/sys/class/nvme
+FABRICS=$ROOT/sys/class/nvme-fabrics/ctl
+NQN=nqn.2014-08.org.nvmexpress.emulated
+MARK=$ROOT/.nvmet_emulate
+
+# only ever clear a sys and dev this script made, never a real one
+if [ ! -e "$MARK" ] && [ -e "$ROOT/sys" -o -e "$ROOT/dev" ] ; then
+  echo "$ROOT has a sys or dev not made by $0, not clearing it"
+  exit 1
+fi
+
+mkdir -p "$ROOT" && : > "$MARK" || exit 1
+rm -rf "$ROOT/sys" "$ROOT/dev"
+mkdir -p "$CFS/subsystems" "$CFS/ports" "$CFS/hosts" "$SYSFS" "$FABRICS" \
+	 "$ROOT/dev" || exit 1
+
+: > "$ROOT/dev/nvme-fabrics"
+[ $NULLB -eq 0 ] || : > "$ROOT/dev/nullb0"
+
+i=0
+while [ $i -lt $PCIE ] ; do
+  mkdir "$SYSFS/nvme$i"
+  echo pcie > "$SYSFS/nvme$i/transport"
+  j=1
+  while [ $j -le $PCIE_NS ] ; do
+    mkdir "$SYSFS/nvme$i/nvme${i}n$j"
+    j=$((j + 1))
+  done
+  i=$((i + 1))
+done
+
+i=0
+while [ $i -lt $HOSTS ] ; do
+  mkdir "$CFS/hosts/$NQN:host$i"
+  i=$((i + 1))
+done
+
+i=0
+while [ $i -lt $SUBSYS ] ; do
+  s=$CFS/subsystems/$NQN:subsys$i
+  mkdir -p "$s/namespaces" "$s/allowed_hosts"
+  echo 0 > "$s/attr_allow_any_host"
+  j=1
+  while [ $j -le $SUBSYS_NS ] ; do
+    mkdir "$s/namespaces/$j"
+    if [ $PCIE -gt 0 ] ; then
+      echo /dev/nvme$((i % PCIE))n1 > "$s/namespaces/$j/device_path"
+    else
+      echo /dev/nullb0 > "$s/namespaces/$j/device_path"
+    fi
+    echo 1 > "$s/namespaces/$j/enable"
+    j=$((j + 1))
+  done
+  j=0
+  while [ $j -lt $HOSTS ] ; do
+    ln -s "$CFS/hosts/$NQN:host$j" "$s/allowed_hosts/$NQN:host$j"
+    j=$((j + 1))
+  done
+  i=$((i + 1))
+done
+
+i=1
+while [ $i -le $PORTS ] ; do
+  p=$CFS/ports/$i
+  mkdir -p "$p/subsystems"
+  echo ipv4 > "$p/addr_adrfam"
+  echo $TRTYPE > "$p/addr_trtype"
+  echo 192.168.$((i / 256)).$((i % 256)) > "$p/addr_traddr"
+  echo 4420 > "$p/addr_trsvcid"
+  echo "not specified" > "$p/addr_treq"
+  j=0
+  while [ $j -lt $SUBSYS ] ; do
+    ln -s "$CFS/subsystems/$NQN:subsys$j" "$p/subsystems/$NQN:subsys$j"
+    j=$((j + 1))
+  done
+  i=$((i + 1))
+done
+
+i=0
+while [ $i -lt $CTRLS ] ; do
+  c=$FABRICS/nvme$i
+  mkdir "$c"
+  echo $NQN:subsys$((i % (SUBSYS > 0 ? SUBSYS : CTRLS))) > "$c/subsysnqn"
+  echo $TRTYPE > "$c/transport"
+  addr=192.168.$((i / 65536 % 256)).$((i / 256 % 256))
+  echo traddr=$addr,trsvcid=$((4420 + i % 256)) > "$c/address"
+  i=$((i + 1))
+done
+
+echo "emulated tree in $ROOT"
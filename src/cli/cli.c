@@ -164,8 +164,6 @@ static int dem_config(char *base, int n, char **p)
 err:
 	printf("%s\n", result);
 out:
-	free(result);
-
 	return 0;
 }
 
@@ -214,8 +212,6 @@ static int list_group(char *url, int n, char **p)
 err:
 	printf("%s\n", result);
 out:
-	free(result);
-
 	return 0;
 }
 
@@ -265,8 +261,6 @@ static int get_group(char *base, int n, char **p)
 err:
 	printf("%s\n", result);
 out:
-	free(result);
-
 	return 0;
 }
 
@@ -356,8 +350,6 @@ static int list_target(char *url, int n, char **p)
 err:
 	printf("%s\n", result);
 out:
-	free(result);
-
 	return 0;
 }
 
@@ -407,8 +399,6 @@ static int get_target(char *base, int n, char **p)
 err:
 	printf("%s\n", result);
 out:
-	free(result);
-
 	return 0;
 }
 
@@ -645,8 +635,6 @@ static int usage_target(char *base, int n, char **p)
 err:
 	printf("%s\n", result);
 out:
-	free(result);
-
 	return 0;
 }
 
@@ -955,8 +943,6 @@ static int list_host(char *url, int n, char **p)
 err:
 	printf("%s\n", result);
 out:
-	free(result);
-
 	return 0;
 }
 
@@ -1007,8 +993,6 @@ static int get_host(char *base, int n, char **p)
 err:
 	printf("%s\n", result);
 out:
-	free(result);
-
 	return 0;
 }
 
@@ -36,8 +36,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include <curl/curl.h>
 
+#include "nvme.h"
+#include "utils.h"
 #include "curl.h"
 
 #ifdef DEM_CLI
@@ -46,38 +49,61 @@ static int curl_show_results = 1;
 extern int curl_show_results;
 #endif
 
+/* a request context: an easy handle and the buffers of its requests.
+ * The reply buffer is kept and grown by doubling, so after the first few
+ * requests on a context no more allocations are made.
+ */
 struct curl_context {
-	CURL *curl;
-	char *write_data;	/* used in write_cb */
-	size_t write_sz;
-	char *read_data;	/* used in read_cb */
-	int read_sz;
+	struct linked_list	 node;
+	CURL			*curl;
+	char			*write_data;	/* used in write_cb */
+	size_t			 write_sz;
+	size_t			 write_max;
+	char			*read_data;	/* used in read_cb */
+	int			 read_sz;
 };
 
-static struct curl_context	*ctx;
 static int			 debug_curl;
 
-#ifdef CURLINFO_CONTENT_LENGTH_DOWNLOAD_T
-#define CURLINFO_CONTENT_LENGTH CURLINFO_CONTENT_LENGTH_DOWNLOAD_T
-#else
-#define CURLINFO_CONTENT_LENGTH CURLINFO_CONTENT_LENGTH_DOWNLOAD
-#endif
+/* all handles share one connection cache so a connection to a peer
+ * opened by one is reused by the next request to it from any other
+ */
+static CURLSH			*share;
+static pthread_mutex_t		 share_lock[CURL_LOCK_DATA_LAST];
+
+/* the context exec_get() and friends use, one per thread, all of them
+ * are kept on a list so cleanup_curl() frees the ones of threads that are
+ * gone or never exit
+ */
+static pthread_key_t		 ctx_key;
+static LINKED_LIST(ctx_list);
+static pthread_mutex_t		 ctx_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* connections to the SCs are kept open between pushes, enough are
+ * cached that pushing to many targets does not keep evicting them
+ */
+#define MAX_CURL_CONNECTS	64L
+
+/* reply buffers are kept up to this size between requests */
+#define MIN_REPLY_SIZE		1024
+#define MAX_KEPT_REPLY_SIZE	(1024 * 1024)
 
 static size_t read_cb(char *p, size_t size, size_t n, void *stream)
 {
+	struct curl_context	*c = stream;
 	int			 len = size * n;
 	int			 cnt;
 
-	if (ctx != stream || !ctx->read_sz)
+	if (!c->read_sz)
 		cnt = 0;
-	else if (len > ctx->read_sz) {
-		memcpy(p, ctx->read_data, ctx->read_sz);
-		cnt = ctx->read_sz;
-		ctx->read_sz = 0;
+	else if (len > c->read_sz) {
+		memcpy(p, c->read_data, c->read_sz);
+		cnt = c->read_sz;
+		c->read_sz = 0;
 	} else {
-		memcpy(p, ctx->read_data, len);
-		ctx->read_data += len;
-		ctx->read_sz -= len;
+		memcpy(p, c->read_data, len);
+		c->read_data += len;
+		c->read_sz -= len;
 		cnt = len;
 	}
 
@@ -86,275 +112,613 @@ static size_t read_cb(char *p, size_t size, size_t n, void *stream)
 
 static size_t write_cb(void *contents, size_t size, size_t n, void *stream)
 {
+	struct curl_context	*c = stream;
 	size_t			 bytes = size * n;
-
-	if (ctx != stream)
-		return 0;
-
-	ctx->write_data = realloc(ctx->write_data, ctx->write_sz + bytes + 1);
-	if (ctx->write_data == NULL) {
-		fprintf(stderr, "unable to alloc memory for new data\n");
-		return 0;
+	size_t			 max = c->write_max;
+	char			*data;
+
+	if (c->write_sz + bytes + 1 > max) {
+		while (c->write_sz + bytes + 1 > max)
+			max *= 2;
+
+		data = realloc(c->write_data, max);
+		if (data == NULL) {
+			fprintf(stderr,
+				"unable to alloc memory for new data\n");
+			return 0;
+		}
+
+		c->write_data = data;
+		c->write_max = max;
 	}
 
-	memcpy(&(ctx->write_data[ctx->write_sz]), contents, bytes);
-	ctx->write_sz += bytes;
-	ctx->write_data[ctx->write_sz] = 0;
+	memcpy(&(c->write_data[c->write_sz]), contents, bytes);
+	c->write_sz += bytes;
+	c->write_data[c->write_sz] = 0;
 
 	return bytes;
 }
 
-int init_curl(int debug)
+static void reset_reply(struct curl_context *c)
 {
-	CURL			*curl;
+	char			*data;
 
-	debug_curl = debug;
+	c->write_sz = 0;
 
-	ctx = malloc(sizeof(*ctx));
-	if (!ctx) {
-		fprintf(stderr, "unable to alloc memory for curl context\n");
-		return -ENOMEM;
+	/* one huge reply should not pin its buffer for good */
+	if (c->write_max > MAX_KEPT_REPLY_SIZE) {
+		data = realloc(c->write_data, MIN_REPLY_SIZE);
+		if (data) {
+			c->write_data = data;
+			c->write_max = MIN_REPLY_SIZE;
+		}
 	}
 
-	curl_global_init(CURL_GLOBAL_ALL);
+	c->write_data[0] = 0;
+}
 
-	curl = curl_easy_init();
-	if (!curl) {
-		fprintf(stderr, "unable to init curl");
-		free(ctx);
-		return -EINVAL;
-	}
+static void lock_cb(CURL *curl, curl_lock_data data, curl_lock_access access,
+		    void *arg)
+{
+	(void) curl;
+	(void) access;
+	(void) arg;
+
+	pthread_mutex_lock(&share_lock[data]);
+}
+
+static void unlock_cb(CURL *curl, curl_lock_data data, void *arg)
+{
+	(void) curl;
+	(void) arg;
+
+	pthread_mutex_unlock(&share_lock[data]);
+}
 
-	/* will be grown as needed by the realloc in write_cb */
-	ctx->write_data = malloc(1);
-	if (!ctx->write_data)
+static int init_share(void)
+{
+	int			 i;
+
+	share = curl_share_init();
+	if (!share)
 		return -ENOMEM;
 
-	ctx->write_sz = 0;    /* no data at this point */
-	ctx->write_data[0] = 0;
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_init(&share_lock[i], NULL);
+
+	curl_share_setopt(share, CURLSHOPT_LOCKFUNC,	lock_cb);
+	curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC,	unlock_cb);
+	curl_share_setopt(share, CURLSHOPT_SHARE,	CURL_LOCK_DATA_DNS);
+#if LIBCURL_VERSION_NUM >= 0x073900
+	/* older libcurl keeps connections in each multi handle instead */
+	curl_share_setopt(share, CURLSHOPT_SHARE,	CURL_LOCK_DATA_CONNECT);
+#endif
+
+	return 0;
+}
+
+/* the options every request starts from, curl_easy_reset() drops them */
+static void setup_handle(struct curl_context *c)
+{
+	CURL			*curl = c->curl;
+
+	curl_easy_reset(curl);
 
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,	(void *) write_cb);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA,	(void *) ctx);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA,	(void *) c);
 	curl_easy_setopt(curl, CURLOPT_READFUNCTION,	(void *) read_cb);
-	curl_easy_setopt(curl, CURLOPT_READDATA,	(void *) ctx);
+	curl_easy_setopt(curl, CURLOPT_READDATA,	(void *) c);
+	curl_easy_setopt(curl, CURLOPT_MAXCONNECTS,	MAX_CURL_CONNECTS);
+	curl_easy_setopt(curl, CURLOPT_SHARE,		share);
+#ifndef DEM_CLI
+	curl_easy_setopt(curl, CURLOPT_FAILONERROR,	1L);
+#endif
+}
+
+static int init_context(struct curl_context *c)
+{
+	memset(c, 0, sizeof(*c));
+
+	c->write_data = malloc(MIN_REPLY_SIZE);
+	if (!c->write_data)
+		return -ENOMEM;
 
-	ctx->curl = curl;
+	c->write_max = MIN_REPLY_SIZE;
+	c->write_data[0] = 0;
+
+	c->curl = curl_easy_init();
+	if (!c->curl) {
+		free(c->write_data);
+		return -ENOMEM;
+	}
 
 	return 0;
 }
 
-void cleanup_curl(void)
+static void cleanup_context(struct curl_context *c)
 {
-	CURL			*curl = ctx->curl;
+	curl_easy_cleanup(c->curl);
+	free(c->write_data);
+}
 
-	curl_easy_cleanup(curl);
+static struct curl_context *alloc_curl_context(void)
+{
+	struct curl_context	*c;
 
-	curl_global_cleanup();
+	c = malloc(sizeof(*c));
+	if (!c)
+		return NULL;
 
-	free(ctx->write_data);
-	free(ctx);
+	if (init_context(c)) {
+		free(c);
+		return NULL;
+	}
+
+	return c;
 }
 
-static int exec_curl(char *url, char **p)
+static void free_curl_context(struct curl_context *c)
 {
-	CURL			*curl = ctx->curl;
-	CURLcode		 ret;
-	curl_off_t		 bytes;
+	if (!c)
+		return;
 
-	curl_easy_setopt(curl, CURLOPT_URL, url);
-#ifndef DEM_CLI
-	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-#endif
+	cleanup_context(c);
+	free(c);
+}
 
-	ret = curl_easy_perform(curl);
+static void free_thread_context(void *arg)
+{
+	struct curl_context	*c = arg;
 
-	if (ret == CURLE_OK) {
-		curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH, &bytes);
-		*p = strndup(ctx->write_data, bytes);
-	} else if (ret == CURLE_COULDNT_CONNECT) {
-		fprintf(stderr, "curl returned error %s (%d) errno %d\n",
-			curl_easy_strerror(ret), ret, errno);
-		ret = -errno;
-	} else
-		ret = -EINVAL;
-
-	if (ctx->write_sz) {
-		free(ctx->write_data);
-		ctx->write_data = malloc(1);
-		if (!ctx->write_data)
-			return -ENOMEM;
-
-		ctx->write_sz = 0;
-		ctx->write_data[0] = 0;
-	}
+	pthread_mutex_lock(&ctx_lock);
+	list_del(&c->node);
+	pthread_mutex_unlock(&ctx_lock);
 
-	return ret;
+	free_curl_context(c);
 }
 
-int exec_get(char *url, char **result)
+static struct curl_context *thread_context(void)
 {
-	CURL			*curl = ctx->curl;
-	int			 ret;
+	struct curl_context	*c;
 
-	curl_easy_setopt(curl, CURLOPT_HTTPGET, 1);
+	c = pthread_getspecific(ctx_key);
+	if (c)
+		return c;
 
-	if (debug_curl)
-		printf("GET %s\n", url);
+	c = alloc_curl_context();
+	if (!c) {
+		fprintf(stderr, "unable to alloc memory for curl context\n");
+		return NULL;
+	}
 
-	ret = exec_curl(url, result);
+	pthread_mutex_lock(&ctx_lock);
+	list_add_tail(&c->node, &ctx_list);
+	pthread_mutex_unlock(&ctx_lock);
 
-	curl_easy_setopt(curl, CURLOPT_HTTPGET, 0);
+	pthread_setspecific(ctx_key, c);
 
-	return ret;
+	return c;
 }
 
-int exec_put(char *url, char *data, int len)
+int init_curl(int debug)
 {
-	CURL			*curl = ctx->curl;
-	char			*result;
-	int			 ret;
+	debug_curl = debug;
 
-	curl_easy_setopt(curl, CURLOPT_PUT, 1);
+	curl_global_init(CURL_GLOBAL_ALL);
 
-	ctx->read_data = data;
-	ctx->read_sz = len;
+	if (init_share()) {
+		fprintf(stderr, "unable to init curl share");
+		return -ENOMEM;
+	}
 
-	if (debug_curl) {
-		printf("PUT %s\n", url);
-		if (len)
-			printf("<< %.*s >>\n", len, data);
+	if (pthread_key_create(&ctx_key, free_thread_context)) {
+		fprintf(stderr, "unable to create curl context key");
+		curl_share_cleanup(share);
+		return -ENOMEM;
 	}
 
-	ret = exec_curl(url, &result);
+	return 0;
+}
 
-	curl_easy_setopt(curl, CURLOPT_PUT, 0);
+/* call once every thread that made requests has been joined */
+void cleanup_curl(void)
+{
+	struct curl_context	*c, *next;
 
-	if (ret)
-		return ret;
+	pthread_setspecific(ctx_key, NULL);
+	pthread_key_delete(ctx_key);
 
-	if (curl_show_results)
-		printf("%s\n", result);
+	list_for_each_entry_safe(c, next, &ctx_list, node) {
+		list_del(&c->node);
+		free_curl_context(c);
+	}
 
-	free(result);
+	curl_share_cleanup(share);
 
-	return 0;
+	curl_global_cleanup();
 }
 
-int exec_post(char *url, char *data, int len)
+static int curl_error(CURLcode ret)
 {
-	CURL			*curl = ctx->curl;
-	char			*result;
-	int			 ret;
+	if (ret == CURLE_OK)
+		return 0;
+
+	if (ret == CURLE_COULDNT_CONNECT)
+		return -ECONNREFUSED;
+
+	return -EINVAL;
+}
+
+/* sets up the method and body of a request, a body on anything but a PUT
+ * is sent as POST fields with the method overridden
+ */
+static void setup_request(struct curl_context *c, const char *method,
+			  char *url, char *data, int len)
+{
+	CURL			*curl = c->curl;
 
-	curl_easy_setopt(curl, CURLOPT_HTTPPOST, 1);
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, len);
+	setup_handle(c);
+
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+
+	if (!strcmp(method, "GET"))
+		curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+	else if (!strcmp(method, "PUT")) {
+		c->read_data = data;
+		c->read_sz = len;
+		curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+		curl_easy_setopt(curl, CURLOPT_INFILESIZE, (long) len);
+	} else {
+		if (data || !strcmp(method, "POST")) {
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDS,
+					 data ? data : "");
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, len);
+		}
+
+		if (strcmp(method, "POST"))
+			curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
+	}
 
 	if (debug_curl) {
-		printf("POST %s\n", url);
+		printf("%s %s\n", method, url);
 		if (len)
 			printf("<< %.*s >>\n", len, data);
 	}
+}
+
+/* runs a request on the context.  The reply is left in the context's
+ * buffer, nul terminated, and stays valid until the next request on it.
+ */
+static int curl_request(struct curl_context *c, const char *method,
+			char *url, char *data, int len, char **reply,
+			size_t *reply_len)
+{
+	CURLcode		 ret;
+
+	reset_reply(c);
 
-	ret = exec_curl(url, &result);
+	setup_request(c, method, url, data, len);
 
-	curl_easy_setopt(curl, CURLOPT_HTTPPOST, 0);
+	ret = curl_easy_perform(c->curl);
 
+	c->read_sz = 0;
+
+	if (ret == CURLE_COULDNT_CONNECT)
+		fprintf(stderr, "curl returned error %s (%d) errno %d\n",
+			curl_easy_strerror(ret), ret, errno);
+
+	if (reply)
+		*reply = c->write_data;
+	if (reply_len)
+		*reply_len = c->write_sz;
+
+	return curl_error(ret);
+}
+
+static int exec_curl(const char *method, char *url, char *data, int len,
+		     char **result)
+{
+	struct curl_context	*c;
+	char			*reply;
+	int			 ret;
+
+	c = thread_context();
+	if (!c)
+		return -ENOMEM;
+
+	ret = curl_request(c, method, url, data, len, &reply, NULL);
 	if (ret)
 		return ret;
 
-	if (curl_show_results)
-		printf("%s\n", result);
-
-	free(result);
+	if (result)
+		*result = reply;
+	else if (curl_show_results)
+		printf("%s\n", reply);
 
 	return 0;
 }
 
+/* the reply is the calling thread's buffer, not a copy; it is only good
+ * until the thread's next request and must not be freed
+ */
+int exec_get(char *url, char **result)
+{
+	return exec_curl("GET", url, NULL, 0, result);
+}
+
+int exec_put(char *url, char *data, int len)
+{
+	return exec_curl("PUT", url, data, len, NULL);
+}
+
+int exec_post(char *url, char *data, int len)
+{
+	return exec_curl("POST", url, data, len, NULL);
+}
+
 int exec_delete(char *url)
 {
-	CURL			*curl = ctx->curl;
-	char			*result;
-	int			 ret;
+	return exec_curl("DELETE", url, NULL, 0, NULL);
+}
 
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+int exec_delete_ex(char *url, char *data, int len)
+{
+	return exec_curl("DELETE", url, data, len, NULL);
+}
 
-	if (debug_curl)
-		printf("DELETE %s\n", url);
+int exec_patch(char *url, char *data, int len)
+{
+	return exec_curl("PATCH", url, data, len, NULL);
+}
 
-	ret = exec_curl(url, &result);
+/* concurrent requests
+ *
+ * The requests of a batch run together on a curl multi handle.  Each is
+ * queued on a channel, one per peer: the requests of a channel go out one
+ * at a time in the order queued while the channels of a batch run in
+ * parallel, so a batch takes as long as its slowest peer rather than the
+ * sum of them.  A channel keeps its easy handle between batches and the
+ * connection cache is shared, so the connection to a peer stays open.
+ *
+ * A channel may only be in one batch at a time.  Once a request of a
+ * channel fails the rest queued on it are dropped.
+ */
 
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, NULL);
+struct curl_request {
+	struct curl_request	*next;
+	const char		*method;
+	char			*url;
+	char			*data;
+	int			 len;
+};
 
-	if (ret)
-		return ret;
+struct curl_chan {
+	struct curl_context	 ctx;
+	struct curl_request	*head;
+	struct curl_request	*tail;
+	struct curl_chan	*next;
+	struct curl_batch	*batch;
+	int			 err;
+};
 
-	if (curl_show_results)
-		printf("%s\n", result);
+struct curl_batch {
+	CURLM			*multi;
+	struct curl_chan	*chans;
+	int			 active;
+};
 
-	free(result);
+struct curl_chan *alloc_curl_chan(void)
+{
+	struct curl_chan	*chan;
 
-	return 0;
+	chan = malloc(sizeof(*chan));
+	if (!chan)
+		return NULL;
+
+	memset(chan, 0, sizeof(*chan));
+
+	if (init_context(&chan->ctx)) {
+		free(chan);
+		return NULL;
+	}
+
+	return chan;
 }
 
-int exec_delete_ex(char *url, char *data, int len)
+void free_curl_chan(struct curl_chan *chan)
 {
-	CURL			*curl = ctx->curl;
-	char			*result;
-	int			 ret;
+	if (!chan)
+		return;
 
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, len);
+	cleanup_context(&chan->ctx);
+	free(chan);
+}
 
-	if (debug_curl) {
-		printf("DELETE %s\n", url);
-		if (len)
-			printf("<< %.*s >>\n", len, data);
+struct curl_batch *alloc_curl_batch(void)
+{
+	struct curl_batch	*batch;
+
+	batch = malloc(sizeof(*batch));
+	if (!batch)
+		return NULL;
+
+	memset(batch, 0, sizeof(*batch));
+
+	batch->multi = curl_multi_init();
+	if (!batch->multi) {
+		free(batch);
+		return NULL;
 	}
 
-	ret = exec_curl(url, &result);
+	return batch;
+}
 
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, NULL);
+static void drop_requests(struct curl_chan *chan)
+{
+	struct curl_request	*req;
 
-	if (ret)
-		return ret;
+	while ((req = chan->head)) {
+		chan->head = req->next;
+		free(req);
+	}
 
-	if (curl_show_results)
-		printf("%s\n", result);
+	chan->tail = NULL;
+}
 
-	free(result);
+void free_curl_batch(struct curl_batch *batch)
+{
+	struct curl_chan	*chan;
 
-	return 0;
+	while ((chan = batch->chans)) {
+		batch->chans = chan->next;
+		drop_requests(chan);
+		chan->batch = NULL;
+	}
+
+	curl_multi_cleanup(batch->multi);
+	free(batch);
 }
 
-int exec_patch(char *url, char *data, int len)
+/* the url and data are not copied and must stay valid until the batch
+ * has run
+ */
+int queue_curl_request(struct curl_batch *batch, struct curl_chan *chan,
+		       const char *method, char *url, char *data, int len)
 {
-	CURL			*curl = ctx->curl;
-	char			*result;
-	int			 ret;
+	struct curl_request	*req;
 
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PATCH");
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, len);
+	if (chan->batch && chan->batch != batch)
+		return -EBUSY;
 
-	if (debug_curl) {
-		printf("PATCH %s\n", url);
-		if (len)
-			printf("<< %.*s >>\n", len, data);
+	req = malloc(sizeof(*req));
+	if (!req)
+		return -ENOMEM;
+
+	req->next = NULL;
+	req->method = method;
+	req->url = url;
+	req->data = data;
+	req->len = len;
+
+	if (chan->tail)
+		chan->tail->next = req;
+	else
+		chan->head = req;
+	chan->tail = req;
+
+	if (!chan->batch) {
+		chan->batch = batch;
+		chan->err = 0;
+		chan->next = batch->chans;
+		batch->chans = chan;
 	}
 
-	ret = exec_curl(url, &result);
+	return 0;
+}
 
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, NULL);
+static int start_request(struct curl_batch *batch, struct curl_chan *chan)
+{
+	struct curl_request	*req = chan->head;
+	CURL			*curl = chan->ctx.curl;
 
-	if (ret)
-		return ret;
+	reset_reply(&chan->ctx);
 
-	if (curl_show_results)
-		printf("%s\n", result);
+	setup_request(&chan->ctx, req->method, req->url, req->data, req->len);
 
-	free(result);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *) chan);
+	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+
+	if (curl_multi_add_handle(batch->multi, curl) != CURLM_OK) {
+		chan->err = -ENOMEM;
+		drop_requests(chan);
+		return -ENOMEM;
+	}
+
+	batch->active++;
 
 	return 0;
 }
+
+static void finish_request(struct curl_batch *batch, CURL *curl,
+			   CURLcode result)
+{
+	struct curl_chan	*chan;
+	struct curl_request	*req;
+	char			*p;
+
+	curl_easy_getinfo(curl, CURLINFO_PRIVATE, &p);
+	chan = (struct curl_chan *) p;
+
+	curl_multi_remove_handle(batch->multi, curl);
+	batch->active--;
+
+	req = chan->head;
+	chan->head = req->next;
+	if (!chan->head)
+		chan->tail = NULL;
+
+	chan->ctx.read_sz = 0;
+
+	if (result == CURLE_OK) {
+		if (curl_show_results)
+			printf("%s\n", chan->ctx.write_data);
+	} else {
+		fprintf(stderr, "curl %s %s returned error %s (%d)\n",
+			req->method, req->url, curl_easy_strerror(result),
+			result);
+		chan->err = curl_error(result);
+		drop_requests(chan);
+	}
+
+	free(req);
+
+	if (chan->head)
+		start_request(batch, chan);
+}
+
+/* returns the first error of any channel, the error of each is left for
+ * curl_chan_error()
+ */
+int run_curl_batch(struct curl_batch *batch)
+{
+	struct curl_chan	*chan;
+	CURLMsg			*msg;
+	CURL			*curl;
+	CURLcode		 result;
+	int			 running;
+	int			 n;
+	int			 ret = 0;
+
+	for (chan = batch->chans; chan; chan = chan->next)
+		if (chan->head)
+			start_request(batch, chan);
+
+	while (batch->active) {
+		curl_multi_perform(batch->multi, &running);
+
+		while ((msg = curl_multi_info_read(batch->multi, &n))) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+
+			/* msg is gone once the handle is removed */
+			curl = msg->easy_handle;
+			result = msg->data.result;
+
+			finish_request(batch, curl, result);
+		}
+
+		if (batch->active)
+			curl_multi_wait(batch->multi, NULL, 0, 1000, NULL);
+	}
+
+	for (chan = batch->chans; chan; chan = chan->next)
+		if (chan->err && !ret)
+			ret = chan->err;
+
+	return ret;
+}
+
+int curl_chan_error(struct curl_chan *chan)
+{
+	return chan->err;
+}
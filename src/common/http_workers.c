@@ -0,0 +1,843 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * HTTP worker pool shared by the discovery and supervisory controllers.
+ *
+ * mongoose is not thread safe so its poll thread still owns every
+ * connection: it hands each complete request to the pool as a private
+ * copy and sends the reply once a worker has built it.  Workers never
+ * touch a connection; they return finished requests on the done list
+ * and poke a socketpair that mongoose is polling so the reply goes out
+ * on the next pass instead of after the idle timeout.  A streamed reply
+ * is passed over the same way one chunk at a time.
+ *
+ * HTTP/1.1 connections are kept open after the reply.  A client may send
+ * its next request before the last one is answered, so each connection
+ * runs one request at a time and holds the rest in order behind it.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "mongoose.h"
+#include "nvme.h"
+#include "utils.h"
+#include "http_workers.h"
+#include "metrics.h"
+
+#define REPLY_SIZE		1024
+#define CHUNK_HDR_LEN		10	/* "%08x\r\n" */
+
+/* a streamed reply waits for the client to read the earlier chunks; one
+ * that stops reading for STREAM_TIMEOUT seconds has its reply cut off
+ */
+#define STREAM_HIGH_WATER	(4 * REPLY_CHUNK_SIZE)
+#define STREAM_TIMEOUT		30
+
+/* a client with more requests than this waiting is cut off */
+#define MAX_PIPELINED		16
+
+extern int debug;
+
+struct http_request {
+	struct linked_list	 node;
+	struct mg_connection	*c;	/* NULL once the client has gone */
+	struct http_message	 hm;	/* strings point into msg */
+	char			*msg;
+	struct http_reply	 reply;
+	int			 flushing; /* reply.buf is waiting to go out */
+	int			 keep_alive;
+	struct http_request	*pipelined; /* next on the connection */
+	unsigned long long	 start;	/* arrival, for the latency metric */
+};
+
+static struct {
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 cond;
+	pthread_cond_t		 sent;
+	struct linked_list	 pending;
+	struct linked_list	 done;
+	struct linked_list	 stalled;
+	pthread_t		*threads;
+	int			 count;
+	int			 stopping;
+	int			 wake[2];
+	http_handler_t		 handler;
+} pool;
+
+static int reply_reserve(struct http_reply *reply, int len)
+{
+	char			*buf;
+	int			 size;
+
+	if (!reply->buf) {
+		reply->buf = malloc(REPLY_SIZE);
+		if (!reply->buf)
+			return -ENOMEM;
+
+		reply->size = REPLY_SIZE;
+		reply->len = 0;
+	}
+
+	if (reply->len + len < reply->size)
+		return 0;
+
+	size = reply->size;
+	while (size <= reply->len + len)
+		size *= 2;
+
+	buf = realloc(reply->buf, size);
+	if (!buf)
+		return -ENOMEM;
+
+	reply->buf = buf;
+	reply->size = size;
+
+	return 0;
+}
+
+static int open_chunk(struct http_reply *reply)
+{
+	int			 ret;
+
+	ret = reply_reserve(reply, CHUNK_HDR_LEN);
+	if (ret)
+		return ret;
+
+	/* the size is filled in when the chunk is closed */
+	reply->chunk = reply->len;
+	reply->len += CHUNK_HDR_LEN;
+
+	return 0;
+}
+
+static int close_chunk(struct http_reply *reply)
+{
+	char			 hdr[CHUNK_HDR_LEN + 1];
+	int			 len;
+	int			 ret;
+
+	len = reply->len - reply->chunk - CHUNK_HDR_LEN;
+	if (!len) {
+		reply->len = reply->chunk;
+		return 0;
+	}
+
+	ret = reply_reserve(reply, 2);
+	if (ret)
+		return ret;
+
+	/* leading zeros keep the header a fixed size */
+	snprintf(hdr, sizeof(hdr), "%08x\r\n", len);
+	memcpy(reply->buf + reply->chunk, hdr, CHUNK_HDR_LEN);
+
+	memcpy(reply->buf + reply->len, "\r\n", 2);
+	reply->len += 2;
+
+	return 0;
+}
+
+static int fail_reply(struct http_reply *reply, int err)
+{
+	reply->failed = err;
+	reply->len = 0;
+
+	return err;
+}
+
+/* hands a full chunk to the client and starts the next one */
+static int flush_chunk(struct http_reply *reply)
+{
+	int			 ret;
+
+	if (!reply->chunked || !reply->flush ||
+	    reply->len - reply->chunk - CHUNK_HDR_LEN < REPLY_CHUNK_SIZE)
+		return 0;
+
+	ret = close_chunk(reply);
+	if (!ret)
+		ret = reply->flush(reply);
+	if (!ret)
+		ret = open_chunk(reply);
+	if (ret)
+		return fail_reply(reply, ret);
+
+	return 0;
+}
+
+int reply_printf(struct http_reply *reply, const char *fmt, ...)
+{
+	va_list			 args;
+	int			 len;
+	int			 ret;
+
+	if (reply->failed)
+		return reply->failed;
+
+	ret = reply_reserve(reply, 0);
+	if (ret)
+		return fail_reply(reply, ret);
+
+	va_start(args, fmt);
+	len = vsnprintf(reply->buf + reply->len, reply->size - reply->len,
+			fmt, args);
+	va_end(args);
+
+	if (len < reply->size - reply->len)
+		goto out;
+
+	ret = reply_reserve(reply, len);
+	if (ret)
+		return fail_reply(reply, ret);
+
+	va_start(args, fmt);
+	vsnprintf(reply->buf + reply->len, reply->size - reply->len, fmt,
+		  args);
+	va_end(args);
+out:
+	reply->len += len;
+
+	ret = flush_chunk(reply);
+
+	return ret ? ret : len;
+}
+
+int reply_write(struct http_reply *reply, const char *buf, int len)
+{
+	int			 ret;
+
+	if (reply->failed)
+		return reply->failed;
+
+	ret = reply_reserve(reply, len);
+	if (ret)
+		return fail_reply(reply, ret);
+
+	memcpy(reply->buf + reply->len, buf, len);
+	reply->len += len;
+
+	ret = flush_chunk(reply);
+
+	return ret ? ret : len;
+}
+
+/* called once the headers are written, they must not set a length */
+int reply_start_chunks(struct http_reply *reply)
+{
+	int			 ret;
+
+	if (reply->failed)
+		return reply->failed;
+
+	ret = reply_printf(reply, "Transfer-Encoding: chunked\r\n\r\n");
+	if (ret < 0)
+		return ret;
+
+	ret = open_chunk(reply);
+	if (ret)
+		return fail_reply(reply, ret);
+
+	reply->chunked = 1;
+
+	return 0;
+}
+
+int reply_end_chunks(struct http_reply *reply)
+{
+	int			 ret;
+
+	if (reply->failed)
+		return reply->failed;
+
+	reply->chunked = 0;
+
+	ret = close_chunk(reply);
+	if (ret)
+		return fail_reply(reply, ret);
+
+	ret = reply_printf(reply, "0\r\n\r\n");
+
+	return (ret < 0) ? ret : 0;
+}
+
+/* HTTP/1.1 keeps the connection open unless the client asks otherwise */
+static int keep_alive(struct http_message *hm)
+{
+	int			 i;
+
+	if (mg_vcmp(&hm->proto, "HTTP/1.1"))
+		return 0;
+
+	for (i = 0; i < MG_MAX_HTTP_HEADERS && hm->header_names[i].len; i++)
+		if (!mg_vcasecmp(&hm->header_names[i], "Connection"))
+			return mg_vcasecmp(&hm->header_values[i], "close") != 0;
+
+	return 1;
+}
+
+/* a reply that failed part way through can only be cut off, returns 0
+ * if the connection is being closed
+ */
+static int send_reply(struct mg_connection *c, struct http_reply *reply,
+		      int keep_alive)
+{
+	if (reply->failed) {
+		c->flags |= MG_F_CLOSE_IMMEDIATELY;
+		return 0;
+	}
+
+	if (reply->len)
+		mg_send(c, reply->buf, reply->len);
+
+	if (keep_alive)
+		return 1;
+
+	c->flags |= MG_F_SEND_AND_CLOSE;
+
+	return 0;
+}
+
+static inline void rebase_str(struct mg_str *s, const char *from, char *to)
+{
+	if (s->p)
+		s->p = to + (s->p - from);
+}
+
+/* every string in hm points into the connection's receive buffer which
+ * mongoose reuses once the event returns, so the worker gets a copy
+ */
+static struct http_request *copy_request(struct http_message *hm)
+{
+	struct http_request	*req;
+	struct http_message	*copy;
+	const char		*start = hm->message.p;
+	size_t			 len = hm->message.len;
+	int			 i;
+
+	if (hm->body.len && hm->body.p + hm->body.len > start + len)
+		len = hm->body.p + hm->body.len - start;
+
+	req = malloc(sizeof(*req));
+	if (!req)
+		return NULL;
+
+	memset(req, 0, sizeof(*req));
+
+	req->msg = malloc(len + 1);
+	if (!req->msg) {
+		free(req);
+		return NULL;
+	}
+
+	memcpy(req->msg, start, len);
+	req->msg[len] = 0;
+
+	copy = &req->hm;
+	*copy = *hm;
+
+	rebase_str(&copy->message, start, req->msg);
+	rebase_str(&copy->method, start, req->msg);
+	rebase_str(&copy->uri, start, req->msg);
+	rebase_str(&copy->proto, start, req->msg);
+	rebase_str(&copy->resp_status_msg, start, req->msg);
+	rebase_str(&copy->query_string, start, req->msg);
+	rebase_str(&copy->body, start, req->msg);
+
+	for (i = 0; i < MG_MAX_HTTP_HEADERS; i++) {
+		rebase_str(&copy->header_names[i], start, req->msg);
+		rebase_str(&copy->header_values[i], start, req->msg);
+	}
+
+	return req;
+}
+
+static void free_request(struct http_request *req)
+{
+	free(req->reply.buf);
+	free(req->msg);
+	free(req);
+}
+
+/* the requests waiting behind one are only seen by the mongoose thread */
+static void free_pipelined(struct http_request *req)
+{
+	struct http_request	*next;
+
+	for (req = req->pipelined; req; req = next) {
+		next = req->pipelined;
+		free_request(req);
+	}
+}
+
+static void start_request(struct http_request *req)
+{
+	req->c->user_data = req;
+
+	pthread_mutex_lock(&pool.lock);
+	list_add_tail(&req->node, &pool.pending);
+	pthread_cond_signal(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/* called on the mongoose thread once the worker is done with req */
+static void finish_request(struct http_request *req)
+{
+	struct mg_connection	*c = req->c;
+
+	c->user_data = NULL;
+
+	observe_http_request(&req->hm, req->start);
+
+	if (send_reply(c, &req->reply, req->keep_alive) && req->pipelined)
+		start_request(req->pipelined);
+	else
+		free_pipelined(req);
+}
+
+/* called with pool.lock held */
+static void wake_mongoose(void)
+{
+	char			 wake = 0;
+
+	/* a full socket means a wake up is already pending */
+	if (send(pool.wake[1], &wake, 1, MSG_DONTWAIT) < 0 &&
+	    errno != EAGAIN)
+		print_errno("http worker wake up failed", errno);
+}
+
+/* runs on a worker, waits until the mongoose thread has queued the chunk
+ * on the connection so reply.buf can be reused for the next one
+ */
+static int flush_worker_reply(struct http_reply *reply)
+{
+	struct http_request	*req = reply->priv;
+	struct timespec		 deadline;
+	int			 ret = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += STREAM_TIMEOUT;
+
+	pthread_mutex_lock(&pool.lock);
+
+	if (!req->c)
+		goto gone;
+
+	req->flushing = 1;
+	list_add_tail(&req->node, &pool.done);
+	wake_mongoose();
+
+	while (req->flushing && !pool.stopping && !ret)
+		ret = -pthread_cond_timedwait(&pool.sent, &pool.lock,
+					      &deadline);
+
+	if (req->flushing) {
+		list_del(&req->node);
+		req->flushing = 0;
+		if (ret == -ETIMEDOUT)
+			print_err("http client stalled, reply cut off");
+		else
+			ret = -EPIPE;
+		goto out;
+	}
+
+	ret = 0;
+
+	if (!req->c)
+		goto gone;
+
+	goto out;
+gone:
+	ret = -EPIPE;
+out:
+	pthread_mutex_unlock(&pool.lock);
+
+	reply->len = 0;
+
+	return ret;
+}
+
+static int flush_inline_reply(struct http_reply *reply)
+{
+	mg_send(reply->priv, reply->buf, reply->len);
+
+	reply->len = 0;
+
+	return 0;
+}
+
+static void *http_worker(void *arg)
+{
+	struct http_request	*req;
+
+	(void) arg;
+
+	pthread_mutex_lock(&pool.lock);
+
+	while (!pool.stopping) {
+		if (list_empty(&pool.pending)) {
+			pthread_cond_wait(&pool.cond, &pool.lock);
+			continue;
+		}
+
+		req = list_first_entry(&pool.pending, struct http_request,
+				       node);
+		list_del(&req->node);
+
+		if (!req->c) {
+			free_request(req);
+			continue;
+		}
+
+		pthread_mutex_unlock(&pool.lock);
+
+		pool.handler(&req->hm, &req->reply);
+
+		pthread_mutex_lock(&pool.lock);
+
+		list_add_tail(&req->node, &pool.done);
+		wake_mongoose();
+	}
+
+	pthread_mutex_unlock(&pool.lock);
+
+	return NULL;
+}
+
+/* called on the mongoose thread with pool.lock held */
+static void send_chunk(struct http_request *req)
+{
+	struct mg_connection	*c = req->c;
+
+	if (c->send_mbuf.len >= STREAM_HIGH_WATER) {
+		list_add_tail(&req->node, &pool.stalled);
+		return;
+	}
+
+	mg_send(c, req->reply.buf, req->reply.len);
+
+	req->flushing = 0;
+	pthread_cond_broadcast(&pool.sent);
+}
+
+/* runs on the mongoose thread when a worker has finished a request or
+ * has a chunk of one ready, and on every poll to move stalled chunks
+ * once their client has caught up
+ */
+static void wake_handler(struct mg_connection *c, int ev, void *ev_data)
+{
+	struct http_request	*req, *next;
+	struct linked_list	 done;
+	struct linked_list	 stalled;
+
+	(void) ev_data;
+
+	if (ev == MG_EV_RECV)
+		mbuf_remove(&c->recv_mbuf, c->recv_mbuf.len);
+	else if (ev != MG_EV_POLL)
+		return;
+
+	INIT_LINKED_LIST(&done);
+	INIT_LINKED_LIST(&stalled);
+
+	pthread_mutex_lock(&pool.lock);
+
+	if (!list_empty(&pool.stalled)) {
+		stalled = pool.stalled;
+		stalled.next->prev = &stalled;
+		stalled.prev->next = &stalled;
+		INIT_LINKED_LIST(&pool.stalled);
+
+		list_for_each_entry_safe(req, next, &stalled, node) {
+			list_del(&req->node);
+			send_chunk(req);
+		}
+	}
+
+	list_for_each_entry_safe(req, next, &pool.done, node) {
+		if (!req->flushing)
+			continue;
+
+		list_del(&req->node);
+		send_chunk(req);
+	}
+
+	if (!list_empty(&pool.done)) {
+		done = pool.done;
+		done.next->prev = &done;
+		done.prev->next = &done;
+		INIT_LINKED_LIST(&pool.done);
+	}
+
+	pthread_mutex_unlock(&pool.lock);
+
+	list_for_each_entry_safe(req, next, &done, node) {
+		/* req->c is only changed on this thread */
+		if (req->c)
+			finish_request(req);
+
+		free_request(req);
+	}
+}
+
+void queue_http_request(struct mg_connection *c, struct http_message *hm)
+{
+	struct http_request	*req;
+	struct http_request	*last;
+	struct http_reply	 reply;
+	unsigned long long	 start = metrics_clock();
+	int			 count = 0;
+
+	if (!pool.count)
+		goto inline_request;
+
+	/* a request can only be handled inline if none is in progress */
+	req = copy_request(hm);
+	if (!req && !c->user_data) {
+		print_err("no memory to queue http request, handling inline");
+		goto inline_request;
+	}
+
+	if (!req) {
+		print_err("no memory to queue pipelined http request");
+		goto drop;
+	}
+
+	req->c = c;
+	req->start = start;
+	req->keep_alive = keep_alive(hm);
+	req->reply.flush = flush_worker_reply;
+	req->reply.priv = req;
+
+	if (!c->user_data) {
+		start_request(req);
+		return;
+	}
+
+	/* replies go out in the order the requests came in */
+	for (last = c->user_data; last->pipelined; last = last->pipelined)
+		count++;
+
+	if (count >= MAX_PIPELINED) {
+		print_err("too many pipelined http requests");
+		free_request(req);
+		goto drop;
+	}
+
+	last->pipelined = req;
+
+	return;
+
+inline_request:
+	memset(&reply, 0, sizeof(reply));
+	reply.flush = flush_inline_reply;
+	reply.priv = c;
+
+	pool.handler(hm, &reply);
+	observe_http_request(hm, start);
+	send_reply(c, &reply, keep_alive(hm));
+	free(reply.buf);
+
+	return;
+drop:
+	c->flags |= MG_F_CLOSE_IMMEDIATELY;
+}
+
+/* called on MG_EV_CLOSE; the request is freed by whoever sees it next */
+void drop_http_request(struct mg_connection *c)
+{
+	struct http_request	*req = c->user_data;
+
+	if (!req)
+		return;
+
+	free_pipelined(req);
+	req->pipelined = NULL;
+
+	pthread_mutex_lock(&pool.lock);
+
+	req->c = NULL;
+
+	/* a worker waiting on a chunk gets -EPIPE */
+	if (req->flushing) {
+		list_del(&req->node);
+		req->flushing = 0;
+		pthread_cond_broadcast(&pool.sent);
+	}
+
+	pthread_mutex_unlock(&pool.lock);
+
+	c->user_data = NULL;
+}
+
+/* called on MG_EV_POLL for the connections of the REST server */
+void expire_http_connection(struct mg_connection *c)
+{
+	if ((c->flags & MG_F_LISTENING) || c->user_data)
+		return;
+
+	if (time(NULL) - c->last_io_time >= HTTP_IDLE_TIMEOUT)
+		c->flags |= MG_F_SEND_AND_CLOSE;
+}
+
+int default_http_workers(void)
+{
+	long			 cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (cpus < 1)
+		return 1;
+
+	return (cpus > MAX_HTTP_WORKERS) ? MAX_HTTP_WORKERS : cpus;
+}
+
+/* on failure the pool is left empty and requests are handled inline */
+int init_http_workers(struct mg_mgr *mgr, int count, http_handler_t handler)
+{
+	pthread_attr_t		 pthread_attr;
+	int			 ret;
+
+	pool.handler = handler;
+	pool.stopping = 0;
+	pool.count = 0;
+
+	INIT_LINKED_LIST(&pool.pending);
+	INIT_LINKED_LIST(&pool.done);
+	INIT_LINKED_LIST(&pool.stalled);
+
+	if (!count)
+		return 0;
+
+	pool.threads = calloc(count, sizeof(pthread_t));
+	if (!pool.threads)
+		return -ENOMEM;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pool.wake)) {
+		ret = -errno;
+		print_errno("http worker socketpair failed", ret);
+		goto out;
+	}
+
+	ret = fcntl(pool.wake[1], F_GETFL);
+	fcntl(pool.wake[1], F_SETFL, ret | O_NONBLOCK);
+
+	/* mongoose owns and closes the read side */
+	if (!mg_add_sock(mgr, pool.wake[0], wake_handler)) {
+		print_err("failed to add http worker socket");
+		close(pool.wake[0]);
+		ret = -ENOMEM;
+		goto out1;
+	}
+
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+	pthread_cond_init(&pool.sent, NULL);
+
+	pthread_attr_init(&pthread_attr);
+
+	for (; pool.count < count; pool.count++) {
+		ret = pthread_create(&pool.threads[pool.count], &pthread_attr,
+				     http_worker, NULL);
+		if (ret) {
+			print_errno("failed to start http worker", ret);
+			break;
+		}
+	}
+
+	pthread_attr_destroy(&pthread_attr);
+
+	if (!pool.count) {
+		ret = -ret;
+		goto out1;
+	}
+
+	print_info("Started %d http workers", pool.count);
+
+	return 0;
+out1:
+	close(pool.wake[1]);
+out:
+	free(pool.threads);
+
+	return ret;
+}
+
+/* must run on the mongoose thread before mg_mgr_free() */
+void cleanup_http_workers(void)
+{
+	struct http_request	*req, *next;
+	int			 i;
+
+	if (!pool.count)
+		return;
+
+	pthread_mutex_lock(&pool.lock);
+	pool.stopping = 1;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_cond_broadcast(&pool.sent);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (i = 0; i < pool.count; i++)
+		pthread_join(pool.threads[i], NULL);
+
+	list_for_each_entry_safe(req, next, &pool.pending, node) {
+		if (req->c)
+			req->c->user_data = NULL;
+		free_request(req);
+	}
+
+	list_for_each_entry_safe(req, next, &pool.done, node) {
+		if (req->c)
+			req->c->user_data = NULL;
+		free_request(req);
+	}
+
+	close(pool.wake[1]);
+
+	pthread_cond_destroy(&pool.cond);
+	pthread_cond_destroy(&pool.sent);
+	pthread_mutex_destroy(&pool.lock);
+
+	free(pool.threads);
+
+	pool.count = 0;
+}
@@ -0,0 +1,267 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+/*
+ * Prometheus text exposition at GET /metrics for the DC and SC.
+ *
+ * Request latency is kept per route and method, the route being the
+ * first segment of the URI so the number of series stays fixed however
+ * many targets and hosts there are.  Each daemon adds its own metrics
+ * through the writer it passes to write_metrics().
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mongoose.h"
+#include "nvme.h"
+#include "utils.h"
+#include "http_workers.h"
+#include "metrics.h"
+
+#define METRICS_CONTENT_TYPE	"text/plain; version=0.0.4"
+#define METRICS_LABEL_SIZE	64
+
+static const unsigned long bucket_bound[HISTOGRAM_BUCKETS] = {
+	100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+	100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+
+/* anything else is counted as "other" */
+static const char * const http_routes[] = {
+	URI_TARGET, URI_HOST, URI_GROUP, URI_DEM, URI_SUBSYSTEM, URI_PORTID,
+	URI_NSDEV, URI_INTERFACE, URI_CONFIG, URI_METRICS
+};
+
+static const char * const http_methods[] = {
+	"GET", "PUT", "POST", "PATCH", "DELETE", "OPTIONS"
+};
+
+#define NUM_ROUTES		(NUM_ENTRIES(http_routes) + 1)
+#define NUM_METHODS		(NUM_ENTRIES(http_methods) + 1)
+
+static struct histogram		 http_latency[NUM_ROUTES][NUM_METHODS];
+
+void observe_histogram(struct histogram *h, unsigned long long start)
+{
+	unsigned long		 usec = metrics_clock() - start;
+	int			 i;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+		if (usec <= bucket_bound[i])
+			break;
+
+	count_metric(&h->bucket[i]);
+	__atomic_add_fetch(&h->sum, usec, __ATOMIC_RELAXED);
+}
+
+static int http_route(struct mg_str *uri)
+{
+	const char		*p = uri->p;
+	size_t			 len = uri->len;
+	size_t			 n;
+	int			 i;
+
+	if (len && *p == '/') {
+		p++;
+		len--;
+	}
+
+	for (n = 0; n < len && p[n] != '/'; n++)
+		;
+
+	for (i = 0; i < NUM_ENTRIES(http_routes); i++)
+		if (strlen(http_routes[i]) == n &&
+		    !memcmp(http_routes[i], p, n))
+			break;
+
+	return i;
+}
+
+static int http_method(struct mg_str *method)
+{
+	int			 i;
+
+	for (i = 0; i < NUM_ENTRIES(http_methods); i++)
+		if (!mg_vcmp(method, http_methods[i]))
+			break;
+
+	return i;
+}
+
+void observe_http_request(struct http_message *hm, unsigned long long start)
+{
+	observe_histogram(&http_latency[http_route(&hm->uri)]
+				       [http_method(&hm->method)], start);
+}
+
+int is_metrics_request(struct http_message *hm)
+{
+	return !mg_vcmp(&hm->method, "GET") &&
+		(!mg_vcmp(&hm->uri, "/" URI_METRICS) ||
+		 !mg_vcmp(&hm->uri, "/" URI_METRICS "/"));
+}
+
+void write_metric_help(struct http_reply *reply, const char *name,
+		       const char *type, const char *help)
+{
+	reply_printf(reply, "# HELP %s %s\n# TYPE %s %s\n", name, help, name,
+		     type);
+}
+
+void write_counter(struct http_reply *reply, const char *name,
+		   const char *help, unsigned long value)
+{
+	write_metric_help(reply, name, "counter", help);
+	reply_printf(reply, "%s %lu\n", name, value);
+}
+
+/* labels is "" or a list of name="value" without the braces; the count
+ * is the sum of the buckets as read so the two always agree
+ */
+void write_histogram_series(struct http_reply *reply, const char *name,
+			    const char *labels, struct histogram *h)
+{
+	const char		*sep = *labels ? "," : "";
+	unsigned long		 count = 0;
+	unsigned long		 sum;
+	int			 i;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		count += read_metric(&h->bucket[i]);
+		reply_printf(reply, "%s_bucket{%s%sle=\"%g\"} %lu\n", name,
+			     labels, sep, bucket_bound[i] / 1e6, count);
+	}
+
+	count += read_metric(&h->bucket[i]);
+	reply_printf(reply, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels,
+		     sep, count);
+
+	sum = read_metric(&h->sum);
+
+	if (*labels) {
+		reply_printf(reply, "%s_sum{%s} %lu.%06lu\n", name, labels,
+			     sum / 1000000, sum % 1000000);
+		reply_printf(reply, "%s_count{%s} %lu\n", name, labels, count);
+	} else {
+		reply_printf(reply, "%s_sum %lu.%06lu\n", name,
+			     sum / 1000000, sum % 1000000);
+		reply_printf(reply, "%s_count %lu\n", name, count);
+	}
+}
+
+void write_histogram(struct http_reply *reply, const char *name,
+		     const char *help, struct histogram *h)
+{
+	write_metric_help(reply, name, "histogram", help);
+	write_histogram_series(reply, name, "", h);
+}
+
+static int histogram_empty(struct histogram *h)
+{
+	int			 i;
+
+	for (i = 0; i <= HISTOGRAM_BUCKETS; i++)
+		if (read_metric(&h->bucket[i]))
+			return 0;
+
+	return 1;
+}
+
+static void write_http_latency(struct http_reply *reply)
+{
+	const char		*name = "dem_http_request_duration_seconds";
+	char			 labels[METRICS_LABEL_SIZE];
+	int			 i, j;
+
+	write_metric_help(reply, name, "histogram",
+			  "Time from a REST request arriving to its reply.");
+
+	for (i = 0; i < NUM_ROUTES; i++)
+		for (j = 0; j < NUM_METHODS; j++) {
+			if (histogram_empty(&http_latency[i][j]))
+				continue;
+
+			snprintf(labels, sizeof(labels),
+				 "route=\"%s%s\",method=\"%s\"",
+				 (i < NUM_ENTRIES(http_routes)) ? "/" : "",
+				 (i < NUM_ENTRIES(http_routes)) ?
+				 http_routes[i] : "other",
+				 (j < NUM_ENTRIES(http_methods)) ?
+				 http_methods[j] : "other");
+
+			write_histogram_series(reply, name, labels,
+					       &http_latency[i][j]);
+		}
+}
+
+static void write_wc_errors(struct http_reply *reply)
+{
+	const char		*name = "dem_rdma_completion_errors_total";
+	const char		*status;
+	unsigned long		 count;
+	int			 i;
+
+	write_metric_help(reply, name, "counter",
+			  "RDMA work completions that failed, by status.");
+
+	for (i = 0; !rdma_wc_errors(i, &status, &count); i++)
+		if (count)
+			reply_printf(reply, "%s{status=\"%s\"} %lu\n", name,
+				     status, count);
+}
+
+void write_metrics(struct http_reply *reply, metrics_writer_t writer)
+{
+	reply_printf(reply, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n",
+		     METRICS_CONTENT_TYPE);
+
+	if (reply_start_chunks(reply))
+		return;
+
+	write_http_latency(reply);
+
+	write_counter(reply, "dem_connect_failures_total",
+		      "Failed connections to a controller.",
+		      read_metric(&connect_failures));
+
+	write_wc_errors(reply);
+
+	if (writer)
+		writer(reply);
+
+	reply_end_chunks(reply);
+}
@@ -41,6 +41,7 @@
 
 #include "common.h"
 #include "ops.h"
+#include "metrics.h"
 
 #define NVME_CTRL_ENABLE	0x460001
 #define NVME_CTRL_DISABLE	0x464001
@@ -48,9 +49,11 @@
 #define NVME_DISC_KATO		360000 /* ms = minutes */
 #define RETRY_COUNT		5
 #define MSG_TIMEOUT		100
-#define CONFIG_TIMEOUT		50
-#define CONFIG_RETRY_COUNT	20
+#define CONFIG_TIMEOUT		2000 /* ms */
 #define CONNECT_RETRY_COUNT	10
+#define CONNECT_RETRY_DELAY	50 /* usec */
+
+unsigned long			 connect_failures;
 
 void dump(u8 *buf, int len)
 {
@@ -212,7 +215,11 @@ static inline int send_cmd(struct endpoint *ep, struct nvme_command *cmd,
 	return ep->ops->send_msg(ep->ep, cmd, bytes, ep->mr);
 }
 
-int process_nvme_rsp(struct endpoint *ep, int ignore_status, u64 *result)
+/* polls for the response until it arrives or timeout ms have passed,
+ * returning as soon as the completion is seen
+ */
+static int wait_nvme_rsp(struct endpoint *ep, int ignore_status, u64 *result,
+			 int timeout)
 {
 	struct xp_qe		*qe;
 	struct nvme_completion	*rsp;
@@ -234,7 +241,7 @@ int process_nvme_rsp(struct endpoint *ep, int ignore_status, u64 *result)
 		if (stopped)
 			return -ESHUTDOWN;
 
-		if (msec_delta(t0) > MSG_TIMEOUT)
+		if (msec_delta(t0) > timeout)
 			return -EAGAIN;
 	}
 
@@ -254,6 +261,11 @@ int process_nvme_rsp(struct endpoint *ep, int ignore_status, u64 *result)
 	return ret;
 }
 
+int process_nvme_rsp(struct endpoint *ep, int ignore_status, u64 *result)
+{
+	return wait_nvme_rsp(ep, ignore_status, result, MSG_TIMEOUT);
+}
+
 static int send_fabric_connect(struct ctrl_queue *ctrl)
 {
 	struct endpoint		*ep = &ctrl->ep;
@@ -330,14 +342,17 @@ int send_keep_alive(struct endpoint *ep)
 	return send_admin_cmd(ep, nvme_admin_keep_alive);
 }
 
-int send_get_config(struct endpoint *ep, int cid, int len, void **_data)
+/* offset is the first entry wanted for the ids that report entries in
+ * pages, see nvmf_get_state_hdr
+ */
+int send_get_config(struct endpoint *ep, int cid, u32 offset, int len,
+		    void **_data)
 {
 	struct nvme_command		*cmd = ep->cmd;
 	struct xp_mr			*mr;
 	u64				*data;
 	int				 bytes;
 	int				 key;
-	int				 cnt = CONFIG_RETRY_COUNT;
 	int				 ret;
 
 	if (!cmd)
@@ -350,11 +365,13 @@ int send_get_config(struct endpoint *ep, int cid, int len, void **_data)
 		return errno;
 	}
 
-	memset(data, 0, PAGE_SIZE);
+	memset(data, 0, len);
 
-	ret = ep->ops->alloc_key(ep->ep, data, PAGE_SIZE, &mr);
-	if (ret)
+	ret = ep->ops->alloc_key(ep->ep, data, len, &mr);
+	if (ret) {
+		free(data);
 		return ret;
+	}
 
 	key = ep->ops->remote_key(mr);
 
@@ -362,22 +379,21 @@ int send_get_config(struct endpoint *ep, int cid, int len, void **_data)
 
 	cmd->config.command_id	= cid;
 	cmd->config.fctype	= nvme_fabrics_type_resource_config_get;
-
-	*_data = data;
+	cmd->config.offset	= htole32(offset);
 
 	ret = send_cmd(ep, cmd, bytes);
-	if (ret) {
-		free(data);
+	if (ret)
 		goto out;
-	}
 
-	do {
-		usleep(CONFIG_TIMEOUT);
-		ret = process_nvme_rsp(ep, 0, NULL);
-	} while (ret == -EAGAIN && --cnt);
+	ret = wait_nvme_rsp(ep, 0, NULL, CONFIG_TIMEOUT);
 out:
 	ep->ops->dealloc_key(mr);
 
+	if (ret)
+		free(data);
+	else
+		*_data = data;
+
 	return ret;
 }
 
@@ -385,7 +401,6 @@ int send_reset_config(struct endpoint *ep)
 {
 	struct nvme_command		*cmd = ep->cmd;
 	int				 bytes;
-	int				 cnt = CONFIG_RETRY_COUNT;
 	int				 ret;
 
 	if (!cmd)
@@ -405,10 +420,7 @@ int send_reset_config(struct endpoint *ep)
 	if (ret)
 		goto out;
 
-	do {
-		usleep(CONFIG_TIMEOUT);
-		ret = process_nvme_rsp(ep, 0, NULL);
-	} while (ret == -EAGAIN && --cnt);
+	ret = wait_nvme_rsp(ep, 0, NULL, CONFIG_TIMEOUT);
 out:
 
 	return ret;
@@ -420,7 +432,6 @@ int send_set_config(struct endpoint *ep, int cid, int len, void *data)
 	struct xp_mr			*mr;
 	int				 bytes;
 	int				 key;
-	int				 cnt = CONFIG_RETRY_COUNT;
 	int				 ret;
 
 	if (!cmd)
@@ -443,11 +454,9 @@ int send_set_config(struct endpoint *ep, int cid, int len, void *data)
 	if (ret)
 		goto out;
 
-	do {
-		usleep(CONFIG_TIMEOUT);
-		ret = process_nvme_rsp(ep, 0, NULL);
-	} while (ret == -EAGAIN && --cnt);
+	ret = wait_nvme_rsp(ep, 0, NULL, CONFIG_TIMEOUT);
 out:
+	ep->ops->dealloc_key(mr);
 
 	return ret;
 }
@@ -626,7 +635,7 @@ void disconnect_ctrl(struct ctrl_queue *ctrl, int shutdown)
 	ctrl->connected = 0;
 }
 
-int connect_ctrl(struct ctrl_queue *ctrl)
+static int open_ctrl(struct ctrl_queue *ctrl)
 {
 	struct portid		*portid = ctrl->portid;
 	struct endpoint		*ep = &ctrl->ep;
@@ -664,10 +673,13 @@ int connect_ctrl(struct ctrl_queue *ctrl)
 
 	bytes = ep->ops->build_connect_data(&req, ctrl->hostnqn);
 
-	do {
-		usleep(CONFIG_TIMEOUT);
+	while (1) {
 		ret = ep->ops->client_connect(ep->ep, &dest, req, bytes);
-	} while (ret == -EAGAIN && --cnt);
+		if (ret != -EAGAIN || !--cnt)
+			break;
+
+		usleep(CONNECT_RETRY_DELAY);
+	}
 
 	if (bytes)
 		free(req);
@@ -704,8 +716,6 @@ int connect_ctrl(struct ctrl_queue *ctrl)
 	if (ret)
 		goto out;
 
-	usleep(100); /* in case dem-dc running of an in-band dem-sc */
-
 	return send_set_property(ep, NVME_REG_CC, NVME_CTRL_ENABLE);
 out:
 	disconnect_endpoint(ep, 0);
@@ -713,6 +723,17 @@ out:
 	return ret;
 }
 
+int connect_ctrl(struct ctrl_queue *ctrl)
+{
+	int			 ret;
+
+	ret = open_ctrl(ctrl);
+	if (ret)
+		count_metric(&connect_failures);
+
+	return ret;
+}
+
 int start_pseudo_target(struct host_iface *iface)
 {
 	struct sockaddr		 dest;
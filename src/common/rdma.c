@@ -45,6 +45,7 @@
 #include <rdma/rdma_cma.h>
 
 #include "ops.h"
+#include "metrics.h"
 
 #define BACKLOG			16
 #define RESOLVE_TIMEOUT		5000
@@ -80,6 +81,7 @@ struct rdma_pep {
 static struct {
 	int			 status;
 	char			*str;
+	unsigned long		 errors;
 } wc_status_array[] = {
 	{ IBV_WC_SUCCESS,		"IBV_WC_SUCCESS" },
 	{ IBV_WC_LOC_LEN_ERR,		"IBV_WC_LOC_LEN_ERR" },
@@ -120,6 +122,28 @@ static inline char *wc_str_status(u16 _status)
 	return str;
 }
 
+void count_wc_error(int status)
+{
+	int			 i;
+
+	for (i = 0; i < NUM_ENTRIES(wc_status_array); i++)
+		if (wc_status_array[i].status == status) {
+			count_metric(&wc_status_array[i].errors);
+			break;
+		}
+}
+
+int rdma_wc_errors(int i, const char **status, unsigned long *count)
+{
+	if (i < 0 || i >= NUM_ENTRIES(wc_status_array))
+		return -ENOENT;
+
+	*status = wc_status_array[i].str;
+	*count = read_metric(&wc_status_array[i].errors);
+
+	return 0;
+}
+
 static void *alloc_buffer(struct rdma_ep *ep, int size, struct ibv_mr **_mr)
 {
 	void			*buf;
@@ -262,11 +286,11 @@ static int rdma_create_completion_queues(struct rdma_ep *ep)
 	if (ret < 0)
 		goto err1;
 
-	rcq = ibv_create_cq(ctx, ep->depth, NULL, ep->comp, 0);
+	rcq = ibv_create_cq(ctx, ep->depth, NULL, comp, 0);
 	if (!rcq)
 		goto err2;
 
-	scq = ibv_create_cq(ctx, ep->depth, NULL, ep->comp, 0);
+	scq = ibv_create_cq(ctx, ep->depth, NULL, comp, 0);
 	if (!scq)
 		goto err3;
 
@@ -661,6 +685,7 @@ static int rdma_rma_read(struct xp_ep *_ep, void *buf, u64 addr, u64 len,
 			return -ESHUTDOWN;
 
 	if (wc.status != IBV_WC_SUCCESS) {
+		count_wc_error(wc.status);
 		print_err("rma_read wc.status %s (%d)",
 			  wc_str_status(wc.status), wc.status);
 		return -ECONNRESET;
@@ -704,6 +729,7 @@ static int rdma_rma_write(struct xp_ep *_ep, void *buf, u64 addr, u64 len,
 			return -ESHUTDOWN;
 
 	if (wc.status != IBV_WC_SUCCESS) {
+		count_wc_error(wc.status);
 		print_err("rma_write wc.status %s (%d)",
 			  wc_str_status(wc.status), wc.status);
 		return -ECONNRESET;
@@ -772,6 +798,7 @@ static int rdma_send_msg(struct xp_ep *_ep, void *msg, int len,
 			return -ESHUTDOWN;
 
 	if (wc.status != IBV_WC_SUCCESS) {
+		count_wc_error(wc.status);
 		if (wc.status != IBV_WC_RETRY_EXC_ERR)
 			print_err("send wc.status %s (%d)",
 				  wc_str_status(wc.status), wc.status);
@@ -796,6 +823,7 @@ static int rdma_poll_for_msg(struct xp_ep *_ep, struct xp_qe **_qe, void **msg,
 		return -EAGAIN;
 
 	if (wc.status != IBV_WC_SUCCESS) {
+		count_wc_error(wc.status);
 		if (wc.status != IBV_WC_WR_FLUSH_ERR)
 			print_err("recv wc.status %s (%d)",
 				  wc_str_status(wc.status), wc.status);
@@ -812,6 +840,46 @@ static int rdma_poll_for_msg(struct xp_ep *_ep, struct xp_qe **_qe, void **msg,
 	return 0;
 }
 
+/* like poll_for_msg but sleeps on the completion channel for up to msec
+ * when nothing has arrived yet
+ */
+static int rdma_wait_for_msg(struct xp_ep *_ep, struct xp_qe **_qe,
+			     void **msg, int *bytes, int msec)
+{
+	struct rdma_ep		*ep = (struct rdma_ep *) _ep;
+	struct ibv_cq		*cq;
+	struct pollfd		 pfd;
+	void			*ctx;
+	int			 ret;
+
+	ret = rdma_poll_for_msg(_ep, _qe, msg, bytes);
+	if (ret != -EAGAIN)
+		return ret;
+
+	/* poll again once armed, for a message that came in between */
+	if (ibv_req_notify_cq(ep->rcq, 0))
+		return -errno;
+
+	ret = rdma_poll_for_msg(_ep, _qe, msg, bytes);
+	if (ret != -EAGAIN)
+		return ret;
+
+	pfd.fd = ep->comp->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	ret = poll(&pfd, 1, msec);
+	if (ret < 0)
+		return (errno == EINTR) ? -EAGAIN : -errno;
+	if (!ret)
+		return -EAGAIN;
+
+	if (!ibv_get_cq_event(ep->comp, &cq, &ctx))
+		ibv_ack_cq_events(cq, 1);
+
+	return rdma_poll_for_msg(_ep, _qe, msg, bytes);
+}
+
 static int rdma_alloc_key(struct xp_ep *_ep, void *buf, int len,
 			  struct xp_mr **_mr)
 {
@@ -926,6 +994,7 @@ static struct xp_ops rdma_ops = {
 	.send_msg		= rdma_send_msg,
 	.send_rsp		= rdma_send_msg,
 	.poll_for_msg		= rdma_poll_for_msg,
+	.wait_for_msg		= rdma_wait_for_msg,
 	.alloc_key		= rdma_alloc_key,
 	.remote_key		= rdma_remote_key,
 	.dealloc_key		= rdma_dealloc_key,
@@ -55,6 +55,8 @@
 #include "ops.h"
 #include "json.h"
 #include "dem.h"
+#include "metrics.h"
+#include "hash.h"
 
 #define JSARRAY		"\"%s\":["
 #define JSEMPTYARRAY	"\"%s\":[]"
@@ -71,6 +73,8 @@ extern struct linked_list	*aen_req_list;
 extern struct linked_list	*target_list;
 extern struct linked_list	*group_list;
 extern struct linked_list	*host_list;
+extern struct config_index	*config_index;
+extern struct dc_metrics	 dc_metrics;
 
 #define PATH_NVME_FABRICS	"/dev/nvme-fabrics"
 #define PATH_NVMF_DEM_DISC	"/etc/nvme/nvmeof-dem/"
@@ -92,6 +96,8 @@ struct target;
 
 struct portid {
 	struct linked_list	 node;
+	struct hash_node	 hnode;
+	struct target		*target;
 	int			 portid;
 	char			 type[CONFIG_TYPE_SIZE + 1];
 	char			 family[CONFIG_FAMILY_SIZE + 1];
@@ -114,6 +120,7 @@ struct host_iface {
 	char			 port[CONFIG_PORT_SIZE + 1];
 	struct xp_pep		*listener;
 	struct xp_ops		*ops;
+	long			 hosts;	/* connected, for metrics */
 };
 
 struct oob_iface {
@@ -124,8 +131,8 @@ struct oob_iface {
 struct host {
 	struct linked_list	 node;
 	struct subsystem	*subsystem;
-	char			 alias[MAX_ALIAS_SIZE + 1];
-	char			 nqn[MAX_NQN_SIZE + 1];
+	int			 alias;		/* interned, see intern.c */
+	int			 nqn;		/* interned */
 };
 
 struct ns {
@@ -136,15 +143,37 @@ struct ns {
 	// TODO add bits for multipath and partitions
 };
 
+/* a discovery log entry with its strings interned and no reserved space,
+ * expand_logpage_entry() fills in the entry sent to hosts
+ */
+#define LOGPAGE_TSAS_SIZE	16
+
+struct logpage_entry {
+	int			 subnqn;
+	int			 traddr;
+	int			 trsvcid;
+	u16			 portid;
+	u16			 cntlid;
+	u8			 trtype;
+	u8			 adrfam;
+	u8			 subtype;
+	u8			 treq;
+	u8			 tsas[LOGPAGE_TSAS_SIZE];
+};
+
 struct logpage {
 	struct linked_list	 node;
 	struct portid		*portid;
-	struct nvmf_disc_rsp_page_entry e;
+	struct logpage_entry	 e;
 	int			 valid;
+	/* restored from the cache and not fetched again yet */
+	int			 stale;
+	time_t			 fetched;
 };
 
 struct subsystem {
 	struct linked_list	 node;
+	struct hash_node	 hnode;
 	struct linked_list	 host_list;
 	struct linked_list	 ns_list;
 	struct linked_list	 logpage_list;
@@ -169,6 +198,19 @@ struct fabric_iface {
 	int			 valid;
 };
 
+/* the managed session to an in-band SC, see config.c.  The counters are
+ * read by /metrics without target->lock.
+ */
+struct inb_session {
+	long			 up;		/* gauge */
+	unsigned long		 connects;
+	unsigned long		 connect_failures;
+	unsigned long		 drops;
+	int			 last_error;
+	int			 backoff;	/* passes between retries */
+	int			 countdown;	/* to a retry or keep alive */
+};
+
 union sc_iface {
 	struct oob_iface oob;
 	struct ctrl_queue inb;
@@ -176,6 +218,7 @@ union sc_iface {
 
 struct target {
 	struct linked_list	 node;
+	struct hash_node	 hnode;
 	struct linked_list	 subsys_list;
 	struct linked_list	 portid_list;
 	struct linked_list	 device_list;
@@ -192,10 +235,53 @@ struct target {
 	int			 refresh_countdown;
 	int			 kato_countdown;
 	bool			 group_member;
+	bool			 removed;
+	/* serializes I/O to the SC and discovery queues of this target */
+	pthread_mutex_t		 lock;
+	/* keeps the connection to an OOB SC open between pushes */
+	struct curl_chan	*oob_chan;
+	/* whether an in-band SC takes nvmf_batch_config, see config.c */
+	int			 inb_batch;
+	struct inb_session	 inb_session;
+	int			 refcnt;
+};
+
+/* hash indexes of the lists, see config.c */
+struct config_index {
+	struct hash_table	 targets;	/* by alias */
+	struct hash_table	 groups;	/* by name */
+	struct hash_table	 subsystems;	/* by target and NQN */
+	struct hash_table	 portids;	/* by target and portid */
+};
+
+/* a live target and its copy in the config sandbox, NULL if it could not
+ * be built there
+ */
+struct target_pair {
+	struct target		*live;
+	struct target		*copy;
+};
+
+/* copy of the part of the config a batch of changes is tried against,
+ * committed as the live config if they all succeed
+ */
+struct config_sandbox {
+	struct linked_list	 targets;
+	struct linked_list	 groups;
+	struct linked_list	 hosts;
+	struct linked_list	*target_list;
+	struct linked_list	*group_list;
+	struct linked_list	*host_list;
+	struct config_index	 index;
+	struct config_index	*config_index;
+	struct target_pair	*pairs;
+	int			 num_targets;
+	json_t			*root;
 };
 
 struct group {
 	struct linked_list	 node;
+	struct hash_node	 hnode;
 	struct linked_list	 target_list;
 	char			 name[MAX_ALIAS_SIZE + 1];
 };
@@ -208,20 +294,41 @@ struct group_target_link {
 struct group_host_link {
 	struct linked_list	 node;
 	struct group		*group;
-	char			 alias[MAX_ALIAS_SIZE + 1];
-	char			 nqn[MAX_NQN_SIZE + 1];
+	int			 alias;		/* interned */
+	int			 nqn;		/* interned */
+};
+
+struct fetched_log {
+	struct linked_list	 node;
+	struct ctrl_queue	*dq;
+	struct nvmf_disc_rsp_page_hdr *log;
+	u32			 num_records;
 };
 
 struct event_notification {
 	struct linked_list	 node;
 	struct endpoint		*ep;
 	struct event_notification *req;
-	char			 nqn[MAX_NQN_SIZE + 1];
+	int			 nqn;		/* interned */
 	int			 valid;
 };
 
-struct mg_connection;
+enum { INB_GET_CONFIG, INB_SET_CONFIG, INB_RESET_CONFIG, NUM_INB_OPS };
+
+/* served at /metrics along with the request latency of the REST API */
+struct dc_metrics {
+	struct histogram	 log_page_latency;
+	struct histogram	 refresh_latency;
+	struct histogram	 inb_config_latency[NUM_INB_OPS];
+	unsigned long		 aens_sent;
+};
+
+struct http_message;
+struct http_reply;
 struct mg_str;
+struct mg_mgr;
+struct mg_connection;
+struct config_job;
 
 extern char shared_nqn[];
 
@@ -229,12 +336,18 @@ extern struct mg_str s_signature_user;
 extern struct mg_str *s_signature;
 
 void shutdown_dem(void);
-void handle_http_request(struct mg_connection *c, void *ev_data);
+void handle_http_request(struct http_message *hm, struct http_reply *reply);
+int authorized_request(struct http_message *hm);
+
+int enter_config_sandbox(struct config_sandbox *sb, json_t *scope);
+void commit_config_sandbox(struct config_sandbox *sb);
+void leave_config_sandbox(struct config_sandbox *sb);
 
 int init_json(char *filename);
 void cleanup_json(void);
-void json_spinlock(void);
-void json_spinunlock(void);
+void json_read_lock(void);
+void json_write_lock(void);
+void json_unlock(void);
 
 int init_interfaces(void);
 void *interface_thread(void *arg);
@@ -243,30 +356,91 @@ int start_pseudo_target(struct host_iface *iface);
 int run_pseudo_target(struct endpoint *ep, void *id);
 
 void build_lists(void);
+void build_group(json_t *iter);
 struct group *init_group(char *name);
 void add_host_to_group(struct group *group, char *alias);
+void free_group_host(struct group_host_link *link);
+struct target *link_target_to_group(struct group *group, char *alias);
 void add_target_to_group(struct group *group, char *alias);
-bool shared_group(struct target *target, char *nqn);
+void drop_group(char *name);
+bool shared_group(struct target *target, int nqn);
 bool indirect_shared_group(struct target *target, char *alias);
 struct target *find_target(char *alias);
 
+int init_config_index(struct config_index *index);
+void free_config_index(struct config_index *index);
+void index_target(struct target *target);
+void index_subsys(struct subsystem *subsys);
+void index_portid(struct portid *portid);
+
 void get_host_nqn(void *context, void *haddr, char *nqn);
 
 struct subsystem *new_subsys(struct target *target, char *nqn);
+void free_host(struct host *host);
 
-void fetch_log_pages(struct ctrl_queue *dq);
+int fetch_log_pages(struct ctrl_queue *dq, struct linked_list *logs);
+void save_fetched_log_pages(struct target *target, struct linked_list *logs);
 void create_discovery_queue(struct target *target, struct subsystem *subsys,
 			    struct portid *portid);
 int target_reconfig(char *alias);
-int target_refresh(char *alias);
+int target_refresh(struct target *target);
+int queue_target_refresh(char *alias);
 int target_usage(char *alias, char **results);
 int target_logpage(char *alias, char **results);
 int host_logpage(char *alias, char **results);
+void load_log_page_cache(void);
+void store_log_page_cache(void);
+void expand_logpage_entry(struct logpage_entry *le,
+			  struct nvmf_disc_rsp_page_entry *e);
+void free_logpage(struct logpage *logpage);
+
+int intern(const char *str);
+int hold_interned(int id);
+void unintern(int id);
+char *interned(int id);
+int reintern(int *id, const char *str);
+void interned_usage(int *count, size_t *bytes);
+
+void begin_notification_batch(void);
+void end_notification_batch(void);
+void drop_notification_batch(void);
+void commit_sandbox_targets(struct config_sandbox *sb);
 
 int get_config(struct target *target);
 int config_target(struct target *target);
 
+int open_inb_session(struct target *target);
+void close_inb_session(struct target *target, int err);
+
+void take_config_ops(struct linked_list *list);
+void coalesce_config_ops(void);
+int flush_config_ops(struct linked_list *list, char *resp);
+void free_config_ops(struct linked_list *list);
+int config_op_targets(struct linked_list *list, struct target **targets,
+		      int max);
+
+int init_config_jobs(void);
+void cleanup_config_jobs(void);
+long submit_config_job(struct linked_list *ops, char *request, char *resp);
+struct config_job *start_config_job(struct linked_list *ops);
+int run_config_job(struct config_job *job, char *resp);
+int show_config_jobs(char **resp);
+int show_config_job(char *id, char **resp);
+
+/* set on a connection that carries an event stream */
+#define MG_F_EVENT_STREAM	MG_F_USER_1
+
+int init_events(struct mg_mgr *mgr);
+void cleanup_events(void);
+char *escape_event_str(const char *str, char *buf, int size);
+void publish_event(char *type, const char *fmt, ...);
+int is_event_request(struct http_message *hm);
+void open_event_stream(struct mg_connection *c, struct http_message *hm);
+void close_event_stream(struct mg_connection *c);
+
 struct target *alloc_target(char *alias);
+void get_target(struct target *target);
+void put_target(struct target *target);
 
 int get_mgmt_mode(char *mode);
 
@@ -65,33 +65,167 @@ int get_mgmt_mode(char *mode)
 	return mgmt_mode;
 }
 
+/* hash indexes of the lists
+ *
+ * Targets and groups are found by name, subsystems and portids by their
+ * target and NQN or portid, without walking the lists.  Everything put
+ * on the lists is indexed as it is added and unindexed before it is freed
+ * or renamed; the index is swapped along with the lists by the config
+ * sandbox and freed with them.  Called with the config lock held,
+ * exclusively to change an index.
+ */
+int init_config_index(struct config_index *index)
+{
+	if (hash_init(&index->targets))
+		goto err1;
+	if (hash_init(&index->groups))
+		goto err2;
+	if (hash_init(&index->subsystems))
+		goto err3;
+	if (hash_init(&index->portids))
+		goto err4;
+
+	return 0;
+err4:
+	hash_free(&index->subsystems);
+err3:
+	hash_free(&index->groups);
+err2:
+	hash_free(&index->targets);
+err1:
+	return -ENOMEM;
+}
+
+void free_config_index(struct config_index *index)
+{
+	hash_free(&index->targets);
+	hash_free(&index->groups);
+	hash_free(&index->subsystems);
+	hash_free(&index->portids);
+}
+
+static inline unsigned int target_key(char *alias)
+{
+	return hash_str(alias, HASH_SEED);
+}
+
+static inline unsigned int subsys_key(struct target *target, char *nqn)
+{
+	return hash_str(nqn, hash_ptr(target));
+}
+
+static inline unsigned int portid_key(struct target *target, int id)
+{
+	return hash_int(id, hash_ptr(target));
+}
+
+static inline unsigned int group_key(char *name)
+{
+	return hash_str(name, HASH_SEED);
+}
+
+void index_target(struct target *target)
+{
+	hash_add(&config_index->targets, &target->hnode,
+		 target_key(target->alias));
+}
+
+void index_subsys(struct subsystem *subsys)
+{
+	hash_add(&config_index->subsystems, &subsys->hnode,
+		 subsys_key(subsys->target, subsys->nqn));
+}
+
+void index_portid(struct portid *portid)
+{
+	hash_add(&config_index->portids, &portid->hnode,
+		 portid_key(portid->target, portid->portid));
+}
+
+static inline void unindex_subsys(struct subsystem *subsys)
+{
+	hash_del(&config_index->subsystems, &subsys->hnode);
+}
+
+static inline void unindex_portid(struct portid *portid)
+{
+	hash_del(&config_index->portids, &portid->hnode);
+}
+
+/* the keys of its subsystems and portids include the target so they go
+ * as well, a later target could be allocated at the same address
+ */
+static void unindex_target(struct target *target)
+{
+	struct subsystem	*subsys;
+	struct portid		*portid;
+
+	list_for_each_entry(subsys, &target->subsys_list, node)
+		unindex_subsys(subsys);
+
+	list_for_each_entry(portid, &target->portid_list, node)
+		unindex_portid(portid);
+
+	hash_del(&config_index->targets, &target->hnode);
+}
+
+static void rename_target(struct target *target, char *alias)
+{
+	hash_del(&config_index->targets, &target->hnode);
+
+	strcpy(target->alias, alias);
+
+	index_target(target);
+}
+
+static void rename_subsys(struct subsystem *subsys, char *nqn)
+{
+	unindex_subsys(subsys);
+
+	strcpy(subsys->nqn, nqn);
+
+	index_subsys(subsys);
+}
+
 struct target *find_target(char *alias)
 {
+	struct hash_node	*node;
 	struct target		*target;
+	unsigned int		 key = target_key(alias);
 
-	list_for_each_entry(target, target_list, node)
+	hash_for_each_possible(&config_index->targets, node, key) {
+		target = hash_entry(node, struct target, hnode);
 		if (!strcmp(target->alias, alias))
 			return target;
+	}
 	return NULL;
 }
 
 static inline struct subsystem *find_subsys(struct target *target, char *nqn)
 {
+	struct hash_node	*node;
 	struct subsystem	*subsys;
+	unsigned int		 key = subsys_key(target, nqn);
 
-	list_for_each_entry(subsys, &target->subsys_list, node)
-		if (!strcmp(subsys->nqn, nqn))
+	hash_for_each_possible(&config_index->subsystems, node, key) {
+		subsys = hash_entry(node, struct subsystem, hnode);
+		if (subsys->target == target && !strcmp(subsys->nqn, nqn))
 			return subsys;
+	}
 	return NULL;
 }
 
 static inline struct portid *find_portid(struct target *target, int id)
 {
+	struct hash_node	*node;
 	struct portid		*portid;
+	unsigned int		 key = portid_key(target, id);
 
-	list_for_each_entry(portid, &target->portid_list, node)
-		if (portid->portid == id)
+	hash_for_each_possible(&config_index->portids, node, key) {
+		portid = hash_entry(node, struct portid, hnode);
+		if (portid->target == target && portid->portid == id)
 			return portid;
+	}
 	return NULL;
 }
 
@@ -107,11 +241,15 @@ static inline struct ns *find_ns(struct subsystem *subsys, int nsid)
 
 static inline struct group *find_group(char *name)
 {
+	struct hash_node	*node;
 	struct group		*group;
+	unsigned int		 key = group_key(name);
 
-	list_for_each_entry(group, group_list, node)
+	hash_for_each_possible(&config_index->groups, node, key) {
+		group = hash_entry(node, struct group, hnode);
 		if (!strcmp(group->name, name))
 			return group;
+	}
 	return NULL;
 }
 
@@ -127,24 +265,308 @@ static inline struct group_target_link *find_group_target(struct group *group,
 }
 
 static inline struct group_host_link *find_group_host(struct group *group,
-						      char *nqn)
+						      char *alias)
 {
 	struct group_host_link *link;
 
 	list_for_each_entry(link, host_list, node)
-		if (link->group == group && !strcmp(link->nqn, nqn))
+		if (link->group == group &&
+		    !strcmp(interned(link->alias), alias))
 			return link;
 	return NULL;
 }
 
+/* deferred target I/O
+ *
+ * Config changes are made with the config lock held exclusively, but nothing
+ * is sent to the SC or the discovery controllers of a target at that point.
+ * Instead the request is queued here and the caller pushes the whole batch
+ * with flush_config_ops() after dropping the lock, serialized per target by
+ * target->lock.  Each op holds a reference on its target.
+ */
+
+enum { OP_SET_CONFIG, OP_RESET_CONFIG, OP_OOB_POST, OP_OOB_DELETE,
+	OP_GET_CONFIG, OP_REFRESH, OP_RECONCILE, OP_DISCONNECT };
+
+struct config_op {
+	struct linked_list	 node;
+	struct target		*target;
+	int			 type;
+	int			 id;
+	int			 len;
+	void			*data;
+	char			 uri[MAX_URI_SIZE];
+};
+
+/* protected by the config lock held exclusively */
+static LINKED_LIST(config_op_list);
+
+static struct config_op *alloc_config_op(struct target *target, int type)
+{
+	struct config_op	*op;
+
+	op = malloc(sizeof(*op));
+	if (!op)
+		return NULL;
+
+	memset(op, 0, sizeof(*op));
+
+	op->target = target;
+	op->type = type;
+
+	get_target(target);
+
+	return op;
+}
+
+static struct config_op *queue_op(struct target *target, int type)
+{
+	struct config_op	*op;
+
+	op = alloc_config_op(target, type);
+	if (op)
+		list_add_tail(&op->node, &config_op_list);
+
+	return op;
+}
+
+/* takes ownership of the posix_memalign'd entry */
+static int queue_set_config(struct target *target, int id, int len,
+			    void *entry)
+{
+	struct config_op	*op;
+
+	op = queue_op(target, OP_SET_CONFIG);
+	if (!op) {
+		free(entry);
+		return -ENOMEM;
+	}
+
+	op->id = id;
+	op->len = len;
+	op->data = entry;
+
+	return 0;
+}
+
+static int queue_oob_post(struct target *target, char *uri, char *buf)
+{
+	struct config_op	*op;
+	char			*data;
+
+	data = strdup(buf);
+	if (!data)
+		return -ENOMEM;
+
+	op = queue_op(target, OP_OOB_POST);
+	if (!op) {
+		free(data);
+		return -ENOMEM;
+	}
+
+	strcpy(op->uri, uri);
+	op->len = strlen(data);
+	op->data = data;
+
+	return 0;
+}
+
+static int queue_oob_delete(struct target *target, char *uri)
+{
+	struct config_op	*op;
+
+	op = queue_op(target, OP_OOB_DELETE);
+	if (!op)
+		return -ENOMEM;
+
+	strcpy(op->uri, uri);
+
+	return 0;
+}
+
+static inline int queue_reset_config(struct target *target)
+{
+	return queue_op(target, OP_RESET_CONFIG) ? 0 : -ENOMEM;
+}
+
+static inline int queue_get_config(struct target *target)
+{
+	return queue_op(target, OP_GET_CONFIG) ? 0 : -ENOMEM;
+}
+
+static inline int queue_reconcile(struct target *target)
+{
+	return queue_op(target, OP_RECONCILE) ? 0 : -ENOMEM;
+}
+
+/* called with target->lock held.  A discovery controller connection that
+ * has to go is handed to an op and torn down when the op is freed, after
+ * the config lock is dropped.  A queue being removed goes with it; one
+ * that stays is left disconnected and connects again on its next refresh.
+ */
+static void queue_disconnect(struct ctrl_queue *dq, bool removed)
+{
+	struct config_op	*op;
+	struct ctrl_queue	*conn = dq;
+
+	if (!dq->connected)
+		goto out;
+
+	op = queue_op(dq->target, OP_DISCONNECT);
+	if (!op)
+		goto now;
+
+	if (!removed) {
+		conn = malloc(sizeof(*conn));
+		if (!conn)
+			goto now;
+
+		memcpy(conn, dq, sizeof(*conn));
+		dq->connected = 0;
+	}
+
+	op->data = conn;
+
+	return;
+now:
+	print_err("unable to defer disconnect from %s", dq->target->alias);
+	disconnect_ctrl(dq, 0);
+out:
+	if (removed)
+		free(dq);
+}
+
+static void queue_refresh(struct target *target)
+{
+	struct config_op	*op;
+
+	/* back to back refreshes of the same target collapse into one */
+	if (!list_empty(&config_op_list)) {
+		op = list_entry(config_op_list.prev, struct config_op, node);
+		if (op->target == target && op->type == OP_REFRESH)
+			return;
+	}
+
+	if (!queue_op(target, OP_REFRESH))
+		print_err("unable to queue refresh for %s", target->alias);
+}
+
+int queue_target_refresh(char *alias)
+{
+	struct target		*target;
+
+	target = find_target(alias);
+	if (!target)
+		return -ENOENT;
+
+	queue_refresh(target);
+
+	return 0;
+}
+
+/* called with the config lock held exclusively */
+void take_config_ops(struct linked_list *list)
+{
+	INIT_LINKED_LIST(list);
+
+	if (list_empty(&config_op_list))
+		return;
+
+	*list = config_op_list;
+	list->next->prev = list;
+	list->prev->next = list;
+
+	INIT_LINKED_LIST(&config_op_list);
+}
+
+/* called with the config lock held exclusively.  Back to back refreshes,
+ * config fetches and reconciles of a target are only worth doing once,
+ * after its last change, and the ops of each target are grouped so a
+ * batch of changes is pushed to a target in one go, in the order queued.
+ */
+void coalesce_config_ops(void)
+{
+	struct config_op	*op, *next, *last;
+	struct target		*target;
+	struct linked_list	 list;
+
+	take_config_ops(&list);
+
+	while (!list_empty(&list)) {
+		target = list_entry(list.next, struct config_op, node)->target;
+
+		list_for_each_entry_safe(op, next, &list, node) {
+			if (op->target != target)
+				continue;
+
+			list_del(&op->node);
+
+			if (op->type != OP_REFRESH &&
+			    op->type != OP_GET_CONFIG &&
+			    op->type != OP_RECONCILE)
+				goto keep;
+
+			list_for_each_entry(last, &list, node)
+				if (last->target == target &&
+				    last->type == op->type)
+					break;
+
+			if (&last->node == &list)
+				goto keep;
+
+			put_target(target);
+			free(op);
+			continue;
+keep:
+			list_add_tail(&op->node, &config_op_list);
+		}
+	}
+}
+
 /* notification functions */
 
+/* while a batch of changes is applied each host is sent one notification
+ * at the end rather than one per change
+ */
+static int hold_aens;
+static LINKED_LIST(held_aen_list);
+
+static inline void free_notification(struct event_notification *entry)
+{
+	unintern(entry->nqn);
+	free(entry);
+}
+
+static inline int hold_notifications(struct linked_list *list)
+{
+	struct event_notification *entry, *next;
+	struct event_notification *held;
+
+	list_for_each_entry_safe(entry, next, list, node) {
+		list_del(&entry->node);
+
+		list_for_each_entry(held, &held_aen_list, node)
+			if (held->req == entry->req)
+				break;
+
+		if (&held->node == &held_aen_list)
+			list_add_tail(&entry->node, &held_aen_list);
+		else
+			free_notification(entry);
+	}
+
+	return 0;
+}
+
 static inline int send_notifications(struct linked_list *list)
 {
 	struct event_notification *entry, *next;
 	struct endpoint		*ep;
 	struct nvme_completion	*resp;
 
+	if (hold_aens)
+		return hold_notifications(list);
+
 	list_for_each_entry_safe(entry, next, list, node) {
 		ep = entry->ep;
 		resp = (void *) ep->cmd;
@@ -154,22 +576,51 @@ static inline int send_notifications(struct linked_list *list)
 		resp->result.U32 = NVME_AER_NOTICE_LOG_PAGE_CHANGE;
 
 		ep->ops->send_rsp(ep->ep, resp, sizeof(*resp), ep->mr);
+		count_metric(&dc_metrics.aens_sent);
 
 		list_del(&entry->req->node);
-		free(entry->req);
+		free_notification(entry->req);
 		list_del(&entry->node);
-		free(entry);
+		free_notification(entry);
 	}
 
 	return 0;
 }
 
-static inline int in_notification_list(struct linked_list *list, char *nqn)
+/* called with the config lock held exclusively */
+void begin_notification_batch(void)
+{
+	hold_aens++;
+}
+
+void end_notification_batch(void)
+{
+	if (--hold_aens)
+		return;
+
+	send_notifications(&held_aen_list);
+}
+
+/* a batch that is not applied is not notified either */
+void drop_notification_batch(void)
+{
+	struct event_notification *entry, *next;
+
+	if (--hold_aens)
+		return;
+
+	list_for_each_entry_safe(entry, next, &held_aen_list, node) {
+		list_del(&entry->node);
+		free_notification(entry);
+	}
+}
+
+static inline int in_notification_list(struct linked_list *list, int nqn)
 {
 	struct event_notification *entry;
 
 	list_for_each_entry(entry, list, node)
-		if (!strcmp(nqn, entry->nqn))
+		if (entry->nqn == nqn)
 			return 1;
 
 	return 0;
@@ -186,7 +637,7 @@ static inline void create_notification_entry(struct linked_list *list,
 
 	memset(entry, 0, sizeof(*entry));
 
-	strncpy(entry->nqn, req->nqn, MAX_NQN_SIZE);
+	entry->nqn = hold_interned(req->nqn);
 	entry->ep = req->ep;
 	entry->req = req;
 
@@ -222,8 +673,7 @@ static inline void flag_by_group_hosts(struct group *group,
 
 	list_for_each_entry(entry, list, node)
 		list_for_each_entry(host, host_list, node) {
-			if ((host->group == group) &&
-			    (strcmp(host->nqn, entry->nqn))) {
+			if (host->group == group && host->nqn == entry->nqn) {
 				entry->valid = 1;
 				break;
 			}
@@ -238,7 +688,7 @@ static inline void flag_by_access_list(struct subsystem *subsys,
 
 	list_for_each_entry(entry, list, node)
 		list_for_each_entry(host, &subsys->host_list, node) {
-			if (strcmp(host->nqn, entry->nqn)) {
+			if (host->nqn == entry->nqn) {
 				entry->valid = 1;
 				break;
 			}
@@ -250,8 +700,10 @@ static inline void prune_notification_list(struct linked_list *list)
 	struct event_notification *entry, *next;
 
 	list_for_each_entry_safe(entry, next, list, node)
-		if (!entry->valid)
+		if (!entry->valid) {
 			list_del(&entry->node);
+			free_notification(entry);
+		}
 }
 
 static inline void enable_entire_list(struct linked_list *list)
@@ -331,14 +783,14 @@ static inline void create_event_host_list_for_target(struct linked_list *list,
 }
 
 static inline void create_event_host_list_for_host(struct linked_list *list,
-						   char *nqn)
+						   int nqn)
 {
 	struct event_notification *req;
 
 	INIT_LINKED_LIST(list);
 
 	list_for_each_entry(req, aen_req_list, node)
-		if (!strcmp(nqn, req->nqn)) {
+		if (req->nqn == nqn) {
 			create_notification_entry(list, req);
 			break;
 		}
@@ -349,17 +801,21 @@ static inline void _del_subsys_dq(struct subsystem *subsys)
 	struct ctrl_queue	*dq;
 	struct target		*target = subsys->target;
 
+	pthread_mutex_lock(&target->lock);
+
 	list_for_each_entry(dq, &target->discovery_queue_list, node) {
 		if (dq->subsys != subsys)
 			continue;
 
 		list_del(&dq->node);
-		free(dq);
+		queue_disconnect(dq, true);
 
-		target_refresh(target->alias);
+		queue_refresh(target);
 
 		break;
 	}
+
+	pthread_mutex_unlock(&target->lock);
 }
 
 static inline void _reset_subsys_dq(struct subsystem *subsys)
@@ -368,6 +824,8 @@ static inline void _reset_subsys_dq(struct subsystem *subsys)
 	struct host		*host;
 	struct target		*target = subsys->target;
 
+	pthread_mutex_lock(&target->lock);
+
 	list_for_each_entry(dq, &target->discovery_queue_list, node) {
 		if (dq->subsys != subsys)
 			continue;
@@ -375,12 +833,14 @@ static inline void _reset_subsys_dq(struct subsystem *subsys)
 		host = list_first_entry(&subsys->host_list, struct host,
 					node);
 
-		strncpy(dq->hostnqn, host->nqn, MAX_NQN_SIZE);
+		strncpy(dq->hostnqn, interned(host->nqn), MAX_NQN_SIZE);
 
-		target_refresh(target->alias);
+		queue_refresh(target);
 
 		break;
 	}
+
+	pthread_mutex_unlock(&target->lock);
 }
 
 static inline void _update_subsys_dq(struct subsystem *subsys, char *old_nqn,
@@ -389,6 +849,8 @@ static inline void _update_subsys_dq(struct subsystem *subsys, char *old_nqn,
 	struct ctrl_queue	*dq;
 	struct target		*target = subsys->target;
 
+	pthread_mutex_lock(&target->lock);
+
 	list_for_each_entry(dq, &target->discovery_queue_list, node) {
 		if (dq->subsys != subsys)
 			continue;
@@ -396,20 +858,21 @@ static inline void _update_subsys_dq(struct subsystem *subsys, char *old_nqn,
 		if (strcmp(old_nqn, dq->hostnqn))
 			break;
 
-		if (dq->connected)
-			disconnect_ctrl(dq, 0);
+		queue_disconnect(dq, false);
 
 		if (list_empty(&subsys->host_list)) {
-			target_refresh(target->alias);
+			queue_refresh(target);
 			break;
 		}
 
 		strncpy(dq->hostnqn, new_nqn, MAX_NQN_SIZE);
 
-		target_refresh(target->alias);
+		queue_refresh(target);
 
 		break;
 	}
+
+	pthread_mutex_unlock(&target->lock);
 }
 
 static inline void _reset_subsys_dq_nqn(struct subsystem *subsys, char *nqn)
@@ -418,6 +881,8 @@ static inline void _reset_subsys_dq_nqn(struct subsystem *subsys, char *nqn)
 	struct host		*host;
 	struct target		*target = subsys->target;
 
+	pthread_mutex_lock(&target->lock);
+
 	list_for_each_entry(dq, &target->discovery_queue_list, node) {
 		if (dq->subsys != subsys)
 			continue;
@@ -425,23 +890,24 @@ static inline void _reset_subsys_dq_nqn(struct subsystem *subsys, char *nqn)
 		if (strcmp(nqn, dq->hostnqn))
 			break;
 
-		if (dq->connected)
-			disconnect_ctrl(dq, 0);
+		queue_disconnect(dq, false);
 
 		if (list_empty(&subsys->host_list)) {
-			target_refresh(target->alias);
+			queue_refresh(target);
 			break;
 		}
 
 		host = list_first_entry(&subsys->host_list, struct host,
 					node);
 
-		strncpy(dq->hostnqn, host->nqn, MAX_NQN_SIZE);
+		strncpy(dq->hostnqn, interned(host->nqn), MAX_NQN_SIZE);
 
-		target_refresh(target->alias);
+		queue_refresh(target);
 
 		break;
 	}
+
+	pthread_mutex_unlock(&target->lock);
 }
 
 /* config functions that are not send to the target */
@@ -454,12 +920,16 @@ struct group *init_group(char *name)
 	if (!group)
 		return NULL;
 
+	memset(group, 0, sizeof(*group));
+
 	strncpy(group->name, name, MAX_ALIAS_SIZE);
 
 	INIT_LINKED_LIST(&group->target_list);
 
 	list_add_tail(&group->node, group_list);
 
+	hash_add(&config_index->groups, &group->hnode, group_key(group->name));
+
 	return group;
 }
 
@@ -491,23 +961,36 @@ int update_group(char *name, char *data, char *resp)
 	if (ret)
 		return ret;
 
-	group = find_group(_name);
+	group = name ? find_group(name) : NULL;
 	if (!group) {
 		group = init_group(_name);
 		if (!group) {
 			print_err("unable to alloc group");
 			return -ENOMEM;
 		}
-	} else
+	} else if (strcmp(group->name, _name)) {
+		hash_del(&config_index->groups, &group->hnode);
+
 		strncpy(group->name, _name, MAX_ALIAS_SIZE);
 
+		hash_add(&config_index->groups, &group->hnode,
+			 group_key(group->name));
+	}
+
 	return 0;
 }
 
+void free_group_host(struct group_host_link *link)
+{
+	unintern(link->alias);
+	unintern(link->nqn);
+	free(link);
+}
+
 void add_host_to_group(struct group *group, char *alias)
 {
 	struct group_host_link	*link;
-	char			 nqn[MAX_NQN_SIZE + 1];
+	char			 nqn[MAX_NQN_SIZE + 1] = "";
 
 	link = malloc(sizeof(*link));
 	if (!link)
@@ -517,36 +1000,52 @@ void add_host_to_group(struct group *group, char *alias)
 
 	get_json_host_nqn(alias, nqn);
 
-	strcpy(link->alias, alias);
-	strcpy(link->nqn, nqn);
+	link->alias = intern(alias);
+	link->nqn = intern(nqn);
+
+	if (link->alias < 0 || link->nqn < 0) {
+		free_group_host(link);
+		return;
+	}
 
 	list_add_tail(&link->node, host_list);
 }
 
-void add_target_to_group(struct group *group, char *alias)
+struct target *link_target_to_group(struct group *group, char *alias)
 {
 	struct target		*target;
 	struct group_target_link *link;
-	struct linked_list	 list;
 
 	target = find_target(alias);
 	if (!target)
-		return;
+		return NULL;
 
 	link = malloc(sizeof(*link));
 	if (!link)
-		return;
+		return NULL;
 
 	link->target = target;
 	target->group_member = true;
 
 	list_add_tail(&link->node, &group->target_list);
 
-	create_event_host_list_for_group(&list, group, target);
-	send_notifications(&list);
+	return target;
 }
 
-int set_group_member(char *name, char *data, char *alias, char *tag,
+void add_target_to_group(struct group *group, char *alias)
+{
+	struct target		*target;
+	struct linked_list	 list;
+
+	target = link_target_to_group(group, alias);
+	if (!target)
+		return;
+
+	create_event_host_list_for_group(&list, group, target);
+	send_notifications(&list);
+}
+
+int set_group_member(char *name, char *data, char *alias, char *tag,
 		     char *parent_tag, char *resp)
 {
 	struct group		*group;
@@ -577,7 +1076,7 @@ static inline void del_host_from_group(struct group *group, char *alias)
 		return;
 
 	list_del(&link->node);
-	free(link);
+	free_group_host(link);
 }
 
 static inline void del_target_from_group(struct group *group, char *alias)
@@ -628,37 +1127,69 @@ int del_group_member(char *name, char *alias, char *tag, char *parent_tag,
 	return 0;
 }
 
-int del_group(char *name, char *resp)
+static bool in_any_group(struct target *target)
 {
-	struct group_host_link	*link, *next;
 	struct group		*group;
-	int			 ret;
 
-	ret = del_json_group(name, resp);
-	if (ret)
-		return ret;
+	list_for_each_entry(group, group_list, node)
+		if (find_group_target(group, target))
+			return true;
+
+	return false;
+}
+
+/* takes the group off the lists, its targets left in no other group are
+ * no longer group members
+ */
+void drop_group(char *name)
+{
+	struct group_host_link	*link, *next;
+	struct group_target_link *target, *t;
+	struct group		*group;
 
 	group = find_group(name);
+	if (!group)
+		return;
 
 	list_for_each_entry_safe(link, next, host_list, node)
 		if (link->group == group) {
 			list_del(&link->node);
-			free(link);
+			free_group_host(link);
 		}
 
+	hash_del(&config_index->groups, &group->hnode);
+
 	list_del(&group->node);
+
+	list_for_each_entry_safe(target, t, &group->target_list, node) {
+		target->target->group_member = in_any_group(target->target);
+		free(target);
+	}
+
 	free(group);
+}
+
+int del_group(char *name, char *resp)
+{
+	int			 ret;
+
+	ret = del_json_group(name, resp);
+	if (ret)
+		return ret;
+
+	drop_group(name);
 
 	return 0;
 }
 
-bool shared_group(struct target *target, char *nqn)
+/* nqn is an interned id */
+bool shared_group(struct target *target, int nqn)
 {
 	struct group_target_link *link;
 	struct group_host_link	*host;
 
 	list_for_each_entry(host, host_list, node) {
-		if (strcmp(host->nqn, nqn))
+		if (host->nqn != nqn)
 			continue;
 		list_for_each_entry(link, &host->group->target_list, node)
 			if (link->target == target)
@@ -674,7 +1205,7 @@ bool indirect_shared_group(struct target *target, char *alias)
 	struct group_host_link	*host;
 
 	list_for_each_entry(host, host_list, node) {
-		if (strcmp(host->alias, alias))
+		if (strcmp(interned(host->alias), alias))
 			continue;
 		list_for_each_entry(link, &host->group->target_list, node)
 			if (link->target == target)
@@ -737,7 +1268,7 @@ static int build_link_host_inb(struct subsystem *subsys, struct host *host,
 	}
 
 	strncpy(entry->subnqn, subsys->nqn, MAX_NQN_SIZE);
-	strncpy(entry->hostnqn, host->nqn, MAX_NQN_SIZE);
+	strncpy(entry->hostnqn, interned(host->nqn), MAX_NQN_SIZE);
 
 	*_entry = entry;
 
@@ -915,18 +1446,35 @@ static void build_set_portid_oob(int portid, char *buf, int len)
 
 /* out of band message sending functions */
 
-static int send_get_config_oob(struct target *target, char *tag, char **buf)
+/* the reply is parsed straight out of the curl buffer, which the next
+ * request reuses
+ */
+static int send_get_config_oob(struct target *target, char *tag,
+			       json_t **obj)
 {
 	char			 uri[MAX_URI_SIZE];
 	char			*p = uri;
+	char			*reply;
+	json_error_t		 error;
 	int			 len;
+	int			 ret;
 
 	len = get_uri(target, uri);
 	p += len;
 
 	strcpy(p, tag);
 
-	return exec_get(uri, buf);
+	ret = exec_get(uri, &reply);
+	if (ret)
+		return ret;
+
+	*obj = json_loads(reply, JSON_DECODE_ANY, &error);
+	if (!*obj) {
+		print_err("invalid json syntax: %s", reply);
+		return -EINVAL;
+	}
+
+	return 0;
 }
 
 static int send_set_portid_oob(struct target *target, char *buf, int portid)
@@ -940,7 +1488,7 @@ static int send_set_portid_oob(struct target *target, char *buf, int portid)
 
 	sprintf(p, URI_PORTID "/%d", portid);
 
-	return exec_post(uri, buf, strlen(buf));
+	return queue_oob_post(target, uri, buf);
 }
 
 static int send_set_config_oob(struct target *target, char *tag, char *buf)
@@ -954,7 +1502,7 @@ static int send_set_config_oob(struct target *target, char *tag, char *buf)
 
 	strcpy(p, tag);
 
-	return exec_post(uri, buf, strlen(buf));
+	return queue_oob_post(target, uri, buf);
 }
 
 static int send_update_subsys_oob(struct target *target, char *subsys,
@@ -969,40 +1517,30 @@ static int send_update_subsys_oob(struct target *target, char *subsys,
 
 	sprintf(p, URI_SUBSYSTEM "/%s/%s", subsys, tag);
 
-	return exec_post(uri, buf, strlen(buf));
+	return queue_oob_post(target, uri, buf);
 }
 
 /* in band get config messages */
 
-static inline int get_inb_nsdevs(struct target *target)
+static inline int get_inb_nsdevs(struct target *target,
+				 struct nvmf_get_ns_devices_entry *entry,
+				 int count)
 {
-	struct nvmf_get_ns_devices_hdr *hdr;
-	struct nvmf_get_ns_devices_entry *entry;
 	struct nsdev		*nsdev;
-	struct endpoint		*ep = &target->sc_iface.inb.ep;
 	char			*alias = target->alias;
 	int			 i;
 	int			 devid;
-	int			 ret;
-
-	ret = send_get_config(ep, nvmf_get_ns_config, PAGE_SIZE,
-			      (void **) &hdr);
-	if (ret) {
-		print_err("send get nsdevs INB failed for %s", alias);
-		goto out1;
-	}
+	int			 ret = 0;
 
-	if (!hdr->num_entries) {
+	if (!count) {
 		print_err("no NS devices defined for %s", alias);
-		goto out2;
+		goto out;
 	}
 
-	entry = (struct nvmf_get_ns_devices_entry *) &hdr->data;
-
 	list_for_each_entry(nsdev, &target->device_list, node)
 		nsdev->valid = 0;
 
-	for (i = hdr->num_entries; i > 0; i--, entry++) {
+	for (i = count; i > 0; i--, entry++) {
 		devid = entry->devid;
 		if (devid == NVMF_NULLB_DEVID)
 			devid = NULLB_DEVID;
@@ -1018,7 +1556,7 @@ static inline int get_inb_nsdevs(struct target *target)
 		if (!nsdev) {
 			print_err("unable to alloc nsdev");
 			ret = -ENOMEM;
-			goto out2;
+			goto out;
 		}
 
 		nsdev->valid = 1;
@@ -1038,46 +1576,34 @@ found:
 	list_for_each_entry(nsdev, &target->device_list, node)
 		if (!nsdev->valid)
 			print_err("removed %s %d:%d from %s '%s'",
-				  TAG_DEVID, entry->devid, entry->nsid,
+				  TAG_DEVID, nsdev->nsdev, nsdev->nsid,
 				  TAG_TARGET, alias);
-out2:
-	free(hdr);
-out1:
+out:
 	return ret;
 }
 
 /* get config command handlers */
 
-static inline int get_inb_xports(struct target *target)
+static inline int get_inb_xports(struct target *target,
+				 struct nvmf_get_transports_entry *entry,
+				 int count)
 {
-	struct nvmf_get_transports_hdr *hdr;
-	struct nvmf_get_transports_entry *entry;
-	struct endpoint		*ep = &target->sc_iface.inb.ep;
 	struct fabric_iface	*iface, *next;
 	char			 type[CONFIG_TYPE_SIZE + 1];
 	char			 fam[CONFIG_FAMILY_SIZE + 1];
 	char			 addr[CONFIG_ADDRESS_SIZE + 1];
 	int			 i, rdma_found;
-	int			 ret;
-
-	ret = send_get_config(ep, nvmf_get_xport_config, PAGE_SIZE,
-			      (void **) &hdr);
-	if (ret) {
-		print_err("send get xports INB failed for %s", target->alias);
-		goto out1;
-	}
+	int			 ret = 0;
 
-	if (!hdr->num_entries) {
+	if (!count) {
 		print_err("no transports defined for %s", target->alias);
-		goto out2;
+		goto out;
 	}
 
-	entry = (struct nvmf_get_transports_entry *) &hdr->data;
-
 	list_for_each_entry(iface, &target->fabric_iface_list, node)
 		iface->valid = 0;
 
-	for (i = hdr->num_entries; i > 0; i--, entry++) {
+	for (i = count; i > 0; i--, entry++) {
 		rdma_found = 0;
 		memset(addr, 0, sizeof(addr));
 		strcpy(type, trtype_str(entry->trtype));
@@ -1110,7 +1636,7 @@ static inline int get_inb_xports(struct target *target)
 		if (!iface) {
 			print_err("unable to alloc iface");
 			ret = -ENOMEM;
-			goto out2;
+			goto out;
 		}
 
 		iface->valid = 1;
@@ -1136,71 +1662,303 @@ found:
 
 			list_del(&iface->node);
 		}
-out2:
-	free(hdr);
-out1:
+out:
 	return ret;
 }
 
-static int get_inb_config(struct target *target)
+/* managed in-band sessions
+ *
+ * Each in-band target keeps one session to its SC.  It is opened and kept
+ * alive by the periodic work in daemon.c and reused by every get, set and
+ * reset config, so a config push never waits on a connect.  An op that
+ * finds the session down fails at once with -ENOTCONN, and a transport
+ * error closes the session for the periodic work to re-establish; a status
+ * from the SC leaves it up.  Once it is back the target is reconciled, so
+ * changes missed in between still reach the SC.
+ *
+ * All of it runs with target->lock held.
+ */
+
+int open_inb_session(struct target *target)
 {
 	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
+	struct inb_session	*s = &target->inb_session;
 	int			 ret;
 
-	ctrl->ep.ops = register_ops(ctrl->portid->type);
+	if (ctrl->connected)
+		return 0;
+
+	if (!ctrl->ep.ops)
+		ctrl->ep.ops = register_ops(ctrl->portid->type);
 	if (!ctrl->ep.ops)
 		return -EINVAL;
 
-	if (ctrl->connected)
-		disconnect_ctrl(ctrl, 0);
-
 	ret = connect_ctrl(ctrl);
 	if (ret) {
-		print_err("failed to connect to %s", target->alias);
-		print_errno("connect_ctrl failed",  ret);
+		/* only the first of a run of failures is worth a message */
+		if (!s->backoff)
+			print_errno("in-band connect failed", ret);
 
+		count_metric(&s->connect_failures);
+		s->last_error = ret;
 		return ret;
 	}
 
 	ctrl->connected = 1;
 
-	ret = get_inb_nsdevs(target);
-	if (!ret)
-		ret = get_inb_xports(target);
+	add_metric(&s->up, 1);
+	count_metric(&s->connects);
 
-	if (ret)
-		disconnect_ctrl(ctrl, 0);
+	print_info("in-band session to %s established", target->alias);
+
+	return 0;
+}
+
+void close_inb_session(struct target *target, int err)
+{
+	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
+	struct inb_session	*s = &target->inb_session;
+
+	if (!ctrl->connected)
+		return;
+
+	print_err("in-band session to %s lost %d", target->alias, err);
+
+	disconnect_ctrl(ctrl, 0);
+
+	add_metric(&s->up, -1);
+	count_metric(&s->drops);
+	s->last_error = err;
+	s->backoff = 0;
+	s->countdown = 0;
+}
+
+static inline struct ctrl_queue *inb_session(struct target *target)
+{
+	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
+
+	return ctrl->connected ? ctrl : NULL;
+}
+
+/* replies to the get config requests, fetched with target->lock held and
+ * applied later under the config lock
+ */
+struct target_config {
+	void			*nsdevs;	/* json_t out of band */
+	void			*xports;
+	int			 num_nsdevs;	/* in band only */
+	int			 num_xports;
+};
+
+/* in-band config round trips are timed per op for /metrics */
+static int inb_get_config(struct ctrl_queue *ctrl, int id, void **data)
+{
+	unsigned long long	 start = metrics_clock();
+	int			 ret;
+
+	ret = send_get_config(&ctrl->ep, id, 0, PAGE_SIZE, data);
+
+	observe_histogram(&dc_metrics.inb_config_latency[INB_GET_CONFIG],
+			  start);
 
 	return ret;
 }
 
-/* set config (INB) command handlers */
+static int inb_get_state(struct ctrl_queue *ctrl, int id, int offset,
+			 void **data)
+{
+	unsigned long long	 start = metrics_clock();
+	int			 ret;
 
-static int _send_set_config(struct ctrl_queue *ctrl, int id, int len, void *p)
+	ret = send_get_config(&ctrl->ep, id, offset, NVMF_GET_STATE_SIZE,
+			      data);
+
+	observe_histogram(&dc_metrics.inb_config_latency[INB_GET_CONFIG],
+			  start);
+
+	return ret;
+}
+
+static int _send_get_config(struct target *target, int id, void **data)
 {
+	struct ctrl_queue	*ctrl = inb_session(target);
 	int			 ret;
 
-	if (ctrl->connected) {
-		ret = send_set_config(&ctrl->ep, id, len, p);
-		if (!ret)
-			return 0;
+	if (!ctrl)
+		return -ENOTCONN;
 
-		ctrl->connected = 0;
-	}
+	ret = inb_get_config(ctrl, id, data);
+	if (ret < 0)
+		close_inb_session(target, ret);
 
-	ret = connect_ctrl(ctrl);
+	return ret;
+}
+
+static int _send_get_state(struct target *target, int id, int offset,
+			   void **data)
+{
+	struct ctrl_queue	*ctrl = inb_session(target);
+	int			 ret;
+
+	if (!ctrl)
+		return -ENOTCONN;
+
+	ret = inb_get_state(ctrl, id, offset, data);
+	if (ret < 0)
+		close_inb_session(target, ret);
+
+	return ret;
+}
+
+/* appends the entries of one reply, an SC that predates the paged ids
+ * may answer with whatever its buffer held so the header is checked
+ */
+static int add_page(int id, int size, struct nvmf_get_state_hdr *hdr,
+		    void **entries, int *count, u32 *total)
+{
+	u32			 max;
+	u32			 n;
+	void			*p;
+
+	if (le32toh(hdr->signature) != NVMF_GET_STATE_SIG ||
+	    hdr->config_id != id)
+		return NVME_SC_INVALID_FIELD;
+
+	max = (NVMF_GET_STATE_SIZE - sizeof(*hdr)) / size;
+	n = le32toh(hdr->num_entries);
+	*total = le32toh(hdr->total);
+
+	if (n > max || *count + n > *total || (!n && *count < (int) *total))
+		return -EPROTO;
+
+	p = realloc(*entries, (*count + n) * size);
+	if (!p)
+		return -ENOMEM;
+
+	memcpy(p + *count * size, hdr->data, n * size);
+
+	*entries = p;
+	*count += n;
+
+	return 0;
+}
+
+/* reads every entry of a paged get id into one array, a page at a time
+ * from where the last one ended; a positive return is the status of an
+ * SC that does not know the id
+ */
+static int fetch_paged(struct target *target, int id, int size,
+		       void **entries, int *count)
+{
+	struct nvmf_get_state_hdr *hdr;
+	u32			 total;
+	int			 ret;
+
+	do {
+		ret = _send_get_state(target, id, *count, (void **) &hdr);
+		if (ret)
+			break;
+
+		ret = add_page(id, size, hdr, entries, count, &total);
+		free(hdr);
+	} while (!ret && *count < (int) total);
+
+	return ret;
+}
+
+/* falls back to the single page get config of an SC that predates the
+ * list ids, whose reply is a u8 count followed by the entries
+ */
+static int fetch_inb_list(struct target *target, int id, int legacy_id,
+			  int size, void **entries, int *count)
+{
+	u8			*data;
+	int			 ret;
+
+	ret = fetch_paged(target, id, size, entries, count);
+	if (ret <= 0)
+		return ret;
+
+	free(*entries);
+	*entries = NULL;
+	*count = 0;
+
+	ret = _send_get_config(target, legacy_id, (void **) &data);
 	if (ret)
 		return ret;
 
-	ctrl->connected = 1;
+	*count = min((int) data[0], (int) ((PAGE_SIZE - 1) / size));
+	memmove(data, data + 1, *count * size);
+	*entries = data;
+
+	return 0;
+}
+
+static int fetch_inb_config(struct target *target, struct target_config *cfg)
+{
+	int			 ret;
+
+	ret = fetch_inb_list(target, nvmf_get_nsdev_list, nvmf_get_ns_config,
+			     sizeof(struct nvmf_get_ns_devices_entry),
+			     &cfg->nsdevs, &cfg->num_nsdevs);
+	if (ret) {
+		print_err("send get nsdevs INB failed for %s", target->alias);
+		goto out;
+	}
+
+	ret = fetch_inb_list(target, nvmf_get_xport_list, nvmf_get_xport_config,
+			     sizeof(struct nvmf_get_transports_entry),
+			     &cfg->xports, &cfg->num_xports);
+	if (ret)
+		print_err("send get xports INB failed for %s", target->alias);
+out:
+	return ret;
+}
+
+static int apply_inb_config(struct target *target, struct target_config *cfg)
+{
+	int			 ret;
+
+	ret = get_inb_nsdevs(target, cfg->nsdevs, cfg->num_nsdevs);
+	if (!ret)
+		ret = get_inb_xports(target, cfg->xports, cfg->num_xports);
+
+	return ret;
+}
+
+/* set config (INB) command handlers */
+
+static int inb_set_config(struct ctrl_queue *ctrl, int id, int len, void *p)
+{
+	unsigned long long	 start = metrics_clock();
+	int			 ret;
+
+	ret = send_set_config(&ctrl->ep, id, len, p);
 
-	return send_set_config(&ctrl->ep, id, len, p);
+	observe_histogram(&dc_metrics.inb_config_latency[INB_SET_CONFIG],
+			  start);
+
+	return ret;
+}
+
+static int _send_set_config(struct target *target, int id, int len, void *p)
+{
+	struct ctrl_queue	*ctrl = inb_session(target);
+	int			 ret;
+
+	if (!ctrl)
+		return -ENOTCONN;
+
+	ret = inb_set_config(ctrl, id, len, p);
+	if (ret < 0)
+		close_inb_session(target, ret);
+
+	return ret;
 }
 
 static int config_portid_inb(struct target *target, struct portid *portid)
 {
 	struct nvmf_port_config_entry *entry;
-	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
 	int			 len;
 	int			 ret;
 
@@ -1211,10 +1969,9 @@ static int config_portid_inb(struct target *target, struct portid *portid)
 		return -ENOMEM;
 	}
 
-	ret = _send_set_config(ctrl, nvmf_set_port_config, len, entry);
+	ret = queue_set_config(target, nvmf_set_port_config, len, entry);
 	if (ret)
 		print_err("send set port INB failed for %s", target->alias);
-	free(entry);
 
 	return ret;
 }
@@ -1222,7 +1979,6 @@ static int config_portid_inb(struct target *target, struct portid *portid)
 static int config_subsys_inb(struct target *target, struct subsystem *subsys)
 {
 	struct nvmf_subsys_config_entry *entry;
-	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
 	int			 len;
 	int			 ret;
 
@@ -1236,33 +1992,37 @@ static int config_subsys_inb(struct target *target, struct subsystem *subsys)
 	if (subsys->access == ALLOW_ANY)
 		_del_subsys_dq(subsys);
 
-	ret = _send_set_config(ctrl, nvmf_set_subsys_config, len, entry);
+	ret = queue_set_config(target, nvmf_set_subsys_config, len, entry);
 	if (ret)
 		print_err("send set subsys INB failed for %s", target->alias);
-	free(entry);
 
 	return ret;
 }
 
 /* HOST */
 
+void free_host(struct host *host)
+{
+	unintern(host->alias);
+	unintern(host->nqn);
+	free(host);
+}
+
 static int send_host_config_inb(struct target *target, struct host *host)
 {
 	struct nvmf_host_config_entry *entry;
-	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
 	int			 len;
 	int			 ret;
 
-	len = build_host_config_inb(host->nqn, &entry);
+	len = build_host_config_inb(interned(host->nqn), &entry);
 	if (!len) {
 		print_err("build host config INB failed for %s", target->alias);
 		return -ENOMEM;
 	}
 
-	ret = _send_set_config(ctrl, nvmf_set_host_config, len, entry);
+	ret = queue_set_config(target, nvmf_set_host_config, len, entry);
 	if (ret)
 		print_err("send link host INB failed for %s", target->alias);
-	free(entry);
 
 	return ret;
 }
@@ -1271,7 +2031,6 @@ static int send_link_host_inb(struct subsystem *subsys, struct host *host)
 {
 	struct nvmf_link_host_entry *entry;
 	struct target		*target = subsys->target;
-	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
 	int			 len;
 	int			 ret;
 
@@ -1281,12 +2040,10 @@ static int send_link_host_inb(struct subsystem *subsys, struct host *host)
 		return -ENOMEM;
 	}
 
-	ret = _send_set_config(ctrl, nvmf_link_host_config, len, entry);
+	ret = queue_set_config(target, nvmf_link_host_config, len, entry);
 	if (ret)
 		print_err("send link host INB failed for %s", target->alias);
 
-	free(entry);
-
 	return ret;
 }
 
@@ -1303,15 +2060,15 @@ static int send_link_host_oob(struct subsystem *subsys, struct host *host)
 
 	strcpy(p, URI_HOST);
 
-	build_set_host_oob(host->nqn, buf, sizeof(buf));
+	build_set_host_oob(interned(host->nqn), buf, sizeof(buf));
 
-	ret = exec_post(uri, buf, strlen(buf));
+	ret = queue_oob_post(subsys->target, uri, buf);
 	if (ret)
 		return ret;
 
 	sprintf(p, URI_SUBSYSTEM "/%s/" URI_HOST, subsys->nqn);
 
-	return exec_post(uri, buf, strlen(buf));
+	return queue_oob_post(subsys->target, uri, buf);
 }
 
 static inline int _link_host(struct subsystem *subsys, struct host *host)
@@ -1337,7 +2094,6 @@ static int send_unlink_host_inb(struct subsystem *subsys, struct host *host)
 {
 	struct nvmf_link_host_entry *entry;
 	struct target		*target = subsys->target;
-	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
 	int			 len;
 	int			 ret;
 
@@ -1347,10 +2103,9 @@ static int send_unlink_host_inb(struct subsystem *subsys, struct host *host)
 		return -ENOMEM;
 	}
 
-	ret = _send_set_config(ctrl, nvmf_unlink_host_config, len, entry);
+	ret = queue_set_config(target, nvmf_unlink_host_config, len, entry);
 	if (ret)
 		print_err("send unlink host INB failed for %s", target->alias);
-	free(entry);
 
 	return ret;
 }
@@ -1364,9 +2119,10 @@ static int send_unlink_host_oob(struct subsystem *subsys, struct host *host)
 	len = get_uri(subsys->target, p);
 	p += len;
 
-	sprintf(p, URI_SUBSYSTEM "/%s/" URI_HOST "/%s", subsys->nqn, host->nqn);
+	sprintf(p, URI_SUBSYSTEM "/%s/" URI_HOST "/%s", subsys->nqn,
+		interned(host->nqn));
 
-	return exec_delete(uri);
+	return queue_oob_delete(subsys->target, uri);
 }
 
 static inline int _unlink_host(struct subsystem *subsys, struct host *host)
@@ -1385,7 +2141,6 @@ static inline int _unlink_host(struct subsystem *subsys, struct host *host)
 static int send_del_host_inb(struct target *target, char *hostnqn)
 {
 	struct nvmf_host_delete_entry *entry;
-	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
 	int			 len;
 	int			 ret;
 
@@ -1395,10 +2150,9 @@ static int send_del_host_inb(struct target *target, char *hostnqn)
 		return -ENOMEM;
 	}
 
-	ret = _send_set_config(ctrl, nvmf_del_host_config, len, entry);
+	ret = queue_set_config(target, nvmf_del_host_config, len, entry);
 	if (ret)
 		print_err("send del host INB failed for %s", target->alias);
-	free(entry);
 
 	return ret;
 }
@@ -1414,7 +2168,7 @@ static int send_del_host_oob(struct target *target, char *hostnqn)
 
 	sprintf(p, URI_HOST "/%s", hostnqn);
 
-	return exec_delete(uri);
+	return queue_oob_delete(target, uri);
 }
 
 static inline int _del_host(struct target *target, char *hostnqn)
@@ -1432,19 +2186,24 @@ static inline int _update_host(struct subsystem *subsys, struct host *host,
 			       char *hostnqn, char *resp)
 {
 	struct target		*target = subsys->target;;
-	char			 oldnqn[MAX_NQN_SIZE + 1];
+	int			 oldnqn = host->nqn;
 	int			 ret;
 
+	ret = intern(hostnqn);
+	if (ret < 0)
+		return ret;
+
 	_unlink_host(subsys, host);
 
-	strcpy(oldnqn, host->nqn);
-	strcpy(host->nqn, hostnqn);
+	host->nqn = ret;
 
 	ret = _link_host(subsys, host);
 	if (ret)
 		sprintf(resp, CONFIG_ALERT, target->alias);
 
-	_update_subsys_dq(subsys, oldnqn, hostnqn);
+	_update_subsys_dq(subsys, interned(oldnqn), hostnqn);
+
+	unintern(oldnqn);
 
 	return ret;
 }
@@ -1468,12 +2227,12 @@ int update_host(char *alias, char *data, char *resp)
 	list_for_each_entry(target, target_list, node)
 		list_for_each_entry(subsys, &target->subsys_list, node)
 			list_for_each_entry(host, &subsys->host_list, node)
-				if (!strcmp(host->alias, alias)) {
-					if (strcmp(host->nqn, hostnqn))
+				if (!strcmp(interned(host->alias), alias)) {
+					if (strcmp(interned(host->nqn),
+						   hostnqn))
 						_update_host(subsys, host,
 							     hostnqn, resp);
-					if (strcmp(host->alias, newalias))
-						strcpy(host->alias, newalias);
+					reintern(&host->alias, newalias);
 					break;
 				}
 	return 0;
@@ -1495,6 +2254,7 @@ int del_host(char *alias, char *resp)
 	struct host		*host;
 	char			 hostnqn[MAX_NQN_SIZE + 1];
 	char			 dummy[MAX_BODY_SIZE];
+	char			*nqn;
 	int			 dirty;
 	int			 ret;
 
@@ -1509,13 +2269,14 @@ int del_host(char *alias, char *resp)
 				continue;
 			dirty = 1;
 			list_for_each_entry(host, &subsys->host_list, node)
-				if (!strcmp(host->alias, alias)) {
+				if (!strcmp(interned(host->alias), alias)) {
+					nqn = interned(host->nqn);
 					_unlink_host(subsys, host);
 					list_del(&host->node);
-					_reset_subsys_dq_nqn(subsys, host->nqn);
+					_reset_subsys_dq_nqn(subsys, nqn);
 					del_json_acl(target->alias, subsys->nqn,
-						     host->alias, dummy);
-					free(host);
+						     alias, dummy);
+					free_host(host);
 					break;
 				}
 		}
@@ -1559,7 +2320,7 @@ int link_host(char *tgt, char *subnqn, char *alias, char *data, char *resp)
 		alias = newalias;
 
 	list_for_each_entry(host, &subsys->host_list, node)
-		if (!strcmp(host->alias, alias))
+		if (!strcmp(interned(host->alias), alias))
 			goto found;
 
 	host = malloc(sizeof(*host));
@@ -1567,6 +2328,11 @@ int link_host(char *tgt, char *subnqn, char *alias, char *data, char *resp)
 		return -ENOMEM;
 
 	memset(host, 0, sizeof(*host));
+
+	if (reintern(&host->alias, alias) || reintern(&host->nqn, hostnqn)) {
+		free_host(host);
+		return -ENOMEM;
+	}
 	goto skip_unlink;
 found:
 	ret = _unlink_host(subsys, host);
@@ -1574,12 +2340,13 @@ found:
 		sprintf(resp, CONFIG_ALERT, target->alias);
 		goto out;
 	}
-	_reset_subsys_dq_nqn(subsys, host->nqn);
+	_reset_subsys_dq_nqn(subsys, interned(host->nqn));
 
-skip_unlink:
-	strcpy(host->alias, alias);
-	strcpy(host->nqn, hostnqn);
+	ret = reintern(&host->nqn, hostnqn);
+	if (ret)
+		goto out;
 
+skip_unlink:
 	ret = _link_host(subsys, host);
 	if (ret)
 		sprintf(resp, CONFIG_ALERT, target->alias);
@@ -1590,7 +2357,7 @@ skip_unlink:
 	} else
 		list_add_tail(&host->node, &subsys->host_list);
 
-	create_event_host_list_for_host(&list, hostnqn);
+	create_event_host_list_for_host(&list, host->nqn);
 	send_notifications(&list);
 out:
 	return ret;
@@ -1601,6 +2368,7 @@ int unlink_host(char *tgt, char *subnqn, char *alias, char *resp)
 	struct target		*target;
 	struct subsystem	*subsys;
 	struct host		*host;
+	struct host		*entry;
 	struct linked_list	 list;
 	int			 ret;
 
@@ -1617,18 +2385,18 @@ int unlink_host(char *tgt, char *subnqn, char *alias, char *resp)
 		goto out;
 
 	list_for_each_entry(host, &subsys->host_list, node)
-		if (!strcmp(host->alias, alias)) {
+		if (!strcmp(interned(host->alias), alias)) {
 			_unlink_host(subsys, host);
 			list_del(&host->node);
-			_reset_subsys_dq_nqn(subsys, host->nqn);
+			_reset_subsys_dq_nqn(subsys, interned(host->nqn));
 			goto found;
 		}
 	goto out;
 found:
 	list_for_each_entry(subsys, &target->subsys_list, node)
-		list_for_each_entry(host, &subsys->host_list, node)
-			if (!strcmp(host->alias, alias))
-				goto out;
+		list_for_each_entry(entry, &subsys->host_list, node)
+			if (entry->alias == host->alias)
+				goto free;
 
 	ret = _del_host(target, alias);
 	if (ret)
@@ -1636,6 +2404,8 @@ found:
 
 	create_event_host_list_for_host(&list, host->nqn);
 	send_notifications(&list);
+free:
+	free_host(host);
 out:
 	return ret;
 }
@@ -1644,7 +2414,6 @@ static int send_link_portid_inb(struct subsystem *subsys, struct portid *portid)
 {
 	struct nvmf_link_port_entry *entry;
 	struct target		*target = subsys->target;
-	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
 	int			 len;
 	int			 ret;
 
@@ -1654,12 +2423,10 @@ static int send_link_portid_inb(struct subsystem *subsys, struct portid *portid)
 		return -ENOMEM;
 	}
 
-	ret = _send_set_config(ctrl, nvmf_link_port_config, len, entry);
+	ret = queue_set_config(target, nvmf_link_port_config, len, entry);
 	if (ret)
 		print_err("send link port INB failed for %s", target->alias);
 
-	free(entry);
-
 	return ret;
 }
 
@@ -1697,7 +2464,6 @@ static int send_unlink_portid_inb(struct subsystem *subsys,
 {
 	struct nvmf_link_port_entry *entry;
 	struct target		*target = subsys->target;
-	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
 	int			 len;
 	int			 ret;
 
@@ -1707,12 +2473,10 @@ static int send_unlink_portid_inb(struct subsystem *subsys,
 		return -ENOMEM;
 	}
 
-	ret = _send_set_config(ctrl, nvmf_unlink_port_config, len, entry);
+	ret = queue_set_config(target, nvmf_unlink_port_config, len, entry);
 	if (ret)
 		print_err("send unlink port INB failed for %s", target->alias);
 
-	free(entry);
-
 	return ret;
 }
 
@@ -1730,7 +2494,7 @@ static int send_unlink_portid_oob(struct subsystem *subsys,
 	sprintf(p, URI_SUBSYSTEM "/%s/" URI_PORTID "/%d",
 		subsys->nqn, portid->portid);
 
-	return exec_delete(uri);
+	return queue_oob_delete(target, uri);
 }
 
 static inline int _unlink_portid(struct subsystem *subsys,
@@ -1753,7 +2517,6 @@ static int send_del_subsys_inb(struct subsystem *subsys)
 {
 	struct nvmf_subsys_delete_entry *entry;
 	struct target		*target = subsys->target;
-	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
 	int			 len;
 	int			 ret;
 
@@ -1764,12 +2527,10 @@ static int send_del_subsys_inb(struct subsystem *subsys)
 		return -ENOMEM;
 	}
 
-	ret = _send_set_config(ctrl, nvmf_del_subsys_config, len, entry);
+	ret = queue_set_config(target, nvmf_del_subsys_config, len, entry);
 	if (ret)
 		print_err("send del subsys INB failed for %s", target->alias);
 
-	free(entry);
-
 	return ret;
 }
 
@@ -1784,7 +2545,7 @@ static int send_del_subsys_oob(struct subsystem *subsys)
 
 	sprintf(p, URI_SUBSYSTEM "/%s", subsys->nqn);
 
-	return exec_delete(uri);
+	return queue_oob_delete(subsys->target, uri);
 }
 
 static inline int _del_subsys(struct subsystem *subsys)
@@ -1825,6 +2586,8 @@ int del_subsys(char *alias, char *nqn, char *resp)
 
 	_del_subsys_dq(subsys);
 
+	unindex_subsys(subsys);
+
 	list_del(&subsys->node);
 
 	create_event_host_list_for_subsys(&list, subsys);
@@ -1862,7 +2625,7 @@ static int config_subsys_oob(struct target *target, struct subsystem *subsys)
 	}
 
 	list_for_each_entry(host, &subsys->host_list, node) {
-		build_set_host_oob(host->nqn, buf, sizeof(buf));
+		build_set_host_oob(interned(host->nqn), buf, sizeof(buf));
 
 		ret = send_set_config_oob(target, URI_HOST, buf);
 		if (ret) {
@@ -1904,6 +2667,7 @@ static inline int _config_subsys(struct target *target,
 	list_for_each_entry_safe(host, next_host, &subsys->host_list, node) {
 		_unlink_host(subsys, host);
 		list_del(&host->node);
+		free_host(host);
 	}
 
 	return ret;
@@ -1955,14 +2719,15 @@ int set_subsys(char *alias, char *nqn, char *data, char *resp)
 			_del_subsys(subsys);
 
 			if (len)
-				strcpy(subsys->nqn, new_ss.nqn);
+				rename_subsys(subsys, new_ss.nqn);
 			if (new_ss.access != UNDEFINED_ACCESS)
 				subsys->access = new_ss.access;
 
 			if (subsys->access == ALLOW_ANY)
 				list_for_each_entry(host, &subsys->host_list,
 						    node)
-					_del_host(target, host->alias);
+					_del_host(target,
+						  interned(host->alias));
 		}
 	}
 
@@ -1977,7 +2742,7 @@ int set_subsys(char *alias, char *nqn, char *data, char *resp)
 		create_discovery_queue(target, subsys, portid);
 	}
 
-	target_refresh(alias);
+	queue_refresh(target);
 
 	create_event_host_list_for_subsys(&list, subsys);
 	send_notifications(&list);
@@ -1990,7 +2755,6 @@ out:
 static int send_del_portid_inb(struct target *target, struct portid *portid)
 {
 	struct nvmf_port_delete_entry *entry;
-	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
 	int			 len;
 	int			 ret;
 
@@ -2000,12 +2764,10 @@ static int send_del_portid_inb(struct target *target, struct portid *portid)
 		return -ENOMEM;
 	}
 
-	ret = _send_set_config(ctrl, nvmf_del_port_config, len, entry);
+	ret = queue_set_config(target, nvmf_del_port_config, len, entry);
 	if (ret)
 		print_err("send del port INB failed for %s", target->alias);
 
-	free(entry);
-
 	return ret;
 }
 
@@ -2020,7 +2782,7 @@ static int send_del_portid_oob(struct target *target, struct portid *portid)
 
 	sprintf(p, URI_PORTID "/%d", portid->portid);
 
-	return exec_delete(uri);
+	return queue_oob_delete(target, uri);
 }
 
 static inline int _del_portid(struct target *target, struct portid *portid)
@@ -2055,29 +2817,33 @@ int del_portid(char *alias, int id, char *resp)
 	if (!portid)
 		goto out;
 
+	pthread_mutex_lock(&target->lock);
+
 	list_for_each_entry_safe(dq, next_dq,
 				 &target->discovery_queue_list, node) {
 		if (dq->portid != portid)
 			continue;
-		if (dq->connected)
-			disconnect_ctrl(dq, 0);
 		list_del(&dq->node);
-		free(dq);
+		queue_disconnect(dq, true);
 	}
 
+	pthread_mutex_unlock(&target->lock);
+
 	list_for_each_entry(subsys, &target->subsys_list, node)
 		list_for_each_entry_safe(logpage, next_log,
 					 &subsys->logpage_list, node) {
 			if (logpage->portid != portid)
 				continue;
 			list_del(&logpage->node);
-			free(logpage);
+			free_logpage(logpage);
 		}
 
 	ret = _del_portid(target, portid);
 	if (ret)
 		sprintf(resp, CONFIG_ALERT, target->alias);
 
+	unindex_portid(portid);
+
 	list_del(&portid->node);
 	free(portid);
 out:
@@ -2137,10 +2903,15 @@ int set_portid(char *alias, int id, char *data, char *resp)
 		goto out;
 	}
 
+	portid->target = target;
+
 	list_add_tail(&portid->node, &target->portid_list);
 
+	index_portid(portid);
+
 	if (target->mgmt_mode == LOCAL_MGMT) {
 		create_discovery_queue(target, NULL, portid);
+		queue_refresh(target);
 		return 0;
 	}
 
@@ -2164,7 +2935,7 @@ int set_portid(char *alias, int id, char *data, char *resp)
 		create_discovery_queue(target, subsys, portid);
 	}
 
-	target_refresh(target->alias);
+	queue_refresh(target);
 out:
 	return ret;
 }
@@ -2175,7 +2946,6 @@ static int send_set_ns_inb(struct subsystem *subsys, struct ns *ns)
 {
 	struct nvmf_ns_config_entry *entry;
 	struct target		*target = subsys->target;
-	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
 	int			 len;
 	int			 ret;
 
@@ -2185,11 +2955,10 @@ static int send_set_ns_inb(struct subsystem *subsys, struct ns *ns)
 		return -ENOMEM;
 	}
 
-	ret = _send_set_config(ctrl, nvmf_set_ns_config, len, entry);
+	ret = queue_set_config(target, nvmf_set_ns_config, len, entry);
 	if (ret)
 		print_err("send set ns config INB failed for %s",
 			  target->alias);
-	free(entry);
 
 	return ret;
 }
@@ -2209,7 +2978,7 @@ static int send_set_ns_oob(struct subsystem *subsys, struct ns *ns)
 	sprintf(p, URI_SUBSYSTEM "/%s/" URI_NAMESPACE "/%d",
 		subsys->nqn, ns->nsid);
 
-	return exec_post(uri, buf, strlen(buf));
+	return queue_oob_post(subsys->target, uri, buf);
 }
 
 static inline int _set_ns(struct subsystem *subsys, struct ns *ns)
@@ -2291,7 +3060,6 @@ static int send_del_ns_inb(struct subsystem *subsys, struct ns *ns)
 {
 	struct nvmf_ns_delete_entry *entry;
 	struct target		*target = subsys->target;
-	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
 	int			 len;
 	int			 ret;
 
@@ -2301,11 +3069,10 @@ static int send_del_ns_inb(struct subsystem *subsys, struct ns *ns)
 		return -ENOMEM;
 	}
 
-	ret = _send_set_config(ctrl, nvmf_del_ns_config, len, entry);
+	ret = queue_set_config(target, nvmf_del_ns_config, len, entry);
 	if (ret)
 		print_err("send del ns config INB failed for %s",
 			  target->alias);
-	free(entry);
 
 	return ret;
 }
@@ -2322,7 +3089,7 @@ static int send_del_ns_oob(struct subsystem *subsys, struct ns *ns)
 	sprintf(p, URI_SUBSYSTEM "/%s/" URI_NAMESPACE "/%d",
 		subsys->nqn, ns->nsid);
 
-	return exec_delete(uri);
+	return queue_oob_delete(subsys->target, uri);
 }
 
 int del_ns(char *alias, char *nqn, int nsid, char *resp)
@@ -2363,114 +3130,36 @@ out:
 
 /* TARGET */
 
-static int get_oob_nsdevs(struct target *target)
+static int fetch_oob_config(struct target *target, struct target_config *cfg)
 {
-	char			*data;
 	char			*alias = target->alias;
 	int			 ret;
 
-	ret = send_get_config_oob(target, URI_NSDEV, &data);
+	ret = send_get_config_oob(target, URI_NSDEV, (json_t **) &cfg->nsdevs);
 	if (ret) {
 		print_err("send get nsdevs OOB failed for %s", alias);
-		goto out1;
+		return ret;
 	}
 
-	ret = set_json_oob_nsdevs(target, data);
+	ret = send_get_config_oob(target, URI_INTERFACE,
+				  (json_t **) &cfg->xports);
 	if (ret)
-		print_err("send get nsdevs OOB failed for %s", alias);
+		print_err("send get interfaces OOB failed for %s", alias);
 
-	free(data);
-out1:
 	return ret;
 }
 
-static int get_oob_xports(struct target *target)
-{
-	char			*data;
-	int			 ret;
-
-	ret = send_get_config_oob(target, URI_INTERFACE, &data);
-	if (ret)
-		return ret;
-
-	ret = set_json_oob_interfaces(target, data);
-
-	free(data);
-
-	return ret;
-}
-
-static int get_oob_config(struct target *target)
+static int apply_oob_config(struct target *target, struct target_config *cfg)
 {
 	int			 ret;
 
-	ret = get_oob_nsdevs(target);
-	if (ret)
+	ret = set_json_oob_nsdevs(target, cfg->nsdevs);
+	if (ret) {
+		print_err("send get nsdevs OOB failed for %s", target->alias);
 		return ret;
-
-	return get_oob_xports(target);
-}
-
-static int config_target_inb(struct target *target)
-{
-	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
-	struct portid		*portid;
-	struct subsystem	*subsys;
-	struct ns		*ns;
-	struct host		*host;
-	int			 ret;
-
-	if (!ctrl->connected) {
-		ret = connect_ctrl(ctrl);
-		if (ret) {
-			print_err("failed to connect to %s", target->alias);
-			print_errno("connect_ctrl failed",  ret);
-			goto out1;
-		}
-	}
-
-	list_for_each_entry(portid, &target->portid_list, node) {
-		ret = config_portid_inb(target, portid);
-		if (ret)
-			goto out2;
-	}
-
-	list_for_each_entry(subsys, &target->subsys_list, node) {
-		ret = config_subsys_inb(target, subsys);
-		if (ret)
-			goto out2;
-
-		if (!subsys->access)
-			list_for_each_entry(host, &subsys->host_list, node) {
-				ret = send_host_config_inb(target, host);
-				if (ret)
-					goto out2;
-
-				ret = send_link_host_inb(subsys, host);
-				if (ret)
-					goto out2;
-			}
-
-		list_for_each_entry(ns, &subsys->ns_list, node) {
-			ret = send_set_ns_inb(subsys, ns);
-			if (ret)
-				goto out2;
-		}
-
-		list_for_each_entry(portid, &target->portid_list, node) {
-			ret = send_link_portid_inb(subsys, portid);
-			if (ret)
-				goto out2;
-		}
 	}
 
-	ret = target_refresh(target->alias);
-
-	return 0;
-out2:
-	disconnect_ctrl(ctrl, 0);
-out1:
-	return ret;
+	return set_json_oob_interfaces(target, cfg->xports);
 }
 
 static int config_target_oob(struct target *target)
@@ -2491,26 +3180,67 @@ static int config_target_oob(struct target *target)
 			break;
 	}
 
-	ret = target_refresh(target->alias);
+	queue_refresh(target);
 out:
 	return ret;
 }
 
+/* called without the config lock or target->lock held, the reply is read
+ * from the target first and only then merged into the config
+ */
 int get_config(struct target *target)
 {
-	if (target->mgmt_mode == IN_BAND_MGMT)
-		return get_inb_config(target);
+	struct target_config	 cfg = { NULL, NULL, 0, 0 };
+	int			 mode = target->mgmt_mode;
+	int			 ret = 0;
 
-	if (target->mgmt_mode == OUT_OF_BAND_MGMT)
-		return get_oob_config(target);
+	if (mode == LOCAL_MGMT)
+		return 0;
 
-	return 0;
+	pthread_mutex_lock(&target->lock);
+
+	if (mode == IN_BAND_MGMT)
+		ret = fetch_inb_config(target, &cfg);
+	else if (mode == OUT_OF_BAND_MGMT)
+		ret = fetch_oob_config(target, &cfg);
+
+	pthread_mutex_unlock(&target->lock);
+
+	if (ret)
+		goto out;
+
+	json_write_lock();
+
+	if (target->removed)
+		ret = -ENOENT;
+	else if (mode == IN_BAND_MGMT)
+		ret = apply_inb_config(target, &cfg);
+	else if (mode == OUT_OF_BAND_MGMT)
+		ret = apply_oob_config(target, &cfg);
+
+	if (!ret)
+		bump_json_generation(GEN_TARGET, target->alias);
+
+	json_unlock();
+out:
+	if (mode == OUT_OF_BAND_MGMT) {
+		json_decref(cfg.nsdevs);
+		json_decref(cfg.xports);
+	} else {
+		free(cfg.nsdevs);
+		free(cfg.xports);
+	}
+
+	return ret;
 }
 
+/* in-band targets are reconciled when the ops are flushed, see
+ * reconcile_target()
+ */
 int config_target(struct target *target)
 {
 	if (target->mgmt_mode == IN_BAND_MGMT)
-		return config_target_inb(target);
+		return queue_reconcile(target);
 
 	if (target->mgmt_mode == OUT_OF_BAND_MGMT)
 		return config_target_oob(target);
@@ -2518,33 +3248,39 @@ int config_target(struct target *target)
 	return 0;
 }
 
-static int _send_reset_config(struct ctrl_queue *ctrl)
+static int inb_reset_config(struct ctrl_queue *ctrl)
 {
+	unsigned long long	 start = metrics_clock();
 	int			 ret;
 
-	if (ctrl->connected) {
-		ret = send_reset_config(&ctrl->ep);
-		if (!ret)
-			return 0;
+	ret = send_reset_config(&ctrl->ep);
 
-		ctrl->connected = 0;
-	}
+	observe_histogram(&dc_metrics.inb_config_latency[INB_RESET_CONFIG],
+			  start);
 
-	ret = connect_ctrl(ctrl);
-	if (ret)
-		return ret;
+	return ret;
+}
 
-	ctrl->connected = 1;
+static int _send_reset_config(struct target *target)
+{
+	struct ctrl_queue	*ctrl = inb_session(target);
+	int			 ret;
+
+	if (!ctrl)
+		return -ENOTCONN;
+
+	ret = inb_reset_config(ctrl);
+	if (ret < 0)
+		close_inb_session(target, ret);
 
-	return send_reset_config(&ctrl->ep);
+	return ret;
 }
 
 static int send_del_target_inb(struct target *target)
 {
-	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
 	int			 ret;
 
-	ret = _send_reset_config(ctrl);
+	ret = queue_reset_config(target);
 	if (ret)
 		print_err("send reset config INB failed for %s", target->alias);
 
@@ -2562,7 +3298,7 @@ static int send_del_target_oob(struct target *target)
 
 	strcpy(p, URI_CONFIG);
 
-	return exec_delete(uri);
+	return queue_oob_delete(target, uri);
 }
 
 int send_del_target(struct target *target)
@@ -2599,18 +3335,28 @@ int del_target(char *alias, char *resp)
 		_del_subsys(subsys);
 
 		list_for_each_entry(host, &subsys->host_list, node)
-			_del_host(target, host->alias);
+			_del_host(target, interned(host->alias));
 	}
 
 	list_for_each_entry(portid, &target->portid_list, node)
 		_del_portid(target, portid);
 
+	unindex_target(target);
+
 	list_del(&target->node);
 
+	target->removed = true;
+
 	create_event_host_list_for_target(&list, target);
 	send_notifications(&list);
 
-	free(target);
+	/* an op holds the last reference so the in-band session that
+	 * put_target() closes is torn down once the config lock is dropped
+	 */
+	if (target->mgmt_mode == IN_BAND_MGMT && target->sc_iface.inb.connected)
+		queue_op(target, OP_DISCONNECT);
+
+	put_target(target);
 out:
 	return ret;
 }
@@ -2677,10 +3423,14 @@ int set_interface(char *alias, char *data, char *resp)
 
 	iface = &target->sc_iface;
 
+	pthread_mutex_lock(&target->lock);
+
 	if (mode == OUT_OF_BAND_MGMT)
 		set_oob_interface(iface, &result);
 	else if (mode == IN_BAND_MGMT)
 		set_inb_interface(iface, &result);
+
+	pthread_mutex_unlock(&target->lock);
 out:
 	return ret;
 }
@@ -2730,19 +3480,23 @@ int update_target(char *alias, char *data, char *resp)
 			return -EFAULT;
 
 		if (strcmp(result.alias, alias))
-			strcpy(target->alias, result.alias);
+			rename_target(target, result.alias);
 	}
 
+	pthread_mutex_lock(&target->lock);
+
 	target->mgmt_mode = result.mgmt_mode;
 	target->refresh	  = result.refresh;
 
-	if (target->mgmt_mode == OUT_OF_BAND_MGMT) {
+	if (target->mgmt_mode == OUT_OF_BAND_MGMT)
 		set_oob_interface(&target->sc_iface, &result.sc_iface);
-		ret = get_oob_config(target);
-	} else if (target->mgmt_mode == IN_BAND_MGMT) {
+	else if (target->mgmt_mode == IN_BAND_MGMT)
 		set_inb_interface(&target->sc_iface, &result.sc_iface);
-		ret = get_inb_config(target);
-	}
+
+	pthread_mutex_unlock(&target->lock);
+
+	if (target->mgmt_mode != LOCAL_MGMT)
+		ret = queue_get_config(target);
 
 	if (!ret)
 		sprintf(resp, "DEM configuration updated for target '%s'",
@@ -2755,3 +3509,1428 @@ int update_target(char *alias, char *data, char *resp)
 
 	return ret;
 }
+
+/* committing a batch tried in the config sandbox, see post_batch_request()
+ *
+ * The config a copy ends up with is moved onto the live target rather
+ * than the copy taking its place, so the target keeps its discovery
+ * queues, log pages, SC session and the references others hold.  Queues
+ * and log pages go over to the subsystems and portids of the same NQN and
+ * id; those left without one are dropped and a queue whose host is no
+ * longer allowed reconnects as another, as the changes would have done to
+ * the live target.  The ops queued in the sandbox go to the live targets.
+ * Called with the config lock held exclusively and the live lists back.
+ */
+static void move_list(struct linked_list *from, struct linked_list *to)
+{
+	struct linked_list	*entry;
+
+	INIT_LINKED_LIST(to);
+
+	while (!list_empty(from)) {
+		entry = from->next;
+		list_del(entry);
+		list_add_tail(entry, to);
+	}
+}
+
+static void swap_lists(struct linked_list *a, struct linked_list *b)
+{
+	struct linked_list	 tmp;
+
+	move_list(a, &tmp);
+	move_list(b, a);
+	move_list(&tmp, b);
+}
+
+static void index_target_config(struct target *target)
+{
+	struct subsystem	*subsys;
+	struct portid		*portid;
+
+	index_target(target);
+
+	list_for_each_entry(subsys, &target->subsys_list, node) {
+		subsys->target = target;
+		index_subsys(subsys);
+	}
+
+	list_for_each_entry(portid, &target->portid_list, node) {
+		portid->target = target;
+		index_portid(portid);
+	}
+}
+
+static inline struct portid *moved_portid(struct target *target,
+					  struct portid *portid)
+{
+	return portid ? find_portid(target, portid->portid) : NULL;
+}
+
+static bool subsys_allows(struct subsystem *subsys, char *hostnqn)
+{
+	struct host		*host;
+
+	list_for_each_entry(host, &subsys->host_list, node)
+		if (!strcmp(interned(host->nqn), hostnqn))
+			return true;
+
+	return false;
+}
+
+/* old is the list of subsystems the target had */
+static void move_logpages(struct target *target, struct linked_list *old)
+{
+	struct subsystem	*subsys, *prev;
+	struct portid		*portid;
+	struct logpage		*logpage, *next;
+
+	list_for_each_entry(prev, old, node) {
+		subsys = find_subsys(target, prev->nqn);
+
+		list_for_each_entry_safe(logpage, next, &prev->logpage_list,
+					 node) {
+			list_del(&logpage->node);
+
+			portid = moved_portid(target, logpage->portid);
+			if (!subsys || !portid) {
+				free_logpage(logpage);
+				continue;
+			}
+
+			logpage->portid = portid;
+			list_add_tail(&logpage->node, &subsys->logpage_list);
+		}
+	}
+
+	list_for_each_entry_safe(logpage, next,
+				 &target->unattached_logpage_list, node) {
+		portid = moved_portid(target, logpage->portid);
+		if (portid) {
+			logpage->portid = portid;
+			continue;
+		}
+
+		list_del(&logpage->node);
+		free_logpage(logpage);
+	}
+}
+
+/* called with target->lock held, true if the target needs a refresh */
+static bool move_discovery_queues(struct target *target)
+{
+	struct ctrl_queue	*dq, *next;
+	struct subsystem	*subsys;
+	struct portid		*portid;
+	struct host		*host;
+	bool			 changed = false;
+
+	list_for_each_entry_safe(dq, next, &target->discovery_queue_list,
+				 node) {
+		portid = moved_portid(target, dq->portid);
+		subsys = NULL;
+		if (dq->subsys)
+			subsys = find_subsys(target, dq->subsys->nqn);
+
+		if (!portid || (dq->subsys &&
+				(!subsys || subsys->access == ALLOW_ANY))) {
+			list_del(&dq->node);
+			queue_disconnect(dq, true);
+			changed = true;
+			continue;
+		}
+
+		dq->portid = portid;
+
+		if (!dq->subsys)
+			continue;
+
+		dq->subsys = subsys;
+
+		if (subsys_allows(subsys, dq->hostnqn))
+			continue;
+
+		queue_disconnect(dq, false);
+
+		if (!list_empty(&subsys->host_list)) {
+			host = list_first_entry(&subsys->host_list,
+						struct host, node);
+			strncpy(dq->hostnqn, interned(host->nqn),
+				MAX_NQN_SIZE);
+		}
+
+		changed = true;
+	}
+
+	return changed;
+}
+
+static void commit_target_copy(struct target *target, struct target *copy)
+{
+	struct ctrl_queue	*dq, *next;
+	bool			 refresh;
+
+	unindex_target(target);
+
+	pthread_mutex_lock(&target->lock);
+
+	swap_lists(&target->subsys_list, &copy->subsys_list);
+	swap_lists(&target->portid_list, &copy->portid_list);
+
+	strcpy(target->alias, copy->alias);
+
+	index_target_config(target);
+
+	move_logpages(target, &copy->subsys_list);
+
+	refresh = move_discovery_queues(target);
+
+	/* the queues the batch added */
+	list_for_each_entry_safe(dq, next, &copy->discovery_queue_list,
+				 node) {
+		list_del(&dq->node);
+		dq->target = target;
+		list_add_tail(&dq->node, &target->discovery_queue_list);
+	}
+
+	target->mgmt_mode = copy->mgmt_mode;
+	target->refresh	  = copy->refresh;
+
+	if (target->mgmt_mode == OUT_OF_BAND_MGMT)
+		set_oob_interface(&target->sc_iface, &copy->sc_iface);
+	else if (target->mgmt_mode == IN_BAND_MGMT)
+		set_inb_interface(&target->sc_iface, &copy->sc_iface);
+
+	target->json = get_json_item(GEN_TARGET, target->alias);
+
+	pthread_mutex_unlock(&target->lock);
+
+	if (refresh)
+		queue_refresh(target);
+}
+
+/* the batch deleted it, its ops were queued by del_target() on the copy */
+static void retire_target(struct target *target)
+{
+	struct ctrl_queue	*dq, *next;
+
+	pthread_mutex_lock(&target->lock);
+
+	list_for_each_entry_safe(dq, next, &target->discovery_queue_list,
+				 node) {
+		list_del(&dq->node);
+		queue_disconnect(dq, true);
+	}
+
+	pthread_mutex_unlock(&target->lock);
+
+	unindex_target(target);
+
+	list_del(&target->node);
+
+	target->removed = true;
+
+	if (target->mgmt_mode == IN_BAND_MGMT && target->sc_iface.inb.connected)
+		queue_op(target, OP_DISCONNECT);
+
+	put_target(target);
+}
+
+static void retarget_config_ops(struct target *from, struct target *to)
+{
+	struct config_op	*op;
+
+	list_for_each_entry(op, &config_op_list, node)
+		if (op->target == from) {
+			get_target(to);
+			put_target(from);
+			op->target = to;
+		}
+}
+
+static bool is_sandbox_copy(struct config_sandbox *sb, struct target *target)
+{
+	int			 i;
+
+	for (i = 0; i < sb->num_targets; i++)
+		if (sb->pairs[i].copy == target)
+			return true;
+
+	return false;
+}
+
+void commit_sandbox_targets(struct config_sandbox *sb)
+{
+	struct target_pair	*pair;
+	struct target		*target, *next;
+	int			 i;
+
+	for (i = 0; i < sb->num_targets; i++) {
+		pair = &sb->pairs[i];
+		if (!pair->copy)
+			continue;
+
+		retarget_config_ops(pair->copy, pair->live);
+
+		if (pair->copy->removed)
+			retire_target(pair->live);
+		else
+			commit_target_copy(pair->live, pair->copy);
+	}
+
+	/* the rest were added by the batch and go over as they are */
+	list_for_each_entry_safe(target, next, &sb->targets, node) {
+		if (is_sandbox_copy(sb, target))
+			continue;
+
+		list_del(&target->node);
+		list_add_tail(&target->node, target_list);
+
+		index_target_config(target);
+
+		target->json = get_json_item(GEN_TARGET, target->alias);
+	}
+}
+
+static int run_config_op(struct config_op *op)
+{
+	struct target		*target = op->target;
+
+	switch (op->type) {
+	case OP_SET_CONFIG:
+		return _send_set_config(target, op->id, op->len, op->data);
+	case OP_RESET_CONFIG:
+		return _send_reset_config(target);
+	case OP_OOB_POST:
+		return exec_post(op->uri, op->data, op->len);
+	case OP_OOB_DELETE:
+		return exec_delete(op->uri);
+	case OP_DISCONNECT:
+		return 0;	/* done as the op is freed */
+	}
+
+	return -EINVAL;
+}
+
+static inline bool is_oob_op(struct config_op *op)
+{
+	return op->type == OP_OOB_POST || op->type == OP_OOB_DELETE;
+}
+
+static void free_config_op(struct config_op *op)
+{
+	list_del(&op->node);
+
+	if (op->type == OP_DISCONNECT && op->data)
+		disconnect_ctrl(op->data, 0);
+
+	put_target(op->target);
+	free(op->data);
+	free(op);
+}
+
+/* the ops of one target while a batch is flushed */
+struct target_ops {
+	struct hash_node	 hnode;
+	struct target		*target;
+	struct linked_list	 ops;
+	int			 err;
+	bool			 locked;
+};
+
+static void target_ops_failed(struct target_ops *t, int err, int *ret,
+			      char *resp)
+{
+	struct config_op	*op, *next;
+
+	print_err("config push to %s failed %d", t->target->alias, err);
+
+	t->err = err;
+
+	if (!*ret) {
+		*ret = err;
+		if (resp)
+			sprintf(resp, CONFIG_ALERT, t->target->alias);
+	}
+
+	list_for_each_entry_safe(op, next, &t->ops, node)
+		free_config_op(op);
+}
+
+static int cmp_target_ops(const void *a, const void *b)
+{
+	const struct target_ops	*x = *(struct target_ops * const *) a;
+	const struct target_ops	*y = *(struct target_ops * const *) b;
+
+	if (x->target == y->target)
+		return 0;
+
+	return (uintptr_t) x->target < (uintptr_t) y->target ? -1 : 1;
+}
+
+/* splits the ops by target, in the order queued within each target, and
+ * sorts the targets by address, the order their locks are taken in
+ */
+static struct target_ops **group_config_ops(struct linked_list *list,
+					    int *count)
+{
+	struct target_ops	**array = NULL;
+	struct target_ops	*t, **tmp;
+	struct config_op	*op, *next;
+	struct hash_table	 table;
+	struct hash_node	*node;
+	unsigned int		 hash;
+	int			 n = 0;
+
+	if (hash_init(&table))
+		return NULL;
+
+	list_for_each_entry_safe(op, next, list, node) {
+		hash = hash_ptr(op->target);
+
+		hash_for_each_possible(&table, node, hash) {
+			t = hash_entry(node, struct target_ops, hnode);
+			if (t->target == op->target)
+				goto found;
+		}
+
+		t = malloc(sizeof(*t));
+		if (!t)
+			goto err;
+
+		tmp = realloc(array, (n + 1) * sizeof(*array));
+		if (!tmp) {
+			free(t);
+			goto err;
+		}
+		array = tmp;
+		array[n++] = t;
+
+		t->target = op->target;
+		t->err = 0;
+		t->locked = false;
+		INIT_LINKED_LIST(&t->ops);
+
+		hash_add(&table, &t->hnode, hash);
+found:
+		list_del(&op->node);
+		list_add_tail(&op->node, &t->ops);
+	}
+
+	hash_free(&table);
+
+	qsort(array, n, sizeof(*array), cmp_target_ops);
+
+	*count = n;
+
+	return array;
+err:
+	/* put everything back in order for the caller */
+	while (n--) {
+		t = array[n];
+		list_for_each_entry_safe(op, next, &t->ops, node) {
+			list_del(&op->node);
+			list_add_tail(&op->node, list);
+		}
+		free(t);
+	}
+	free(array);
+	hash_free(&table);
+
+	return NULL;
+}
+
+/* queues the OOB ops at the head of the target's list on its channel,
+ * or runs them one by one if there is no batch.  Called with the target
+ * lock held.
+ */
+static int push_oob_ops(struct target_ops *t, struct curl_batch *batch)
+{
+	struct target		*target = t->target;
+	struct config_op	*op, *next;
+	const char		*method;
+	int			 ret;
+
+	if (batch && !target->oob_chan) {
+		target->oob_chan = alloc_curl_chan();
+		if (!target->oob_chan)
+			batch = NULL;
+	}
+
+	list_for_each_entry_safe(op, next, &t->ops, node) {
+		if (!is_oob_op(op))
+			break;
+
+		if (!batch) {
+			ret = run_config_op(op);
+			if (ret)
+				return ret;
+
+			free_config_op(op);
+			continue;
+		}
+
+		method = (op->type == OP_OOB_POST) ? "POST" : "DELETE";
+
+		ret = queue_curl_request(batch, target->oob_chan, method,
+					 op->uri, op->data, op->len);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* drops the OOB ops of the target once its channel has run */
+static void finish_oob_ops(struct target_ops *t)
+{
+	struct config_op	*op, *next;
+
+	list_for_each_entry_safe(op, next, &t->ops, node) {
+		if (!is_oob_op(op))
+			break;
+
+		free_config_op(op);
+	}
+}
+
+/* Consecutive set config ops of an in-band target go to the SC as one
+ * nvmf_batch_config command.  An SC that predates it reads the command
+ * into a one page buffer before rejecting the id, so batches stay within
+ * a page until one has been taken; an SC that rejects it gets the ops one
+ * at a time from then on.
+ */
+enum { INB_BATCH_UNKNOWN, INB_BATCH_SUPPORTED, INB_BATCH_UNSUPPORTED };
+
+static inline int batch_entry_size(int len)
+{
+	int			 size = sizeof(struct nvmf_batch_config_entry);
+
+	return (size + len + NVMF_BATCH_CONFIG_ALIGN - 1) &
+		~(NVMF_BATCH_CONFIG_ALIGN - 1);
+}
+
+static int _send_batch_config(struct target *target, int len, void *buf)
+{
+	struct ctrl_queue	*ctrl = inb_session(target);
+	int			 ret;
+
+	if (!ctrl)
+		return -ENOTCONN;
+
+	ret = inb_set_config(ctrl, nvmf_batch_config, len, buf);
+	if (ret < 0)
+		close_inb_session(target, ret);
+
+	return ret;
+}
+
+/* called with the target lock held, returns -EOPNOTSUPP if the SC does
+ * not take batches and the ops are left for the caller
+ */
+static int push_set_config_batch(struct target_ops *t)
+{
+	struct target		*target = t->target;
+	struct nvmf_batch_config_hdr *hdr;
+	struct nvmf_batch_config_entry *entry;
+	struct config_op	*op, *next;
+	void			*buf;
+	int			 max, len, size;
+	int			 n = 0, i;
+	int			 status;
+	bool			 failed = false;
+	int			 ret;
+
+	if (target->inb_batch == INB_BATCH_UNSUPPORTED)
+		return -EOPNOTSUPP;
+
+	max = (target->inb_batch == INB_BATCH_SUPPORTED) ?
+		NVMF_BATCH_CONFIG_SIZE : PAGE_SIZE;
+
+	if (posix_memalign(&buf, PAGE_SIZE, max))
+		return -ENOMEM;
+
+	memset(buf, 0, max);
+
+	hdr = buf;
+	len = sizeof(*hdr);
+
+	list_for_each_entry(op, &t->ops, node) {
+		if (op->type != OP_SET_CONFIG)
+			break;
+
+		size = batch_entry_size(op->len);
+		if (len + size > max)
+			break;
+
+		entry = buf + len;
+		entry->config_id = op->id;
+		entry->status = htole16(NVME_SC_ABORT_REQ);
+		entry->len = htole16(op->len);
+		memcpy(entry->data, op->data, op->len);
+
+		len += size;
+		n++;
+	}
+
+	if (!n) {
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
+	hdr->num_entries = htole16(n);
+
+	ret = _send_batch_config(target, len, buf);
+
+	/* an SC that knows the command sets the status of the first entry */
+	entry = buf + sizeof(*hdr);
+
+	if (ret > 0 && (ret & ~NVME_SC_DNR) == NVME_SC_INVALID_FIELD &&
+	    entry->status == htole16(NVME_SC_ABORT_REQ) &&
+	    target->inb_batch == INB_BATCH_UNKNOWN) {
+		print_info("SC of %s does not take batched config",
+			   target->alias);
+		target->inb_batch = INB_BATCH_UNSUPPORTED;
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
+	if (!ret)
+		target->inb_batch = INB_BATCH_SUPPORTED;
+
+	/* applied entries are done with, the failed one is reported.  An SC
+	 * that rolls back a failed batch marks the entries it undid aborted,
+	 * so they stay queued with the rest.
+	 */
+	i = 0;
+	len = sizeof(*hdr);
+	list_for_each_entry_safe(op, next, &t->ops, node) {
+		if (i++ == n)
+			break;
+
+		entry = buf + len;
+		len += batch_entry_size(op->len);
+
+		if (!entry->status && !failed) {
+			free_config_op(op);
+			continue;
+		}
+
+		failed = true;
+
+		status = le16toh(entry->status);
+		if (status && status != NVME_SC_ABORT_REQ)
+			print_err("config id %d for %s failed %d", op->id,
+				  target->alias, status);
+	}
+out:
+	free(buf);
+
+	return ret;
+}
+
+/* reconciliation of in-band targets
+ *
+ * Instead of resetting the SC and replaying the whole config, the SC is
+ * asked what it has with the get state ids and only the changes that take
+ * it from there to the config are pushed, in the order the config would
+ * be replayed.  A target already in sync costs the reads and no changes.
+ */
+
+enum { STATE_PORT, STATE_SUBSYS, STATE_NS, STATE_HOST, STATE_HOST_LINK,
+	STATE_PORT_LINK, NUM_STATES };
+
+/* what an SC reported, the entries of each kind sorted for lookups */
+struct sc_state {
+	void			*entries[NUM_STATES];
+	int			 count[NUM_STATES];
+};
+
+static int cmp_u32(u32 x, u32 y)
+{
+	return (x > y) - (x < y);
+}
+
+static int cmp_port_state(const void *a, const void *b)
+{
+	const struct nvmf_port_config_entry *x = a, *y = b;
+
+	return cmp_u32(le16toh(x->portid), le16toh(y->portid));
+}
+
+static int cmp_subsys_state(const void *a, const void *b)
+{
+	const struct nvmf_subsys_config_entry *x = a, *y = b;
+
+	return strcmp(x->subnqn, y->subnqn);
+}
+
+static int cmp_ns_state(const void *a, const void *b)
+{
+	const struct nvmf_ns_config_entry *x = a, *y = b;
+	int			 ret;
+
+	ret = strcmp(x->subnqn, y->subnqn);
+	if (!ret)
+		ret = cmp_u32(le32toh(x->nsid), le32toh(y->nsid));
+
+	return ret;
+}
+
+static int cmp_host_state(const void *a, const void *b)
+{
+	const struct nvmf_host_config_entry *x = a, *y = b;
+
+	return strcmp(x->hostnqn, y->hostnqn);
+}
+
+static int cmp_host_link_state(const void *a, const void *b)
+{
+	const struct nvmf_link_host_entry *x = a, *y = b;
+	int			 ret;
+
+	ret = strcmp(x->subnqn, y->subnqn);
+	if (!ret)
+		ret = strcmp(x->hostnqn, y->hostnqn);
+
+	return ret;
+}
+
+static int cmp_port_link_state(const void *a, const void *b)
+{
+	const struct nvmf_link_port_entry *x = a, *y = b;
+	int			 ret;
+
+	ret = strcmp(x->subnqn, y->subnqn);
+	if (!ret)
+		ret = cmp_u32(le16toh(x->portid), le16toh(y->portid));
+
+	return ret;
+}
+
+static const struct {
+	int			 id;
+	int			 size;
+	int			(*cmp)(const void *a, const void *b);
+} state_kinds[NUM_STATES] = {
+	[STATE_PORT] = { nvmf_get_port_state,
+		sizeof(struct nvmf_port_config_entry), cmp_port_state },
+	[STATE_SUBSYS] = { nvmf_get_subsys_state,
+		sizeof(struct nvmf_subsys_config_entry), cmp_subsys_state },
+	[STATE_NS] = { nvmf_get_ns_state,
+		sizeof(struct nvmf_ns_config_entry), cmp_ns_state },
+	[STATE_HOST] = { nvmf_get_host_state,
+		sizeof(struct nvmf_host_config_entry), cmp_host_state },
+	[STATE_HOST_LINK] = { nvmf_get_host_link_state,
+		sizeof(struct nvmf_link_host_entry), cmp_host_link_state },
+	[STATE_PORT_LINK] = { nvmf_get_port_link_state,
+		sizeof(struct nvmf_link_port_entry), cmp_port_link_state },
+};
+
+static void free_sc_state(struct sc_state *state)
+{
+	int			 i;
+
+	for (i = 0; i < NUM_STATES; i++) {
+		free(state->entries[i]);
+		state->entries[i] = NULL;
+		state->count[i] = 0;
+	}
+}
+
+static void *find_state(struct sc_state *state, int kind, void *key)
+{
+	if (!state->count[kind])
+		return NULL;
+
+	return bsearch(key, state->entries[kind], state->count[kind],
+		       state_kinds[kind].size, state_kinds[kind].cmp);
+}
+
+/* called with the target lock held, a positive return is the status of
+ * an SC that cannot report its state
+ */
+static int fetch_sc_state(struct target *target, struct sc_state *state)
+{
+	int			 kind;
+	int			 ret = 0;
+
+	for (kind = 0; kind < NUM_STATES && !ret; kind++) {
+		ret = fetch_paged(target, state_kinds[kind].id,
+				  state_kinds[kind].size,
+				  &state->entries[kind], &state->count[kind]);
+
+		if (!ret && state->count[kind])
+			qsort(state->entries[kind], state->count[kind],
+			      state_kinds[kind].size, state_kinds[kind].cmp);
+	}
+
+	if (ret < 0)
+		print_err("get state INB failed for %s", target->alias);
+
+	return ret;
+}
+
+static int add_delta(struct linked_list *delta, struct target *target,
+		     int id, int len, void *entry)
+{
+	struct config_op	*op;
+
+	if (!len)
+		return -ENOMEM;
+
+	op = alloc_config_op(target, OP_SET_CONFIG);
+	if (!op) {
+		free(entry);
+		return -ENOMEM;
+	}
+
+	op->id = id;
+	op->len = len;
+	op->data = entry;
+
+	list_add_tail(&op->node, delta);
+
+	return 0;
+}
+
+/* sends back what the SC reported, the unlink and delete entries are the
+ * leading fields of the entries reported
+ */
+static int add_delta_copy(struct linked_list *delta, struct target *target,
+			  int id, void *src, int len)
+{
+	void			*entry;
+
+	if (posix_memalign(&entry, PAGE_SIZE, len)) {
+		print_errno("posix_memalign failed", errno);
+		return -ENOMEM;
+	}
+
+	memcpy(entry, src, len);
+
+	return add_delta(delta, target, id, len, entry);
+}
+
+static int cmp_str(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/* the host nqns the restricted subsystems of the target allow, sorted and
+ * without duplicates
+ */
+static int get_config_hosts(struct target *target, char ***_hosts)
+{
+	struct subsystem	*subsys;
+	struct host		*host;
+	char			**hosts = NULL;
+	char			**tmp;
+	int			 n = 0, max = 0;
+	int			 i, j;
+
+	list_for_each_entry(subsys, &target->subsys_list, node) {
+		if (subsys->access != RESTRICTED)
+			continue;
+
+		list_for_each_entry(host, &subsys->host_list, node) {
+			if (n == max) {
+				max = max ? max * 2 : 32;
+				tmp = realloc(hosts, max * sizeof(*hosts));
+				if (!tmp) {
+					free(hosts);
+					return -ENOMEM;
+				}
+				hosts = tmp;
+			}
+			hosts[n++] = interned(host->nqn);
+		}
+	}
+
+	if (n)
+		qsort(hosts, n, sizeof(*hosts), cmp_str);
+
+	for (i = j = 0; i < n; i++)
+		if (!j || strcmp(hosts[i], hosts[j - 1]))
+			hosts[j++] = hosts[i];
+
+	*_hosts = hosts;
+
+	return j;
+}
+
+static struct host *find_subsys_host(struct subsystem *subsys, char *nqn)
+{
+	struct host		*host;
+
+	list_for_each_entry(host, &subsys->host_list, node)
+		if (!strcmp(interned(host->nqn), nqn))
+			return host;
+
+	return NULL;
+}
+
+/* compared as build_set_port_config_inb() fills in the entry */
+static bool port_matches(struct nvmf_port_config_entry *entry,
+			 struct portid *portid)
+{
+	char			 svcid[NVMF_TRSVCID_SIZE];
+
+	snprintf(svcid, sizeof(svcid), "%d", portid->port_num);
+
+	return entry->trtype == to_trtype(portid->type) &&
+		entry->adrfam == to_adrfam(portid->family) &&
+		entry->treq == NVMF_TREQ_NOT_REQUIRED &&
+		!strcmp(entry->traddr, portid->address) &&
+		!strcmp(entry->trsvcid, svcid);
+}
+
+static bool port_in_sync(struct sc_state *state, struct portid *portid)
+{
+	struct nvmf_port_config_entry key;
+	struct nvmf_port_config_entry *entry;
+
+	key.portid = htole16(portid->portid);
+
+	entry = find_state(state, STATE_PORT, &key);
+
+	return entry && port_matches(entry, portid);
+}
+
+static bool ns_matches(struct nvmf_ns_config_entry *entry, struct ns *ns)
+{
+	if (ns->devid == NULLB_DEVID)
+		return le32toh(entry->deviceid) == NVMF_NULLB_DEVID;
+
+	return le32toh(entry->deviceid) == (u32) ns->devid &&
+		le32toh(entry->devicensid) == (u32) ns->devns;
+}
+
+/* what the SC has that the config does not: links first, then what they
+ * point at.  Links and namespaces of subsystems and ports that go anyway
+ * go with them.
+ */
+static int remove_stale(struct target *target, struct sc_state *state,
+			char **hosts, int num_hosts, struct linked_list *delta)
+{
+	struct nvmf_link_host_entry	*link = state->entries[STATE_HOST_LINK];
+	struct nvmf_ns_config_entry	*nsent = state->entries[STATE_NS];
+	struct nvmf_subsys_config_entry	*subent = state->entries[STATE_SUBSYS];
+	struct nvmf_port_config_entry	*portent = state->entries[STATE_PORT];
+	struct nvmf_host_config_entry	*hostent = state->entries[STATE_HOST];
+	struct nvmf_port_delete_entry	*del;
+	struct subsystem		*subsys;
+	struct portid			*portid;
+	struct ns			*ns;
+	char				*nqn;
+	int				 i;
+	int				 ret = 0;
+
+	for (i = 0; !ret && i < state->count[STATE_HOST_LINK]; i++, link++) {
+		subsys = find_subsys(target, link->subnqn);
+		if (!subsys || (subsys->access == RESTRICTED &&
+				find_subsys_host(subsys, link->hostnqn)))
+			continue;
+
+		ret = add_delta_copy(delta, target, nvmf_unlink_host_config,
+				     link, sizeof(*link));
+	}
+
+	for (i = 0; !ret && i < state->count[STATE_NS]; i++, nsent++) {
+		subsys = find_subsys(target, nsent->subnqn);
+		if (!subsys)
+			continue;
+
+		ns = find_ns(subsys, le32toh(nsent->nsid));
+		if (ns && ns_matches(nsent, ns))
+			continue;
+
+		ret = add_delta_copy(delta, target, nvmf_del_ns_config, nsent,
+				     sizeof(struct nvmf_ns_delete_entry));
+	}
+
+	for (i = 0; !ret && i < state->count[STATE_SUBSYS]; i++, subent++) {
+		if (find_subsys(target, subent->subnqn))
+			continue;
+
+		ret = add_delta_copy(delta, target, nvmf_del_subsys_config,
+				     subent,
+				     sizeof(struct nvmf_subsys_delete_entry));
+	}
+
+	for (i = 0; !ret && i < state->count[STATE_PORT]; i++, portent++) {
+		portid = find_portid(target, le16toh(portent->portid));
+		if (portid && port_matches(portent, portid))
+			continue;
+
+		if (posix_memalign((void **) &del, PAGE_SIZE, sizeof(*del))) {
+			print_errno("posix_memalign failed", errno);
+			return -ENOMEM;
+		}
+
+		del->portid = portent->portid;
+
+		ret = add_delta(delta, target, nvmf_del_port_config,
+				sizeof(*del), del);
+	}
+
+	for (i = 0; !ret && i < state->count[STATE_HOST]; i++, hostent++) {
+		nqn = hostent->hostnqn;
+		if (num_hosts &&
+		    bsearch(&nqn, hosts, num_hosts, sizeof(*hosts), cmp_str))
+			continue;
+
+		ret = add_delta_copy(delta, target, nvmf_del_host_config,
+				     hostent,
+				     sizeof(struct nvmf_host_delete_entry));
+	}
+
+	return ret;
+}
+
+static int add_subsys_links(struct target *target, struct sc_state *state,
+			    struct subsystem *subsys, struct linked_list *delta)
+{
+	struct nvmf_link_host_entry	 hkey, *hlink = NULL;
+	struct nvmf_link_port_entry	 pkey, *plink = NULL;
+	struct nvmf_ns_config_entry	 nskey, *nsent;
+	struct host			*host;
+	struct ns			*ns;
+	struct portid			*portid;
+	int				 len;
+	int				 ret = 0;
+
+	strncpy(hkey.subnqn, subsys->nqn, MAX_NQN_SIZE);
+	strncpy(pkey.subnqn, subsys->nqn, MAX_NQN_SIZE);
+	strncpy(nskey.subnqn, subsys->nqn, MAX_NQN_SIZE);
+
+	if (subsys->access == RESTRICTED)
+		list_for_each_entry(host, &subsys->host_list, node) {
+			strncpy(hkey.hostnqn, interned(host->nqn),
+				MAX_NQN_SIZE);
+			if (find_state(state, STATE_HOST_LINK, &hkey))
+				continue;
+
+			len = build_link_host_inb(subsys, host, &hlink);
+			ret = add_delta(delta, target, nvmf_link_host_config,
+					len, hlink);
+			if (ret)
+				return ret;
+		}
+
+	list_for_each_entry(ns, &subsys->ns_list, node) {
+		nskey.nsid = htole32(ns->nsid);
+		nsent = find_state(state, STATE_NS, &nskey);
+		if (nsent && ns_matches(nsent, ns))
+			continue;
+
+		len = build_ns_config_inb(subsys, ns, &nsent);
+		ret = add_delta(delta, target, nvmf_set_ns_config, len, nsent);
+		if (ret)
+			return ret;
+	}
+
+	list_for_each_entry(portid, &target->portid_list, node) {
+		pkey.portid = htole16(portid->portid);
+		if (port_in_sync(state, portid) &&
+		    find_state(state, STATE_PORT_LINK, &pkey))
+			continue;
+
+		len = build_link_port_inb(subsys, portid, &plink);
+		ret = add_delta(delta, target, nvmf_link_port_config, len,
+				plink);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* what the config has that the SC does not, in the order it is replayed */
+static int add_missing(struct target *target, struct sc_state *state,
+		       char **hosts, int num_hosts, struct linked_list *delta)
+{
+	struct nvmf_port_config_entry	*portent = NULL;
+	struct nvmf_subsys_config_entry	 skey, *subent;
+	struct nvmf_host_config_entry	 hkey, *hostent = NULL;
+	struct subsystem		*subsys;
+	struct portid			*portid;
+	int				 len;
+	int				 i;
+	int				 ret;
+
+	list_for_each_entry(portid, &target->portid_list, node) {
+		if (port_in_sync(state, portid))
+			continue;
+
+		len = build_set_port_config_inb(portid, &portent);
+		ret = add_delta(delta, target, nvmf_set_port_config, len,
+				portent);
+		if (ret)
+			return ret;
+	}
+
+	list_for_each_entry(subsys, &target->subsys_list, node) {
+		if (subsys->access == ALLOW_ANY)
+			_del_subsys_dq(subsys);
+
+		strncpy(skey.subnqn, subsys->nqn, MAX_NQN_SIZE);
+		subent = find_state(state, STATE_SUBSYS, &skey);
+		if (subent && (subent->allowanyhost != 0) ==
+			      (subsys->access != RESTRICTED))
+			continue;
+
+		len = build_subsys_config_inb(subsys, &subent);
+		ret = add_delta(delta, target, nvmf_set_subsys_config, len,
+				subent);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < num_hosts; i++) {
+		strncpy(hkey.hostnqn, hosts[i], MAX_NQN_SIZE);
+		if (find_state(state, STATE_HOST, &hkey))
+			continue;
+
+		len = build_host_config_inb(hosts[i], &hostent);
+		ret = add_delta(delta, target, nvmf_set_host_config, len,
+				hostent);
+		if (ret)
+			return ret;
+	}
+
+	list_for_each_entry(subsys, &target->subsys_list, node) {
+		ret = add_subsys_links(target, state, subsys, delta);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* called with the config lock held exclusively */
+static int build_delta(struct target *target, struct sc_state *state,
+		       struct linked_list *delta)
+{
+	struct config_op	*op;
+	char			**hosts = NULL;
+	int			 num_hosts;
+	int			 ret;
+
+	num_hosts = get_config_hosts(target, &hosts);
+	if (num_hosts < 0)
+		return num_hosts;
+
+	ret = remove_stale(target, state, hosts, num_hosts, delta);
+	if (!ret)
+		ret = add_missing(target, state, hosts, num_hosts, delta);
+
+	free(hosts);
+
+	if (ret)
+		return ret;
+
+	op = alloc_config_op(target, OP_REFRESH);
+	if (!op)
+		return -ENOMEM;
+
+	list_add_tail(&op->node, delta);
+
+	return 0;
+}
+
+/* runs without any lock held.  The changes are queued right behind op so
+ * the flush pushes them next, batched like any other set config ops.  An
+ * SC that cannot report its state is reset and the config replayed.
+ */
+static int reconcile_target(struct config_op *op)
+{
+	struct target		*target = op->target;
+	struct sc_state		 state;
+	struct linked_list	 delta;
+	struct linked_list	*pos = &op->node;
+	struct config_op	*dop, *next;
+	int			 changes = 0;
+	int			 ret;
+
+	memset(&state, 0, sizeof(state));
+	INIT_LINKED_LIST(&delta);
+
+	pthread_mutex_lock(&target->lock);
+	ret = fetch_sc_state(target, &state);
+	pthread_mutex_unlock(&target->lock);
+
+	if (ret < 0)
+		goto out;
+
+	if (ret) {
+		print_info("%s cannot report its config, replaying it",
+			   target->alias);
+
+		free_sc_state(&state);
+
+		dop = alloc_config_op(target, OP_RESET_CONFIG);
+		if (!dop) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		list_add_tail(&dop->node, &delta);
+	}
+
+	json_write_lock();
+
+	if (target->removed)
+		ret = -ENOENT;
+	else
+		ret = build_delta(target, &state, &delta);
+
+	json_unlock();
+
+	list_for_each_entry_safe(dop, next, &delta, node) {
+		list_del(&dop->node);
+
+		if (ret) {
+			put_target(dop->target);
+			free(dop->data);
+			free(dop);
+			continue;
+		}
+
+		list_add(&dop->node, pos);
+		pos = &dop->node;
+
+		if (dop->type == OP_SET_CONFIG)
+			changes++;
+	}
+
+	if (!ret)
+		print_debug("reconciling %s takes %d changes", target->alias,
+			    changes);
+out:
+	free_sc_state(&state);
+
+	return ret;
+}
+
+static int run_sync_op(struct config_op *op)
+{
+	struct target		*target = op->target;
+	int			 ret;
+
+	if (op->type == OP_GET_CONFIG)
+		return get_config(target);
+
+	if (op->type == OP_REFRESH)
+		return target_refresh(target);
+
+	if (op->type == OP_RECONCILE)
+		return reconcile_target(op);
+
+	pthread_mutex_lock(&target->lock);
+	ret = run_config_op(op);
+	pthread_mutex_unlock(&target->lock);
+
+	return ret;
+}
+
+/* runs the op at the head of the target's list, or the run of set config
+ * ops there as one batch
+ */
+static int run_next_op(struct target_ops *t)
+{
+	struct config_op	*op, *next;
+	int			 ret;
+
+	op = list_first_entry(&t->ops, struct config_op, node);
+
+	if (op->type == OP_SET_CONFIG && op->node.next != &t->ops) {
+		next = list_entry(op->node.next, struct config_op, node);
+		if (next->type == OP_SET_CONFIG) {
+			pthread_mutex_lock(&t->target->lock);
+			ret = push_set_config_batch(t);
+			pthread_mutex_unlock(&t->target->lock);
+
+			if (ret != -EOPNOTSUPP)
+				return ret;
+		}
+	}
+
+	ret = run_sync_op(op);
+	if (!ret)
+		free_config_op(op);
+
+	return ret;
+}
+
+/* the original one op at a time flush, used if the ops cannot be grouped */
+static int flush_config_ops_serial(struct linked_list *list, char *resp)
+{
+	struct config_op	*op;
+	struct target		*target;
+	struct target		*failed = NULL;
+	int			 ret = 0;
+	int			 err;
+
+	/* a reconcile queues its changes right behind itself */
+	while (!list_empty(list)) {
+		op = list_first_entry(list, struct config_op, node);
+		target = op->target;
+
+		if (target == failed)
+			goto next;
+
+		err = run_sync_op(op);
+		if (err) {
+			print_err("config push to %s failed %d",
+				  target->alias, err);
+			failed = target;
+			if (!ret) {
+				ret = err;
+				if (resp)
+					sprintf(resp, CONFIG_ALERT,
+						target->alias);
+			}
+		}
+next:
+		free_config_op(op);
+	}
+
+	return ret;
+}
+
+/* called without the config lock held.  Ops run in the order queued
+ * within each target; once one fails the rest for that target are dropped
+ * since the SC is no longer in a known state, a reconfig of the target
+ * brings it back in sync.
+ *
+ * The OOB pushes to different targets go out in parallel.  Each round
+ * sends the leading OOB ops of every target as one curl batch, holding
+ * the locks of those targets, then runs the next in-band, config fetch or
+ * refresh op of each target on its own, until no ops are left.
+ */
+int flush_config_ops(struct linked_list *list, char *resp)
+{
+	struct target_ops	**array;
+	struct target_ops	*t;
+	struct curl_batch	*batch;
+	struct config_op	*op;
+	int			 pending;
+	int			 ret = 0;
+	int			 err;
+	int			 i, n;
+
+	if (list_empty(list))
+		return 0;
+
+	array = group_config_ops(list, &n);
+	if (!array)
+		return flush_config_ops_serial(list, resp);
+
+	do {
+		pending = 0;
+
+		batch = alloc_curl_batch();
+
+		for (i = 0; i < n; i++) {
+			t = array[i];
+			if (list_empty(&t->ops))
+				continue;
+
+			op = list_first_entry(&t->ops, struct config_op, node);
+			if (!is_oob_op(op))
+				continue;
+
+			pthread_mutex_lock(&t->target->lock);
+			t->locked = true;
+
+			/* what was queued before a failure still goes out,
+			 * so the ops are only dropped once the batch has run
+			 */
+			t->err = push_oob_ops(t, batch);
+		}
+
+		if (batch)
+			run_curl_batch(batch);
+
+		for (i = 0; i < n; i++) {
+			t = array[i];
+			if (!t->locked)
+				continue;
+
+			err = t->err;
+			if (!err && batch && t->target->oob_chan)
+				err = curl_chan_error(t->target->oob_chan);
+
+			if (err)
+				target_ops_failed(t, err, &ret, resp);
+			else
+				finish_oob_ops(t);
+
+			t->locked = false;
+			pthread_mutex_unlock(&t->target->lock);
+		}
+
+		if (batch)
+			free_curl_batch(batch);
+
+		for (i = 0; i < n; i++) {
+			t = array[i];
+			if (list_empty(&t->ops))
+				continue;
+
+			op = list_first_entry(&t->ops, struct config_op, node);
+			if (!is_oob_op(op)) {
+				err = run_next_op(t);
+				if (err)
+					target_ops_failed(t, err, &ret, resp);
+			}
+
+			if (!list_empty(&t->ops))
+				pending = 1;
+		}
+	} while (pending);
+
+	for (i = 0; i < n; i++)
+		free(array[i]);
+	free(array);
+
+	return ret;
+}
+
+/* drops ops that will never be pushed, the targets pick up the config
+ * from the JSON store on the next start
+ */
+void free_config_ops(struct linked_list *list)
+{
+	struct config_op	*op, *next;
+
+	list_for_each_entry_safe(op, next, list, node)
+		free_config_op(op);
+}
+
+/* fills targets with each distinct target the ops touch, returns the
+ * count or -E2BIG if there are more than max
+ */
+int config_op_targets(struct linked_list *list, struct target **targets,
+		      int max)
+{
+	struct config_op	*op;
+	int			 i, n = 0;
+
+	list_for_each_entry(op, list, node) {
+		for (i = 0; i < n; i++)
+			if (targets[i] == op->target)
+				break;
+
+		if (i < n)
+			continue;
+
+		if (n == max)
+			return -E2BIG;
+
+		targets[n++] = op->target;
+	}
+
+	return n;
+}
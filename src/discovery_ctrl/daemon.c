@@ -40,6 +40,7 @@
 
 #include "mongoose.h"
 #include "common.h"
+#include "http_workers.h"
 #include "curl.h"
 
 #define DEFAULT_HTTP_ROOT	"/"
@@ -48,13 +49,16 @@
 
 /* needs to be < NVMF_DISC_KATO in connect AND < 2 MIN for upstream target */
 #define KEEP_ALIVE_TIMER	120000 /* ms */
+#define INB_SESSION_BACKOFF	(30000 / IDLE_TIMEOUT)
 
 static LINKED_LIST(target_linked_list);
 static LINKED_LIST(group_linked_list);
 static LINKED_LIST(host_linked_list);
 static LINKED_LIST(aen_linked_list);
+static struct config_index		 config_linked_index;
 
 static struct mg_serve_http_opts	 s_http_server_opts;
+static int				 s_http_workers = -1;
 static char				*s_http_port = DEFAULT_HTTP_PORT;
 int					 stopped;
 int					 debug;
@@ -65,6 +69,8 @@ struct linked_list			*target_list = &target_linked_list;
 struct linked_list			*group_list = &group_linked_list;
 struct linked_list			*host_list = &host_linked_list;
 struct linked_list			*aen_req_list = &aen_linked_list;
+struct config_index			*config_index = &config_linked_index;
+struct dc_metrics			 dc_metrics;
 static pthread_t			*listen_threads;
 static int				 signalled;
 
@@ -86,12 +92,27 @@ static void ev_handler(struct mg_connection *c, int ev, void *ev_data)
 {
 	switch (ev) {
 	case MG_EV_HTTP_REQUEST:
-		handle_http_request(c, ev_data);
+		/* an event stream only ever sends */
+		if (c->flags & MG_F_EVENT_STREAM)
+			break;
+		if (!c->user_data && is_event_request(ev_data) &&
+		    authorized_request(ev_data))
+			open_event_stream(c, ev_data);
+		else
+			queue_http_request(c, ev_data);
 		break;
-	case MG_EV_HTTP_CHUNK:
-	case MG_EV_ACCEPT:
 	case MG_EV_CLOSE:
+		if (c->flags & MG_F_EVENT_STREAM)
+			close_event_stream(c);
+		else
+			drop_http_request(c);
+		break;
 	case MG_EV_POLL:
+		if (!(c->flags & MG_F_EVENT_STREAM))
+			expire_http_connection(c);
+		break;
+	case MG_EV_HTTP_CHUNK:
+	case MG_EV_ACCEPT:
 	case MG_EV_SEND:
 	case MG_EV_RECV:
 		break;
@@ -100,10 +121,69 @@ static void ev_handler(struct mg_connection *c, int ev, void *ev_data)
 	}
 }
 
+/* called with target->lock held every pass.  A live session gets a keep
+ * alive every half KATO, one that is down is retried after a backoff that
+ * doubles up to INB_SESSION_BACKOFF passes.  Returns 1 when the session
+ * has just been established.
+ */
+static int keep_inb_session(struct target *target)
+{
+	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
+	struct inb_session	*s = &target->inb_session;
+	int			 ret;
+
+	if (ctrl->connected) {
+		if (--s->countdown > 0)
+			return 0;
+
+		s->countdown = KEEP_ALIVE_TIMER / IDLE_TIMEOUT / 2;
+
+		ret = send_keep_alive(&ctrl->ep);
+		if (ret)
+			close_inb_session(target, ret);
+
+		return 0;
+	}
+
+	if (s->countdown > 0 && --s->countdown > 0)
+		return 0;
+
+	if (open_inb_session(target)) {
+		s->backoff = s->backoff ?
+			min(s->backoff * 2, INB_SESSION_BACKOFF) : 1;
+		s->countdown = s->backoff;
+		return 0;
+	}
+
+	s->backoff = 0;
+	s->countdown = KEEP_ALIVE_TIMER / IDLE_TIMEOUT / 2;
+
+	return 1;
+}
+
+/* a session that was down may have missed changes to the target */
+static void resync_target(struct target *target)
+{
+	struct linked_list	 ops;
+
+	get_config(target);
+
+	json_write_lock();
+
+	if (!target->removed)
+		config_target(target);
+
+	take_config_ops(&ops);
+
+	json_unlock();
+
+	flush_config_ops(&ops, NULL);
+}
+
+/* called with target->lock held */
 static int keep_alive_work(struct target *target)
 {
 	struct ctrl_queue	*dq;
-	struct ctrl_queue	*ctrl;
 	int			 ret;
 
 	if (--target->kato_countdown > 0)
@@ -123,61 +203,109 @@ static int keep_alive_work(struct target *target)
 		}
 	}
 
-	if (target->mgmt_mode == IN_BAND_MGMT) {
-		ctrl = &target->sc_iface.inb;
-		if (!ctrl->connected) {
-			ret = connect_ctrl(ctrl);
-			if (!ret)
-				ctrl->connected = 1;
-		} else {
-			ret = send_keep_alive(&ctrl->ep);
-			if (ret)
-				ctrl->connected = 0;
-		}
-	}
-
 	target->kato_countdown = KEEP_ALIVE_TIMER / IDLE_TIMEOUT / 2;
 
 	return 0;
 }
 
-static void periodic_work(void)
+static void target_work(struct target *target)
 {
-	struct target		*target;
 	struct ctrl_queue	*dq;
+	struct linked_list	 logs;
+	unsigned long long	 start;
 
-	list_for_each_entry(target, target_list, node) {
-		if (keep_alive_work(target))
-			continue;
+	/* a target busy with a config push is picked up on the next pass */
+	if (pthread_mutex_trylock(&target->lock))
+		return;
 
-		if (target->log_page_retry_count)
-			if (--target->log_page_retry_count)
-				continue;
+	if (target->mgmt_mode == IN_BAND_MGMT && keep_inb_session(target)) {
+		pthread_mutex_unlock(&target->lock);
+		resync_target(target);
+		return;
+	}
 
-		target->refresh_countdown--;
-		if (target->refresh_countdown)
-			continue;
+	if (keep_alive_work(target))
+		goto out;
 
-		if (target->mgmt_mode != LOCAL_MGMT)
-			get_config(target);
-
-		list_for_each_entry(dq, &target->discovery_queue_list, node) {
-			if (!dq->connected && connect_ctrl(dq)) {
-				print_err("could not connect to target %s",
-					  target->alias);
-				target->log_page_retry_count = LOG_PAGE_RETRY;
-				continue;
-			}
+	if (target->log_page_retry_count)
+		if (--target->log_page_retry_count)
+			goto out;
 
-			fetch_log_pages(dq);
+	target->refresh_countdown--;
+	if (target->refresh_countdown)
+		goto out;
 
-			if (dq->failed_kato)
-				disconnect_ctrl(dq, 0);
+	pthread_mutex_unlock(&target->lock);
+
+	start = metrics_clock();
+
+	if (target->mgmt_mode != LOCAL_MGMT)
+		get_config(target);
+
+	INIT_LINKED_LIST(&logs);
+
+	pthread_mutex_lock(&target->lock);
+
+	list_for_each_entry(dq, &target->discovery_queue_list, node) {
+		if (!dq->connected && connect_ctrl(dq)) {
+			print_err("could not connect to target %s",
+				  target->alias);
+			target->log_page_retry_count = LOG_PAGE_RETRY;
+			continue;
 		}
 
-		target->refresh_countdown =
-			target->refresh * MINUTES / IDLE_TIMEOUT;
+		fetch_log_pages(dq, &logs);
+
+		if (dq->failed_kato)
+			disconnect_ctrl(dq, 0);
+	}
+
+	target->refresh_countdown = target->refresh * MINUTES / IDLE_TIMEOUT;
+
+	pthread_mutex_unlock(&target->lock);
+
+	json_write_lock();
+	save_fetched_log_pages(target, &logs);
+	json_unlock();
+
+	observe_histogram(&dc_metrics.refresh_latency, start);
+
+	return;
+out:
+	pthread_mutex_unlock(&target->lock);
+}
+
+static void periodic_work(void)
+{
+	struct target		*target;
+	struct target		**targets;
+	int			 i, n = 0;
+
+	json_read_lock();
+
+	list_for_each_entry(target, target_list, node)
+		n++;
+
+	targets = calloc(n ? n : 1, sizeof(*targets));
+	if (!targets) {
+		json_unlock();
+		return;
+	}
+
+	n = 0;
+	list_for_each_entry(target, target_list, node) {
+		get_target(target);
+		targets[n++] = target;
 	}
+
+	json_unlock();
+
+	for (i = 0; i < n; i++) {
+		target_work(targets[i]);
+		put_target(targets[i]);
+	}
+
+	free(targets);
 }
 
 static void *poll_loop(struct mg_mgr *mgr)
@@ -189,6 +317,9 @@ static void *poll_loop(struct mg_mgr *mgr)
 			periodic_work();
 	}
 
+	cleanup_http_workers();
+	cleanup_events();
+
 	mg_mgr_free(mgr);
 
 	return NULL;
@@ -234,8 +365,8 @@ static void show_help(char *app)
 	const char		*arg_list = "{-d} {-s}";
 #endif
 
-	print_info("Usage: %s %s {-p <port>} {-r <root>} {-c <cert_file>}",
-		   app, arg_list);
+	print_info("Usage: %s %s {-p <port>} {-r <root>} {-c <cert_file>} "
+		   "{-w <workers>}", app, arg_list);
 #ifdef CONFIG_DEBUG
 	print_info("  -q - quiet mode, no debug prints");
 	print_info("  -d - run as a daemon process (default is standalone)");
@@ -248,6 +379,8 @@ static void show_help(char *app)
 	print_info("  -r - HTTP interface: root (default %s)",
 		   DEFAULT_HTTP_ROOT);
 	print_info("  -c - HTTP interface: SSL cert file (defaut no SSL)");
+	print_info("  -w - HTTP interface: request worker threads, 0 to run");
+	print_info("       requests on the server thread (default one per cpu)");
 }
 
 static int init_dem(int argc, char *argv[], char **ssl_cert)
@@ -255,9 +388,9 @@ static int init_dem(int argc, char *argv[], char **ssl_cert)
 	int			 opt;
 	int			 run_as_daemon;
 #ifdef CONFIG_DEBUG
-	const char		*opt_list = "?qdp:r:c:";
+	const char		*opt_list = "?qdp:r:c:w:";
 #else
-	const char		*opt_list = "?dsp:r:c:";
+	const char		*opt_list = "?dsp:r:c:w:";
 #endif
 
 	curl_show_results = 0;
@@ -307,6 +440,15 @@ static int init_dem(int argc, char *argv[], char **ssl_cert)
 		case 'c':
 			*ssl_cert = optarg;
 			break;
+		case 'w':
+			s_http_workers = atoi(optarg);
+			if (s_http_workers < 0 ||
+			    s_http_workers > MAX_HTTP_WORKERS) {
+				print_err("workers must be 0 to %d",
+					  MAX_HTTP_WORKERS);
+				return 1;
+			}
+			break;
 		case '?':
 		default:
 help:
@@ -419,8 +561,9 @@ static inline int check_logpage_portid(struct subsystem *subsys,
 {
 	struct logpage		*logpage;
 
+	/* a cached log page may have come from a queue of the subsystem */
 	list_for_each_entry(logpage, &subsys->logpage_list, node)
-		if (logpage->portid == portid)
+		if (logpage->portid == portid && !logpage->stale)
 			return 1;
 	return 0;
 }
@@ -452,21 +595,17 @@ void create_discovery_queue(struct target *target, struct subsystem *subsys,
 		return;
 	}
 
-	list_add_tail(&dq->node, &target->discovery_queue_list);
-
 	if (!subsys)
 		strncpy(dq->hostnqn, shared_nqn, MAX_NQN_SIZE);
 	else {
 		host = list_first_entry(&subsys->host_list, struct host, node);
-		strncpy(dq->hostnqn, host->nqn, MAX_NQN_SIZE);
+		strncpy(dq->hostnqn, interned(host->nqn), MAX_NQN_SIZE);
 	}
 
-	if (connect_ctrl(dq))
-		return;
-
-	fetch_log_pages(dq);
-
-	disconnect_ctrl(dq, 0);
+	/* log pages are fetched by the refresh the caller queues */
+	pthread_mutex_lock(&target->lock);
+	list_add_tail(&dq->node, &target->discovery_queue_list);
+	pthread_mutex_unlock(&target->lock);
 }
 
 static void init_discovery_queue(struct target *target, struct portid *portid)
@@ -480,10 +619,14 @@ static void init_discovery_queue(struct target *target, struct portid *portid)
 			create_discovery_queue(target, subsys, portid);
 }
 
+/* runs before the interface threads and the http server are started so the
+ * config lock is only taken where get_config() takes it itself
+ */
 static void init_targets(void)
 {
 	struct target		*target;
 	struct portid		*portid;
+	struct linked_list	 ops;
 
 	list_for_each_entry(target, target_list, node) {
 		target->refresh_countdown =
@@ -491,6 +634,12 @@ static void init_targets(void)
 
 		target->log_page_retry_count = LOG_PAGE_RETRY;
 
+		/* in-band sessions are opened up front, retried by
+		 * target_work() if that fails
+		 */
+		if (target->mgmt_mode == IN_BAND_MGMT)
+			keep_inb_session(target);
+
 		if (target->mgmt_mode != LOCAL_MGMT)
 			if (!get_config(target))
 				config_target(target);
@@ -498,7 +647,12 @@ static void init_targets(void)
 		list_for_each_entry(portid, &target->portid_list, node) {
 			init_discovery_queue(target, portid);
 		}
+
+		queue_target_refresh(target->alias);
 	}
+
+	take_config_ops(&ops);
+	flush_config_ops(&ops, NULL);
 }
 
 static void cleanup_target_list(void)
@@ -506,6 +660,8 @@ static void cleanup_target_list(void)
 	struct target		*target, *next_target;
 	struct subsystem	*subsys, *next_subsys;
 	struct host		*host, *next_host;
+	struct ns		*ns, *next_ns;
+	struct portid		*portid, *next_portid;
 	struct logpage		*logpage, *next_logpage;
 	struct ctrl_queue	*dq, *next_dq;
 
@@ -514,10 +670,13 @@ static void cleanup_target_list(void)
 					 &target->subsys_list, node) {
 			list_for_each_entry_safe(host, next_host,
 						 &subsys->host_list, node)
-				free(host);
+				free_host(host);
+			list_for_each_entry_safe(ns, next_ns,
+						 &subsys->ns_list, node)
+				free(ns);
 			list_for_each_entry_safe(logpage, next_logpage,
 						 &subsys->logpage_list, node)
-				free(logpage);
+				free_logpage(logpage);
 
 			free(subsys);
 		}
@@ -526,7 +685,7 @@ static void cleanup_target_list(void)
 
 		list_for_each_entry_safe(logpage, next_logpage,
 					 &target->unattached_logpage_list, node)
-			free(logpage);
+			free_logpage(logpage);
 
 		list_for_each_entry_safe(dq, next_dq,
 					 &target->discovery_queue_list, node) {
@@ -536,10 +695,11 @@ static void cleanup_target_list(void)
 			free(dq);
 		}
 
-		if (target->mgmt_mode == IN_BAND_MGMT)
-			free(target->sc_iface.inb.portid);
+		list_for_each_entry_safe(portid, next_portid,
+					 &target->portid_list, node)
+			free(portid);
 
-		free(target);
+		put_target(target);
 	}
 }
 
@@ -548,7 +708,7 @@ static void cleanup_host_list(void)
 	struct group_host_link *host, *next;
 
 	list_for_each_entry_safe(host, next, host_list, node)
-		free(host);
+		free_group_host(host);
 }
 
 static void cleanup_group_list(void)
@@ -570,6 +730,157 @@ static void cleanup_lists(void)
 	cleanup_target_list();
 }
 
+static void use_sandbox_lists(struct config_sandbox *sb)
+{
+	sb->target_list = target_list;
+	sb->group_list = group_list;
+	sb->host_list = host_list;
+	sb->config_index = config_index;
+
+	target_list = &sb->targets;
+	group_list = &sb->groups;
+	host_list = &sb->hosts;
+	config_index = &sb->index;
+}
+
+static void use_live_lists(struct config_sandbox *sb)
+{
+	target_list = sb->target_list;
+	group_list = sb->group_list;
+	host_list = sb->host_list;
+	config_index = sb->config_index;
+}
+
+/* called with the config lock held exclusively and notifications held.
+ * Points the config at copies of the targets, hosts and groups in scope,
+ * see scoped_json_root(), and lists built from them so a batch of changes
+ * can be tried without touching the live config.  Nothing is sent to the
+ * targets until the ops queued are flushed, nor to the hosts until the
+ * notifications are let go.
+ */
+int enter_config_sandbox(struct config_sandbox *sb, json_t *scope)
+{
+	struct target		*target;
+	json_t			*names;
+	json_t			*value;
+	json_t			*root;
+	const char		*name;
+	int			 i, n = 0;
+
+	root = scoped_json_root(scope);
+	if (!root)
+		return -ENOMEM;
+
+	names = json_object_get(scope, TAG_TARGETS);
+
+	sb->pairs = calloc(json_object_size(names) + 1, sizeof(*sb->pairs));
+	if (!sb->pairs)
+		goto err1;
+
+	if (init_config_index(&sb->index))
+		goto err2;
+
+	json_object_foreach(names, name, value) {
+		target = find_target((char *) name);
+		if (!target)
+			continue;
+
+		get_target(target);
+		sb->pairs[n++].live = target;
+	}
+
+	sb->num_targets = n;
+
+	INIT_LINKED_LIST(&sb->targets);
+	INIT_LINKED_LIST(&sb->groups);
+	INIT_LINKED_LIST(&sb->hosts);
+
+	use_sandbox_lists(sb);
+
+	sb->root = swap_json_root(root);
+
+	build_lists();
+
+	for (i = 0; i < n; i++) {
+		target = find_target(sb->pairs[i].live->alias);
+		if (target)
+			get_target(target);
+		sb->pairs[i].copy = target;
+	}
+
+	return 0;
+err2:
+	free(sb->pairs);
+err1:
+	json_decref(root);
+
+	return -ENOMEM;
+}
+
+static void free_config_sandbox(struct config_sandbox *sb)
+{
+	int			 i;
+
+	use_sandbox_lists(sb);
+
+	cleanup_lists();
+	free_config_index(&sb->index);
+
+	use_live_lists(sb);
+
+	for (i = 0; i < sb->num_targets; i++) {
+		put_target(sb->pairs[i].live);
+		if (sb->pairs[i].copy)
+			put_target(sb->pairs[i].copy);
+	}
+
+	free(sb->pairs);
+}
+
+/* makes what the batch did in the sandbox the live config and leaves it;
+ * the objects changed are moved over rather than the changes made again,
+ * so nothing a change checks can fail here.  The groups changed are built
+ * again from their committed config.
+ */
+void commit_config_sandbox(struct config_sandbox *sb)
+{
+	json_t			*changes;
+	json_t			*groups;
+	json_t			*value;
+	const char		*name;
+
+	changes = json_incref(get_json_context()->changes);
+
+	json_decref(swap_json_root(sb->root));
+
+	use_live_lists(sb);
+
+	commit_json_changes(changes);
+
+	commit_sandbox_targets(sb);
+
+	groups = json_object_get(changes, TAG_GROUPS);
+	json_object_foreach(groups, name, value) {
+		drop_group((char *) name);
+		if (json_is_object(value))
+			build_group(value);
+	}
+
+	json_decref(changes);
+
+	free_config_sandbox(sb);
+}
+
+/* any config ops queued in the sandbox must be freed before leaving it */
+void leave_config_sandbox(struct config_sandbox *sb)
+{
+	json_decref(swap_json_root(sb->root));
+
+	use_live_lists(sb);
+
+	free_config_sandbox(sb);
+}
+
 static void set_signature(void)
 {
 	FILE			*fd;
@@ -641,12 +952,18 @@ int main(int argc, char *argv[])
 
 	set_signature();
 
+	if (init_config_index(config_index))
+		goto out2;
+
 	ret = init_interfaces();
 	if (ret < 0)
 		goto out2;
 
 	build_lists();
 
+	/* served until each target is refreshed, which replaces or drops them */
+	load_log_page_cache();
+
 	init_targets();
 
 	signalled = stopped = 0;
@@ -657,10 +974,26 @@ int main(int argc, char *argv[])
 	if (init_interface_threads(&listen_threads))
 		goto out3;
 
+	if (s_http_workers < 0)
+		s_http_workers = default_http_workers();
+
+	/* without the job threads ?async changes are pushed before replying */
+	init_config_jobs();
+
+	/* if this fails events go out on the next poll instead */
+	init_events(&mgr);
+
+	/* if the pool can't start requests are run on the poll thread */
+	init_http_workers(&mgr, s_http_workers, handle_http_request);
+
 	poll_loop(&mgr);
 
+	cleanup_config_jobs();
+
 	cleanup_threads(listen_threads);
 
+	store_log_page_cache();
+
 	if (signalled)
 		printf("\n");
 
@@ -669,6 +1002,8 @@ out3:
 	free(interfaces);
 	cleanup_lists();
 out2:
+	free_config_index(config_index);
+
 	if (s_signature == &s_signature_user)
 		free((char *) s_signature->p);
 
@@ -0,0 +1,388 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Change event stream.
+ *
+ * GET /dem/events is answered with a text/event-stream that is kept open.
+ * Every change to the config or to the log pages of a target is given the
+ * next sequence number and kept in a ring of the last MAX_EVENTS.  A client
+ * picks up after the last event it saw with ?since=<seq> or Last-Event-ID;
+ * one that has fallen off the ring, or that saw the sequence of an earlier
+ * run of the DC, is sent a resync event telling it to refetch everything.
+ * Sequence numbers start from the time the DC started, shifted up so each
+ * run's are above those of the runs before it.
+ *
+ * Streams belong to the mongoose thread.  Events are published by whichever
+ * thread made the change and a socketpair wakes mongoose to send them.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "mongoose.h"
+#include "common.h"
+
+#define MAX_EVENTS		1024
+#define EVENT_SIZE		1024
+#define EVENT_TYPE_SIZE		16
+#define EVENT_HIGH_WATER	65536	/* bytes queued before a stream waits */
+#define EVENT_KEEPALIVE		15	/* seconds between comments */
+
+#define EVENT_URI		"/" URI_DEM "/" URI_EVENTS
+#define EVENT_HDR \
+"HTTP/1.1 200 OK\r\n" \
+"Content-Type: text/event-stream\r\n" \
+"Cache-Control: no-cache\r\n" \
+"Access-Control-Allow-Origin:*\r\n\r\n"
+
+struct event {
+	unsigned long		 seq;
+	char			 type[EVENT_TYPE_SIZE];
+	char			 data[EVENT_SIZE];
+};
+
+struct event_stream {
+	struct linked_list	 node;
+	struct mg_connection	*c;
+	unsigned long		 next;	/* seq of the next one to send */
+};
+
+/* the ring and last_seq are protected by lock */
+static struct event		 events[MAX_EVENTS];
+static unsigned long		 last_seq;
+static pthread_mutex_t		 lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* mongoose thread only */
+static LINKED_LIST(stream_list);
+static time_t			 last_keepalive;
+
+static int			 wake[2] = { -1, -1 };
+
+/* called with lock held */
+static inline void seed_seq(void)
+{
+	if (!last_seq)
+		last_seq = (unsigned long) time(NULL) << 20;
+}
+
+/* copies str to buf quoted for a JSON string in an event's data, cut short
+ * at size rather than in the middle of an escape.  Every string put in an
+ * event goes through here.
+ */
+char *escape_event_str(const char *str, char *buf, int size)
+{
+	char			*p = buf;
+	char			*end = buf + size - 1;
+	unsigned char		 c;
+	int			 n;
+
+	for (; *str; str++) {
+		c = *str;
+		if (c == '"' || c == '\\')
+			n = 2;
+		else if (c < 0x20)
+			n = 6;
+		else
+			n = 1;
+
+		if (p + n > end)
+			break;
+
+		if (n == 6) {
+			p += sprintf(p, "\\u%04x", c);
+		} else {
+			if (n == 2)
+				*p++ = '\\';
+			*p++ = c;
+		}
+	}
+	*p = 0;
+
+	return buf;
+}
+
+/* fmt gives the members of the event's JSON data after Seq and Event,
+ * strings in it are escaped with escape_event_str()
+ */
+void publish_event(char *type, const char *fmt, ...)
+{
+	struct event		*event;
+	va_list			 args;
+	char			 poke = 0;
+	int			 n;
+
+	pthread_mutex_lock(&lock);
+
+	seed_seq();
+
+	event = &events[++last_seq % MAX_EVENTS];
+	event->seq = last_seq;
+
+	strncpy(event->type, type, EVENT_TYPE_SIZE - 1);
+	event->type[EVENT_TYPE_SIZE - 1] = 0;
+
+	n = snprintf(event->data, EVENT_SIZE, "{\"%s\":%lu,\"%s\":\"%s\",",
+		     TAG_SEQ, last_seq, TAG_EVENT, type);
+
+	va_start(args, fmt);
+	n += vsnprintf(event->data + n, EVENT_SIZE - n - 1, fmt, args);
+	va_end(args);
+
+	if (n > EVENT_SIZE - 2)
+		n = EVENT_SIZE - 2;
+
+	strcpy(event->data + n, "}");
+
+	if (wake[1] >= 0 && send(wake[1], &poke, 1, MSG_DONTWAIT) < 0 &&
+	    errno != EAGAIN)
+		print_errno("event wake up failed", errno);
+
+	pthread_mutex_unlock(&lock);
+}
+
+/* called on the mongoose thread with lock held */
+static void send_events(struct event_stream *stream)
+{
+	struct mg_connection	*c = stream->c;
+	struct event		*event;
+
+	/* gone from the ring, from an earlier run or never published */
+	if (stream->next > last_seq + 1 || (stream->next <= last_seq &&
+	    events[stream->next % MAX_EVENTS].seq != stream->next)) {
+		mg_printf(c, "id: %lu\nevent: %s\ndata: {\"%s\":%lu}\n\n",
+			  last_seq, EVENT_RESYNC, TAG_SEQ, last_seq);
+		stream->next = last_seq + 1;
+	}
+
+	while (stream->next <= last_seq &&
+	       c->send_mbuf.len < EVENT_HIGH_WATER) {
+		event = &events[stream->next % MAX_EVENTS];
+
+		mg_printf(c, "id: %lu\nevent: %s\ndata: %s\n\n",
+			  event->seq, event->type, event->data);
+
+		stream->next++;
+	}
+}
+
+static void wake_handler(struct mg_connection *c, int ev, void *ev_data)
+{
+	struct event_stream	*stream;
+	time_t			 now;
+	int			 keepalive = 0;
+
+	UNUSED(ev_data);
+
+	if (ev == MG_EV_RECV)
+		mbuf_remove(&c->recv_mbuf, c->recv_mbuf.len);
+	else if (ev != MG_EV_POLL)
+		return;
+
+	if (list_empty(&stream_list))
+		return;
+
+	now = time(NULL);
+	if (now - last_keepalive >= EVENT_KEEPALIVE) {
+		last_keepalive = now;
+		keepalive = 1;
+	}
+
+	pthread_mutex_lock(&lock);
+
+	list_for_each_entry(stream, &stream_list, node) {
+		send_events(stream);
+
+		/* keeps proxies from timing out an idle stream */
+		if (keepalive && !stream->c->send_mbuf.len)
+			mg_printf(stream->c, ": keepalive\n\n");
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+int is_event_request(struct http_message *hm)
+{
+	size_t			 len = strlen(EVENT_URI);
+
+	return hm->method.len == 3 && !memcmp(hm->method.p, "GET", 3) &&
+		hm->uri.len == len && !memcmp(hm->uri.p, EVENT_URI, len);
+}
+
+/* the sequence number to resume after, 0 for only new events */
+static long resume_after(struct http_message *hm)
+{
+	const char		*p = hm->query_string.p;
+	const char		*end = p + hm->query_string.len;
+	size_t			 len = strlen(URI_PARM_SINCE);
+	char			 buf[24];
+	int			 i;
+
+	for (i = 0; i < MG_MAX_HTTP_HEADERS; i++)
+		if (!mg_vcmp(&hm->header_names[i], "Last-Event-ID"))
+			goto found;
+
+	while (p && p < end) {
+		if ((size_t) (end - p) > len &&
+		    !strncmp(p, URI_PARM_SINCE, len)) {
+			p += len;
+			for (i = 0; p < end && *p != '&'; p++)
+				if (i < (int) sizeof(buf) - 1)
+					buf[i++] = *p;
+			buf[i] = 0;
+			return strtol(buf, NULL, 10) + 1;
+		}
+
+		p = memchr(p, '&', end - p);
+		if (p)
+			p++;
+	}
+
+	return 0;
+found:
+	len = min(hm->header_values[i].len, sizeof(buf) - 1);
+	memcpy(buf, hm->header_values[i].p, len);
+	buf[len] = 0;
+
+	return strtol(buf, NULL, 10) + 1;
+}
+
+/* runs on the mongoose thread, the connection is kept until the client
+ * goes away or the DC shuts down
+ */
+void open_event_stream(struct mg_connection *c, struct http_message *hm)
+{
+	struct event_stream	*stream;
+	long			 next = resume_after(hm);
+
+	stream = malloc(sizeof(*stream));
+	if (!stream) {
+		print_err("no memory for event stream");
+		c->flags |= MG_F_CLOSE_IMMEDIATELY;
+		return;
+	}
+
+	stream->c = c;
+
+	c->user_data = stream;
+	c->flags |= MG_F_EVENT_STREAM;
+
+	mg_printf(c, EVENT_HDR);
+
+	pthread_mutex_lock(&lock);
+
+	stream->next = (next > 0) ? (unsigned long) next : last_seq + 1;
+
+	send_events(stream);
+
+	pthread_mutex_unlock(&lock);
+
+	list_add_tail(&stream->node, &stream_list);
+
+	print_debug("event stream opened from seq %lu", stream->next);
+}
+
+void close_event_stream(struct mg_connection *c)
+{
+	struct event_stream	*stream = c->user_data;
+
+	if (!stream)
+		return;
+
+	list_del(&stream->node);
+	free(stream);
+
+	c->user_data = NULL;
+}
+
+/* without the wake up socket events only go out on the next poll */
+int init_events(struct mg_mgr *mgr)
+{
+	int			 flags;
+
+	pthread_mutex_lock(&lock);
+	seed_seq();
+	pthread_mutex_unlock(&lock);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, wake)) {
+		print_errno("event socketpair failed", errno);
+		goto err;
+	}
+
+	flags = fcntl(wake[1], F_GETFL);
+	fcntl(wake[1], F_SETFL, flags | O_NONBLOCK);
+
+	/* mongoose owns and closes the read side */
+	if (!mg_add_sock(mgr, wake[0], wake_handler)) {
+		print_err("failed to add event socket");
+		close(wake[0]);
+		close(wake[1]);
+		goto err;
+	}
+
+	return 0;
+err:
+	wake[0] = wake[1] = -1;
+
+	return -ENOMEM;
+}
+
+/* must run on the mongoose thread before mg_mgr_free() */
+void cleanup_events(void)
+{
+	struct event_stream	*stream, *next;
+
+	list_for_each_entry_safe(stream, next, &stream_list, node) {
+		stream->c->user_data = NULL;
+		list_del(&stream->node);
+		free(stream);
+	}
+
+	pthread_mutex_lock(&lock);
+
+	if (wake[1] >= 0)
+		close(wake[1]);
+	wake[1] = -1;
+
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,570 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Binary config image.
+ *
+ * On a clean shutdown the config is also written out as an image that
+ * the next start maps and turns back into the JSON tree without parsing
+ * any text.  Each distinct key and string is stored once, and the tree is
+ * a flat array of nodes in the order a walk of it visits them: an object
+ * or array node holds its number of children, which follow it, and a
+ * member of an object holds the index of its key.
+ *
+ * The image is only a cache of the config file, which stays the place to
+ * edit the config.  It records the inode, size and time of the config file
+ * it was taken with, and is ignored, and the config file parsed, once that
+ * file has been replaced or changed, or if the image fails its checksum.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "hash.h"
+
+#define IMAGE_MAGIC		0x31494d44	/* "DMI1" */
+#define IMAGE_VERSION		1
+#define IMAGE_NO_KEY		UINT32_MAX
+#define IMAGE_MAX_DEPTH		64
+#define FNV_OFFSET		2166136261U
+#define FNV_PRIME		16777619U
+
+enum {
+	IMAGE_OBJECT,
+	IMAGE_ARRAY,
+	IMAGE_STRING,
+	IMAGE_INTEGER,
+	IMAGE_REAL,
+	IMAGE_TRUE,
+	IMAGE_FALSE,
+	IMAGE_NULL,
+};
+
+struct image_header {
+	uint32_t		 magic;
+	uint32_t		 version;
+	uint32_t		 num_nodes;
+	uint32_t		 num_strings;
+	uint32_t		 data_size;
+	uint32_t		 checksum;	/* of all after the header */
+	/* the config file the image was taken with */
+	uint64_t		 config_ino;
+	uint64_t		 config_size;
+	int64_t			 config_sec;
+	int64_t			 config_nsec;
+};
+
+/* followed by the string offsets into the data, then the data */
+struct image_node {
+	uint32_t		 type;
+	uint32_t		 key;
+	int64_t			 value;	/* count, string or number */
+};
+
+struct image_string {
+	struct hash_node	 node;
+	const char		*str;
+	uint32_t		 index;
+};
+
+struct image {
+	struct image_node	*nodes;
+	uint32_t		 num_nodes;
+	uint32_t		 max_nodes;
+	struct image_string	**strings;
+	uint32_t		 num_strings;
+	uint32_t		 max_strings;
+	uint32_t		 data_size;
+	struct hash_table	 interned;
+	/* of the mapped image being loaded */
+	const uint32_t		*offsets;
+	const char		*data;
+};
+
+static uint32_t fnv_hash(const void *buf, size_t len, uint32_t hash)
+{
+	const unsigned char	*p = buf;
+
+	while (len--)
+		hash = (hash ^ *p++) * FNV_PRIME;
+
+	return hash;
+}
+
+static void image_path(char *path, char *filename, char *suffix)
+{
+	snprintf(path, FILENAME_MAX, "%s%s%s", filename, IMAGE_SUFFIX, suffix);
+}
+
+static int grow(void **array, uint32_t count, uint32_t *max, size_t size)
+{
+	void			*p;
+	uint32_t		 n;
+
+	if (count < *max)
+		return 0;
+
+	n = *max ? *max * 2 : 64;
+
+	p = realloc(*array, n * size);
+	if (!p)
+		return -ENOMEM;
+
+	*array = p;
+	*max = n;
+
+	return 0;
+}
+
+static int add_string(struct image *img, const char *str, uint32_t *index)
+{
+	struct image_string	*s;
+	struct hash_node	*node;
+	unsigned int		 hash = hash_str(str, HASH_SEED);
+
+	hash_for_each_possible(&img->interned, node, hash) {
+		s = hash_entry(node, struct image_string, node);
+		if (!strcmp(s->str, str)) {
+			*index = s->index;
+			return 0;
+		}
+	}
+
+	if (grow((void **) &img->strings, img->num_strings,
+		 &img->max_strings, sizeof(s)))
+		return -ENOMEM;
+
+	s = malloc(sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+
+	/* the tree outlives the image so its strings can be pointed at */
+	s->str = str;
+	s->index = img->num_strings;
+
+	img->strings[img->num_strings++] = s;
+	hash_add(&img->interned, &s->node, hash);
+
+	img->data_size += strlen(str) + 1;
+
+	*index = s->index;
+
+	return 0;
+}
+
+static int add_node(struct image *img, const char *key, json_t *obj)
+{
+	struct image_node	*node;
+	const char		*name;
+	json_t			*value;
+	double			 real;
+	uint32_t		 index;
+	int			 i, n;
+	int			 ret;
+
+	if (grow((void **) &img->nodes, img->num_nodes, &img->max_nodes,
+		 sizeof(*node)))
+		return -ENOMEM;
+
+	node = &img->nodes[img->num_nodes++];
+	node->key = IMAGE_NO_KEY;
+	node->value = 0;
+
+	if (key) {
+		ret = add_string(img, key, &node->key);
+		if (ret)
+			return ret;
+	}
+
+	/* node is stale once children are added, they may move the nodes */
+	switch (json_typeof(obj)) {
+	case JSON_OBJECT:
+		node->type = IMAGE_OBJECT;
+		node->value = json_object_size(obj);
+
+		json_object_foreach(obj, name, value) {
+			ret = add_node(img, name, value);
+			if (ret)
+				return ret;
+		}
+		return 0;
+	case JSON_ARRAY:
+		node->type = IMAGE_ARRAY;
+		node->value = n = json_array_size(obj);
+
+		for (i = 0; i < n; i++) {
+			ret = add_node(img, NULL, json_array_get(obj, i));
+			if (ret)
+				return ret;
+		}
+		return 0;
+	case JSON_STRING:
+		node->type = IMAGE_STRING;
+		ret = add_string(img, json_string_value(obj), &index);
+		node->value = index;
+		return ret;
+	case JSON_INTEGER:
+		node->type = IMAGE_INTEGER;
+		node->value = json_integer_value(obj);
+		return 0;
+	case JSON_REAL:
+		node->type = IMAGE_REAL;
+		real = json_real_value(obj);
+		memcpy(&node->value, &real, sizeof(real));
+		return 0;
+	case JSON_TRUE:
+		node->type = IMAGE_TRUE;
+		return 0;
+	case JSON_FALSE:
+		node->type = IMAGE_FALSE;
+		return 0;
+	default:
+		node->type = IMAGE_NULL;
+		return 0;
+	}
+}
+
+static void free_image(struct image *img)
+{
+	uint32_t		 i;
+
+	for (i = 0; i < img->num_strings; i++)
+		free(img->strings[i]);
+
+	free(img->strings);
+	free(img->nodes);
+
+	hash_free(&img->interned);
+}
+
+static int write_image(struct image *img, struct image_header *hdr,
+		       char *filename)
+{
+	FILE			*fd;
+	uint32_t		*offsets;
+	char			*data;
+	uint32_t		 i, len, off = 0;
+	int			 ret = 0;
+
+	/* one more so neither is empty */
+	offsets = malloc((img->num_strings + 1) * sizeof(*offsets));
+	data = malloc(img->data_size + 1);
+	if (!offsets || !data) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < img->num_strings; i++) {
+		len = strlen(img->strings[i]->str) + 1;
+		memcpy(data + off, img->strings[i]->str, len);
+		offsets[i] = off;
+		off += len;
+	}
+
+	hdr->num_nodes = img->num_nodes;
+	hdr->num_strings = img->num_strings;
+	hdr->data_size = img->data_size;
+
+	hdr->checksum = fnv_hash(img->nodes,
+				 img->num_nodes * sizeof(*img->nodes),
+				 FNV_OFFSET);
+	hdr->checksum = fnv_hash(offsets, img->num_strings * sizeof(*offsets),
+				 hdr->checksum);
+	hdr->checksum = fnv_hash(data, img->data_size, hdr->checksum);
+
+	fd = fopen(filename, "w");
+	if (!fd) {
+		ret = -errno;
+		goto out;
+	}
+
+	fwrite(hdr, sizeof(*hdr), 1, fd);
+	fwrite(img->nodes, sizeof(*img->nodes), img->num_nodes, fd);
+	fwrite(offsets, sizeof(*offsets), img->num_strings, fd);
+	fwrite(data, 1, img->data_size, fd);
+
+	if (ferror(fd))
+		ret = -EIO;
+
+	if (fclose(fd) && !ret)
+		ret = -errno;
+out:
+	free(offsets);
+	free(data);
+
+	return ret;
+}
+
+/* called once the config file holds root; a torn image fails its
+ * checksum so neither needs to be synced
+ */
+int write_config_image(json_t *root, char *filename)
+{
+	struct image		 img;
+	struct image_header	 hdr;
+	struct stat		 st;
+	char			 path[FILENAME_MAX + 1];
+	char			 new[FILENAME_MAX + 1];
+	int			 ret;
+
+	image_path(path, filename, "");
+	image_path(new, filename, NEW_FILE_SUFFIX);
+
+	if (stat(filename, &st)) {
+		ret = -errno;
+		goto err;
+	}
+
+	memset(&img, 0, sizeof(img));
+	memset(&hdr, 0, sizeof(hdr));
+
+	hdr.magic = IMAGE_MAGIC;
+	hdr.version = IMAGE_VERSION;
+	hdr.config_ino = st.st_ino;
+	hdr.config_size = st.st_size;
+	hdr.config_sec = st.st_mtim.tv_sec;
+	hdr.config_nsec = st.st_mtim.tv_nsec;
+
+	ret = hash_init(&img.interned);
+	if (ret)
+		goto err;
+
+	ret = add_node(&img, NULL, root);
+	if (!ret)
+		ret = write_image(&img, &hdr, new);
+
+	free_image(&img);
+
+	if (ret)
+		goto err;
+
+	if (rename(new, path)) {
+		ret = -errno;
+		goto err;
+	}
+
+	return 0;
+err:
+	print_errno("unable to write config image", ret);
+	unlink(new);
+	unlink(path);
+
+	return ret;
+}
+
+static inline const char *image_string(struct image *img, int64_t index)
+{
+	if (index < 0 || index >= img->num_strings)
+		return NULL;
+
+	return img->data + img->offsets[index];
+}
+
+static json_t *load_node(struct image *img, int depth)
+{
+	struct image_node	*node;
+	json_t			*obj = NULL;
+	json_t			*child;
+	const char		*str;
+	const char		*key;
+	double			 real;
+	int64_t			 i;
+
+	if (img->num_nodes == img->max_nodes || depth > IMAGE_MAX_DEPTH)
+		return NULL;
+
+	/* max_nodes is the number mapped and num_nodes those loaded */
+	node = &img->nodes[img->num_nodes++];
+
+	switch (node->type) {
+	case IMAGE_OBJECT:
+	case IMAGE_ARRAY:
+		if (node->value < 0 ||
+		    node->value > img->max_nodes - img->num_nodes)
+			return NULL;
+
+		if (node->type == IMAGE_OBJECT)
+			obj = json_object();
+		else
+			obj = json_array();
+		if (!obj)
+			return NULL;
+
+		for (i = 0; i < node->value; i++) {
+			if (img->num_nodes == img->max_nodes)
+				goto err;
+
+			key = image_string(img, img->nodes[img->num_nodes].key);
+
+			child = load_node(img, depth + 1);
+			if (!child)
+				goto err;
+
+			if (node->type == IMAGE_ARRAY) {
+				if (json_array_append_new(obj, child))
+					goto err;
+			} else if (!key || json_object_set_new(obj, key, child))
+				goto err;
+		}
+		return obj;
+	case IMAGE_STRING:
+		str = image_string(img, node->value);
+		return str ? json_string(str) : NULL;
+	case IMAGE_INTEGER:
+		return json_integer(node->value);
+	case IMAGE_REAL:
+		memcpy(&real, &node->value, sizeof(real));
+		return json_real(real);
+	case IMAGE_TRUE:
+		return json_true();
+	case IMAGE_FALSE:
+		return json_false();
+	case IMAGE_NULL:
+		return json_null();
+	}
+err:
+	json_decref(obj);
+
+	return NULL;
+}
+
+static json_t *load_image(struct image *img, char *map, size_t size)
+{
+	struct image_header	*hdr = (struct image_header *) map;
+	uint64_t		 len;
+	uint32_t		 i;
+	json_t			*root;
+
+	len = sizeof(*hdr) + (uint64_t) hdr->num_nodes * sizeof(*img->nodes) +
+		(uint64_t) hdr->num_strings * sizeof(*img->offsets) +
+		hdr->data_size;
+	if (len != size)
+		return NULL;
+
+	if (fnv_hash(hdr + 1, size - sizeof(*hdr), FNV_OFFSET) !=
+	    hdr->checksum)
+		return NULL;
+
+	img->nodes = (struct image_node *) (hdr + 1);
+	img->max_nodes = hdr->num_nodes;
+	img->offsets = (uint32_t *) (img->nodes + hdr->num_nodes);
+	img->num_strings = hdr->num_strings;
+	img->data = (char *) (img->offsets + hdr->num_strings);
+	img->data_size = hdr->data_size;
+
+	/* every string must end within the data */
+	if (img->num_strings && img->data[img->data_size - 1])
+		return NULL;
+
+	for (i = 0; i < img->num_strings; i++)
+		if (img->offsets[i] >= img->data_size)
+			return NULL;
+
+	root = load_node(img, 0);
+	if (root && img->num_nodes != img->max_nodes) {
+		json_decref(root);
+		root = NULL;
+	}
+
+	return root;
+}
+
+/* returns NULL if there is no image or it is not of the config file */
+json_t *load_config_image(char *filename)
+{
+	struct image		 img;
+	struct image_header	*hdr;
+	struct stat		 st;
+	struct stat		 config;
+	char			 path[FILENAME_MAX + 1];
+	char			*map;
+	json_t			*root = NULL;
+	int			 fd;
+
+	image_path(path, filename, "");
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || st.st_size < (off_t) sizeof(*hdr)) {
+		close(fd);
+		goto err;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (map == MAP_FAILED)
+		goto err;
+
+	hdr = (struct image_header *) map;
+
+	if (hdr->magic != IMAGE_MAGIC || hdr->version != IMAGE_VERSION) {
+		munmap(map, st.st_size);
+		goto err;
+	}
+
+	if (stat(filename, &config) ||
+	    hdr->config_ino != (uint64_t) config.st_ino ||
+	    hdr->config_size != (uint64_t) config.st_size ||
+	    hdr->config_sec != config.st_mtim.tv_sec ||
+	    hdr->config_nsec != config.st_mtim.tv_nsec) {
+		munmap(map, st.st_size);
+		print_info("config file changed, ignoring config image");
+		return NULL;
+	}
+
+	memset(&img, 0, sizeof(img));
+
+	root = load_image(&img, map, st.st_size);
+
+	munmap(map, st.st_size);
+
+	if (root)
+		return root;
+err:
+	print_err("invalid config image %s, ignoring it", path);
+
+	return NULL;
+}
@@ -36,12 +36,85 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <dirent.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
 
 #include "common.h"
 
+#include "curl.h"
+
+/* wire strings are fixed size and need not be terminated */
+static int intern_field(const char *field, int size)
+{
+	char			 buf[NVMF_NQN_FIELD_LEN + 1];
+
+	memcpy(buf, field, size);
+	buf[size] = 0;
+
+	return intern(buf);
+}
+
+static void release_logpage_entry(struct logpage_entry *le)
+{
+	unintern(le->subnqn);
+	unintern(le->traddr);
+	unintern(le->trsvcid);
+}
+
+static int intern_logpage_entry(struct logpage_entry *le,
+				struct nvmf_disc_rsp_page_entry *e)
+{
+	memset(le, 0, sizeof(*le));
+
+	le->subnqn = intern_field(e->subnqn, NVMF_NQN_FIELD_LEN);
+	le->traddr = intern_field(e->traddr, NVMF_TRADDR_SIZE);
+	le->trsvcid = intern_field(e->trsvcid, NVMF_TRSVCID_SIZE);
+
+	if (le->subnqn < 0 || le->traddr < 0 || le->trsvcid < 0) {
+		release_logpage_entry(le);
+		return -ENOMEM;
+	}
+
+	le->portid = e->portid;
+	le->cntlid = e->cntlid;
+	le->trtype = e->trtype;
+	le->adrfam = e->adrfam;
+	le->subtype = e->subtype;
+	le->treq = e->treq;
+
+	/* holds the RDMA parameters, other transports use less */
+	memcpy(le->tsas, &e->tsas, LOGPAGE_TSAS_SIZE);
+
+	return 0;
+}
+
+void expand_logpage_entry(struct logpage_entry *le,
+			  struct nvmf_disc_rsp_page_entry *e)
+{
+	memset(e, 0, sizeof(*e));
+
+	strncpy(e->subnqn, interned(le->subnqn), NVMF_NQN_FIELD_LEN);
+	strncpy(e->traddr, interned(le->traddr), NVMF_TRADDR_SIZE);
+	strncpy(e->trsvcid, interned(le->trsvcid), NVMF_TRSVCID_SIZE);
+
+	e->portid = le->portid;
+	e->cntlid = le->cntlid;
+	e->trtype = le->trtype;
+	e->adrfam = le->adrfam;
+	e->subtype = le->subtype;
+	e->treq = le->treq;
+
+	memcpy(&e->tsas, le->tsas, LOGPAGE_TSAS_SIZE);
+}
+
+void free_logpage(struct logpage *logpage)
+{
+	release_logpage_entry(&logpage->e);
+	free(logpage);
+}
+
 static void _del_unattached_logpage_list(struct target *target)
 {
 	struct logpage		*lp, *n;
@@ -49,10 +122,15 @@ static void _del_unattached_logpage_list(struct target *target)
 	list_for_each_entry_safe(lp, n, &target->unattached_logpage_list,
 				 node) {
 		list_del(&lp->node);
-		free(lp);
+		free_logpage(lp);
 	}
 }
 
+/* queues what brings the target back in line with the config, the caller
+ * pushes it with flush_config_ops() once the config lock is dropped.  An
+ * in-band SC is reconciled against what it reports, an OOB one is reset
+ * and given the full config.
+ */
 int target_reconfig(char *alias)
 {
 	struct target		*target;
@@ -66,13 +144,20 @@ int target_reconfig(char *alias)
 found:
 	_del_unattached_logpage_list(target);
 
-	ret = send_del_target(target);
-	if (ret)
-		return ret;
+	if (target->mgmt_mode != IN_BAND_MGMT) {
+		ret = send_del_target(target);
+		if (ret)
+			return ret;
+	}
 
 	return config_target(target);
 }
 
+/* while a fetched log is saved a log page that was valid and has not been
+ * seen again is marked PENDING so what changed can be counted afterwards
+ */
+#define PENDING		-1
+
 static inline void invalidate_log_pages(struct target *target)
 {
 	struct subsystem		*subsys;
@@ -80,128 +165,233 @@ static inline void invalidate_log_pages(struct target *target)
 
 	list_for_each_entry(subsys, &target->subsys_list, node)
 		list_for_each_entry(logpage, &subsys->logpage_list, node)
-			logpage->valid = 0;
+			if (logpage->valid)
+				logpage->valid = PENDING;
 
-	_del_unattached_logpage_list(target);
+	list_for_each_entry(logpage, &target->unattached_logpage_list, node)
+		logpage->valid = PENDING;
+}
+
+/* returns the number of log pages that were not seen again */
+static int drop_pending_log_pages(struct target *target)
+{
+	struct subsystem		*subsys;
+	struct logpage			*logpage, *n;
+	int				 removed = 0;
+
+	list_for_each_entry(subsys, &target->subsys_list, node)
+		list_for_each_entry(logpage, &subsys->logpage_list, node)
+			if (logpage->valid == PENDING) {
+				logpage->valid = 0;
+				removed++;
+			}
+
+	list_for_each_entry_safe(logpage, n, &target->unattached_logpage_list,
+				 node)
+		if (logpage->valid == PENDING) {
+			list_del(&logpage->node);
+			free_logpage(logpage);
+			removed++;
+		}
+
+	return removed;
 }
 
 static inline int match_logpage(struct logpage *logpage,
-				struct nvmf_disc_rsp_page_entry *e)
+				struct logpage_entry *e)
 {
-	if (strcmp(e->traddr, logpage->e.traddr) ||
-	    strcmp(e->trsvcid, logpage->e.trsvcid) ||
+	if (e->traddr != logpage->e.traddr ||
+	    e->trsvcid != logpage->e.trsvcid ||
 	    e->trtype != logpage->e.trtype ||
 	    e->adrfam != logpage->e.adrfam)
 		return 0;
 	return 1;
 }
 
-static inline void store_logpage(struct logpage *logpage,
-				 struct nvmf_disc_rsp_page_entry *e,
-				 struct ctrl_queue *dq)
+/* returns 1 if the log page was not valid before the fetch, the strings
+ * of the entry are handed to the log page
+ */
+static inline int store_logpage(struct logpage *logpage,
+				struct logpage_entry *e,
+				struct ctrl_queue *dq)
 {
+	int				 added = !logpage->valid;
+
+	release_logpage_entry(&logpage->e);
+
 	logpage->e = *e;
 	logpage->valid = 1;
+	logpage->stale = 0;
+	logpage->fetched = time(NULL);
 	logpage->portid = dq->portid;
+
+	return added;
 }
 
-static void save_log_pages(struct nvmf_disc_rsp_page_hdr *log, int numrec,
-			   struct target *target, struct ctrl_queue *dq)
+/* returns the number of log pages that were not valid before the fetch */
+static int save_log_pages(struct nvmf_disc_rsp_page_hdr *log, int numrec,
+			  struct target *target, struct ctrl_queue *dq)
 {
 	int				 i;
-	int				 found;
-	int				 create;
+	int				 attached;
+	int				 added = 0;
+	char				*subnqn;
 	struct subsystem		*subsys;
-	struct logpage			*logpage, *lp;
-	struct nvmf_disc_rsp_page_entry *e;
+	struct logpage			*logpage;
+	struct logpage_entry		 e;
+	struct linked_list		*list;
 
 	for (i = 0; i < numrec; i++) {
-		e = &log->entries[i];
-		found = 0;
-		create = 1;
+		if (intern_logpage_entry(&e, &log->entries[i])) {
+			print_err("alloc new logpage failed");
+			break;
+		}
+
+		list = &target->unattached_logpage_list;
+		attached = 0;
+
+		subnqn = interned(e.subnqn);
+
 		list_for_each_entry(subsys, &target->subsys_list, node)
-			if ((strcmp(subsys->nqn, e->subnqn) == 0)) {
-				found = 1;
-				list_for_each_entry(logpage,
-						    &subsys->logpage_list,
-						    node)
-					if (match_logpage(logpage, e)) {
-						store_logpage(logpage, e, dq);
-						create = 0;
-						goto next;
-					}
-next:
+			if (!strcmp(subsys->nqn, subnqn)) {
+				list = &subsys->logpage_list;
+				attached = 1;
 				break;
 			}
 
-		if (!create)
-			continue;
+		/* the log pages of a subsystem match whatever its NQN */
+		list_for_each_entry(logpage, list, node)
+			if (match_logpage(logpage, &e) &&
+			    (attached || logpage->e.subnqn == e.subnqn)) {
+				added += store_logpage(logpage, &e, dq);
+				goto next;
+			}
 
 		logpage = malloc(sizeof(*logpage));
 		if (!logpage) {
+			release_logpage_entry(&e);
 			print_err("alloc new logpage failed");
-			return;
+			break;
 		}
 
-		store_logpage(logpage, e, dq);
+		memset(logpage, 0, sizeof(*logpage));
 
-		if (found) {
-			list_add_tail(&logpage->node, &subsys->logpage_list);
-			continue;
-		}
+		added += store_logpage(logpage, &e, dq);
 
-		list_for_each_entry(lp, &target->unattached_logpage_list, node)
-			if (!strcmp(lp->e.subnqn, e->subnqn) &&
-			    match_logpage(lp, e)) {
-				found = 1;
-				free(logpage);
-				break;
-			}
-
-		if (!found)
-			list_add_tail(&logpage->node,
-				      &target->unattached_logpage_list);
+		list_add_tail(&logpage->node, list);
+next:
+		;
 	}
+
+	return added;
 }
 
-void fetch_log_pages(struct ctrl_queue *dq)
+/* called with target->lock held, the log is kept on the list until the
+ * config lock can be taken to save it
+ */
+int fetch_log_pages(struct ctrl_queue *dq, struct linked_list *logs)
 {
 	struct nvmf_disc_rsp_page_hdr	*log = NULL;
 	struct target			*target = dq->target;
+	struct fetched_log		*entry;
 	u32				 num_records = 0;
+	int				 ret;
 
-	if (get_logpages(dq, &log, &num_records)) {
+	ret = get_logpages(dq, &log, &num_records);
+	if (ret) {
 		print_err("get logpages for target %s failed", target->alias);
-		return;
+		return ret;
+	}
+
+	entry = malloc(sizeof(*entry));
+	if (!entry) {
+		free(log);
+		return -ENOMEM;
 	}
 
-	invalidate_log_pages(target);
+	entry->dq = dq;
+	entry->log = log;
+	entry->num_records = num_records;
 
-	save_log_pages(log, num_records, target, dq);
+	list_add_tail(&entry->node, logs);
+
+	return 0;
+}
 
-	print_discovery_log(log, num_records);
+static inline int valid_dq(struct target *target, struct ctrl_queue *dq)
+{
+	struct ctrl_queue	*entry;
 
-	free(log);
+	list_for_each_entry(entry, &target->discovery_queue_list, node)
+		if (entry == dq)
+			return 1;
+	return 0;
 }
 
-int target_refresh(char *alias)
+/* called with the config lock held exclusively, a change to the log
+ * pages of the target is published as an event
+ */
+void save_fetched_log_pages(struct target *target, struct linked_list *logs)
+{
+	struct fetched_log	*entry, *next;
+	/* escaped, a control character takes 6 */
+	char			 alias[6 * MAX_ALIAS_SIZE + 1];
+	int			 added = 0;
+	int			 removed = 0;
+	int			 save;
+
+	save = !list_empty(logs) && !target->removed;
+	if (save)
+		invalidate_log_pages(target);
+
+	list_for_each_entry_safe(entry, next, logs, node) {
+		if (save && valid_dq(target, entry->dq)) {
+			added += save_log_pages(entry->log, entry->num_records,
+						target, entry->dq);
+			print_discovery_log(entry->log, entry->num_records);
+		}
+
+		list_del(&entry->node);
+		free(entry->log);
+		free(entry);
+	}
+
+	if (save)
+		removed = drop_pending_log_pages(target);
+
+	if (added || removed)
+		publish_event(EVENT_LOG_PAGE, "\"%s\":\"%s\",\"%s\":%d,"
+			      "\"%s\":%d", TAG_TARGET,
+			      escape_event_str(target->alias, alias,
+					       sizeof(alias)),
+			      TAG_ADDED, added, TAG_REMOVED, removed);
+}
+
+int target_refresh(struct target *target)
 {
-	struct target		*target;
 	struct ctrl_queue	*dq;
+	struct linked_list	 logs;
+	unsigned long long	 start = metrics_clock();
 
-	list_for_each_entry(target, target_list, node)
-		if (!strcmp(target->alias, alias))
-			goto found;
+	INIT_LINKED_LIST(&logs);
+
+	pthread_mutex_lock(&target->lock);
 
-	return -ENOENT;
-found:
 	list_for_each_entry(dq, &target->discovery_queue_list, node) {
 		if (!connect_ctrl(dq)) {
-			fetch_log_pages(dq);
+			fetch_log_pages(dq, &logs);
 			disconnect_ctrl(dq, 0);
 		}
 	}
 
+	pthread_mutex_unlock(&target->lock);
+
+	json_write_lock();
+	save_fetched_log_pages(target, &logs);
+	json_unlock();
+
+	observe_histogram(&dc_metrics.refresh_latency, start);
+
 	return 0;
 }
 
@@ -219,11 +409,15 @@ found:
 	return 0;
 }
 
-static void format_logpage(char *buf, struct nvmf_disc_rsp_page_entry *e)
+static void format_logpage(char *buf, struct logpage *logpage)
 {
+	struct nvmf_disc_rsp_page_entry entry;
+	struct nvmf_disc_rsp_page_entry *e = &entry;
 	int			 n;
 	char			*p = buf;
 
+	expand_logpage_entry(&logpage->e, e);
+
 	n = sprintf(p, "<p>trtype <b>%s</b> ", trtype_str(e->trtype));
 	p += n;
 	n = sprintf(p, "adrfam <b>%s</b> ", adrfam_str(e->adrfam));
@@ -257,6 +451,12 @@ static void format_logpage(char *buf, struct nvmf_disc_rsp_page_entry *e)
 		p += n;
 		break;
 	}
+	if (logpage->stale) {
+		n = sprintf(p, "<br> &nbsp; <i>stale, fetched %ld %s</i>",
+			    (long) (time(NULL) - logpage->fetched),
+			    "seconds ago");
+		p += n;
+	}
 	n = sprintf(p, "</p>");
 	p += n;
 }
@@ -282,7 +482,7 @@ found:
 			if (!logpage->valid)
 				continue;
 
-			format_logpage(buf, &logpage->e);
+			format_logpage(buf, logpage);
 
 			if ((len + strlen(buf)) > bytes) {
 				bytes += MAX_BODY_SIZE;
@@ -316,7 +516,7 @@ found:
 	len += n;
 
 	list_for_each_entry(logpage, &target->unattached_logpage_list, node) {
-		format_logpage(buf, &logpage->e);
+		format_logpage(buf, logpage);
 
 		if ((len + strlen(buf)) > bytes) {
 			bytes += MAX_BODY_SIZE;
@@ -360,7 +560,7 @@ int host_logpage(char *alias, char **resp)
 				goto found;
 
 			list_for_each_entry(host, &subsys->host_list, node)
-				if (!strcmp(alias, host->alias))
+				if (!strcmp(alias, interned(host->alias)))
 					goto found;
 			continue;
 found:
@@ -369,7 +569,7 @@ found:
 				if (!logpage->valid)
 					continue;
 
-				format_logpage(buf, &logpage->e);
+				format_logpage(buf, logpage);
 
 				if ((len + strlen(buf)) > bytes) {
 					bytes += MAX_BODY_SIZE;
@@ -393,6 +593,186 @@ found:
 	return 0;
 }
 
+/* the log pages are cached across a restart so hosts that connect before
+ * a target is refreshed are not served an empty log
+ */
+#define LOG_PAGE_CACHE_MAGIC	0x3143504c	/* "LPC1" */
+#define LOG_PAGE_CACHE_AGE	(24 * 60 * 60)	/* seconds */
+
+struct log_page_cache_hdr {
+	u32			 magic;
+	u32			 entry_size;
+	u32			 num_entries;
+	u32			 resv;
+};
+
+struct log_page_cache_entry {
+	char			 alias[MAX_ALIAS_SIZE + 1];
+	int			 portid;
+	__s64			 fetched;
+	struct nvmf_disc_rsp_page_entry e;
+};
+
+static int write_cached_log_page(FILE *fd, struct target *target,
+				 struct logpage *logpage)
+{
+	struct log_page_cache_entry entry;
+
+	if (!logpage->valid || !logpage->portid)
+		return 0;
+
+	memset(&entry, 0, sizeof(entry));
+
+	strcpy(entry.alias, target->alias);
+	entry.portid = logpage->portid->portid;
+	entry.fetched = logpage->fetched;
+
+	expand_logpage_entry(&logpage->e, &entry.e);
+
+	return fwrite(&entry, sizeof(entry), 1, fd);
+}
+
+/* called once the interface threads and the refreshes have stopped */
+void store_log_page_cache(void)
+{
+	struct log_page_cache_hdr hdr;
+	struct target		*target;
+	struct subsystem	*subsys;
+	struct logpage		*logpage;
+	FILE			*fd;
+	char			 new[FILENAME_MAX + 1];
+	int			 ret;
+
+	snprintf(new, FILENAME_MAX, "%s%s", LOG_PAGE_CACHE_FILE,
+		 NEW_FILE_SUFFIX);
+
+	fd = fopen(new, "w");
+	if (!fd) {
+		print_errno("unable to write log page cache", errno);
+		return;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	hdr.magic = LOG_PAGE_CACHE_MAGIC;
+	hdr.entry_size = sizeof(struct log_page_cache_entry);
+
+	/* the header is rewritten once the entries are counted */
+	fwrite(&hdr, sizeof(hdr), 1, fd);
+
+	list_for_each_entry(target, target_list, node) {
+		list_for_each_entry(subsys, &target->subsys_list, node)
+			list_for_each_entry(logpage, &subsys->logpage_list,
+					    node)
+				hdr.num_entries +=
+					write_cached_log_page(fd, target,
+							      logpage);
+
+		list_for_each_entry(logpage, &target->unattached_logpage_list,
+				    node)
+			hdr.num_entries += write_cached_log_page(fd, target,
+								 logpage);
+	}
+
+	rewind(fd);
+	fwrite(&hdr, sizeof(hdr), 1, fd);
+
+	ret = ferror(fd);
+
+	if (fclose(fd) || ret || rename(new, LOG_PAGE_CACHE_FILE)) {
+		print_err("unable to write log page cache");
+		unlink(new);
+	}
+}
+
+/* returns 1 if the log page was restored */
+static int load_cached_log_page(struct log_page_cache_entry *entry)
+{
+	struct target		*target;
+	struct subsystem	*subsys;
+	struct portid		*portid;
+	struct logpage		*logpage;
+
+	target = find_target(entry->alias);
+	if (!target)
+		return 0;
+
+	list_for_each_entry(portid, &target->portid_list, node)
+		if (portid->portid == entry->portid)
+			goto found;
+
+	return 0;
+found:
+	logpage = malloc(sizeof(*logpage));
+	if (!logpage)
+		return 0;
+
+	memset(logpage, 0, sizeof(*logpage));
+
+	if (intern_logpage_entry(&logpage->e, &entry->e)) {
+		free(logpage);
+		return 0;
+	}
+
+	logpage->portid = portid;
+	logpage->valid = 1;
+	logpage->stale = 1;
+	logpage->fetched = entry->fetched;
+
+	list_for_each_entry(subsys, &target->subsys_list, node)
+		if (!strcmp(subsys->nqn, interned(logpage->e.subnqn))) {
+			list_add_tail(&logpage->node, &subsys->logpage_list);
+			return 1;
+		}
+
+	list_add_tail(&logpage->node, &target->unattached_logpage_list);
+
+	return 1;
+}
+
+/* called once the lists are built and before the targets are refreshed,
+ * log pages of targets or ports no longer in the config are dropped
+ */
+void load_log_page_cache(void)
+{
+	struct log_page_cache_hdr hdr;
+	struct log_page_cache_entry entry;
+	FILE			*fd;
+	time_t			 now = time(NULL);
+	u32			 i;
+	int			 count = 0;
+
+	fd = fopen(LOG_PAGE_CACHE_FILE, "r");
+	if (!fd)
+		return;
+
+	if (fread(&hdr, sizeof(hdr), 1, fd) != 1 ||
+	    hdr.magic != LOG_PAGE_CACHE_MAGIC ||
+	    hdr.entry_size != sizeof(entry)) {
+		print_err("invalid log page cache, ignoring it");
+		goto out;
+	}
+
+	for (i = 0; i < hdr.num_entries; i++) {
+		if (fread(&entry, sizeof(entry), 1, fd) != 1)
+			break;
+
+		if (now - entry.fetched > LOG_PAGE_CACHE_AGE)
+			continue;
+
+		entry.alias[MAX_ALIAS_SIZE] = 0;
+
+		count += load_cached_log_page(&entry);
+	}
+
+	print_info("restored %d cached log pages", count);
+out:
+	fclose(fd);
+
+	/* rewritten on shutdown, after a crash it would be out of date */
+	unlink(LOG_PAGE_CACHE_FILE);
+}
+
 static void check_host(struct subsystem *subsys, json_t *acl,
 		       const char *alias, const char *nqn)
 {
@@ -411,8 +791,15 @@ static void check_host(struct subsystem *subsys, json_t *acl,
 			memset(host, 0, sizeof(*host));
 
 			host->subsystem = subsys;
-			strcpy(host->nqn, nqn);
-			strcpy(host->alias, alias);
+			host->nqn = intern(nqn);
+			host->alias = intern(alias);
+
+			if (host->nqn < 0 || host->alias < 0) {
+				unintern(host->nqn);
+				unintern(host->alias);
+				free(host);
+				return;
+			}
 
 			list_add_tail(&host->node, &subsys->host_list);
 		}
@@ -506,6 +893,8 @@ struct subsystem *new_subsys(struct target *target, char *nqn)
 
 	list_add_tail(&subsys->node, &target->subsys_list);
 
+	index_subsys(subsys);
+
 	return subsys;
 }
 
@@ -631,13 +1020,46 @@ struct target *alloc_target(char *alias)
 	INIT_LINKED_LIST(&target->discovery_queue_list);
 	INIT_LINKED_LIST(&target->unattached_logpage_list);
 
+	pthread_mutex_init(&target->lock, NULL);
+
+	/* reference held by target_list */
+	target->refcnt = 1;
+
 	list_add_tail(&target->node, target_list);
 
 	strncpy(target->alias, alias, MAX_ALIAS_SIZE);
 
+	index_target(target);
+
 	return target;
 }
 
+void get_target(struct target *target)
+{
+	__sync_fetch_and_add(&target->refcnt, 1);
+}
+
+/* the last reference goes away once the target is off target_list and
+ * any queued config ops or periodic work holding it are done
+ */
+void put_target(struct target *target)
+{
+	if (__sync_sub_and_fetch(&target->refcnt, 1))
+		return;
+
+	pthread_mutex_destroy(&target->lock);
+
+	free_curl_chan(target->oob_chan);
+
+	if (target->mgmt_mode == IN_BAND_MGMT && target->sc_iface.inb.connected)
+		disconnect_ctrl(&target->sc_iface.inb, 0);
+
+	if (target->mgmt_mode == IN_BAND_MGMT && target->sc_iface.inb.portid)
+		free(target->sc_iface.inb.portid);
+
+	free(target);
+}
+
 static int setup_oob_target(json_t *parent, struct target *target)
 {
 	json_t			*iface;
@@ -779,13 +1201,18 @@ static int add_port_to_target(struct target *target, json_t *obj)
 
 	memset(portid, 0, sizeof(*portid));
 
+	portid->target = target;
+
 	list_add_tail(&portid->node, &target->portid_list);
 
 	if (!get_transport_info(target->alias, obj, portid))
 		goto err;
 
+	index_portid(portid);
+
 	return 0;
 err:
+	list_del(&portid->node);
 	free(portid);
 
 	return -EINVAL;
@@ -807,15 +1234,38 @@ static void get_address_str(const struct sockaddr *sa, char *s, size_t len)
 	}
 }
 
-static void build_group_list(void)
+void build_group(json_t *iter)
 {
-	struct json_context	*ctx = get_json_context();
 	struct group		*group;
-	json_t			*array;
-	json_t			*iter;
 	json_t			*links;
 	json_t			*obj;
-	int			 i, j, num_groups, num_links;
+	int			 i, num_links;
+
+	obj = json_object_get(iter, TAG_NAME);
+	group = init_group((char *) json_string_value(obj));
+	if (!group)
+		return;
+
+	links = json_object_get(iter, TAG_TARGETS);
+	num_links = json_array_size(links);
+	for (i = 0; i < num_links; i++) {
+		obj = json_array_get(links, i);
+		link_target_to_group(group, (char *) json_string_value(obj));
+	}
+
+	links = json_object_get(iter, TAG_HOSTS);
+	num_links = json_array_size(links);
+	for (i = 0; i < num_links; i++) {
+		obj = json_array_get(links, i);
+		add_host_to_group(group, (char *) json_string_value(obj));
+	}
+}
+
+static void build_group_list(void)
+{
+	struct json_context	*ctx = get_json_context();
+	json_t			*array;
+	int			 i, num_groups;
 
 	array = json_object_get(ctx->root, TAG_GROUPS);
 	if (!array)
@@ -824,28 +1274,8 @@ static void build_group_list(void)
 	if (!num_groups)
 		return;
 
-	for (i = 0; i < num_groups; i++) {
-		iter = json_array_get(array, i);
-
-		obj = json_object_get(iter, TAG_NAME);
-		group = init_group((char *) json_string_value(obj));
-
-		links = json_object_get(iter, TAG_TARGETS);
-		num_links = json_array_size(links);
-		for (j = 0; j < num_links; j++) {
-			obj = json_array_get(links, j);
-			add_target_to_group(group,
-					    (char *) json_string_value(obj));
-		}
-
-		links = json_object_get(iter, TAG_HOSTS);
-		num_links = json_array_size(links);
-		for (j = 0; j < num_links; j++) {
-			obj = json_array_get(links, j);
-			add_host_to_group(group,
-					  (char *) json_string_value(obj));
-		}
-	}
+	for (i = 0; i < num_groups; i++)
+		build_group(json_array_get(array, i));
 }
 
 static void build_target_list(void)
@@ -888,6 +1318,20 @@ void build_lists(void)
 	build_group_list();
 }
 
+/* everything else in the config dir describes an interface */
+static int is_dem_file(const char *name)
+{
+	return !strcmp(name, CONFIG_FILENAME) ||
+		!strcmp(name, CONFIG_FILENAME NEW_FILE_SUFFIX) ||
+		!strcmp(name, CONFIG_FILENAME JOURNAL_SUFFIX) ||
+		!strcmp(name, CONFIG_FILENAME JOURNAL_SUFFIX OLD_FILE_SUFFIX) ||
+		!strcmp(name, CONFIG_FILENAME IMAGE_SUFFIX) ||
+		!strcmp(name, CONFIG_FILENAME IMAGE_SUFFIX NEW_FILE_SUFFIX) ||
+		!strcmp(name, LOG_PAGE_CACHE_FILENAME) ||
+		!strcmp(name, LOG_PAGE_CACHE_FILENAME NEW_FILE_SUFFIX) ||
+		!strcmp(name, SIGNATURE_FILE_FILENAME);
+}
+
 static int count_dem_config_files(void)
 {
 	struct dirent		*entry;
@@ -897,8 +1341,7 @@ static int count_dem_config_files(void)
 	dir = opendir(PATH_NVMF_DEM_DISC);
 	if (dir != NULL) {
 		for_each_dir(entry, dir)
-			if ((strcmp(entry->d_name, CONFIG_FILENAME)) &&
-			    (strcmp(entry->d_name, SIGNATURE_FILE_FILENAME)))
+			if (!is_dem_file(entry->d_name))
 				filecount++;
 		closedir(dir);
 	} else {
@@ -961,8 +1404,7 @@ static int read_dem_config_files(struct host_iface *iface)
 	}
 
 	for_each_dir(entry, dir) {
-		if ((strcmp(entry->d_name, CONFIG_FILENAME) == 0) ||
-		    (strcmp(entry->d_name, SIGNATURE_FILE_FILENAME) == 0))
+		if (is_dem_file(entry->d_name))
 			continue;
 
 		snprintf(config_file, FILENAME_MAX, "%s%s",
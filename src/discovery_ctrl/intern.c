@@ -0,0 +1,249 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Interned strings.
+ *
+ * The NQNs and aliases of ACL links, group members and log pages are
+ * stored once here and referred to by an integer id.  A string is looked
+ * up by its hash to find its id, and interned() maps an id back to the
+ * string.  Each intern() of a string takes a reference that unintern()
+ * drops, and the string and its id are freed with the last one.
+ *
+ * The table is chunked so a string never moves.  interned() does not take
+ * the lock; the holder of an id keeps the string alive.  Id 0 is never
+ * handed out so a zeroed struct holds no string.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "common.h"
+
+#define INTERN_CHUNK_SHIFT	10
+#define INTERN_CHUNK_SIZE	(1 << INTERN_CHUNK_SHIFT)
+#define INTERN_MAX_CHUNKS	4096
+
+struct interned_string {
+	struct hash_node	 hnode;
+	char			*str;
+	unsigned int		 refcnt;
+	int			 id;
+	int			 next_free;
+};
+
+static struct {
+	pthread_mutex_t		 lock;
+	struct hash_table	 table;
+	struct interned_string	*chunks[INTERN_MAX_CHUNKS];
+	int			 num_ids;
+	int			 free_id;
+	int			 count;
+	size_t			 bytes;
+} strings = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static inline struct interned_string *slot(int id)
+{
+	return &strings.chunks[id >> INTERN_CHUNK_SHIFT]
+		[id & (INTERN_CHUNK_SIZE - 1)];
+}
+
+static int alloc_id(void)
+{
+	struct interned_string	*chunk;
+	int			 id;
+
+	if (strings.free_id) {
+		id = strings.free_id;
+		strings.free_id = slot(id)->next_free;
+		return id;
+	}
+
+	/* id 0 stays unused */
+	if (!strings.num_ids)
+		strings.num_ids = 1;
+
+	id = strings.num_ids;
+
+	if (!(id & (INTERN_CHUNK_SIZE - 1)) || id == 1) {
+		if ((id >> INTERN_CHUNK_SHIFT) >= INTERN_MAX_CHUNKS)
+			return -ENOMEM;
+
+		chunk = calloc(INTERN_CHUNK_SIZE, sizeof(*chunk));
+		if (!chunk)
+			return -ENOMEM;
+
+		strings.chunks[id >> INTERN_CHUNK_SHIFT] = chunk;
+	}
+
+	strings.num_ids++;
+
+	return id;
+}
+
+/* returns the id of the string or -ENOMEM */
+int intern(const char *str)
+{
+	struct interned_string	*s;
+	struct hash_node	*node;
+	unsigned int		 hash = hash_str(str, HASH_SEED);
+	int			 id;
+
+	pthread_mutex_lock(&strings.lock);
+
+	if (!strings.table.buckets && hash_init(&strings.table)) {
+		id = -ENOMEM;
+		goto out;
+	}
+
+	hash_for_each_possible(&strings.table, node, hash) {
+		s = hash_entry(node, struct interned_string, hnode);
+		if (!strcmp(s->str, str)) {
+			s->refcnt++;
+			id = s->id;
+			goto out;
+		}
+	}
+
+	id = alloc_id();
+	if (id < 0)
+		goto out;
+
+	s = slot(id);
+
+	s->str = strdup(str);
+	if (!s->str) {
+		s->next_free = strings.free_id;
+		strings.free_id = id;
+		id = -ENOMEM;
+		goto out;
+	}
+
+	s->refcnt = 1;
+	s->id = id;
+
+	hash_add(&strings.table, &s->hnode, hash);
+
+	strings.count++;
+	strings.bytes += strlen(str) + 1;
+out:
+	pthread_mutex_unlock(&strings.lock);
+
+	return id;
+}
+
+/* takes another reference on an id the caller already holds */
+int hold_interned(int id)
+{
+	if (!id)
+		return 0;
+
+	pthread_mutex_lock(&strings.lock);
+	slot(id)->refcnt++;
+	pthread_mutex_unlock(&strings.lock);
+
+	return id;
+}
+
+void unintern(int id)
+{
+	struct interned_string	*s;
+
+	if (id <= 0)
+		return;
+
+	pthread_mutex_lock(&strings.lock);
+
+	s = slot(id);
+
+	if (--s->refcnt)
+		goto out;
+
+	hash_del(&strings.table, &s->hnode);
+
+	strings.count--;
+	strings.bytes -= strlen(s->str) + 1;
+
+	free(s->str);
+	s->str = NULL;
+
+	s->next_free = strings.free_id;
+	strings.free_id = id;
+out:
+	pthread_mutex_unlock(&strings.lock);
+}
+
+/* the string is shared and must not be modified */
+char *interned(int id)
+{
+	static char		 none[] = "";
+
+	if (id <= 0)
+		return none;
+
+	return slot(id)->str;
+}
+
+/* points *id at the string, leaving it as it was if that fails */
+int reintern(int *id, const char *str)
+{
+	int			 new;
+
+	new = intern(str);
+	if (new < 0)
+		return new;
+
+	unintern(*id);
+	*id = new;
+
+	return 0;
+}
+
+/* the number of strings interned and the bytes they take up */
+void interned_usage(int *count, size_t *bytes)
+{
+	pthread_mutex_lock(&strings.lock);
+
+	*count = strings.count;
+	*bytes = strings.bytes + strings.table.size * sizeof(void *) +
+		(strings.num_ids + INTERN_CHUNK_SIZE - 1) /
+		INTERN_CHUNK_SIZE * INTERN_CHUNK_SIZE *
+		sizeof(struct interned_string);
+
+	pthread_mutex_unlock(&strings.lock);
+}
@@ -0,0 +1,527 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Asynchronous provisioning jobs.
+ *
+ * A change made with ?async is applied to the JSON store like any other
+ * but the pushes it queued for the targets are handed to a pool of job
+ * threads instead of being run before the reply.  The client gets 202 and
+ * a job ID it can poll under /dem/jobs.
+ *
+ * Synchronous changes are entered in the same queue, while the config
+ * lock is still held, and run by the request's own worker.  A job only
+ * starts once every earlier job touching one of its targets is done, so
+ * pushes to a target go out in the order the changes were made.  Async
+ * jobs for unrelated targets run on separate job threads at the same
+ * time, alongside the synchronous ones.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "common.h"
+
+#define MAX_JOB_TARGETS		16
+#define MAX_JOB_HISTORY		1024
+#define MAX_JOB_REQUEST		128
+#define NUM_JOB_THREADS		4
+
+enum { JOB_QUEUED, JOB_RUNNING, JOB_DONE, JOB_FAILED };
+
+static const char * const job_state[] = {
+	"queued", "running", "done", "failed"
+};
+
+struct config_job {
+	struct linked_list	 node;
+	struct linked_list	 ops;
+	struct target		*targets[MAX_JOB_TARGETS];
+	int			 num_targets;	/* < 0 if more than fit */
+	bool			 async;
+	long			 id;
+	int			 state;
+	int			 err;
+	char			 request[MAX_JOB_REQUEST + 1];
+	char			 message[BODY_SIZE];
+	struct timeval		 queued;
+	struct timeval		 started;
+	struct timeval		 finished;
+};
+
+static struct {
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 changed;
+	struct linked_list	 queue;		/* oldest first */
+	struct linked_list	 history;	/* oldest first, async only */
+	int			 num_history;
+	long			 next_id;
+	long			 completed;
+	long			 failed;
+	long long		 total_ms;
+	long			 max_ms;
+	pthread_t		 threads[NUM_JOB_THREADS];
+	int			 num_threads;
+	int			 started;
+	int			 stopping;
+} jobs;
+
+static inline long elapsed_ms(struct timeval *from, struct timeval *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000 +
+		(to->tv_usec - from->tv_usec) / 1000;
+}
+
+static int conflicts(struct config_job *a, struct config_job *b)
+{
+	int			 i, j;
+
+	if (a->num_targets < 0 || b->num_targets < 0)
+		return 1;
+
+	for (i = 0; i < a->num_targets; i++)
+		for (j = 0; j < b->num_targets; j++)
+			if (a->targets[i] == b->targets[j])
+				return 1;
+
+	return 0;
+}
+
+/* called with jobs.lock held */
+static int blocked(struct config_job *job)
+{
+	struct config_job	*prev;
+
+	list_for_each_entry(prev, &jobs.queue, node) {
+		if (prev == job)
+			break;
+
+		if (conflicts(prev, job))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* ops must not be empty */
+static struct config_job *alloc_job(struct linked_list *ops, bool async)
+{
+	struct config_job	*job;
+
+	job = malloc(sizeof(*job));
+	if (!job)
+		return NULL;
+
+	memset(job, 0, sizeof(*job));
+
+	job->async = async;
+	job->state = JOB_QUEUED;
+	job->num_targets = config_op_targets(ops, job->targets,
+					     MAX_JOB_TARGETS);
+
+	job->ops = *ops;
+	job->ops.next->prev = &job->ops;
+	job->ops.prev->next = &job->ops;
+	INIT_LINKED_LIST(ops);
+
+	gettimeofday(&job->queued, NULL);
+
+	return job;
+}
+
+static long enqueue_job(struct config_job *job)
+{
+	long			 id;
+
+	pthread_mutex_lock(&jobs.lock);
+
+	id = job->async ? ++jobs.next_id : 0;
+	job->id = id;
+
+	list_add_tail(&job->node, &jobs.queue);
+	pthread_cond_broadcast(&jobs.changed);
+
+	pthread_mutex_unlock(&jobs.lock);
+
+	return id;
+}
+
+/* called with jobs.lock held */
+static void finish_job(struct config_job *job, int err)
+{
+	struct config_job	*old;
+	long			 ms;
+
+	list_del(&job->node);
+	pthread_cond_broadcast(&jobs.changed);
+
+	if (!job->async) {
+		free(job);
+		return;
+	}
+
+	gettimeofday(&job->finished, NULL);
+
+	job->err = err;
+	job->state = err ? JOB_FAILED : JOB_DONE;
+
+	ms = elapsed_ms(&job->queued, &job->finished);
+
+	jobs.completed++;
+	if (err)
+		jobs.failed++;
+	jobs.total_ms += ms;
+	if (ms > jobs.max_ms)
+		jobs.max_ms = ms;
+
+	list_add_tail(&job->node, &jobs.history);
+
+	if (++jobs.num_history > MAX_JOB_HISTORY) {
+		old = list_first_entry(&jobs.history, struct config_job, node);
+		list_del(&old->node);
+		free(old);
+		jobs.num_history--;
+	}
+}
+
+/* called with jobs.lock held; a job is taken by the first thread to mark
+ * it running
+ */
+static struct config_job *next_async_job(void)
+{
+	struct config_job	*job;
+
+	list_for_each_entry(job, &jobs.queue, node)
+		if (job->async && job->state == JOB_QUEUED && !blocked(job))
+			return job;
+
+	return NULL;
+}
+
+static void *job_thread(void *arg)
+{
+	struct config_job	*job;
+	int			 err;
+
+	(void) arg;
+
+	pthread_mutex_lock(&jobs.lock);
+
+	while (!jobs.stopping) {
+		job = next_async_job();
+		if (!job) {
+			pthread_cond_wait(&jobs.changed, &jobs.lock);
+			continue;
+		}
+
+		job->state = JOB_RUNNING;
+		gettimeofday(&job->started, NULL);
+
+		pthread_mutex_unlock(&jobs.lock);
+
+		err = flush_config_ops(&job->ops, job->message);
+
+		pthread_mutex_lock(&jobs.lock);
+
+		finish_job(job, err);
+	}
+
+	pthread_mutex_unlock(&jobs.lock);
+
+	return NULL;
+}
+
+/* called with the config write lock held so jobs queue in the order the
+ * changes were made; takes the ops and returns the job ID, or an error
+ * and leaves the ops if the job can't be queued
+ */
+long submit_config_job(struct linked_list *ops, char *request, char *resp)
+{
+	struct config_job	*job;
+
+	if (!jobs.started)
+		return -EAGAIN;
+
+	job = alloc_job(ops, true);
+	if (!job)
+		return -ENOMEM;
+
+	strncpy(job->request, request, MAX_JOB_REQUEST);
+	strncpy(job->message, resp, BODY_SIZE - 1);
+
+	return enqueue_job(job);
+}
+
+/* as submit_config_job() but the caller runs the job, returns NULL and
+ * leaves the ops if there is no memory
+ */
+struct config_job *start_config_job(struct linked_list *ops)
+{
+	struct config_job	*job;
+
+	job = alloc_job(ops, false);
+	if (job)
+		enqueue_job(job);
+
+	return job;
+}
+
+int run_config_job(struct config_job *job, char *resp)
+{
+	int			 ret;
+
+	pthread_mutex_lock(&jobs.lock);
+
+	while (blocked(job))
+		pthread_cond_wait(&jobs.changed, &jobs.lock);
+
+	job->state = JOB_RUNNING;
+
+	pthread_mutex_unlock(&jobs.lock);
+
+	ret = flush_config_ops(&job->ops, resp);
+
+	pthread_mutex_lock(&jobs.lock);
+	finish_job(job, ret);
+	pthread_mutex_unlock(&jobs.lock);
+
+	return ret;
+}
+
+static json_t *job_to_json(struct config_job *job, struct timeval *now)
+{
+	json_t			*obj;
+	long			 wait_ms = 0;
+	long			 run_ms = 0;
+
+	obj = json_object();
+	if (!obj)
+		return NULL;
+
+	switch (job->state) {
+	case JOB_QUEUED:
+		wait_ms = elapsed_ms(&job->queued, now);
+		break;
+	case JOB_RUNNING:
+		wait_ms = elapsed_ms(&job->queued, &job->started);
+		run_ms = elapsed_ms(&job->started, now);
+		break;
+	default:
+		wait_ms = elapsed_ms(&job->queued, &job->started);
+		run_ms = elapsed_ms(&job->started, &job->finished);
+	}
+
+	json_object_set_new(obj, TAG_ID, json_integer(job->id));
+	json_object_set_new(obj, TAG_STATE, json_string(job_state[job->state]));
+	json_object_set_new(obj, TAG_REQUEST, json_string(job->request));
+	json_object_set_new(obj, TAG_MESSAGE, json_string(job->message));
+	json_object_set_new(obj, TAG_WAIT_MS, json_integer(wait_ms));
+	json_object_set_new(obj, TAG_RUN_MS, json_integer(run_ms));
+
+	return obj;
+}
+
+static int dump_jobs(json_t *obj, char **resp)
+{
+	char			*p;
+
+	if (!obj) {
+		strcpy(*resp, "No memory!");
+		return -ENOMEM;
+	}
+
+	p = json_dumps(obj, 0);
+
+	json_decref(obj);
+
+	if (!p) {
+		strcpy(*resp, "No memory!");
+		return -ENOMEM;
+	}
+
+	free(*resp);
+	*resp = p;
+
+	return 0;
+}
+
+int show_config_jobs(char **resp)
+{
+	struct config_job	*job;
+	struct timeval		 now;
+	json_t			*obj;
+	json_t			*array;
+	int			 pending = 0;
+
+	obj = json_object();
+	array = json_array();
+	if (!obj || !array) {
+		json_decref(array);
+		json_decref(obj);
+		return dump_jobs(NULL, resp);
+	}
+
+	gettimeofday(&now, NULL);
+
+	pthread_mutex_lock(&jobs.lock);
+
+	list_for_each_entry(job, &jobs.queue, node) {
+		if (!job->async)
+			continue;
+
+		json_array_append_new(array, job_to_json(job, &now));
+		pending++;
+	}
+
+	list_for_each_entry(job, &jobs.history, node)
+		json_array_append_new(array, job_to_json(job, &now));
+
+	json_object_set_new(obj, TAG_PENDING, json_integer(pending));
+	json_object_set_new(obj, TAG_COMPLETED, json_integer(jobs.completed));
+	json_object_set_new(obj, TAG_FAILED, json_integer(jobs.failed));
+	json_object_set_new(obj, TAG_AVG_LATENCY, json_integer(jobs.completed ?
+			    jobs.total_ms / jobs.completed : 0));
+	json_object_set_new(obj, TAG_MAX_LATENCY, json_integer(jobs.max_ms));
+
+	pthread_mutex_unlock(&jobs.lock);
+
+	json_object_set_new(obj, TAG_JOBS, array);
+
+	return dump_jobs(obj, resp);
+}
+
+int show_config_job(char *id, char **resp)
+{
+	struct config_job	*job;
+	struct timeval		 now;
+	json_t			*obj = NULL;
+	long			 n;
+
+	n = strtol(id, NULL, 10);
+
+	gettimeofday(&now, NULL);
+
+	pthread_mutex_lock(&jobs.lock);
+
+	list_for_each_entry(job, &jobs.queue, node)
+		if (job->async && job->id == n)
+			goto found;
+
+	list_for_each_entry(job, &jobs.history, node)
+		if (job->id == n)
+			goto found;
+
+	pthread_mutex_unlock(&jobs.lock);
+
+	sprintf(*resp, "%s '%s' not found", TAG_JOB, id);
+
+	return -ENOENT;
+found:
+	obj = job_to_json(job, &now);
+
+	pthread_mutex_unlock(&jobs.lock);
+
+	return dump_jobs(obj, resp);
+}
+
+static void stop_job_threads(void)
+{
+	int			 i;
+
+	pthread_mutex_lock(&jobs.lock);
+	jobs.stopping = 1;
+	pthread_cond_broadcast(&jobs.changed);
+	pthread_mutex_unlock(&jobs.lock);
+
+	for (i = 0; i < jobs.num_threads; i++)
+		pthread_join(jobs.threads[i], NULL);
+
+	jobs.num_threads = 0;
+}
+
+int init_config_jobs(void)
+{
+	int			 ret;
+
+	INIT_LINKED_LIST(&jobs.queue);
+	INIT_LINKED_LIST(&jobs.history);
+
+	pthread_mutex_init(&jobs.lock, NULL);
+	pthread_cond_init(&jobs.changed, NULL);
+
+	while (jobs.num_threads < NUM_JOB_THREADS) {
+		ret = pthread_create(&jobs.threads[jobs.num_threads], NULL,
+				     job_thread, NULL);
+		if (ret) {
+			print_errno("failed to start config job thread", ret);
+			stop_job_threads();
+			return -ret;
+		}
+
+		jobs.num_threads++;
+	}
+
+	jobs.started = 1;
+
+	return 0;
+}
+
+/* jobs not yet run are dropped, their changes are already in the JSON
+ * store and are pushed when the targets are configured on the next start
+ */
+void cleanup_config_jobs(void)
+{
+	struct config_job	*job, *next;
+
+	if (!jobs.started)
+		return;
+
+	stop_job_threads();
+
+	list_for_each_entry_safe(job, next, &jobs.queue, node) {
+		free_config_ops(&job->ops);
+		free(job);
+	}
+
+	list_for_each_entry_safe(job, next, &jobs.history, node)
+		free(job);
+
+	pthread_cond_destroy(&jobs.changed);
+	pthread_mutex_destroy(&jobs.lock);
+
+	jobs.started = 0;
+}
@@ -0,0 +1,437 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Config journal.
+ *
+ * A store of the config appends what it changed to the journal as one
+ * line of JSON: for each of the targets, hosts and groups a map of name
+ * to the whole object, or to null if it was deleted.  A line is applied
+ * as a whole so a store of several changes, a batch among them, is never
+ * half persisted, and one cut short by a crash is dropped on replay.  On
+ * start the journal is replayed on top of the config file, which is then
+ * rewritten.
+ *
+ * The journal thread syncs the journal at most every JOURNAL_SYNC_MS and
+ * compacts it once it outgrows the config file: the config is copied
+ * under the read lock and the journal set aside for a new one, then the
+ * copy is written out and renamed over the config file and the old
+ * journal removed.  A line only ever sets or deletes whole objects, so
+ * replaying one again leaves the same config and a compaction cut short
+ * at any point loses nothing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "common.h"
+
+#define JOURNAL_SYNC_MS		100
+#define JOURNAL_MIN_SIZE	(256 * 1024)
+
+static struct {
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 changed;
+	char			 config[FILENAME_MAX + 1];
+	char			 snapshot[FILENAME_MAX + 1];
+	char			 current[FILENAME_MAX + 1];
+	char			 old[FILENAME_MAX + 1];
+	int			 fd;
+	off_t			 size;
+	off_t			 config_size;
+	int			 unsynced;
+	pthread_t		 thread;
+	int			 started;
+	int			 stopping;
+} journal;
+
+/* the rename of a file is only durable once its directory is synced */
+static void sync_config_dir(void)
+{
+	char			 dir[FILENAME_MAX + 1];
+	char			*p;
+	int			 fd;
+
+	strcpy(dir, journal.config);
+
+	p = strrchr(dir, '/');
+	if (!p)
+		strcpy(dir, ".");
+	else if (p == dir)
+		p[1] = 0;
+	else
+		*p = 0;
+
+	fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return;
+
+	fsync(fd);
+	close(fd);
+}
+
+static int write_snapshot(json_t *root)
+{
+	FILE			*fd;
+	struct stat		 st;
+	int			 ret = 0;
+
+	fd = fopen(journal.snapshot, "w");
+	if (!fd) {
+		ret = -errno;
+		goto err;
+	}
+
+	if (json_dumpf(root, fd, JSON_INDENT(2)))
+		ret = -EIO;
+	else if (fflush(fd) || fsync(fileno(fd)))
+		ret = -errno;
+
+	fclose(fd);
+
+	if (ret)
+		goto err;
+
+	if (rename(journal.snapshot, journal.config)) {
+		ret = -errno;
+		goto err;
+	}
+
+	sync_config_dir();
+
+	if (!stat(journal.config, &st))
+		journal.config_size = st.st_size;
+
+	return 0;
+err:
+	print_errno("unable to write config file", ret);
+	unlink(journal.snapshot);
+
+	return ret;
+}
+
+/* called with the config lock held exclusively, or before the journal
+ * is opened or after it is closed; everything journaled is in the
+ * config file once it is rewritten
+ */
+int write_config_file(json_t *root)
+{
+	int			 ret;
+
+	ret = write_snapshot(root);
+	if (ret)
+		return ret;
+
+	if (journal.fd < 0)
+		unlink(journal.current);
+	else if (!ftruncate(journal.fd, 0)) {
+		pthread_mutex_lock(&journal.lock);
+		journal.size = 0;
+		pthread_mutex_unlock(&journal.lock);
+	}
+
+	unlink(journal.old);
+
+	return 0;
+}
+
+/* called with the config lock held exclusively */
+int append_journal(json_t *changes)
+{
+	char			*line;
+	size_t			 len;
+	ssize_t			 n;
+	int			 ret = 0;
+
+	if (journal.fd < 0)
+		return -EBADF;
+
+	line = json_dumps(changes, JSON_COMPACT);
+	if (!line)
+		return -ENOMEM;
+
+	/* the terminating NUL is not written */
+	len = strlen(line);
+	line[len++] = '\n';
+
+	n = write(journal.fd, line, len);
+	if (n != (ssize_t) len) {
+		ret = (n < 0) ? -errno : -EIO;
+		print_errno("unable to append to config journal", ret);
+
+		/* a partial line would take the next one with it */
+		if (n > 0 && ftruncate(journal.fd, journal.size))
+			print_errno("unable to truncate config journal", errno);
+	}
+
+	free(line);
+
+	if (ret)
+		return ret;
+
+	pthread_mutex_lock(&journal.lock);
+
+	journal.size += len;
+
+	if (!journal.unsynced) {
+		journal.unsynced = 1;
+		pthread_cond_signal(&journal.changed);
+	}
+
+	pthread_mutex_unlock(&journal.lock);
+
+	return 0;
+}
+
+/* appends after the copy go to a new journal, the old one is kept for
+ * replay until the copy is the config file
+ */
+static int set_journal_aside(void)
+{
+	int			 fd;
+
+	/* left by a compaction that failed, it still has to be replayed */
+	if (!access(journal.old, F_OK))
+		return 0;
+
+	fdatasync(journal.fd);
+
+	if (rename(journal.current, journal.old))
+		return -errno;
+
+	fd = open(journal.current, O_WRONLY | O_CREAT | O_APPEND | O_TRUNC,
+		  0644);
+	if (fd < 0) {
+		rename(journal.old, journal.current);
+		return -errno;
+	}
+
+	close(journal.fd);
+	journal.fd = fd;
+
+	pthread_mutex_lock(&journal.lock);
+	journal.size = 0;
+	pthread_mutex_unlock(&journal.lock);
+
+	return 0;
+}
+
+static void compact_journal(void)
+{
+	json_t			*copy;
+	int			 ret;
+
+	json_read_lock();
+
+	copy = json_deep_copy(get_json_context()->root);
+	if (!copy) {
+		json_unlock();
+		print_err("no memory to compact config journal");
+		return;
+	}
+
+	ret = set_journal_aside();
+
+	json_unlock();
+
+	if (ret) {
+		print_errno("unable to set config journal aside", ret);
+		goto out;
+	}
+
+	if (!write_snapshot(copy))
+		unlink(journal.old);
+out:
+	json_decref(copy);
+}
+
+static void *journal_thread(void *arg)
+{
+	int			 compact;
+
+	(void) arg;
+
+	pthread_mutex_lock(&journal.lock);
+
+	while (!journal.stopping) {
+		if (!journal.unsynced) {
+			pthread_cond_wait(&journal.changed, &journal.lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&journal.lock);
+
+		/* stores made meanwhile share the sync */
+		usleep(JOURNAL_SYNC_MS * 1000);
+
+		pthread_mutex_lock(&journal.lock);
+
+		journal.unsynced = 0;
+		compact = journal.size > max(journal.config_size,
+					     (off_t) JOURNAL_MIN_SIZE);
+
+		pthread_mutex_unlock(&journal.lock);
+
+		if (fdatasync(journal.fd))
+			print_errno("unable to sync config journal", errno);
+
+		if (compact)
+			compact_journal();
+
+		pthread_mutex_lock(&journal.lock);
+	}
+
+	pthread_mutex_unlock(&journal.lock);
+
+	return NULL;
+}
+
+void init_journal(char *filename)
+{
+	snprintf(journal.config, FILENAME_MAX, "%s", filename);
+	snprintf(journal.snapshot, FILENAME_MAX, "%s%s", filename,
+		 NEW_FILE_SUFFIX);
+	snprintf(journal.current, FILENAME_MAX, "%s%s", filename,
+		 JOURNAL_SUFFIX);
+	snprintf(journal.old, FILENAME_MAX, "%s%s%s", filename,
+		 JOURNAL_SUFFIX, OLD_FILE_SUFFIX);
+
+	journal.fd = -1;
+
+	pthread_mutex_init(&journal.lock, NULL);
+	pthread_cond_init(&journal.changed, NULL);
+}
+
+static int replay_file(char *filename, void (*apply)(json_t *changes))
+{
+	FILE			*fd;
+	json_t			*changes;
+	json_error_t		 error;
+	char			*line = NULL;
+	size_t			 size = 0;
+	int			 count = 0;
+
+	fd = fopen(filename, "r");
+	if (!fd)
+		return 0;
+
+	while (getline(&line, &size, fd) > 0) {
+		changes = json_loads(line, 0, &error);
+		if (!changes || !json_is_object(changes)) {
+			print_err("%s: dropped partial change at line %d",
+				  filename, count + 1);
+			json_decref(changes);
+			break;
+		}
+
+		apply(changes);
+		json_decref(changes);
+		count++;
+	}
+
+	free(line);
+	fclose(fd);
+
+	return count;
+}
+
+/* returns the number of changes replayed */
+int replay_journal(void (*apply)(json_t *changes))
+{
+	return replay_file(journal.old, apply) +
+		replay_file(journal.current, apply);
+}
+
+/* if this fails every store rewrites the config file instead */
+int start_journal(void)
+{
+	struct stat		 st;
+	int			 ret;
+
+	journal.fd = open(journal.current, O_WRONLY | O_CREAT | O_APPEND,
+			  0644);
+	if (journal.fd < 0) {
+		ret = -errno;
+		goto err;
+	}
+
+	if (!fstat(journal.fd, &st))
+		journal.size = st.st_size;
+
+	if (!stat(journal.config, &st))
+		journal.config_size = st.st_size;
+
+	ret = pthread_create(&journal.thread, NULL, journal_thread, NULL);
+	if (ret) {
+		ret = -ret;
+		close(journal.fd);
+		journal.fd = -1;
+		goto err;
+	}
+
+	journal.started = 1;
+
+	return 0;
+err:
+	print_errno("unable to start config journal", ret);
+
+	return ret;
+}
+
+/* leaves the whole config in the config file */
+int stop_journal(json_t *root)
+{
+	if (journal.started) {
+		pthread_mutex_lock(&journal.lock);
+		journal.stopping = 1;
+		pthread_cond_signal(&journal.changed);
+		pthread_mutex_unlock(&journal.lock);
+
+		pthread_join(journal.thread, NULL);
+
+		journal.started = 0;
+	}
+
+	if (journal.fd >= 0) {
+		close(journal.fd);
+		journal.fd = -1;
+	}
+
+	return write_config_file(root);
+}
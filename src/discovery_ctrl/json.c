@@ -32,16 +32,28 @@
  * SOFTWARE.
  */
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include "common.h"
 #include "mongoose.h"
 
 static struct json_context *ctx;
 
+/* the top level arrays and the tag naming their objects */
+static const struct {
+	char			*list;
+	char			*tag;
+} gen_kinds[NUM_GEN_KINDS] = {
+	[GEN_TARGET]	= { TAG_TARGETS, TAG_ALIAS },
+	[GEN_HOST]	= { TAG_HOSTS, TAG_ALIAS },
+	[GEN_GROUP]	= { TAG_GROUPS, TAG_NAME },
+};
+
 /* helper functions */
 
 static int find_array(json_t *array, const char *tag, char *val,
@@ -115,138 +127,330 @@ static int find_array_string(json_t *array, char *val)
 	return -ENOENT;
 }
 
-static int strlen_array(json_t *array, char *tag)
+/* hash indexes of the top level arrays
+ *
+ * Targets, hosts and groups are looked up by name through a map built
+ * the first time the array is searched.  Every name added, renamed or
+ * removed goes through add_item(), rename_item() or del_item() so the
+ * map follows the array; one whose array was replaced is rebuilt.  The
+ * config sandbox sets the maps of the live arrays aside while it runs, see
+ * swap_json_root().  The map holds the array so it cannot be reused while
+ * indexed.  Lookups share the config lock so a rebuild takes the
+ * index lock; without a map the array is searched as before.
+ */
+static struct json_index {
+	int			 valid;
+	json_t			*array;
+	json_t			*map;
+} json_index[NUM_GEN_KINDS];
+
+/* those of the live arrays while the config sandbox runs */
+static struct json_index stashed_index[NUM_GEN_KINDS];
+
+static const char *item_name(int kind, json_t *item)
 {
-	json_t			*iter;
 	json_t			*obj;
-	int			 i, cnt;
-	int			 n = 0;
 
-	cnt = json_array_size(array);
+	obj = json_object_get(item, gen_kinds[kind].tag);
+	if (!obj || !json_is_string(obj))
+		return NULL;
 
-	for (i = 0; i < cnt; i++) {
+	return json_string_value(obj);
+}
+
+static int build_json_index(struct json_index *index, int kind,
+			    json_t *array)
+{
+	json_t			*iter;
+	const char		*name;
+	int			 i, n;
+
+	index->valid = 0;
+
+	if (!index->map) {
+		index->map = json_object();
+		if (!index->map)
+			return -ENOMEM;
+	} else
+		json_object_clear(index->map);
+
+	json_decref(index->array);
+	index->array = json_incref(array);
+
+	n = json_array_size(array);
+	for (i = 0; i < n; i++) {
 		iter = json_array_get(array, i);
 		if (!json_is_object(iter))
 			continue;
 
-		obj = json_object_get(iter, tag);
-		if (obj && json_is_string(obj))
-			n += strlen(json_string_value(obj)) + 4;
+		/* the first of a name is the one a search would find */
+		name = item_name(kind, iter);
+		if (!name || json_object_get(index->map, name))
+			continue;
+
+		if (json_object_set(index->map, name, iter))
+			return -ENOMEM;
 	}
 
-	return n;
+	index->valid = 1;
+
+	return 0;
 }
 
-static int list_array(json_t *array, char *tag, char *resp)
+/* called with the config lock held */
+static struct json_index *get_json_index(int kind)
 {
-	json_t			*iter;
-	json_t			*obj;
-	char			*p = resp;
-	int			 i, n, cnt;
+	struct json_index	*index = &json_index[kind];
+	json_t			*array;
+	int			 ret = 0;
 
-	cnt = json_array_size(array);
+	array = json_object_get(ctx->root, gen_kinds[kind].list);
 
-	for (i = 0; i < cnt; i++) {
-		iter = json_array_get(array, i);
-		if (!json_is_object(iter))
-			continue;
+	pthread_mutex_lock(&ctx->index_lock);
 
-		obj = json_object_get(iter, tag);
-		if (obj && json_is_string(obj))
-			array_json_string(obj, p, i, n);
+	if (!index->valid || index->array != array)
+		ret = build_json_index(index, kind, array);
+
+	pthread_mutex_unlock(&ctx->index_lock);
+
+	return ret ? NULL : index;
+}
+
+/* the objects changed since the last store by name, null for one that
+ * went away, go to the journal with the next store; one looked up with
+ * the config lock held exclusively is taken to have been changed
+ */
+static void note_item(int kind, const char *name, json_t *item)
+{
+	json_t			*map;
+
+	if (!ctx->changes || !name)
+		return;
+
+	map = json_object_get(ctx->changes, gen_kinds[kind].list);
+	if (!map) {
+		map = json_object();
+		if (json_object_set_new(ctx->changes, gen_kinds[kind].list,
+					map))
+			return;
 	}
 
-	return p - resp;
+	json_object_set_new(map, name, item ? json_incref(item) : json_null());
 }
 
-static int filter_fabric(json_t *array, char *query, char *resp)
+static inline void touch_item(int kind, json_t *item)
 {
-	json_t			*iter;
-	json_t			*list;
+	note_item(kind, item_name(kind, item), item);
+}
+
+static json_t *lookup_item(int kind, const char *name)
+{
+	struct json_index	*index;
+	json_t			*array;
 	json_t			*obj;
-	char			*p = resp;
-	int			 i, j, n = 0, tmp, num_targets, num_ports;
 
-	query += PARM_FABRIC_LEN;
+	index = get_json_index(kind);
+	if (index)
+		return json_object_get(index->map, name);
 
-	num_targets = json_array_size(array);
+	array = json_object_get(ctx->root, gen_kinds[kind].list);
+	if (find_array(array, gen_kinds[kind].tag, (char *) name, &obj) < 0)
+		obj = NULL;
 
-	for (i = 0; i < num_targets; i++) {
-		iter = json_array_get(array, i);
-		if (!json_is_object(iter))
-			continue;
+	return obj;
+}
 
-		list = json_object_get(iter, TAG_PORTIDS);
-		if (!list || !json_is_array(list))
-			continue;
+static int find_item(int kind, char *name, json_t **result)
+{
+	json_t			*obj;
 
-		num_ports = json_array_size(list);
+	obj = lookup_item(kind, name);
 
-		for (j = 0; j < num_ports; j++) {
-			obj = json_array_get(list, j);
-			if (!json_is_object(obj))
-				continue;
+	if (obj && ctx->writer)
+		touch_item(kind, obj);
 
-			obj = json_object_get(obj, TAG_TYPE);
-			if (!obj || !json_is_string(obj))
-				continue;
-			if (strcmp(query, json_string_value(obj)))
-				continue;
+	if (result)
+		*result = obj;
 
-			obj = json_object_get(iter, TAG_ALIAS);
-			if (!obj || !json_is_string(obj))
-				continue;
+	return obj ? 0 : -ENOENT;
+}
+
+/* the following are called with the config lock held exclusively */
+
+static void add_item(int kind, json_t *array, json_t *item)
+{
+	struct json_index	*index;
+	const char		*name;
+
+	/* brought up to the array before the item goes in */
+	index = get_json_index(kind);
+
+	json_array_append_new(array, item);
+
+	name = item_name(kind, item);
+	if (index && name && json_object_set(index->map, name, item))
+		index->valid = 0;
+
+	note_item(kind, name, item);
+}
+
+static void rename_item(int kind, json_t *item, const char *old)
+{
+	struct json_index	*index = &json_index[kind];
+	const char		*name = item_name(kind, item);
+
+	note_item(kind, old, NULL);
+	note_item(kind, name, item);
+
+	if (!index->valid)
+		return;
 
-			array_json_string(obj, p, n, tmp);
-			n++;
+	if (json_object_get(index->map, old) == item)
+		json_object_del(index->map, old);
+
+	if (name && json_object_set(index->map, name, item))
+		index->valid = 0;
+}
+
+static void del_item(int kind, json_t *array, json_t *item)
+{
+	struct json_index	*index = &json_index[kind];
+	const char		*name;
+	int			 i, n;
+
+	name = item_name(kind, item);
+	if (index->valid && name && json_object_get(index->map, name) == item)
+		json_object_del(index->map, name);
+
+	note_item(kind, name, NULL);
+
+	n = json_array_size(array);
+	for (i = 0; i < n; i++)
+		if (json_array_get(array, i) == item) {
+			json_array_remove(array, i);
+			break;
 		}
+}
+
+static void free_json_indexes(void)
+{
+	int			 i;
+
+	for (i = 0; i < NUM_GEN_KINDS; i++) {
+		json_decref(json_index[i].map);
+		json_decref(json_index[i].array);
+		memset(&json_index[i], 0, sizeof(json_index[i]));
 	}
+}
+
+/* listings and shows are copied out as text with the config lock held and
+ * written with it dropped, so a client that reads slowly does not hold up
+ * changes.  A list is copied a round of about LIST_ROUND_SIZE bytes at a
+ * time so the copy does not grow with the size of the config.
+ */
+#define LIST_ROUND_SIZE		16384
+
+struct text_buf {
+	char			*buf;
+	int			 len;
+	int			 size;
+};
+
+static int text_reserve(struct text_buf *text, int len)
+{
+	char			*buf;
+	int			 size;
+
+	if (text->len + len < text->size)
+		return 0;
 
-	return p - resp;
+	size = text->size ? text->size : LIST_ROUND_SIZE;
+	while (size <= text->len + len)
+		size *= 2;
+
+	buf = realloc(text->buf, size);
+	if (!buf)
+		return -ENOMEM;
+
+	text->buf = buf;
+	text->size = size;
+
+	return 0;
 }
 
-static int filter_mode(json_t *array, char *query, char *resp)
+static int text_printf(struct text_buf *text, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static int text_printf(struct text_buf *text, const char *fmt, ...)
 {
-	json_t			*iter;
-	json_t			*obj;
-	char			*p = resp;
-	int			 i, n = 0, tmp, num_targets;
+	va_list			 args;
+	int			 n;
 
-	query += PARM_MODE_LEN;
+	va_start(args, fmt);
+	n = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
 
-	num_targets = json_array_size(array);
+	if (text_reserve(text, n))
+		return -ENOMEM;
 
-	for (i = 0; i < num_targets; i++) {
-		iter = json_array_get(array, i);
-		if (!json_is_object(iter))
-			continue;
+	va_start(args, fmt);
+	vsnprintf(text->buf + text->len, text->size - text->len, fmt, args);
+	va_end(args);
 
-		obj = json_object_get(iter, TAG_MGMT_MODE);
-		if (!obj || !json_is_string(obj))
-			continue;
-		if (strcmp(query, json_string_value(obj)))
-			continue;
+	text->len += n;
 
-		obj = json_object_get(iter, TAG_ALIAS);
-		if (!obj || !json_is_string(obj))
-			continue;
+	return 0;
+}
 
-		array_json_string(obj, p, n, tmp);
-		n++;
-	}
+static int text_write(const char *buf, size_t len, void *data)
+{
+	struct text_buf		*text = data;
+
+	if (text_reserve(text, len))
+		return -ENOMEM;
+
+	memcpy(text->buf + text->len, buf, len);
+	text->len += len;
+
+	return 0;
+}
+
+/* called with the config lock held for reading */
+static int write_unlocked(struct text_buf *text, json_writer_t write,
+			  void *data)
+{
+	int			 ret;
+
+	json_unlock();
+	ret = write(text->buf, text->len, data) ? -EPIPE : 0;
+	json_read_lock();
+
+	text->len = 0;
+
+	return ret;
+}
+
+static int dump_json(json_t *obj, json_writer_t write, void *data)
+{
+	struct text_buf		 text = { NULL, 0, 0 };
+	int			 ret;
 
-	return p - resp;
+	if (json_dump_callback(obj, text_write, &text, 0))
+		ret = -ENOMEM;
+	else
+		ret = write_unlocked(&text, write, data);
+
+	free(text.buf);
+
+	return ret;
 }
 
-static int del_from_array(json_t *parent, const char *tag,
-			  char *value, const char *subgroup, char *subnqn)
+static int del_from_array(json_t *obj, const char *subgroup, char *subnqn)
 {
 	json_t			*array;
-	json_t			*obj;
 	int			 i;
 
-	i = find_array(parent, tag, value, &obj);
-	if (i < 0)
+	if (!obj)
 		goto err;
 
 	array = json_object_get(obj, subgroup);
@@ -260,157 +464,1005 @@ static int del_from_array(json_t *parent, const char *tag,
 	json_array_remove(array, i);
 
 	return 0;
-err:
-	return -ENOENT;
+err:
+	return -ENOENT;
+}
+
+static int del_int_from_array(json_t *obj, const char *subgroup,
+			      char *key, int val)
+{
+	json_t			*array;
+	int			 i;
+
+	if (!obj)
+		goto err;
+
+	array = json_object_get(obj, subgroup);
+	if (!array)
+		goto err;
+
+	i = find_array_int(array, key, val, NULL);
+	if (i < 0)
+		goto err;
+
+	json_array_remove(array, i);
+
+	return 0;
+err:
+	return -ENOENT;
+}
+
+/* a line of the journal */
+static void apply_changes(json_t *changes)
+{
+	json_t			*array;
+	json_t			*map;
+	json_t			*value;
+	json_t			*item;
+	const char		*name;
+	int			 kind;
+
+	for (kind = 0; kind < NUM_GEN_KINDS; kind++) {
+		map = json_object_get(changes, gen_kinds[kind].list);
+		if (!map)
+			continue;
+
+		array = json_object_get(ctx->root, gen_kinds[kind].list);
+		if (!array) {
+			array = json_array();
+			json_object_set_new(ctx->root, gen_kinds[kind].list,
+					    array);
+		}
+
+		json_object_foreach(map, name, value) {
+			find_item(kind, (char *) name, &item);
+
+			if (!json_is_object(value)) {
+				if (item)
+					del_item(kind, array, item);
+			} else if (item) {
+				json_object_clear(item);
+				json_object_update(item, value);
+			} else
+				add_item(kind, array, json_incref(value));
+		}
+	}
+}
+
+static void parse_config_file(void)
+{
+	json_t			*root;
+	json_error_t		 error;
+	int			 dirty = 0;
+
+	root = load_config_image(ctx->filename);
+	if (!root)
+		root = json_load_file(ctx->filename, JSON_DECODE_ANY, &error);
+	if (!root) {
+		root = json_object();
+		dirty = 1;
+	}
+
+	ctx->root = root;
+
+	if (replay_journal(apply_changes))
+		dirty = 1;
+
+	if (dirty)
+		write_config_file(root);
+
+	/* from here on changes are journaled */
+	ctx->changes = json_object();
+}
+
+static inline int invalid_json_syntax(char *resp)
+{
+	sprintf(resp, "invalid json syntax");
+	return -EINVAL;
+}
+
+/* walk all subsystem allowed host list for host name changes */
+static void rename_in_allowed_hosts(char *old, char *new)
+{
+	json_t			*targets;
+	json_t			*array;
+	json_t			*tgt;
+	json_t			*subsys;
+	json_t			*list;
+	json_t			*obj;
+	int			 idx;
+	int			 i, j;
+	int			 n, m;
+
+	targets = json_object_get(ctx->root, TAG_TARGETS);
+	if (!targets)
+		return;
+
+	n = json_array_size(targets);
+
+	for (i = 0; i < n; i++) {
+		tgt = json_array_get(targets, i);
+
+		array = json_object_get(tgt, TAG_SUBSYSTEMS);
+		if (!array)
+			continue;
+
+		m = json_array_size(array);
+
+		for (j = 0; j < m; j++) {
+			subsys = json_array_get(array, j);
+
+			list = json_object_get(subsys, TAG_HOSTS);
+			if (!list)
+				continue;
+
+			idx = find_array_string(list, old);
+			if (idx >= 0) {
+				obj = json_array_get(list, idx);
+				json_string_set(obj, new);
+				touch_item(GEN_TARGET, tgt);
+			}
+		}
+	}
+}
+
+/* walk all subsystem allowed host list for host deletions */
+static void del_from_allowed_hosts(char *alias)
+{
+	json_t			*targets;
+	json_t			*array;
+	json_t			*tgt;
+	json_t			*subsys;
+	json_t			*list;
+	int			 idx;
+	int			 i, j;
+	int			 n, m;
+
+	targets = json_object_get(ctx->root, TAG_TARGETS);
+	if (!targets)
+		return;
+
+	n = json_array_size(targets);
+
+	for (i = 0; i < n; i++) {
+		tgt = json_array_get(targets, i);
+
+		array = json_object_get(tgt, TAG_SUBSYSTEMS);
+		if (!array)
+			continue;
+
+		m = json_array_size(array);
+
+		for (j = 0; j < m; j++) {
+			subsys = json_array_get(array, j);
+
+			list = json_object_get(subsys, TAG_HOSTS);
+			if (!list)
+				continue;
+
+			idx = find_array_string(list, alias);
+			if (idx >= 0) {
+				json_array_remove(list, idx);
+				touch_item(GEN_TARGET, tgt);
+			}
+		}
+	}
+}
+
+/* command functions */
+
+/* only what changed is written, to the journal; without one the whole
+ * config file is rewritten
+ */
+void store_json_config_file(void)
+{
+	int			 ret;
+
+	if (ctx->batch) {
+		ctx->dirty = 1;
+		return;
+	}
+
+	if (!ctx->changes) {
+		write_config_file(ctx->root);
+		return;
+	}
+
+	if (!json_object_size(ctx->changes))
+		return;
+
+	ret = append_journal(ctx->changes);
+	if (ret == -EBADF)
+		ret = write_config_file(ctx->root);
+
+	/* if not written they go with the next store */
+	if (!ret)
+		json_object_clear(ctx->changes);
+}
+
+/* called with the config lock held exclusively, the config file is
+ * rewritten once at the end of the batch if anything changed
+ */
+void begin_json_batch(void)
+{
+	ctx->batch++;
+}
+
+void end_json_batch(void)
+{
+	if (--ctx->batch)
+		return;
+
+	if (ctx->dirty) {
+		ctx->dirty = 0;
+		store_json_config_file();
+	}
+}
+
+/* lets a batch be tried against a scratch copy of the config, what is
+ * pending a store only ever refers to the root it was made to so the
+ * changes not yet stored are set aside until the live root is back.  The
+ * indexes of the live arrays are kept rather than rebuilt on the way back;
+ * what the batch changed is in ctx->changes until the live root returns.
+ */
+json_t *swap_json_root(json_t *root)
+{
+	json_t			*old = ctx->root;
+
+	ctx->root = root;
+	ctx->dirty = 0;
+
+	if (root == ctx->stashed_root) {
+		json_decref(ctx->changes);
+		ctx->changes = ctx->stashed_changes;
+		ctx->stashed_root = NULL;
+		ctx->stashed_changes = NULL;
+
+		free_json_indexes();
+		memcpy(json_index, stashed_index, sizeof(json_index));
+		memset(stashed_index, 0, sizeof(stashed_index));
+	} else {
+		ctx->stashed_root = old;
+		ctx->stashed_changes = ctx->changes;
+		ctx->changes = json_object();
+
+		memcpy(stashed_index, json_index, sizeof(json_index));
+		memset(json_index, 0, sizeof(json_index));
+	}
+
+	return old;
+}
+
+/* the scope of a batch maps each kind's list to the names the batch may
+ * touch, true for the ones it changes through their own URI
+ */
+int add_json_scope(json_t *scope, int kind, const char *name, int changed)
+{
+	const char		*list = gen_kinds[kind].list;
+	json_t			*names;
+
+	names = json_object_get(scope, list);
+	if (!names) {
+		names = json_object();
+		if (json_object_set_new(scope, list, names))
+			return -ENOMEM;
+	}
+
+	if (!changed && json_object_get(names, name))
+		return 0;
+
+	if (json_object_set_new(names, name, json_boolean(changed)))
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int changes_any(json_t *scope, int kind)
+{
+	json_t			*names;
+	json_t			*value;
+	const char		*name;
+
+	names = json_object_get(scope, gen_kinds[kind].list);
+	json_object_foreach(names, name, value)
+		if (json_is_true(value))
+			return 1;
+
+	return 0;
+}
+
+/* whether the array names anything the batch changes */
+static int names_changed(json_t *scope, int kind, json_t *array)
+{
+	json_t			*names;
+	json_t			*iter;
+	int			 i, n;
+
+	names = json_object_get(scope, gen_kinds[kind].list);
+
+	n = json_array_size(array);
+	for (i = 0; i < n; i++) {
+		iter = json_array_get(array, i);
+		if (json_is_string(iter) &&
+		    json_is_true(json_object_get(names,
+						 json_string_value(iter))))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int add_strings_to_scope(json_t *scope, int kind, json_t *array)
+{
+	json_t			*iter;
+	int			 i, n;
+
+	n = json_array_size(array);
+	for (i = 0; i < n; i++) {
+		iter = json_array_get(array, i);
+		if (json_is_string(iter) &&
+		    add_json_scope(scope, kind, json_string_value(iter), 0))
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static int add_item_to_scope(json_t *scope, int kind, json_t *item)
+{
+	const char		*name = item_name(kind, item);
+
+	if (!name)
+		return 0;
+
+	return add_json_scope(scope, kind, name, 0);
+}
+
+/* a host renamed or deleted is rewritten in the targets and groups naming
+ * it, as is a target in its groups, so those come along
+ */
+static int add_referrers(json_t *scope)
+{
+	json_t			*array;
+	json_t			*item;
+	json_t			*list;
+	json_t			*hosts;
+	int			 i, j, n, m;
+
+	if (!changes_any(scope, GEN_HOST))
+		goto groups;
+
+	array = json_object_get(ctx->root, TAG_TARGETS);
+	n = json_array_size(array);
+	for (i = 0; i < n; i++) {
+		item = json_array_get(array, i);
+		list = json_object_get(item, TAG_SUBSYSTEMS);
+		m = json_array_size(list);
+		for (j = 0; j < m; j++) {
+			hosts = json_object_get(json_array_get(list, j),
+						TAG_HOSTS);
+			if (names_changed(scope, GEN_HOST, hosts)) {
+				if (add_item_to_scope(scope, GEN_TARGET, item))
+					return -ENOMEM;
+				break;
+			}
+		}
+	}
+groups:
+	if (!changes_any(scope, GEN_TARGET) && !changes_any(scope, GEN_HOST))
+		return 0;
+
+	array = json_object_get(ctx->root, TAG_GROUPS);
+	n = json_array_size(array);
+	for (i = 0; i < n; i++) {
+		item = json_array_get(array, i);
+		if ((names_changed(scope, GEN_TARGET,
+				   json_object_get(item, TAG_TARGETS)) ||
+		     names_changed(scope, GEN_HOST,
+				   json_object_get(item, TAG_HOSTS))) &&
+		    add_item_to_scope(scope, GEN_GROUP, item))
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/* the hosts a target lets in and those of a group are needed to build
+ * them the same in the sandbox
+ */
+static int add_referenced(json_t *scope)
+{
+	json_t			*names;
+	json_t			*value;
+	json_t			*item;
+	json_t			*list;
+	const char		*name;
+	int			 i, n;
+
+	names = json_object_get(scope, TAG_TARGETS);
+	json_object_foreach(names, name, value) {
+		item = lookup_item(GEN_TARGET, name);
+		list = json_object_get(item, TAG_SUBSYSTEMS);
+		n = json_array_size(list);
+		for (i = 0; i < n; i++)
+			if (add_strings_to_scope(scope, GEN_HOST,
+						 json_object_get(
+						 json_array_get(list, i),
+						 TAG_HOSTS)))
+				return -ENOMEM;
+	}
+
+	names = json_object_get(scope, TAG_GROUPS);
+	json_object_foreach(names, name, value) {
+		item = lookup_item(GEN_GROUP, name);
+		if (add_strings_to_scope(scope, GEN_HOST,
+					 json_object_get(item, TAG_HOSTS)))
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static int is_gen_list(const char *key)
+{
+	int			 kind;
+
+	for (kind = 0; kind < NUM_GEN_KINDS; kind++)
+		if (!strcmp(key, gen_kinds[kind].list))
+			return 1;
+
+	return 0;
+}
+
+/* the root a batch is tried against, holding copies of just the targets,
+ * hosts and groups in its scope and what they need; anything else looks
+ * to the batch as if it did not exist.  The rest of the live root is
+ * shared, a batch only changes the lists.
+ */
+json_t *scoped_json_root(json_t *scope)
+{
+	json_t			*root;
+	json_t			*array;
+	json_t			*names;
+	json_t			*value;
+	json_t			*item;
+	const char		*name;
+	int			 kind;
+
+	if (add_referrers(scope) || add_referenced(scope))
+		return NULL;
+
+	root = json_object();
+	if (!root)
+		return NULL;
+
+	json_object_foreach(ctx->root, name, value)
+		if (!is_gen_list(name) && json_object_set(root, name, value))
+			goto err;
+
+	for (kind = 0; kind < NUM_GEN_KINDS; kind++) {
+		array = json_array();
+		if (json_object_set_new(root, gen_kinds[kind].list, array))
+			goto err;
+
+		names = json_object_get(scope, gen_kinds[kind].list);
+		json_object_foreach(names, name, value) {
+			item = lookup_item(kind, name);
+			if (item && json_array_append_new(array,
+							  json_deep_copy(item)))
+				goto err;
+		}
+	}
+
+	return root;
+err:
+	json_decref(root);
+
+	return NULL;
+}
+
+/* called with the config lock held */
+json_t *get_json_item(int kind, char *name)
+{
+	return lookup_item(kind, name);
+}
+
+/* generation numbers for conditional GETs
+ *
+ * Every change bumps the number of the object it was made to and of its
+ * collection.  An object that goes away (deleted or renamed) also bumps
+ * the floor of its kind: a new object reusing the name must not match an
+ * old ETag, and other objects that named it have been rewritten.  The
+ * numbers are not persisted, ETags also carry the time the DC started.
+ * Called with the config lock held, exclusively to bump.
+ */
+#define GEN_HASH_SIZE		256
+
+struct generation {
+	struct generation	*next;
+	unsigned long		 gen;
+	char			 name[MAX_ALIAS_SIZE + 1];
+};
+
+static struct generation	*generations[NUM_GEN_KINDS][GEN_HASH_SIZE];
+static unsigned long		 collection_gen[NUM_GEN_KINDS];
+static unsigned long		 floor_gen[NUM_GEN_KINDS];
+static unsigned long		 last_gen;
+
+static unsigned int gen_hash(char *name)
+{
+	unsigned int		 hash = 5381;
+
+	while (*name)
+		hash = hash * 33 + (unsigned char) *name++;
+
+	return hash % GEN_HASH_SIZE;
+}
+
+static struct generation *find_generation(int kind, char *name, int add)
+{
+	struct generation	**head = &generations[kind][gen_hash(name)];
+	struct generation	*entry;
+
+	for (entry = *head; entry; entry = entry->next)
+		if (!strncmp(entry->name, name, MAX_ALIAS_SIZE))
+			return entry;
+
+	if (!add)
+		return NULL;
+
+	entry = malloc(sizeof(*entry));
+	if (!entry)
+		return NULL;
+
+	memset(entry, 0, sizeof(*entry));
+	strncpy(entry->name, name, MAX_ALIAS_SIZE);
+
+	entry->next = *head;
+	*head = entry;
+
+	return entry;
+}
+
+void bump_json_generation(int kind, char *name)
+{
+	struct generation	*entry;
+
+	collection_gen[kind] = ++last_gen;
+
+	if (!name || !*name)
+		return;
+
+	entry = find_generation(kind, name, 1);
+	if (entry)
+		entry->gen = last_gen;
+	else
+		floor_gen[kind] = last_gen;
+
+	if (find_item(kind, name, NULL) < 0)
+		floor_gen[kind] = last_gen;
+}
+
+/* a NULL name is the collection, lists only carry names but filters on
+ * them look at the content so any change to a member counts
+ */
+unsigned long json_generation(int kind, char *name)
+{
+	struct generation	*entry;
+	unsigned long		 gen;
+
+	if (!name || !*name)
+		return collection_gen[kind];
+
+	gen = floor_gen[kind];
+
+	entry = find_generation(kind, name, 0);
+	if (entry && entry->gen > gen)
+		gen = entry->gen;
+
+	/* shows also change with the objects they refer to */
+	if (kind == GEN_TARGET)
+		gen = max(gen, floor_gen[GEN_HOST]);
+	else if (kind == GEN_HOST)
+		gen = max(gen, collection_gen[GEN_TARGET]);
+	else if (kind == GEN_GROUP)
+		gen = max(gen, max(floor_gen[GEN_TARGET],
+				   floor_gen[GEN_HOST]));
+
+	return gen;
+}
+
+unsigned long json_epoch(void)
+{
+	return ctx->epoch;
+}
+
+/* sorted name indexes for the lists
+ *
+ * Each collection is listed from an array of its names in order, rebuilt
+ * the first time it is listed after the collection's generation moves.
+ * Paging and the name prefix are then a binary search into it and the
+ * other filters only look at the entries from there on, stopping at the
+ * end of the page.  Lists share the config lock so a rebuild takes its
+ * own lock; an index cannot change while any list holds the config lock.
+ */
+struct list_entry {
+	const char		*name;
+	json_t			*obj;
+};
+
+static struct list_index {
+	int			 built;
+	unsigned long		 gen;
+	json_t			*array;
+	struct list_entry	*entries;
+	int			 count;
+	int			 size;
+} list_index[NUM_GEN_KINDS];
+
+struct list_filter {
+	struct list_query	*query;
+	const char		**members;	/* in the group, sorted */
+	int			 num_members;
+};
+
+static int cmp_entry(const void *a, const void *b)
+{
+	return strcmp(((struct list_entry *) a)->name,
+		      ((struct list_entry *) b)->name);
+}
+
+static int cmp_name(const void *a, const void *b)
+{
+	return strcmp(*(const char **) a, *(const char **) b);
+}
+
+static int build_list_index(struct list_index *index, int kind,
+			    json_t *array)
+{
+	struct list_entry	*entries;
+	json_t			*iter;
+	json_t			*obj;
+	int			 i, cnt;
+
+	cnt = json_array_size(array);
+
+	if (cnt > index->size) {
+		entries = realloc(index->entries, cnt * sizeof(*entries));
+		if (!entries)
+			return -ENOMEM;
+
+		index->entries = entries;
+		index->size = cnt;
+	}
+
+	index->count = 0;
+
+	for (i = 0; i < cnt; i++) {
+		iter = json_array_get(array, i);
+		if (!json_is_object(iter))
+			continue;
+
+		obj = json_object_get(iter, gen_kinds[kind].tag);
+		if (!obj || !json_is_string(obj))
+			continue;
+
+		index->entries[index->count].name = json_string_value(obj);
+		index->entries[index->count++].obj = iter;
+	}
+
+	qsort(index->entries, index->count, sizeof(*index->entries),
+	      cmp_entry);
+
+	index->array = array;
+	index->gen = collection_gen[kind];
+	index->built = 1;
+
+	return 0;
+}
+
+/* called with the config lock held */
+static struct list_index *get_list_index(int kind)
+{
+	struct list_index	*index = &list_index[kind];
+	json_t			*array;
+	int			 ret = 0;
+
+	array = json_object_get(ctx->root, gen_kinds[kind].list);
+
+	pthread_mutex_lock(&ctx->index_lock);
+
+	if (!index->built || index->gen != collection_gen[kind] ||
+	    index->array != array)
+		ret = build_list_index(index, kind, array);
+
+	pthread_mutex_unlock(&ctx->index_lock);
+
+	return ret ? NULL : index;
+}
+
+/* first entry whose name compares above key, or not below it if !upper;
+ * a len compares only the first len characters
+ */
+static int index_bound(struct list_index *index, const char *key, int len,
+		       int upper)
+{
+	int			 lo = 0;
+	int			 hi = index->count;
+	int			 mid;
+	int			 cmp;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (len)
+			cmp = strncmp(index->entries[mid].name, key, len);
+		else
+			cmp = strcmp(index->entries[mid].name, key);
+
+		if (cmp > 0 || (!upper && !cmp))
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return lo;
+}
+
+/* the first entry after the given name, -1 or count if there is none */
+static int first_list_entry(struct list_index *index,
+			    struct list_query *query, const char *after)
+{
+	int			 len = strlen(query->alias);
+	int			 i, j;
+
+	if (!query->descending) {
+		i = len ? index_bound(index, query->alias, len, 0) : 0;
+		j = *after ? index_bound(index, after, 0, 1) : 0;
+
+		return max(i, j);
+	}
+
+	i = len ? index_bound(index, query->alias, len, 1) : index->count;
+	j = *after ? index_bound(index, after, 0, 0) : index->count;
+
+	return ((i < j) ? i : j) - 1;
+}
+
+static int has_member(json_t *array, const char *tag, char *value)
+{
+	json_t			*iter;
+	json_t			*obj;
+	int			 i, cnt;
+
+	cnt = json_array_size(array);
+
+	for (i = 0; i < cnt; i++) {
+		iter = json_array_get(array, i);
+		obj = json_object_get(iter, tag);
+		if (obj && json_is_string(obj) &&
+		    !strcmp(value, json_string_value(obj)))
+			return 1;
+	}
+
+	return 0;
 }
 
-static int del_int_from_array(json_t *parent, const char *tag,
-			      char *value, const char *subgroup,
-			      char *key, int val)
+static int match_list_entry(struct list_filter *filter,
+			    struct list_entry *entry)
 {
-	json_t			*array;
-	json_t			*obj;
-	int			 i;
+	struct list_query	*query = filter->query;
+	json_t			*obj = entry->obj;
+	json_t			*tmp;
 
-	i = find_array(parent, tag, value, &obj);
-	if (i < 0)
-		goto err;
+	if (*query->group && !bsearch(&entry->name, filter->members,
+				      filter->num_members,
+				      sizeof(*filter->members), cmp_name))
+		return 0;
 
-	array = json_object_get(obj, subgroup);
-	if (!array)
-		goto err;
+	if (*query->mode) {
+		tmp = json_object_get(obj, TAG_MGMT_MODE);
+		if (!tmp || !json_is_string(tmp) ||
+		    strcmp(query->mode, json_string_value(tmp)))
+			return 0;
+	}
 
-	i = find_array_int(array, key, val, NULL);
-	if (i < 0)
-		goto err;
+	tmp = json_object_get(obj, TAG_PORTIDS);
 
-	json_array_remove(array, i);
+	if (*query->fabric && !has_member(tmp, TAG_TYPE, query->fabric))
+		return 0;
 
-	return 0;
-err:
-	return -ENOENT;
+	if (*query->address && !has_member(tmp, TAG_ADDRESS, query->address))
+		return 0;
+
+	if (!*query->nqn)
+		return 1;
+
+	/* a target by the subsystems it exports, a host by its own NQN */
+	tmp = json_object_get(obj, TAG_HOSTNQN);
+	if (tmp)
+		return json_is_string(tmp) &&
+			!strcmp(query->nqn, json_string_value(tmp));
+
+	tmp = json_object_get(obj, TAG_SUBSYSTEMS);
+
+	return has_member(tmp, TAG_SUBNQN, query->nqn);
 }
 
-static void parse_config_file(void)
+/* the names of the group's members of the kind being listed */
+static int get_group_members(struct list_filter *filter, char *parent_tag)
 {
-	json_t			*root;
-	json_error_t		 error;
-	int			 dirty = 0;
+	json_t			*group;
+	json_t			*array;
+	json_t			*obj;
+	int			 i, cnt;
 
-	root = json_load_file(ctx->filename, JSON_DECODE_ANY, &error);
-	if (!root) {
-		root = json_object();
-		dirty = 1;
+	if (find_item(GEN_GROUP, filter->query->group, &group) < 0)
+		return 0;
+
+	array = json_object_get(group, parent_tag);
+	cnt = json_array_size(array);
+	if (!cnt)
+		return 0;
+
+	filter->members = malloc(cnt * sizeof(*filter->members));
+	if (!filter->members)
+		return -ENOMEM;
+
+	for (i = 0; i < cnt; i++) {
+		obj = json_array_get(array, i);
+		if (json_is_string(obj))
+			filter->members[filter->num_members++] =
+				json_string_value(obj);
 	}
 
-	ctx->root = root;
+	qsort(filter->members, filter->num_members,
+	      sizeof(*filter->members), cmp_name);
 
-	if (dirty)
-		store_json_config_file();
+	return 0;
 }
 
-static inline int invalid_json_syntax(char *resp)
+/* a round of a list, the names after last the query accepts until about
+ * LIST_ROUND_SIZE bytes of them are copied.  Returns 1 once the list is
+ * done; last is left as the final name copied.
+ */
+static int copy_list_round(int kind, struct list_query *query,
+			   struct text_buf *text, char *last, int *n)
 {
-	sprintf(resp, "invalid json syntax");
-	return -EINVAL;
-}
+	struct list_index	*index;
+	struct list_filter	 filter;
+	struct list_entry	*entry;
+	int			 len = strlen(query->alias);
+	int			 step = query->descending ? -1 : 1;
+	int			 i;
+	int			 ret;
 
-/* walk all subsystem allowed host list for host name changes */
-static void rename_in_allowed_hosts(char *old, char *new)
-{
-	json_t			*targets;
-	json_t			*array;
-	json_t			*tgt;
-	json_t			*subsys;
-	json_t			*list;
-	json_t			*obj;
-	int			 idx;
-	int			 i, j;
-	int			 n, m;
+	memset(&filter, 0, sizeof(filter));
+	filter.query = query;
 
-	targets = json_object_get(ctx->root, TAG_TARGETS);
-	if (!targets)
-		return;
+	index = get_list_index(kind);
+	if (!index)
+		return -ENOMEM;
 
-	n = json_array_size(targets);
+	if (*query->group) {
+		ret = get_group_members(&filter, gen_kinds[kind].list);
+		if (ret)
+			return ret;
+	}
 
-	for (i = 0; i < n; i++) {
-		tgt = json_array_get(targets, i);
+	for (i = first_list_entry(index, query, last);
+	     i >= 0 && i < index->count; i += step) {
+		entry = &index->entries[i];
 
-		array = json_object_get(tgt, TAG_SUBSYSTEMS);
-		if (!array)
+		/* the prefix is a range of the index */
+		if (len && strncmp(entry->name, query->alias, len))
+			break;
+
+		if (!match_list_entry(&filter, entry))
 			continue;
 
-		m = json_array_size(array);
+		if (query->limit && *n == query->limit) {
+			ret = text_printf(text, "]," JSSTR "}", TAG_NEXT,
+					  last);
+			goto done;
+		}
 
-		for (j = 0; j < m; j++) {
-			subsys = json_array_get(array, j);
+		if (text->len >= LIST_ROUND_SIZE) {
+			ret = 0;
+			goto out;
+		}
 
-			list = json_object_get(subsys, TAG_HOSTS);
-			if (!list)
-				continue;
+		ret = text_printf(text, "%s\"%s\"", (*n)++ ? "," : "",
+				  entry->name);
+		if (ret)
+			goto out;
 
-			idx = find_array_string(list, old);
-			if (idx >= 0) {
-				obj = json_array_get(list, idx);
-				json_string_set(obj, new);
-			}
-		}
+		snprintf(last, MAX_NQN_SIZE + 1, "%s", entry->name);
 	}
+
+	ret = text_printf(text, "]}");
+done:
+	if (!ret)
+		ret = 1;
+out:
+	free(filter.members);
+
+	return ret;
 }
 
-/* walk all subsystem allowed host list for host deletions */
-static void del_from_allowed_hosts(char *alias)
+/* writes {"<list>":["<name>",...]} for a page of the entries the query
+ * accepts, with "Next":"<name>" when there are more.  Each round picks up
+ * after the last name written, so names added or removed between rounds
+ * may or may not be listed but none is listed twice or out of order.
+ */
+static int write_json_list(int kind, struct list_query *query,
+			   json_writer_t write, void *data)
 {
-	json_t			*targets;
-	json_t			*array;
-	json_t			*tgt;
-	json_t			*subsys;
-	json_t			*list;
-	int			 idx;
-	int			 i, j;
-	int			 n, m;
+	struct text_buf		 text = { NULL, 0, 0 };
+	char			 last[MAX_NQN_SIZE + 1];
+	int			 n = 0;
+	int			 done;
+	int			 ret;
 
-	targets = json_object_get(ctx->root, TAG_TARGETS);
-	if (!targets)
-		return;
+	snprintf(last, sizeof(last), "%s", query->after);
 
-	n = json_array_size(targets);
+	ret = text_printf(&text, "{" JSARRAY, gen_kinds[kind].list);
 
-	for (i = 0; i < n; i++) {
-		tgt = json_array_get(targets, i);
+	while (!ret) {
+		ret = copy_list_round(kind, query, &text, last, &n);
+		if (ret < 0)
+			break;
 
-		array = json_object_get(tgt, TAG_SUBSYSTEMS);
-		if (!array)
-			continue;
+		done = ret;
+		ret = write_unlocked(&text, write, data);
+		if (!ret && done)
+			break;
+	}
 
-		m = json_array_size(array);
+	free(text.buf);
 
-		for (j = 0; j < m; j++) {
-			subsys = json_array_get(array, i);
+	return ret;
+}
 
-			list = json_object_get(subsys, TAG_HOSTS);
-			if (!list)
-				continue;
+static void free_list_indexes(void)
+{
+	int			 i;
 
-			idx = find_array_string(list, alias);
-			if (idx >= 0)
-				json_array_remove(array, idx);
-		}
+	for (i = 0; i < NUM_GEN_KINDS; i++) {
+		free(list_index[i].entries);
+		memset(&list_index[i], 0, sizeof(list_index[i]));
 	}
 }
 
-/* command functions */
+/* makes what a batch changed in the sandbox part of the live config.  The
+ * objects are updated in place, so what the lists point at stays valid, or
+ * are moved over from the sandbox as they are; nothing is checked again.
+ * Their names are new strings though, so the sorted indexes of the kinds
+ * changed are rebuilt.
+ */
+void commit_json_changes(json_t *changes)
+{
+	int			 kind;
 
-void store_json_config_file(void)
+	apply_changes(changes);
+
+	for (kind = 0; kind < NUM_GEN_KINDS; kind++)
+		if (json_object_get(changes, gen_kinds[kind].list))
+			list_index[kind].built = 0;
+
+	store_json_config_file();
+}
+
+static void free_generations(void)
 {
-	json_t			*root = ctx->root;
-	char			*filename = ctx->filename;
-	int			 ret;
+	struct generation	*entry;
+	int			 i, j;
 
-	ret = json_dump_file(root, filename, 2);
-	if (ret)
-		print_errno("json_dump_file failed", ret);
+	for (i = 0; i < NUM_GEN_KINDS; i++)
+		for (j = 0; j < GEN_HASH_SIZE; j++)
+			while ((entry = generations[i][j])) {
+				generations[i][j] = entry->next;
+				free(entry);
+			}
 }
 
 struct json_context *get_json_context(void)
@@ -418,14 +1470,34 @@ struct json_context *get_json_context(void)
 	return ctx;
 }
 
-void json_spinlock(void)
+/* The config lock covers the JSON document and the in-memory lists built
+ * from it.  Readers (GETs, log page builders) share it; anything that
+ * changes the configuration holds it exclusively.  I/O to a target is never
+ * done with it held, see flush_config_ops().
+ *
+ * There is one lock rather than one per target, host or group: a change to
+ * any of them edits the shared arrays of the one document, the name indexes
+ * and often the ACLs and groups of the others, and with target I/O done
+ * after it is dropped a change holds it only for those updates.
+ */
+void json_read_lock(void)
+{
+	pthread_rwlock_rdlock(&ctx->lock);
+}
+
+void json_write_lock(void)
 {
-	pthread_spin_lock(&ctx->lock);
+	pthread_rwlock_wrlock(&ctx->lock);
+	ctx->writer = 1;
 }
 
-void json_spinunlock(void)
+/* a reader only ever sees writer clear */
+void json_unlock(void)
 {
-	pthread_spin_unlock(&ctx->lock);
+	if (ctx->writer)
+		ctx->writer = 0;
+
+	pthread_rwlock_unlock(&ctx->lock);
 }
 
 int init_json(char *filename)
@@ -434,63 +1506,41 @@ int init_json(char *filename)
 	if (!ctx)
 		return -ENOMEM;
 
+	memset(ctx, 0, sizeof(*ctx));
+
 	strncpy(ctx->filename, filename, sizeof(ctx->filename));
 
-	pthread_spin_init(&ctx->lock, PTHREAD_PROCESS_SHARED);
+	ctx->epoch = time(NULL);
 
-	parse_config_file();
+	pthread_rwlock_init(&ctx->lock, NULL);
+	pthread_mutex_init(&ctx->index_lock, NULL);
 
-	return 0;
-}
+	init_journal(ctx->filename);
 
-void cleanup_json(void)
-{
-	json_decref(ctx->root);
+	parse_config_file();
 
-	pthread_spin_destroy(&ctx->lock);
+	start_journal();
 
-	free(ctx);
+	return 0;
 }
 
-static int _list_target(char *query, char **resp, int offset)
+void cleanup_json(void)
 {
-	json_t			*targets;
-	char			*p = *resp + offset;
-	char			*new;
-	int			 n;
-	int			 cnt;
-	int			 max = BODY_SIZE - 32;
-
-	targets = json_object_get(ctx->root, TAG_TARGETS);
+	/* the image is only good for as long as the config file is */
+	if (!stop_journal(ctx->root))
+		write_config_image(ctx->root, ctx->filename);
 
-	start_json_array(TAG_TARGETS, p, n);
-
-	cnt = n;
-
-	if (targets) {
-		n = strlen_array(targets, TAG_ALIAS);
-		if (n > max) {
-			max += n - BODY_SIZE;
-			new = realloc(*resp, max);
-			if (!new)
-				goto out;
-			*resp = new;
-			p = new + cnt + offset;
-		}
+	free_generations();
+	free_list_indexes();
+	free_json_indexes();
 
-		if (query == NULL)
-			n = list_array(targets, TAG_ALIAS, p);
-		else if (strncmp(query, URI_PARM_MODE, PARM_MODE_LEN) == 0)
-			n = filter_mode(targets, query, p);
-		else if (strncmp(query, URI_PARM_FABRIC, PARM_FABRIC_LEN) == 0)
-			n = filter_fabric(targets, query, p);
+	json_decref(ctx->changes);
+	json_decref(ctx->root);
 
-		p += n;
-	}
-out:
-	end_json_array(p, n);
+	pthread_rwlock_destroy(&ctx->lock);
+	pthread_mutex_destroy(&ctx->index_lock);
 
-	return p - *resp;
+	free(ctx);
 }
 
 /* GROUPS */
@@ -507,7 +1557,7 @@ int add_json_group(char *group, char *resp)
 		groups = json_array();
 		json_object_set_new(ctx->root, TAG_GROUPS, groups);
 	} else {
-		i = find_array(groups, TAG_NAME, group, NULL);
+		i = find_item(GEN_GROUP, group, NULL);
 		if (i >= 0) {
 			sprintf(resp, "%s '%s' exists", TAG_GROUP, group);
 			return -EEXIST;
@@ -516,7 +1566,7 @@ int add_json_group(char *group, char *resp)
 
 	iter = json_object();
 	json_set_string(iter, TAG_NAME, group);
-	json_array_append_new(groups, iter);
+	add_item(GEN_GROUP, groups, iter);
 
 	tmp = json_array();
 	json_object_set_new(iter, TAG_TARGETS, tmp);
@@ -551,7 +1601,7 @@ int update_json_group(char *group, char *data, char *resp, char *_name)
 	}
 
 	if (group) {
-		i = find_array(groups, TAG_NAME, group, &iter);
+		i = find_item(GEN_GROUP, group, &iter);
 		if (i < 0) {
 			sprintf(resp, "%s '%s' not found", TAG_GROUP, group);
 			return -ENOENT;
@@ -570,7 +1620,7 @@ int update_json_group(char *group, char *data, char *resp, char *_name)
 
 	strcpy(newname, json_string_value(value));
 	if ((!group && *newname) || (group && strcmp(group, newname) != 0)) {
-		i = find_array(groups, TAG_NAME, newname, &tmp);
+		i = find_item(GEN_GROUP, newname, &tmp);
 		if (i >= 0) {
 			sprintf(resp, "%s '%s' exists",
 				TAG_GROUP, newname);
@@ -578,12 +1628,13 @@ int update_json_group(char *group, char *data, char *resp, char *_name)
 			goto out;
 		}
 	}
-	if (group)
+	if (group) {
 		json_update_string(iter, new, TAG_NAME, value);
-	else {
+		rename_item(GEN_GROUP, iter, group);
+	} else {
 		iter = json_object();
 		json_set_string(iter, TAG_NAME, newname);
-		json_array_append_new(groups, iter);
+		add_item(GEN_GROUP, groups, iter);
 
 		tmp = json_array();
 		json_object_set_new(iter, TAG_HOSTS, tmp);
@@ -622,7 +1673,7 @@ int set_json_group_member(char *group, char *data, char *alias, char *tag,
 		return -ENOENT;
 	}
 
-	i = find_array(groups, TAG_NAME, group, &iter);
+	i = find_item(GEN_GROUP, group, &iter);
 	if (i < 0) {
 		sprintf(resp, "%s '%s' not found", TAG_GROUP, group);
 		return -ENOENT;
@@ -655,7 +1706,8 @@ int set_json_group_member(char *group, char *data, char *alias, char *tag,
 		goto out;
 	}
 
-	i = find_array(parent, TAG_ALIAS, alias, &tmp);
+	i = find_item(strcmp(parent_tag, TAG_TARGETS) ? GEN_HOST : GEN_TARGET,
+		      alias, &tmp);
 	if (i < 0) {
 		sprintf(resp, "%s '%s' not found", tag, alias);
 		ret = -ENOENT;
@@ -694,7 +1746,7 @@ int del_json_group_member(char *group, char *member, char *tag,
 		return -ENOENT;
 	}
 
-	i = find_array(groups, TAG_NAME, group, &iter);
+	i = find_item(GEN_GROUP, group, &iter);
 	if (i < 0) {
 		sprintf(resp, "%s '%s' not found", TAG_GROUP, group);
 		return -ENOENT;
@@ -748,6 +1800,7 @@ static void rename_in_groups(char *tag, char *member, char *alias)
 			if (json_is_string(item) &&
 			    !strcmp(member, json_string_value(item))) {
 				json_string_set(item, alias);
+				touch_item(GEN_GROUP, group);
 				break;
 			}
 		}
@@ -779,6 +1832,7 @@ static void del_from_groups(char *tag, char *member)
 			if (json_is_string(item) &&
 			    !strcmp(member, json_string_value(item))) {
 				json_array_remove(array, j);
+				touch_item(GEN_GROUP, group);
 				break;
 			}
 		}
@@ -788,6 +1842,7 @@ static void del_from_groups(char *tag, char *member)
 int del_json_group(char *group, char *resp)
 {
 	json_t			*groups;
+	json_t			*iter;
 	int			 i;
 
 	groups = json_object_get(ctx->root, TAG_GROUPS);
@@ -796,57 +1851,27 @@ int del_json_group(char *group, char *resp)
 		return -ENOENT;
 	}
 
-	i = find_array(groups, TAG_NAME, group, NULL);
+	i = find_item(GEN_GROUP, group, &iter);
 	if (i < 0) {
 		sprintf(resp, "%s '%s' not found", TAG_GROUP, group);
 		return -ENOENT;
 	}
 
-	json_array_remove(groups, i);
+	del_item(GEN_GROUP, groups, iter);
 
 	sprintf(resp, "%s '%s' deleted", TAG_GROUP, group);
 
 	return 0;
 }
 
-int list_json_group(char **resp)
+int list_json_group(struct list_query *query, json_writer_t write,
+		    void *data)
 {
-	json_t			*groups;
-	char			*p = *resp;
-	char			*new;
-	int			 n, m;
-	int			 max = BODY_SIZE - 32;
-	int			 len;
-
-	n = sprintf(p, "{");
-	p += n;
-
-	start_json_array(TAG_GROUPS, p, m);
-
-	groups = json_object_get(ctx->root, TAG_GROUPS);
-	if (groups) {
-		len = strlen_array(groups, TAG_NAME);
-		if (len > max) {
-			max += len - BODY_SIZE;
-			new = realloc(*resp, max);
-			if (!new)
-				goto out;
-			*resp = new;
-			p = new + n + m;
-		}
-
-		n = list_array(groups, TAG_NAME, p);
-		p += n;
-	}
-out:
-	end_json_array(p, n);
-
-	sprintf(p, "}");
-
-	return 0;
+	return write_json_list(GEN_GROUP, query, write, data);
 }
 
-int show_json_group(char *group, char **resp)
+int show_json_group(char *group, json_writer_t write, void *data,
+		    char *resp)
 {
 	json_t			*groups;
 	json_t			*obj;
@@ -854,21 +1879,17 @@ int show_json_group(char *group, char **resp)
 
 	groups = json_object_get(ctx->root, TAG_GROUPS);
 	if (!groups) {
-		sprintf(*resp, "%s '%s' not found", TAG_GROUP, group);
+		sprintf(resp, "%s '%s' not found", TAG_GROUP, group);
 		return -ENOENT;
 	}
 
-	i = find_array(groups, TAG_NAME, group, &obj);
+	i = find_item(GEN_GROUP, group, &obj);
 	if (i < 0) {
-		sprintf(*resp, "%s '%s' not found", TAG_GROUP, group);
+		sprintf(resp, "%s '%s' not found", TAG_GROUP, group);
 		return -ENOENT;
 	}
 
-	free(*resp);
-
-	*resp = json_dumps(obj, 0);
-
-	return 0;
+	return dump_json(obj, write, data);
 }
 
 /* HOSTS */
@@ -885,7 +1906,7 @@ int add_json_host(char *host, char *resp)
 		hosts = json_array();
 		json_object_set_new(ctx->root, TAG_HOSTS, hosts);
 	} else {
-		i = find_array(hosts, TAG_ALIAS, host, NULL);
+		i = find_item(GEN_HOST, host, NULL);
 		if (i >= 0) {
 			sprintf(resp, "%s '%s' exists",	TAG_HOST, host);
 			return -EEXIST;
@@ -895,7 +1916,7 @@ int add_json_host(char *host, char *resp)
 	iter = json_object();
 	json_set_string(iter, TAG_ALIAS, host);
 
-	json_array_append_new(hosts, iter);
+	add_item(GEN_HOST, hosts, iter);
 
 	sprintf(resp, "%s '%s' added", TAG_HOST, host);
 
@@ -913,7 +1934,7 @@ int get_json_host_nqn(char *host, char *nqn)
 	if (!hosts)
 		return -ENOENT;
 
-	i = find_array(hosts, TAG_ALIAS, host, &iter);
+	i = find_item(GEN_HOST, host, &iter);
 	if (i < 0)
 		return -ENOENT;
 
@@ -947,7 +1968,7 @@ int update_json_host(char *host, char *data, char *resp, char *alias, char *nqn)
 	}
 
 	if (host) {
-		i = find_array(hosts, TAG_ALIAS, host, &iter);
+		i = find_item(GEN_HOST, host, &iter);
 		if (i < 0) {
 			sprintf(resp, "%s '%s' not found", TAG_HOST, host);
 			return -ENOENT;
@@ -963,7 +1984,7 @@ int update_json_host(char *host, char *data, char *resp, char *alias, char *nqn)
 		strcpy(alias, (char *) json_string_value(value));
 
 		if ((!host && *alias) || (host && strcmp(host, alias))) {
-			i = find_array(hosts, TAG_ALIAS, alias, &tmp);
+			i = find_item(GEN_HOST, alias, &tmp);
 			if (i >= 0) {
 				sprintf(resp, "%s '%s' exists",
 					TAG_HOSTS, alias);
@@ -972,12 +1993,13 @@ int update_json_host(char *host, char *data, char *resp, char *alias, char *nqn)
 			}
 			if (host) {
 				json_update_string(iter, new, TAG_ALIAS, value);
+				rename_item(GEN_HOST, iter, host);
 				rename_in_allowed_hosts(host, alias);
 				rename_in_groups(TAG_HOSTS, host, alias);
 			} else {
 				iter = json_object();
 				json_set_string(iter, TAG_ALIAS, alias);
-				json_array_append_new(hosts, iter);
+				add_item(GEN_HOST, hosts, iter);
 			}
 		}
 	} else if (!host) {
@@ -1015,7 +2037,7 @@ int del_json_host(char *alias, char *resp, char *nqn)
 		return -ENOENT;
 	}
 
-	i = find_array(hosts, TAG_ALIAS, alias, &iter);
+	i = find_item(GEN_HOST, alias, &iter);
 	if (i < 0) {
 		sprintf(resp, "%s '%s' not found", TAG_HOST, alias);
 		return -ENOENT;
@@ -1027,7 +2049,7 @@ int del_json_host(char *alias, char *resp, char *nqn)
 			strcpy(nqn, json_string_value(obj));
 	}
 
-	json_array_remove(hosts, i);
+	del_item(GEN_HOST, hosts, iter);
 
 	del_from_allowed_hosts(alias);
 
@@ -1038,41 +2060,10 @@ int del_json_host(char *alias, char *resp, char *nqn)
 	return 0;
 }
 
-int list_json_host(char **resp)
+int list_json_host(struct list_query *query, json_writer_t write,
+		   void *data)
 {
-	json_t			*hosts;
-	char			*p = *resp;
-	char			*new;
-	int			 m, n;
-	int			 max = BODY_SIZE - 32;
-	int			 len;
-
-	n = sprintf(p, "{");
-	p += n;
-
-	start_json_array(TAG_HOSTS, p, m);
-
-	hosts = json_object_get(ctx->root, TAG_HOSTS);
-	if (hosts) {
-		len = strlen_array(hosts, TAG_ALIAS);
-		if (len > max) {
-			max += len - BODY_SIZE;
-			new = realloc(*resp, max);
-			if (!new)
-				goto out;
-			*resp = new;
-			p = new + n + m;
-		}
-
-		n = list_array(hosts, TAG_ALIAS, p);
-		p += n;
-	}
-out:
-	end_json_array(p, n);
-
-	sprintf(p, "}");
-
-	return 0;
+	return write_json_list(GEN_HOST, query, write, data);
 }
 
 static inline int match_string(json_t *item, char *str)
@@ -1159,36 +2150,37 @@ static void get_host_subsystems(char *host, json_t *parent)
 	}
 }
 
-int show_json_host(char *alias, char **resp)
+int show_json_host(char *alias, json_writer_t write, void *data, char *resp)
 {
 	json_t			*hosts;
 	json_t			*obj;
 	json_t			*host;
 	int			 i;
+	int			 ret;
 
 	hosts = json_object_get(ctx->root, TAG_HOSTS);
 	if (!hosts) {
-		sprintf(*resp, "'%s' not found", TAG_HOSTS);
+		sprintf(resp, "'%s' not found", TAG_HOSTS);
 		return -ENOENT;
 	}
 
-	i = find_array(hosts, TAG_ALIAS, alias, &obj);
+	i = find_item(GEN_HOST, alias, &obj);
 	if (i < 0) {
-		sprintf(*resp, "%s '%s' not found", TAG_HOST, alias);
+		sprintf(resp, "%s '%s' not found", TAG_HOST, alias);
 		return -ENOENT;
 	}
 
-	free(*resp);
-
 	host = json_copy(obj);
+	if (!host)
+		return -ENOMEM;
 
 	get_host_subsystems(alias, host);
 
-	*resp = json_dumps(host, 0);
+	ret = dump_json(host, write, data);
 
 	json_decref(host);
 
-	return 0;
+	return ret;
 }
 
 /* TARGET */
@@ -1215,7 +2207,7 @@ int set_json_subsys(char *alias, char *subnqn, char *data, char *resp,
 		return -ENOENT;
 	}
 
-	i = find_array(targets, TAG_ALIAS, alias, &obj);
+	i = find_item(GEN_TARGET, alias, &obj);
 	if (i < 0) {
 		sprintf(resp, "%s '%s' not found", TAG_TARGET, alias);
 		return -ENOENT;
@@ -1296,6 +2288,7 @@ out:
 int del_json_subsys(char *alias, char *subnqn, char *resp)
 {
 	json_t			*targets;
+	json_t			*target;
 	int			 ret;
 
 	targets = json_object_get(ctx->root, TAG_TARGETS);
@@ -1304,7 +2297,9 @@ int del_json_subsys(char *alias, char *subnqn, char *resp)
 		return -ENOENT;
 	}
 
-	ret = del_from_array(targets, TAG_ALIAS, alias, TAG_SUBSYSTEMS, subnqn);
+	find_item(GEN_TARGET, alias, &target);
+
+	ret = del_from_array(target, TAG_SUBSYSTEMS, subnqn);
 	if (ret) {
 		sprintf(resp, "Unable to delete %s '%s' from %s '%s'",
 			TAG_SUBSYSTEM, subnqn, TAG_TARGET, alias);
@@ -1319,31 +2314,22 @@ int del_json_subsys(char *alias, char *subnqn, char *resp)
 
 /* set target lists */
 
-int set_json_oob_nsdevs(struct target *target, char *data)
+/* new is the reply of the SC, parsed before the config lock was taken */
+int set_json_oob_nsdevs(struct target *target, json_t *new)
 {
 	struct nsdev		*nsdev, *next;
 	json_t			*array;
-	json_t			*targets;
 	json_t			*tgt;
 	json_t			*nsdevs;
-	json_t			*new;
 	json_t			*obj;
 	json_t			*tmp;
 	json_t			*iter;
-	json_error_t		 error;
 	char			*alias = target->alias;
 	int			 i, cnt;
 	int			 devid, nsid;
 	int			 ret = -EINVAL;
 
-	new = json_loads(data, JSON_DECODE_ANY, &error);
-	if (!new) {
-		print_err("invalid json syntax: %s", data);
-		return -EINVAL;
-	}
-
-	targets = json_object_get(ctx->root, TAG_TARGETS);
-	find_array(targets, TAG_ALIAS, alias, &tgt);
+	find_item(GEN_TARGET, alias, &tgt);
 
 	json_get_array(tgt, TAG_NSDEVS, nsdevs);
 	if (!nsdevs) {
@@ -1430,35 +2416,23 @@ found:
 
 	ret = 0;
 out:
-	json_decref(new);
-
 	return ret;
 }
 
-int set_json_oob_interfaces(struct target *target, char *data)
+int set_json_oob_interfaces(struct target *target, json_t *new)
 {
-	json_t			*new;
 	json_t			*trtype, *tradr, *trfam;
 	json_t			*iter;
 	json_t			*array;
-	json_t			*targets;
 	json_t			*tgt;
 	json_t			*ifaces;
 	json_t			*tmp;
-	json_error_t		 error;
 	struct fabric_iface	*iface, *next;
 	char			*alias = target->alias;
 	int			 i, cnt;
 	int			 ret;
 
-	new = json_loads(data, JSON_DECODE_ANY, &error);
-	if (!new) {
-		print_err("invalid json syntax: %s", data);
-		return -EINVAL;
-	}
-
-	targets = json_object_get(ctx->root, TAG_TARGETS);
-	find_array(targets, TAG_ALIAS, alias, &tgt);
+	find_item(GEN_TARGET, alias, &tgt);
 
 	json_get_array(tgt, TAG_INTERFACES, ifaces);
 	if (!ifaces) {
@@ -1545,20 +2519,17 @@ found:
 
 	ret = 0;
 out:
-	json_decref(new);
 	return ret;
 }
 
 int set_json_inb_nsdev(struct target *target, struct nsdev *nsdev)
 {
 	json_t			*iter;
-	json_t			*targets;
 	json_t			*nsdevs;
 	json_t			*tgt;
 	json_t			*tmp;
 
-	targets = json_object_get(ctx->root, TAG_TARGETS);
-	find_array(targets, TAG_ALIAS, target->alias, &tgt);
+	find_item(GEN_TARGET, target->alias, &tgt);
 	if (!tgt)
 		return -ENOENT;
 
@@ -1584,13 +2555,11 @@ int set_json_inb_nsdev(struct target *target, struct nsdev *nsdev)
 int set_json_inb_fabric_iface(struct target *target, struct fabric_iface *iface)
 {
 	json_t			*iter;
-	json_t			*targets;
 	json_t			*ifaces;
 	json_t			*tgt;
 	json_t			*tmp;
 
-	targets = json_object_get(ctx->root, TAG_TARGETS);
-	find_array(targets, TAG_ALIAS, target->alias, &tgt);
+	find_item(GEN_TARGET, target->alias, &tgt);
 	if (!tgt)
 		return -ENOENT;
 
@@ -1632,7 +2601,7 @@ int set_json_portid(char *target, int id, char *data, char *resp,
 		return -ENOENT;
 	}
 
-	i = find_array(targets, TAG_ALIAS, target, &obj);
+	i = find_item(GEN_TARGET, target, &obj);
 	if (i < 0) {
 		sprintf(resp, "%s '%s' not found", TAG_TARGET, target);
 		return -ENOENT;
@@ -1691,6 +2660,7 @@ out:
 int del_json_portid(char *alias, int portid, char *resp)
 {
 	json_t			*targets;
+	json_t			*target;
 	int			 ret;
 
 	targets = json_object_get(ctx->root, TAG_TARGETS);
@@ -1699,8 +2669,9 @@ int del_json_portid(char *alias, int portid, char *resp)
 		return -ENOENT;
 	}
 
-	ret = del_int_from_array(targets, TAG_ALIAS, alias, TAG_PORTIDS,
-				 TAG_PORTID, portid);
+	find_item(GEN_TARGET, alias, &target);
+
+	ret = del_int_from_array(target, TAG_PORTIDS, TAG_PORTID, portid);
 	if (ret) {
 		sprintf(resp,
 			"Unable to delete %s '%d' from %s '%s'",
@@ -1738,7 +2709,7 @@ int set_json_ns(char *alias, char *subnqn, char *data, char *resp,
 		goto out;
 	}
 
-	i = find_array(targets, TAG_ALIAS, alias, &subgroup);
+	i = find_item(GEN_TARGET, alias, &subgroup);
 	if (i < 0) {
 		sprintf(resp, "%s '%s' not found", TAG_TARGET, alias);
 		goto out;
@@ -1800,6 +2771,7 @@ int del_json_ns(char *alias, char *subnqn, int ns, char *resp)
 	json_t			*targets;
 	json_t			*subgroup;
 	json_t			*array;
+	json_t			*subsys;
 	int			 i;
 	int			 ret;
 
@@ -1809,7 +2781,7 @@ int del_json_ns(char *alias, char *subnqn, int ns, char *resp)
 		return -ENOENT;
 	}
 
-	i = find_array(targets, TAG_ALIAS, alias, &subgroup);
+	i = find_item(GEN_TARGET, alias, &subgroup);
 	if (i < 0) {
 		sprintf(resp, "%s '%s' not found'", TAG_TARGET, alias);
 		return -ENOENT;
@@ -1822,8 +2794,9 @@ int del_json_ns(char *alias, char *subnqn, int ns, char *resp)
 		return -ENOENT;
 	}
 
-	ret = del_int_from_array(array, TAG_SUBNQN, subnqn, TAG_NSIDS,
-				 TAG_NSID, ns);
+	find_array(array, TAG_SUBNQN, subnqn, &subsys);
+
+	ret = del_int_from_array(subsys, TAG_NSIDS, TAG_NSID, ns);
 	if (ret) {
 		sprintf(resp,
 			"Unable to delete %s '%d' from %s '%s in %s '%s'",
@@ -1846,7 +2819,7 @@ int del_json_target(char *alias, char *resp)
 	json_t			*iter;
 	json_t			*obj;
 	json_t			*subnqn;
-	int			 i, n, idx;
+	int			 i, n;
 
 	targets = json_object_get(ctx->root, TAG_TARGETS);
 	if (!targets) {
@@ -1854,8 +2827,8 @@ int del_json_target(char *alias, char *resp)
 		return -ENOENT;
 	}
 
-	idx = find_array(targets, TAG_ALIAS, alias, &iter);
-	if (idx < 0) {
+	i = find_item(GEN_TARGET, alias, &iter);
+	if (i < 0) {
 		sprintf(resp, "%s '%s' not found", TAG_TARGET, alias);
 		return -ENOENT;
 	}
@@ -1873,7 +2846,7 @@ int del_json_target(char *alias, char *resp)
 		}
 	}
 
-	json_array_remove(targets, idx);
+	del_item(GEN_TARGET, targets, iter);
 
 	del_from_groups(TAG_TARGETS, alias);
 
@@ -1882,20 +2855,10 @@ int del_json_target(char *alias, char *resp)
 	return 0;
 }
 
-int list_json_target(char *query, char **resp)
+int list_json_target(struct list_query *query, json_writer_t write,
+		     void *data)
 {
-	char			*p = *resp;
-	int			 n, m;
-
-	n = sprintf(p, "{");
-	p += n;
-
-	m = _list_target(query, resp, n);
-	p = *resp + n + m - 1;
-
-	sprintf(p, "}");
-
-	return 0;
+	return write_json_list(GEN_TARGET, query, write, data);
 }
 
 int set_json_inb_interface(char *alias, char *data, char *resp,
@@ -1917,7 +2880,7 @@ int set_json_inb_interface(char *alias, char *data, char *resp,
 		return -ENOENT;
 	}
 
-	i = find_array(targets, TAG_ALIAS, alias, &obj);
+	i = find_item(GEN_TARGET, alias, &obj);
 	if (i < 0) {
 		sprintf(resp, "%s '%s' not found", TAG_TARGET, alias);
 		return -ENOENT;
@@ -1972,7 +2935,7 @@ int set_json_oob_interface(char *alias, char *data, char *resp,
 		return -ENOENT;
 	}
 
-	i = find_array(targets, TAG_ALIAS, alias, &obj);
+	i = find_item(GEN_TARGET, alias, &obj);
 	if (i < 0) {
 		sprintf(resp, "%s '%s' not found", TAG_TARGET, alias);
 		return -ENOENT;
@@ -2114,7 +3077,7 @@ int add_json_target(char *alias, char *resp)
 		targets = json_array();
 		json_object_set_new(ctx->root, TAG_TARGETS, targets);
 	} else {
-		i = find_array(targets, TAG_ALIAS, alias, &iter);
+		i = find_item(GEN_TARGET, alias, &iter);
 		if (i >= 0) {
 			sprintf(resp, "%s '%s' exists", TAG_TARGET, alias);
 			return -EEXIST;
@@ -2130,7 +3093,7 @@ int add_json_target(char *alias, char *resp)
 	tmp = json_array();
 	json_object_set_new(iter, TAG_SUBSYSTEMS, tmp);
 
-	json_array_append_new(targets, iter);
+	add_item(GEN_TARGET, targets, iter);
 
 	sprintf(resp, "%s '%s' added", TAG_TARGET, alias);
 
@@ -2164,7 +3127,7 @@ int update_json_target(char *alias, char *data, char *resp,
 	}
 
 	if (alias) {
-		i = find_array(targets, TAG_ALIAS, alias, &iter);
+		i = find_item(GEN_TARGET, alias, &iter);
 		if (i < 0) {
 			sprintf(resp, "%s '%s' not found", TAG_TARGET, alias);
 			return -ENOENT;
@@ -2180,7 +3143,7 @@ int update_json_target(char *alias, char *data, char *resp,
 		strcpy(buf, (char *) json_string_value(value));
 
 		if ((!alias && *buf) || (alias && strcmp(alias, buf) != 0)) {
-			i = find_array(targets, TAG_ALIAS, buf, &tmp);
+			i = find_item(GEN_TARGET, buf, &tmp);
 			if (i >= 0) {
 				sprintf(resp, "%s '%s' exists",
 					TAG_TARGET, buf);
@@ -2190,6 +3153,7 @@ int update_json_target(char *alias, char *data, char *resp,
 
 			if (alias) {
 				json_update_string(iter, new, TAG_ALIAS, value);
+				rename_item(GEN_TARGET, iter, alias);
 
 				newalias = (char *) json_string_value(value);
 				rename_in_groups(TAG_TARGETS, alias, newalias);
@@ -2203,7 +3167,7 @@ int update_json_target(char *alias, char *data, char *resp,
 				tmp = json_array();
 				json_object_set_new(iter, TAG_SUBSYSTEMS, tmp);
 
-				json_array_append_new(targets, iter);
+				add_item(GEN_TARGET, targets, iter);
 			}
 		}
 	} else if (alias)
@@ -2277,7 +3241,8 @@ out:
 	return ret;
 }
 
-int show_json_target(char *alias, char **resp)
+int show_json_target(char *alias, json_writer_t write, void *data,
+		     char *resp)
 {
 	json_t			*targets;
 	json_t			*obj;
@@ -2285,21 +3250,17 @@ int show_json_target(char *alias, char **resp)
 
 	targets = json_object_get(ctx->root, TAG_TARGETS);
 	if (!targets) {
-		sprintf(*resp, "%s not found", TAG_TARGETS);
+		sprintf(resp, "%s not found", TAG_TARGETS);
 		return -ENOENT;
 	}
 
-	i = find_array(targets, TAG_ALIAS, alias, &obj);
+	i = find_item(GEN_TARGET, alias, &obj);
 	if (i < 0) {
-		sprintf(*resp, "%s '%s' not found", TAG_TARGET, alias);
+		sprintf(resp, "%s '%s' not found", TAG_TARGET, alias);
 		return -ENOENT;
 	}
 
-	free(*resp);
-
-	*resp = json_dumps(obj, 0);
-
-	return 0;
+	return dump_json(obj, write, data);
 }
 
 int set_json_acl(char *tgt, char *subnqn, char *alias, char *data,
@@ -2328,7 +3289,7 @@ int set_json_acl(char *tgt, char *subnqn, char *alias, char *data,
 		return -ENOENT;
 	}
 
-	i = find_array(targets, TAG_ALIAS, tgt, &subgroup);
+	i = find_item(GEN_TARGET, tgt, &subgroup);
 	if (i < 0) {
 		sprintf(resp, "%s '%s' not found", TAG_TARGET, tgt);
 		return -ENOENT;
@@ -2373,7 +3334,7 @@ int set_json_acl(char *tgt, char *subnqn, char *alias, char *data,
 		json_decref(new);
 	}
 
-	i = find_array(hosts, TAG_ALIAS, newalias, &host);
+	i = find_item(GEN_HOST, newalias, &host);
 	if (i < 0) {
 		sprintf(resp, "%s '%s' not found", TAG_HOST, newalias);
 		return -ENOENT;
@@ -2416,7 +3377,7 @@ int del_json_acl(char *alias, char *subnqn, char *host, char *resp)
 		return -ENOENT;
 	}
 
-	i = find_array(targets, TAG_ALIAS, alias, &subgroup);
+	i = find_item(GEN_TARGET, alias, &subgroup);
 	if (i < 0) {
 		sprintf(resp, "%s '%s' not found'", TAG_TARGET, alias);
 		return -ENOENT;
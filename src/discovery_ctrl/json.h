@@ -43,11 +43,59 @@ union sc_iface;
 struct nsdev;
 struct fabric_iface;
 
+/* same shape as json_dump_callback_t, returns non-zero to stop.  The list
+ * and show functions are called with the config lock held for reading and
+ * drop it while write is called.
+ */
+typedef int (*json_writer_t)(const char *buf, size_t len, void *data);
+
+#define LIST_PARM_SIZE		256
+
+/* filters and paging for the lists, empty strings are not applied.  Lists
+ * are in order of name; a page of limit entries ends with the name to
+ * pass as after to get the next one.
+ */
+struct list_query {
+	char			 alias[LIST_PARM_SIZE];	/* prefix */
+	char			 after[LIST_PARM_SIZE];
+	char			 fabric[LIST_PARM_SIZE];
+	char			 address[LIST_PARM_SIZE];
+	char			 nqn[LIST_PARM_SIZE];
+	char			 group[LIST_PARM_SIZE];
+	char			 mode[LIST_PARM_SIZE];
+	int			 limit;		/* 0 for no limit */
+	int			 descending;
+};
+
 struct json_context *get_json_context(void);
 void store_json_config_file(void);
+void begin_json_batch(void);
+void end_json_batch(void);
+json_t *swap_json_root(json_t *root);
+int add_json_scope(json_t *scope, int kind, const char *name, int changed);
+json_t *scoped_json_root(json_t *scope);
+void commit_json_changes(json_t *changes);
+
+void init_journal(char *filename);
+int replay_journal(void (*apply)(json_t *changes));
+int start_journal(void);
+int stop_journal(json_t *root);
+int append_journal(json_t *changes);
+int write_config_file(json_t *root);
 
-int list_json_group(char **resp);
-int show_json_group(char *grp, char **resp);
+json_t *load_config_image(char *filename);
+int write_config_image(json_t *root, char *filename);
+
+enum { GEN_TARGET, GEN_HOST, GEN_GROUP, NUM_GEN_KINDS };
+
+void bump_json_generation(int kind, char *name);
+unsigned long json_generation(int kind, char *name);
+unsigned long json_epoch(void);
+json_t *get_json_item(int kind, char *name);
+
+int list_json_group(struct list_query *query, json_writer_t write,
+		    void *data);
+int show_json_group(char *grp, json_writer_t write, void *data, char *resp);
 int add_json_group(char *grp, char *resp);
 int update_json_group(char *grp, char *data, char *resp, char *new_name);
 int set_json_group_target(char *alias, char *data, char *resp);
@@ -61,15 +109,18 @@ int del_json_group_member(char *group, char *member, char *tag,
 int add_json_target(char *alias, char *resp);
 int update_json_target(char *alias, char *data, char *resp,
 		       struct target *target);
-int list_json_target(char *query, char **resp);
-int show_json_target(char *alias, char **resp);
+int list_json_target(struct list_query *query, json_writer_t write,
+		     void *data);
+int show_json_target(char *alias, json_writer_t write, void *data,
+		     char *resp);
 int del_json_target(char *alias, char *resp);
 
 int add_json_host(char *alias, char *resp);
 int update_json_host(char *alias, char *data, char *resp,
 		     char *newalias, char *nqn);
-int list_json_host(char **resp);
-int show_json_host(char *alias, char **resp);
+int list_json_host(struct list_query *query, json_writer_t write,
+		   void *data);
+int show_json_host(char *alias, json_writer_t write, void *data, char *resp);
 int del_json_host(char *alias, char *resp, char *nqn);
 int get_json_host_nqn(char *host, char *nqn);
 
@@ -130,8 +181,8 @@ int del_ns(char *alias,  char *subnqn, int ns, char *resp);
 int link_host(char *alias, char *subnqn, char *host, char *data, char *resp);
 int unlink_host(char *alias,  char *subnqn, char *host, char *resp);
 
-int set_json_oob_nsdevs(struct target *target, char *data);
-int set_json_oob_interfaces(struct target *target, char *data);
+int set_json_oob_nsdevs(struct target *target, json_t *new);
+int set_json_oob_interfaces(struct target *target, json_t *new);
 
 int set_json_inb_nsdev(struct target *target, struct nsdev *nsdev);
 int set_json_inb_fabric_iface(struct target *target,
@@ -142,9 +193,21 @@ int update_signature(char *data, char *resp);
 #define MAX_STRING		128
 
 struct json_context {
-	pthread_spinlock_t	 lock;
+	pthread_rwlock_t	 lock;
+	/* taken to rebuild the list indexes */
+	pthread_mutex_t		 index_lock;
 	json_t			*root;
 	char			 filename[128];
+	/* stores are held back while a batch of changes is applied */
+	int			 batch;
+	int			 dirty;
+	/* changes since the last store, see note_item() */
+	json_t			*changes;
+	json_t			*stashed_root;
+	json_t			*stashed_changes;
+	/* the lock is held exclusively */
+	int			 writer;
+	unsigned long		 epoch;
 };
 
 /* json parsing helpers */
@@ -253,19 +316,3 @@ struct json_context {
 #define JSSTR		"\"%s\":\"%s\""
 #define JSINT		"\"%s\":%lld"
 
-#define array_json_string(obj, p, i, n)				\
-	do {							\
-		n = sprintf(p, "%s\"%s\"", i ? "," : "",	\
-			    json_string_value(obj));		\
-		p += n;						\
-	} while (0)
-#define start_json_array(tag, p, n)				\
-	do {							\
-		n = sprintf(p, JSARRAY, tag);			\
-		p += n;						\
-	} while (0)
-#define end_json_array(p, n)					\
-	do {							\
-		n = sprintf(p, "]");				\
-		p += n;						\
-	} while (0)
@@ -165,10 +165,17 @@ static int handle_async_event(struct host_conn *host)
 
 	memset(entry, 0, sizeof(*entry));
 
-	strcpy(entry->nqn, host->ep->nqn);
+	entry->nqn = intern(host->ep->nqn);
+	if (entry->nqn < 0) {
+		free(entry);
+		return -ENOMEM;
+	}
+
 	entry->ep = host->ep;
 
+	json_write_lock();
 	list_add_tail(&entry->node, aen_req_list);
+	json_unlock();
 
 	return ret;
 }
@@ -241,7 +248,7 @@ static int handle_identify(struct endpoint *ep, struct nvme_command *cmd,
 	return ret;
 }
 
-static int host_access(struct subsystem *subsys, char *nqn)
+static int host_access(struct subsystem *subsys, int nqn)
 {
 	struct host		*entry;
 
@@ -249,7 +256,7 @@ static int host_access(struct subsystem *subsys, char *nqn)
 	/* return: 0 if no access; else access rights */
 
 	list_for_each_entry(entry, &subsys->host_list, node)
-		if (strcmp(entry->nqn, nqn) == 0)
+		if (entry->nqn == nqn)
 			return 1;
 
 	return 0;
@@ -264,10 +271,18 @@ static int handle_get_log_page_count(struct endpoint *ep,
 	struct subsystem		*subsys;
 	struct logpage			*p;
 	int				 numrec = 0;
+	int				 nqn;
 	int				 ret;
 
+	/* held so the id is not reused for another host meanwhile */
+	nqn = intern(ep->nqn);
+	if (nqn < 0)
+		return NVME_SC_INTERNAL;
+
+	json_read_lock();
+
 	list_for_each_entry(target, target_list, node) {
-		if (target->group_member && !shared_group(target, ep->nqn))
+		if (target->group_member && !shared_group(target, nqn))
 			continue;
 
 		list_for_each_entry(subsys, &target->subsys_list, node)
@@ -276,11 +291,15 @@ static int handle_get_log_page_count(struct endpoint *ep,
 					continue;
 
 				if (subsys->access ||
-				    host_access(subsys, ep->nqn))
+				    host_access(subsys, nqn))
 					numrec++;
 			}
 	}
 
+	json_unlock();
+
+	unintern(nqn);
+
 	log->numrec = numrec;
 	log->genctr = 1;
 
@@ -308,6 +327,7 @@ static int handle_get_log_pages(struct endpoint *ep, struct nvme_command *cmd,
 	struct target			*target;
 	struct subsystem		*subsys;
 	int				 numrec = 0;
+	int				 nqn;
 	int				 ret;
 
 	log = malloc(len);
@@ -322,8 +342,16 @@ static int handle_get_log_pages(struct endpoint *ep, struct nvme_command *cmd,
 
 	e = (void *) (&log[1]);
 
+	nqn = intern(ep->nqn);
+	if (nqn < 0) {
+		ret = NVME_SC_INTERNAL;
+		goto out;
+	}
+
+	json_read_lock();
+
 	list_for_each_entry(target, target_list, node) {
-		if (target->group_member && !shared_group(target, ep->nqn))
+		if (target->group_member && !shared_group(target, nqn))
 			continue;
 
 		list_for_each_entry(subsys, &target->subsys_list, node)
@@ -332,14 +360,18 @@ static int handle_get_log_pages(struct endpoint *ep, struct nvme_command *cmd,
 					continue;
 
 				if (subsys->access ||
-				    host_access(subsys, ep->nqn)) {
-					memcpy(e, &p->e, sizeof(*e));
+				    host_access(subsys, nqn)) {
+					expand_logpage_entry(&p->e, e);
 					numrec++;
 					e++;
 				}
 			}
 	}
 
+	json_unlock();
+
+	unintern(nqn);
+
 	log->numrec = numrec;
 	log->genctr = 1;
 
@@ -348,7 +380,7 @@ static int handle_get_log_pages(struct endpoint *ep, struct nvme_command *cmd,
 		print_errno("rma_write failed", ret);
 		ret = NVME_SC_WRITE_FAULT;
 	}
-
+out:
 	ep->ops->dealloc_key(mr);
 	free(log);
 
@@ -365,6 +397,7 @@ static int handle_request(struct host_conn *host, struct qe *qe, void *buf,
 	u64				 addr;
 	u32				 len;
 	u32				 key;
+	unsigned long long		 start;
 	int				 ret;
 
 	addr	= c->dptr.ksgl.addr;
@@ -405,11 +438,13 @@ static int handle_request(struct host_conn *host, struct qe *qe, void *buf,
 		ret = 0;
 		break;
 	case nvme_admin_get_log_page:
+		start = metrics_clock();
 		if (len == 16)
 			ret = handle_get_log_page_count(ep, cmd, addr, key,
 							len);
 		else
 			ret = handle_get_log_pages(ep, cmd, addr, key, len);
+		observe_histogram(&dc_metrics.log_page_latency, start);
 		break;
 	case nvme_admin_get_features:
 		ret = handle_get_features(cmd, resp, host);
@@ -438,6 +473,7 @@ static int handle_request(struct host_conn *host, struct qe *qe, void *buf,
 struct host_queue {
 	struct endpoint		*ep[HOST_QUEUE_MAX];
 	int			 tail, head;
+	struct host_iface	*iface;
 };
 
 static inline int is_empty(struct host_queue *q)
@@ -526,6 +562,7 @@ static void *host_thread(void *arg)
 						host->inst);
 
 				list_add_tail(&host->node, &host_list);
+				add_metric(&q->iface->hosts, 1);
 			}
 		} while (!ret && !stopped);
 
@@ -558,6 +595,7 @@ loop:
 			free(ep);
 			list_del(&host->node);
 			free(host);
+			add_metric(&q->iface->hosts, -1);
 		}
 
 		delta = msec_delta(timeval);
@@ -569,6 +607,7 @@ out:
 		disconnect_endpoint(host->ep, 1);
 		free(host->ep);
 		free(host);
+		add_metric(&q->iface->hosts, -1);
 	}
 
 	while (!is_empty(q))
@@ -638,6 +677,7 @@ void *interface_thread(void *arg)
 	signal(SIGTERM, SIG_IGN);
 
 	memset(&q, 0, sizeof(q));
+	q.iface = iface;
 
 	pthread_attr_init(&pthread_attr);
 
@@ -34,6 +34,7 @@
 
 #include "mongoose.h"
 #include "common.h"
+#include "http_workers.h"
 
 static const struct mg_str s_get_method = MG_MK_STR("GET");
 static const struct mg_str s_put_method = MG_MK_STR("PUT");
@@ -42,6 +43,7 @@ static const struct mg_str s_patch_method = MG_MK_STR("PATCH");
 static const struct mg_str s_options_method = MG_MK_STR("OPTIONS");
 static const struct mg_str s_delete_method = MG_MK_STR("DELETE");
 static const struct mg_str s_authorization = MG_MK_STR("Authorization");
+static const struct mg_str s_if_none_match = MG_MK_STR("If-None-Match");
 static const struct mg_str s_signature_default =
 	MG_MK_STR("Basic QjU6v9wxOTU4QGBlgPztOCQ6QTsD");
 struct mg_str s_signature_user;
@@ -52,6 +54,8 @@ struct mg_str *s_signature = (struct mg_str *) &s_signature_default;
 #define LARGE_RSP			512
 
 #define HTTP_OK				200
+#define HTTP_ACCEPTED			202
+#define HTTP_NOT_MODIFIED		304
 #define HTTP_ERR_NOT_FOUND		402
 #define HTTP_ERR_INTERNAL		403
 #define HTTP_ERR_PAGE_NOT_FOUND		404
@@ -65,13 +69,26 @@ struct mg_str *s_signature = (struct mg_str *) &s_signature_default;
 "Access-Control-Allow-Methods:GET,PUT,POST,DELETE,PATCH,OPTIONS\r\n" \
 "Access-Control-Allow-Headers:" \
 "access-control-allow-origin,origin,content-type,accept,x-requested-with," \
-"authorization,client-security-token,accept-encoding"
+"authorization,client-security-token,accept-encoding,if-none-match"
 
 static int is_equal(const struct mg_str *s1, const struct mg_str *s2)
 {
 	return s1->len == s2->len && memcmp(s1->p, s2->p, s2->len) == 0;
 }
 
+/* a request without an Authorization header is let through */
+int authorized_request(struct http_message *hm)
+{
+	int			 i;
+
+	for (i = 0; i < MG_MAX_HTTP_HEADERS; i++)
+		if (is_equal(&hm->header_names[i], &s_authorization))
+			break;
+
+	return (i == MG_MAX_HTTP_HEADERS) ||
+		is_equal(&hm->header_values[i], s_signature);
+}
+
 static inline int http_error(int err)
 {
 	if (err == 0)
@@ -114,6 +131,170 @@ static int parse_uri(char *p, int depth, char *part[])
 	return (i >= 0) && part[i] ? i + 1 : i;
 }
 
+#define ETAG_SIZE			48
+#define EVENT_URI_SIZE			512
+
+/* list and show replies are streamed as chunks rather than built up in
+ * resp, the headers go out with the first piece of the body.  The pieces
+ * are copied out of the JSON store and written with the config lock
+ * dropped, a client that is slow to read only holds up its own reply.
+ */
+struct body_stream {
+	struct http_reply	*reply;
+	char			*etag;
+};
+
+static int write_body(const char *buf, size_t len, void *data)
+{
+	struct body_stream	*stream = data;
+	struct http_reply	*reply = stream->reply;
+
+	if (!reply->chunked) {
+		reply_printf(reply, "%s %d OK\r\n%s\r\n"
+			     "Content-Type: plain/text\r\n",
+			     HTTP_HDR, HTTP_OK, HTTP_ALLOW);
+		if (*stream->etag)
+			reply_printf(reply, "ETag: %s\r\n", stream->etag);
+		if (reply_start_chunks(reply))
+			return -1;
+	}
+
+	return (reply_write(reply, buf, len) < 0) ? -1 : 0;
+}
+
+static int config_kind(char *part)
+{
+	if (strncmp(part, URI_TARGET, TARGET_LEN) == 0)
+		return GEN_TARGET;
+	if (strncmp(part, URI_HOST, HOST_LEN) == 0)
+		return GEN_HOST;
+	if (strncmp(part, URI_GROUP, GROUP_LEN) == 0)
+		return GEN_GROUP;
+
+	return -1;
+}
+
+/* the type of change event a successful change to the URI publishes,
+ * NULL for a target refresh or reconfig which change nothing in the config
+ */
+static char *event_type(char *parts[], int n, int kind)
+{
+	if (kind == GEN_HOST)
+		return URI_HOST;
+	if (kind == GEN_GROUP)
+		return URI_GROUP;
+	if (n <= 2 || !strcmp(parts[2], URI_INTERFACE))
+		return URI_TARGET;
+	if (!strcmp(parts[2], URI_PORTID))
+		return URI_PORTID;
+	if (strcmp(parts[2], URI_SUBSYSTEM))
+		return NULL;
+	if (n > 4 && !strcmp(parts[4], URI_NSID))
+		return EVENT_NS;
+	if (n > 4 && !strcmp(parts[4], URI_HOST))
+		return EVENT_ACL;
+
+	return EVENT_SUBSYS;
+}
+
+/* called with the config lock held exclusively after a change */
+static void note_change(char *parts[], int n, struct mg_str *method)
+{
+	int			 kind = config_kind(parts[0]);
+	char			 uri[EVENT_URI_SIZE];
+	char			 quoted[EVENT_URI_SIZE];
+	char			*type;
+	char			*p = uri;
+	char			*end = uri + sizeof(uri) - 1;
+	char			*c;
+	int			 i;
+
+	if (kind < 0)
+		return;
+
+	bump_json_generation(kind, (n > 1) ? parts[1] : NULL);
+
+	type = event_type(parts, n, kind);
+	if (!type)
+		return;
+
+	/* the URI is rebuilt from its parts */
+	for (i = 0; i < n && p < end; i++) {
+		*p++ = '/';
+		for (c = parts[i]; *c && p < end; c++)
+			*p++ = *c;
+	}
+	*p = 0;
+
+	publish_event(type, "\"%s\":\"%s\",\"%s\":\"%s\"", TAG_ACTION,
+		      is_equal(method, &s_delete_method) ? "delete" : "update",
+		      TAG_URI, escape_event_str(uri, quoted, sizeof(quoted)));
+}
+
+/* lists and shows of the config are tagged with generation numbers so an
+ * unchanged one is answered without being read, returns 0 for anything
+ * else
+ */
+static int config_etag(char *parts[], int n, const struct mg_str *query,
+		       char *etag)
+{
+	int			 kind = config_kind(parts[0]);
+	unsigned long		 gen;
+
+	if (kind < 0 || n > 2)
+		return 0;
+
+	gen = json_generation(kind, (n > 1) ? parts[1] : NULL);
+
+	/* a list filtered by group also changes with the groups */
+	if (n < 2 && query->len)
+		gen = max(gen, json_generation(GEN_GROUP, NULL));
+
+	snprintf(etag, ETAG_SIZE, "\"%lx-%lx\"", json_epoch(), gen);
+
+	return 1;
+}
+
+/* everything else is tagged with a hash of the body */
+static void body_etag(char *body, char *etag)
+{
+	unsigned long long	 hash = 14695981039346656037ULL;
+
+	while (*body) {
+		hash ^= (unsigned char) *body++;
+		hash *= 1099511628211ULL;
+	}
+
+	snprintf(etag, ETAG_SIZE, "\"%016llx\"", hash);
+}
+
+static int etag_matches(struct http_message *hm, char *etag)
+{
+	struct mg_str		*val;
+	size_t			 len = strlen(etag);
+	size_t			 i;
+	int			 j;
+
+	for (j = 0; j < MG_MAX_HTTP_HEADERS; j++)
+		if (is_equal(&hm->header_names[j], &s_if_none_match))
+			break;
+
+	if (j == MG_MAX_HTTP_HEADERS)
+		return 0;
+
+	val = &hm->header_values[j];
+
+	if (val->len == 1 && *val->p == '*')
+		return 1;
+
+	/* a list of tags, weak or not */
+	for (i = 0; i + len <= val->len; i++)
+		if (!memcmp(val->p + i, etag, len))
+			return 1;
+
+	return 0;
+}
+
 static int get_dem_request(char *verb, char *resp)
 {
 	struct host_iface	*iface = interfaces;
@@ -171,36 +352,119 @@ static int post_dem_request(char *verb, struct mg_str *body, char *resp)
 	return ret;
 }
 
-static int handle_dem_requests(char *verb, struct http_message *hm, char *resp)
+static int get_jobs_request(char *p[], int n, char **resp)
 {
 	int			 ret;
 
-	if (is_equal(&hm->method, &s_get_method))
-		ret = get_dem_request(verb, resp);
-	else if (is_equal(&hm->method, &s_post_method))
-		ret = post_dem_request(verb, &hm->body, resp);
+	if (n == 2)
+		ret = show_config_jobs(resp);
+	else if (n == 3)
+		ret = show_config_job(p[2], resp);
 	else
-		ret = bad_request(resp);
+		return bad_request(*resp);
 
-	return ret;
+	return http_error(ret);
+}
+
+#define LIST_TARGETS	(1 << GEN_TARGET)
+#define LIST_HOSTS	(1 << GEN_HOST)
+#define LIST_GROUPS	(1 << GEN_GROUP)
+#define LIST_ALL	(LIST_TARGETS | LIST_HOSTS | LIST_GROUPS)
+
+/* fills in the filters and paging of a list of the given kind from its
+ * query string, parameters that are not for lists are left for others
+ */
+static int parse_list_query(const struct mg_str *qs, int kind,
+			    struct list_query *query, char *resp)
+{
+	struct {
+		char		*parm;
+		char		*value;
+		int		 lists;
+	} parms[] = {
+		{ URI_PARM_ALIAS, query->alias, LIST_ALL },
+		{ URI_PARM_AFTER, query->after, LIST_ALL },
+		{ URI_PARM_FABRIC, query->fabric, LIST_TARGETS },
+		{ URI_PARM_ADDRESS, query->address, LIST_TARGETS },
+		{ URI_PARM_MODE, query->mode, LIST_TARGETS },
+		{ URI_PARM_NQN, query->nqn, LIST_TARGETS | LIST_HOSTS },
+		{ URI_PARM_GROUP, query->group, LIST_TARGETS | LIST_HOSTS },
+		{ URI_PARM_LIMIT, NULL, LIST_ALL },
+		{ URI_PARM_SORT, NULL, LIST_ALL },
+	};
+	int			 num = sizeof(parms) / sizeof(parms[0]);
+	const char		*p = qs->p;
+	const char		*end = p + qs->len;
+	const char		*next;
+	char			 buf[LIST_PARM_SIZE];
+	char			*value;
+	int			 len;
+	int			 i;
+
+	memset(query, 0, sizeof(*query));
+
+	for (; p && p < end; p = next ? next + 1 : NULL) {
+		next = memchr(p, '&', end - p);
+
+		for (i = 0; i < num; i++) {
+			len = strlen(parms[i].parm);
+			if (end - p >= len && !strncmp(p, parms[i].parm, len))
+				break;
+		}
+
+		if (i == num)
+			continue;
+
+		if (!(parms[i].lists & (1 << kind))) {
+			sprintf(resp, "'%.*s' does not apply to this list",
+				len - 1, parms[i].parm);
+			return -EINVAL;
+		}
+
+		value = parms[i].value ? parms[i].value : buf;
+
+		p += len;
+		if (mg_url_decode(p, (next ? next : end) - p, value,
+				  LIST_PARM_SIZE, 1) < 0) {
+			sprintf(resp, "'%.*s' is too long", len - 1,
+				parms[i].parm);
+			return -EINVAL;
+		}
+
+		if (parms[i].value)
+			continue;
+
+		if (!strcmp(parms[i].parm, URI_PARM_LIMIT)) {
+			query->limit = atoi(buf);
+			if (query->limit < 0)
+				goto bad_value;
+		} else if (!strcmp(buf, "-alias") || !strcmp(buf, "-name"))
+			query->descending = 1;
+		else if (strcmp(buf, "alias") && strcmp(buf, "name"))
+			goto bad_value;
+	}
+
+	return 0;
+bad_value:
+	sprintf(resp, "Bad value '%s' for '%.*s'", buf, len - 1,
+		parms[i].parm);
+
+	return -EINVAL;
 }
 
-static int get_target_request(char *target, char **p, int n, char *query,
-			      char **resp)
+static int get_target_request(char *target, char **p, int n,
+			      const struct mg_str *qs,
+			      struct body_stream *stream, char **resp)
 {
+	struct list_query	 query;
 	int			 ret;
 
 	if (!target || !*target) {
-		if ((strncmp(query, URI_PARM_MODE, PARM_MODE_LEN) == 0)
-		    && (query[PARM_MODE_LEN]))
-			ret = list_json_target(query, resp);
-		else if ((strncmp(query, URI_PARM_FABRIC, PARM_FABRIC_LEN) == 0)
-			 && (query[PARM_FABRIC_LEN]))
-			ret = list_json_target(query, resp);
-		else
-			ret = list_json_target(NULL, resp);
+		ret = parse_list_query(qs, GEN_TARGET, &query, *resp);
+		if (!ret)
+			ret = list_json_target(&query, write_body, stream);
 	} else if (n == 0)
-		ret = show_json_target(target, resp);
+		ret = show_json_target(target, write_body, stream, *resp);
 	else if (n == 1 && !strcmp(*p, URI_USAGE)) {
 		ret = target_usage(target, resp);
 		if (ret)
@@ -341,7 +605,7 @@ static int post_target_request(char *target, char **p, int n,
 			sprintf(resp, "Unable to reconfigure %s '%s' error %d",
 				TAG_TARGET, target, ret);
 	} else if (!strcmp(*p, METHOD_REFRESH)) {
-		ret = target_refresh(target);
+		ret = queue_target_refresh(target);
 		if (!ret)
 			sprintf(resp, "%s '%s' refreshed", TAG_TARGET, target);
 		else if (ret == -ENOENT)
@@ -402,22 +666,18 @@ out:
 }
 
 static int handle_target_requests(char *p[], int n, struct http_message *hm,
-				  char **resp)
+				  struct body_stream *stream, char **resp)
 {
 	char			*target;
-	char			 query[32] = { 0 };
 	int			 ret;
 
 	target = p[1];
 	p += 2;
 	n = (n > 2) ? n - 2 : 0;
 
-	if (hm->query_string.len)
-		strncpy(query, hm->query_string.p,
-			min(hm->query_string.len, sizeof(query) - 1));
-
 	if (is_equal(&hm->method, &s_get_method))
-		ret = get_target_request(target, p, n, query, resp);
+		ret = get_target_request(target, p, n, &hm->query_string,
+					 stream, resp);
 	else if (is_equal(&hm->method, &s_put_method))
 		ret = put_target_request(target, p, n, &hm->body, *resp);
 	else if (is_equal(&hm->method, &s_delete_method))
@@ -432,14 +692,19 @@ static int handle_target_requests(char *p[], int n, struct http_message *hm,
 	return ret;
 }
 
-static int get_host_request(char *host, char **p, int n, char **resp)
+static int get_host_request(char *host, char **p, int n,
+			    const struct mg_str *qs,
+			    struct body_stream *stream, char **resp)
 {
+	struct list_query	 query;
 	int			 ret = -EINVAL;
 
-	if (!host)
-		ret = list_json_host(resp);
-	else if (n == 0)
-		ret = show_json_host(host, resp);
+	if (!host) {
+		ret = parse_list_query(qs, GEN_HOST, &query, *resp);
+		if (!ret)
+			ret = list_json_host(&query, write_body, stream);
+	} else if (n == 0)
+		ret = show_json_host(host, write_body, stream, *resp);
 	else if (n == 1 && !strcmp(*p, URI_LOG_PAGE)) {
 		ret = host_logpage(host, resp);
 		if (ret)
@@ -547,14 +812,18 @@ out:
 	return 0;
 }
 
-static int get_group_request(char *group, char **resp)
+static int get_group_request(char *group, const struct mg_str *qs,
+			     struct body_stream *stream, char *resp)
 {
+	struct list_query	 query;
 	int			 ret;
 
-	if (!group)
-		ret = list_json_group(resp);
-	else
-		ret = show_json_group(group, resp);
+	if (!group) {
+		ret = parse_list_query(qs, GEN_GROUP, &query, resp);
+		if (!ret)
+			ret = list_json_group(&query, write_body, stream);
+	} else
+		ret = show_json_group(group, write_body, stream, resp);
 
 	return http_error(ret);
 }
@@ -649,7 +918,7 @@ static int patch_group_request(char *group, struct mg_str *body, char *resp)
 }
 
 static int handle_group_requests(char *p[], int n, struct http_message *hm,
-				 char **resp)
+				 struct body_stream *stream, char **resp)
 {
 	char			*group;
 	int			 ret;
@@ -660,7 +929,8 @@ static int handle_group_requests(char *p[], int n, struct http_message *hm,
 	p += 2;
 
 	if (is_equal(&hm->method, &s_get_method))
-		ret = get_group_request(group, resp);
+		ret = get_group_request(group, &hm->query_string, stream,
+					*resp);
 	else if (is_equal(&hm->method, &s_put_method))
 		ret = put_group_request(group, p, n, &hm->body, *resp);
 	else if (is_equal(&hm->method, &s_delete_method))
@@ -676,7 +946,7 @@ static int handle_group_requests(char *p[], int n, struct http_message *hm,
 }
 
 static int handle_host_requests(char *p[], int n, struct http_message *hm,
-				char **resp)
+				struct body_stream *stream, char **resp)
 {
 	char			*host = NULL;
 	int			 ret;
@@ -686,7 +956,8 @@ static int handle_host_requests(char *p[], int n, struct http_message *hm,
 	n = (n > 2) ? n - 2 : 0;
 
 	if (is_equal(&hm->method, &s_get_method))
-		ret = get_host_request(host, p, n, resp);
+		ret = get_host_request(host, p, n, &hm->query_string, stream,
+				       resp);
 	else if (is_equal(&hm->method, &s_put_method))
 		ret = put_host_request(host, n, &hm->body, *resp);
 	else if (is_equal(&hm->method, &s_delete_method))
@@ -703,16 +974,479 @@ static int handle_host_requests(char *p[], int n, struct http_message *hm,
 
 #define MAX_DEPTH 8
 
-void handle_http_request(struct mg_connection *c, void *ev_data)
+static int run_batch_entry(json_t *entry, char *resp)
+{
+	struct http_message	 hm;
+	char			*parts[MAX_DEPTH] = { NULL };
+	char			*uri = NULL;
+	char			*body = NULL;
+	json_t			*obj;
+	int			 ret;
+	int			 n;
+
+	memset(&hm, 0, sizeof(hm));
+
+	obj = json_object_get(entry, TAG_METHOD);
+	if (!obj || !json_is_string(obj))
+		goto invalid;
+
+	hm.method.p = json_string_value(obj);
+	hm.method.len = strlen(hm.method.p);
+
+	if (is_equal(&hm.method, &s_get_method) ||
+	    is_equal(&hm.method, &s_options_method))
+		goto invalid;
+
+	obj = json_object_get(entry, TAG_URI);
+	if (!obj || !json_is_string(obj) || *json_string_value(obj) != '/')
+		goto invalid;
+
+	uri = strdup(json_string_value(obj));
+	if (!uri)
+		goto nomem;
+
+	hm.uri.p = json_string_value(obj);
+	hm.uri.len = strlen(uri);
+
+	obj = json_object_get(entry, TAG_BODY);
+	if (obj && json_is_string(obj))
+		hm.body.p = json_string_value(obj);
+	else if (obj) {
+		body = json_dumps(obj, JSON_COMPACT);
+		if (!body)
+			goto nomem;
+		hm.body.p = body;
+	}
+
+	if (hm.body.p)
+		hm.body.len = strlen(hm.body.p);
+
+	n = parse_uri(uri, MAX_DEPTH, parts);
+	if (n < 1)
+		goto invalid;
+
+	if (strncmp(parts[0], URI_GROUP, GROUP_LEN) == 0)
+		ret = handle_group_requests(parts, n, &hm, NULL, &resp);
+	else if (strncmp(parts[0], URI_HOST, HOST_LEN) == 0)
+		ret = handle_host_requests(parts, n, &hm, NULL, &resp);
+	else if (strncmp(parts[0], URI_TARGET, TARGET_LEN) == 0)
+		ret = handle_target_requests(parts, n, &hm, NULL, &resp);
+	else
+		goto invalid;
+
+	goto out;
+invalid:
+	strcpy(resp, "Invalid batch entry");
+	ret = http_error(-EINVAL);
+	goto out;
+nomem:
+	strcpy(resp, "No memory!");
+	ret = HTTP_ERR_INTERNAL;
+out:
+	free(body);
+	free(uri);
+
+	return ret;
+}
+
+static int run_batch(json_t *batch, char *entry_resp, char *resp)
+{
+	size_t			 i;
+	int			 ret;
+
+	for (i = 0; i < json_array_size(batch); i++) {
+		memset(entry_resp, 0, BODY_SIZE);
+
+		ret = run_batch_entry(json_array_get(batch, i), entry_resp);
+		if (ret) {
+			snprintf(resp, BODY_SIZE, "Batch entry %zu failed: %s",
+				 i, entry_resp);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/* the changes of a committed batch are published as if made one by one */
+static void note_batch_entry(json_t *entry)
+{
+	struct mg_str		 method;
+	char			*parts[MAX_DEPTH] = { NULL };
+	char			*uri;
+	int			 n;
+
+	method.p = json_string_value(json_object_get(entry, TAG_METHOD));
+	method.len = strlen(method.p);
+
+	uri = strdup(json_string_value(json_object_get(entry, TAG_URI)));
+	if (!uri)
+		return;
+
+	n = parse_uri(uri, MAX_DEPTH, parts);
+	if (n > 0)
+		note_change(parts, n, &method);
+
+	free(uri);
+}
+
+static int scope_name(json_t *scope, const char *name)
+{
+	int			 kind;
+
+	for (kind = 0; kind < NUM_GEN_KINDS; kind++)
+		if (add_json_scope(scope, kind, name, 0))
+			return -ENOMEM;
+
+	return 0;
+}
+
+/* any string in a body may name a target, host or group */
+static int scope_names(json_t *scope, json_t *obj)
+{
+	const char		*key;
+	json_t			*value;
+	size_t			 i;
+
+	if (json_is_string(obj))
+		return scope_name(scope, json_string_value(obj));
+
+	if (json_is_object(obj)) {
+		json_object_foreach(obj, key, value)
+			if (scope_names(scope, value))
+				return -ENOMEM;
+	} else if (json_is_array(obj)) {
+		for (i = 0; i < json_array_size(obj); i++)
+			if (scope_names(scope, json_array_get(obj, i)))
+				return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/* the object an entry's URI is for is changed by the batch, anything else
+ * the URI or body names may be looked at; see scoped_json_root().  An
+ * entry that is not valid is left to run_batch_entry() to report.
+ */
+static int scope_batch_entry(json_t *scope, json_t *entry)
+{
+	char			*parts[MAX_DEPTH] = { NULL };
+	char			*uri;
+	json_t			*body = NULL;
+	json_t			*obj;
+	int			 kind;
+	int			 ret = 0;
+	int			 i, n;
+
+	obj = json_object_get(entry, TAG_URI);
+	if (!obj || !json_is_string(obj))
+		return 0;
+
+	uri = strdup(json_string_value(obj));
+	if (!uri)
+		return -ENOMEM;
+
+	n = parse_uri(uri, MAX_DEPTH, parts);
+
+	kind = (n > 1) ? config_kind(parts[0]) : -1;
+	if (kind >= 0)
+		ret = add_json_scope(scope, kind, parts[1], 1);
+
+	for (i = 2; !ret && i < n; i++)
+		ret = scope_name(scope, parts[i]);
+
+	obj = json_object_get(entry, TAG_BODY);
+	if (obj && json_is_string(obj)) {
+		body = json_loads(json_string_value(obj), JSON_DECODE_ANY,
+				  NULL);
+		obj = body;
+	}
+
+	if (!ret && obj)
+		ret = scope_names(scope, obj);
+
+	json_decref(body);
+	free(uri);
+
+	return ret;
+}
+
+/* POST /dem/batch takes a JSON array of changes, each
+ * {"Method":"PUT","URI":"/target/t1/subsystem/s1","Body":{...}} with the
+ * Body given as it would be to the single request.  The changes are made
+ * in a sandbox holding copies of just the targets, hosts and groups they
+ * name, and what refers to those.  If any fails the sandbox is thrown away
+ * and nothing has changed; otherwise the sandbox is committed as it is,
+ * with the config file written once, each host sent one AEN and the
+ * changes for each target pushed together in one job.
+ */
+static int post_batch_request(struct mg_str *body, char *resp)
+{
+	struct config_sandbox	 sb;
+	struct linked_list	 ops;
+	json_error_t		 error;
+	json_t			*batch;
+	json_t			*scope = NULL;
+	char			*entry_resp = NULL;
+	size_t			 i;
+	int			 ret;
+
+	batch = json_loadb(body->p, body->len, 0, &error);
+	if (!batch || !json_is_array(batch)) {
+		strcpy(resp, "Batch must be a JSON array of changes");
+		ret = http_error(-EINVAL);
+		goto out;
+	}
+
+	entry_resp = malloc(BODY_SIZE);
+	if (!entry_resp)
+		goto nomem;
+
+	scope = json_object();
+	if (!scope)
+		goto nomem;
+
+	for (i = 0; i < json_array_size(batch); i++)
+		if (scope_batch_entry(scope, json_array_get(batch, i)))
+			goto nomem;
+
+	begin_json_batch();
+	begin_notification_batch();
+
+	if (enter_config_sandbox(&sb, scope)) {
+		drop_notification_batch();
+		end_json_batch();
+		goto nomem;
+	}
+
+	ret = run_batch(batch, entry_resp, resp);
+	if (ret) {
+		take_config_ops(&ops);
+		free_config_ops(&ops);
+
+		leave_config_sandbox(&sb);
+
+		drop_notification_batch();
+	} else {
+		commit_config_sandbox(&sb);
+
+		for (i = 0; i < json_array_size(batch); i++)
+			note_batch_entry(json_array_get(batch, i));
+
+		coalesce_config_ops();
+		end_notification_batch();
+	}
+
+	end_json_batch();
+
+	if (!ret)
+		sprintf(resp, "Batch of %zu changes applied",
+			json_array_size(batch));
+
+	goto out;
+nomem:
+	strcpy(resp, "No memory!");
+	ret = HTTP_ERR_INTERNAL;
+out:
+	free(entry_resp);
+	json_decref(scope);
+	if (batch)
+		json_decref(batch);
+
+	return ret;
+}
+
+static int handle_dem_requests(char *p[], int n, struct http_message *hm,
+			       char **resp)
+{
+	int			 ret;
+
+	if (is_equal(&hm->method, &s_get_method)) {
+		if (n > 1 && strcmp(p[1], URI_JOBS) == 0)
+			ret = get_jobs_request(p, n, resp);
+		else
+			ret = get_dem_request(p[1], *resp);
+	} else if (is_equal(&hm->method, &s_post_method)) {
+		if (n > 1 && strcmp(p[1], URI_BATCH) == 0)
+			ret = post_batch_request(&hm->body, *resp);
+		else
+			ret = post_dem_request(p[1], &hm->body, *resp);
+	} else
+		ret = bad_request(*resp);
+
+	return ret;
+}
+
+/* ?async on a change hands its target pushes to a job, ?async=0 is off */
+static int is_async(const struct mg_str *query)
+{
+	const char		*p = query->p;
+	const char		*end = p + query->len;
+	size_t			 len = strlen(URI_PARM_ASYNC);
+
+	while (p && p < end) {
+		if ((size_t) (end - p) >= len &&
+		    strncmp(p, URI_PARM_ASYNC, len) == 0) {
+			if (p + len == end || p[len] == '&')
+				return 1;
+			if (p[len] == '=')
+				return p + len + 1 == end || p[len + 1] != '0';
+		}
+
+		p = memchr(p, '&', end - p);
+		if (p)
+			p++;
+	}
+
+	return 0;
+}
+
+static void write_inb_config_latency(struct http_reply *reply)
+{
+	const char		*name = "dem_inband_config_duration_seconds";
+	static const char	*ops[NUM_INB_OPS] = {
+		[INB_GET_CONFIG]	= "get",
+		[INB_SET_CONFIG]	= "set",
+		[INB_RESET_CONFIG]	= "reset",
+	};
+	char			 labels[32];
+	int			 i;
+
+	write_metric_help(reply, name, "histogram",
+			  "Time for an in-band SC to answer a config command.");
+
+	for (i = 0; i < NUM_INB_OPS; i++) {
+		snprintf(labels, sizeof(labels), "op=\"%s\"", ops[i]);
+		write_histogram_series(reply, name, labels,
+				       &dc_metrics.inb_config_latency[i]);
+	}
+}
+
+static void write_inb_session_counter(struct http_reply *reply,
+				      const char *name, const char *help,
+				      size_t offset)
+{
+	struct target		*target;
+	unsigned long		*counter;
+
+	write_metric_help(reply, name, "counter", help);
+
+	list_for_each_entry(target, target_list, node) {
+		if (target->mgmt_mode != IN_BAND_MGMT)
+			continue;
+
+		counter = (void *) &target->inb_session + offset;
+		reply_printf(reply, "%s{target=\"%s\"} %lu\n", name,
+			     target->alias, read_metric(counter));
+	}
+}
+
+/* health of the managed session of each in-band target, built aside with
+ * the config lock held and copied into the reply once it is dropped since
+ * the reply may have to wait on the client
+ */
+static void write_inb_sessions(struct http_reply *out)
+{
+	const char		*name = "dem_inband_session_up";
+	struct http_reply	 snapshot = { NULL };
+	struct http_reply	*reply = &snapshot;
+	struct target		*target;
+
+	json_read_lock();
+
+	write_metric_help(reply, name, "gauge",
+			  "Whether the session to an in-band SC is up.");
+
+	list_for_each_entry(target, target_list, node)
+		if (target->mgmt_mode == IN_BAND_MGMT)
+			reply_printf(reply, "%s{target=\"%s\"} %ld\n", name,
+				     target->alias,
+				     read_gauge(&target->inb_session.up));
+
+	write_inb_session_counter(reply, "dem_inband_session_connects_total",
+				  "Sessions established to an in-band SC.",
+				  offsetof(struct inb_session, connects));
+
+	write_inb_session_counter(reply,
+				  "dem_inband_session_connect_failures_total",
+				  "Failed connects to an in-band SC.",
+				  offsetof(struct inb_session,
+					   connect_failures));
+
+	write_inb_session_counter(reply, "dem_inband_session_drops_total",
+				  "Sessions to an in-band SC lost to an error.",
+				  offsetof(struct inb_session, drops));
+
+	json_unlock();
+
+	if (!snapshot.failed && snapshot.len)
+		reply_write(out, snapshot.buf, snapshot.len);
+
+	free(snapshot.buf);
+}
+
+static void write_dc_metrics(struct http_reply *reply)
+{
+	const char		*name = "dem_connected_hosts";
+	struct host_iface	*iface = interfaces;
+	size_t			 bytes;
+	int			 count;
+	int			 i;
+
+	write_histogram(reply, "dem_log_page_duration_seconds",
+			"Time to serve a Get Log Page to a host.",
+			&dc_metrics.log_page_latency);
+
+	write_histogram(reply, "dem_target_refresh_duration_seconds",
+			"Time to refresh the log pages of a target.",
+			&dc_metrics.refresh_latency);
+
+	write_inb_config_latency(reply);
+
+	write_inb_sessions(reply);
+
+	write_counter(reply, "dem_aens_sent_total",
+		      "Log page change notifications sent to hosts.",
+		      read_metric(&dc_metrics.aens_sent));
+
+	write_metric_help(reply, name, "gauge",
+			  "Hosts connected to a host interface.");
+
+	for (i = 0; i < num_interfaces; i++, iface++)
+		reply_printf(reply, "%s{type=\"%s\",family=\"%s\","
+			     "address=\"%s\",port=\"%s\"} %ld\n", name,
+			     iface->type, iface->family, iface->address,
+			     iface->port, read_gauge(&iface->hosts));
+
+	interned_usage(&count, &bytes);
+
+	write_metric_help(reply, "dem_interned_strings", "gauge",
+			  "Distinct NQNs and aliases held in memory.");
+	reply_printf(reply, "dem_interned_strings %d\n", count);
+
+	write_metric_help(reply, "dem_interned_string_bytes", "gauge",
+			  "Bytes used by interned NQNs and aliases.");
+	reply_printf(reply, "dem_interned_string_bytes %zu\n", bytes);
+}
+
+void handle_http_request(struct http_message *hm, struct http_reply *reply)
 {
-	struct http_message	*hm = (struct http_message *) ev_data;
 	char			*resp = NULL;
 	char			*uri = NULL;
 	char			*parts[MAX_DEPTH] = { NULL };
+	char			 request[BODY_SIZE];
+	char			 etag[ETAG_SIZE] = { 0 };
+	struct body_stream	 stream = { reply, etag };
+	struct linked_list	 ops;
+	struct config_job	*job = NULL;
+	long			 job_id = 0;
+	int			 read_only;
+	int			 bad_uri = 0;
+	int			 not_modified = 0;
 	int			 ret;
 	int			 i, n;
 
-	json_spinlock();
+	INIT_LINKED_LIST(&ops);
 
 	if (!hm->uri.len) {
 		ret = HTTP_ERR_PAGE_NOT_FOUND;
@@ -735,16 +1469,17 @@ void handle_http_request(struct mg_connection *c, void *ev_data)
 	print_debug("%.*s %.*s", (int) hm->method.len, hm->method.p,
 		    (int) hm->uri.len, hm->uri.p);
 
-	for (i = 0; i < MG_MAX_HTTP_HEADERS; i++)
-		if (is_equal(&hm->header_names[i], &s_authorization))
-			break;
-
-	if ((i < MG_MAX_HTTP_HEADERS) &&
-	    (!is_equal(&hm->header_values[i], s_signature))) {
+	if (!authorized_request(hm)) {
 		ret = HTTP_ERR_FORBIDDEN;
 		goto out;
 	}
 
+	if (is_metrics_request(hm)) {
+		write_metrics(reply, write_dc_metrics);
+		free(resp);
+		goto done;
+	}
+
 	if (hm->body.len)
 		print_debug("%.*s", (int) hm->body.len, hm->body.p);
 
@@ -763,49 +1498,128 @@ void handle_http_request(struct mg_connection *c, void *ev_data)
 	if (n < 0)
 		goto bad_page;
 
-	if (strncmp(parts[0], URI_DEM, DEM_LEN) == 0)
-		ret = handle_dem_requests(parts[1], hm, resp);
+	/* GETs share the config lock, changes hold it only while the config
+	 * is updated; anything they need sent to targets is pushed after
+	 * the lock is dropped so other requests are not held up by a slow
+	 * or unreachable SC
+	 */
+	read_only = is_equal(&hm->method, &s_get_method);
+	if (read_only)
+		json_read_lock();
+	else
+		json_write_lock();
+
+	if (read_only && config_etag(parts, n, &hm->query_string, etag) &&
+	    etag_matches(hm, etag)) {
+		not_modified = 1;
+		ret = 0;
+	} else if (strncmp(parts[0], URI_DEM, DEM_LEN) == 0)
+		ret = handle_dem_requests(parts, n, hm, &resp);
 	else if (strncmp(parts[0], URI_GROUP, GROUP_LEN) == 0)
-		ret = handle_group_requests(parts, n, hm, &resp);
+		ret = handle_group_requests(parts, n, hm, &stream, &resp);
 	else if (strncmp(parts[0], URI_HOST, HOST_LEN) == 0)
-		ret = handle_host_requests(parts, n, hm, &resp);
+		ret = handle_host_requests(parts, n, hm, &stream, &resp);
 	else if (strncmp(parts[0], URI_TARGET, TARGET_LEN) == 0)
-		ret = handle_target_requests(parts, n, hm, &resp);
-	else
+		ret = handle_target_requests(parts, n, hm, &stream, &resp);
+	else {
+		bad_uri = 1;
+		ret = 0;
+	}
+
+	if (!read_only && !ret && !bad_uri)
+		note_change(parts, n, &hm->method);
+
+	/* jobs are queued before the lock is dropped so pushes to a target
+	 * go out in the order the changes were made
+	 */
+	if (!read_only)
+		take_config_ops(&ops);
+
+	if (!list_empty(&ops) && !ret && is_async(&hm->query_string)) {
+		snprintf(request, sizeof(request), "%.*s %.*s",
+			 (int) hm->method.len, hm->method.p,
+			 (int) hm->uri.len, hm->uri.p);
+		job_id = submit_config_job(&ops, request, resp);
+	}
+
+	if (!list_empty(&ops))
+		job = start_config_job(&ops);
+
+	json_unlock();
+
+	if (bad_uri)
 		goto bad_page;
 
+	if (read_only) {
+		if (!ret && !*etag && !reply->chunked) {
+			body_etag(resp, etag);
+			not_modified = etag_matches(hm, etag);
+		}
+		goto out;
+	}
+
+	if (job_id > 0) {
+		sprintf(resp, "{" JSINDX "}", TAG_JOB, (int) job_id);
+		ret = HTTP_ACCEPTED;
+		goto out;
+	}
+
+	if (job)
+		i = run_config_job(job, ret ? NULL : resp);
+	else
+		i = flush_config_ops(&ops, ret ? NULL : resp);
+	if (i && !ret)
+		ret = http_error(i);
+
 	goto out;
 
 bad_page:
 	sprintf(resp, "Bad page %.*s", (int) hm->uri.len, hm->uri.p);
 	ret = HTTP_ERR_PAGE_NOT_FOUND;
 out:
-	if (!ret)
-		mg_printf(c, "%s %d OK\r\n%s", HTTP_HDR, HTTP_OK, HTTP_ALLOW);
+	if (reply->chunked) {
+		reply_end_chunks(reply);
+		free(resp);
+		goto done;
+	}
+
+	if (not_modified) {
+		reply_printf(reply, "%s %d Not Modified\r\nETag: %s\r\n%s\r\n"
+			     "\r\n", HTTP_HDR, HTTP_NOT_MODIFIED, etag,
+			     HTTP_ALLOW);
+		free(resp);
+		goto done;
+	}
+
+	if (!ret && *etag)
+		reply_printf(reply, "%s %d OK\r\nETag: %s\r\n%s", HTTP_HDR,
+			     HTTP_OK, etag, HTTP_ALLOW);
+	else if (!ret)
+		reply_printf(reply, "%s %d OK\r\n%s", HTTP_HDR, HTTP_OK, HTTP_ALLOW);
+	else if (ret == HTTP_ACCEPTED)
+		reply_printf(reply, "%s %d Accepted\r\n"
+			     "Location: /%s/%s/%ld\r\n%s", HTTP_HDR, ret,
+			     URI_DEM, URI_JOBS, job_id, HTTP_ALLOW);
 	else if (ret == -1)
-		mg_printf(c, "%s %d OK\r\n%s\r\n%s", HTTP_HDR, HTTP_OK,
+		reply_printf(reply, "%s %d OK\r\n%s\r\n%s", HTTP_HDR, HTTP_OK,
 			  HTTP_ALLOW, HTTP_ALLOW_CONTROL);
 	else if (resp)
-		mg_printf(c, "%s %d\r\n%s\r\n%s", HTTP_HDR, ret, resp,
+		reply_printf(reply, "%s %d\r\n%s\r\n%s", HTTP_HDR, ret, resp,
 			  HTTP_ALLOW);
 	else
-		mg_printf(c, "%s %d\r\nInternal Error\r\n%s", HTTP_HDR, ret,
+		reply_printf(reply, "%s %d\r\nInternal Error\r\n%s", HTTP_HDR, ret,
 			  HTTP_ALLOW);
 
-	mg_printf(c, "\r\nContent-Type: plain/text");
+	reply_printf(reply, "\r\nContent-Type: plain/text");
 	if (resp) {
-		mg_printf(c, "\r\nContent-Length: %ld\r\n", strlen(resp));
-		mg_printf(c, "\r\n%s\r\n\r\n", resp);
+		reply_printf(reply, "\r\nContent-Length: %ld\r\n", strlen(resp));
+		reply_printf(reply, "\r\n%s", resp);
 		free(resp);
 	} else {
-		mg_printf(c, "\r\nContent-Length: 14\r\n");
-		mg_printf(c, "\r\nInternal Error\r\n\r\n");
+		reply_printf(reply, "\r\nContent-Length: 14\r\n");
+		reply_printf(reply, "\r\nInternal Error");
 	}
-
+done:
 	if (uri)
 		free(uri);
-
-	c->flags = MG_F_SEND_AND_CLOSE;
-
-	json_spinunlock();
 }
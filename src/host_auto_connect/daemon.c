@@ -49,6 +49,10 @@ static int			 signalled;
 static int			 debug;
 static struct ctrl_queue	 discovery_queue;
 static const char		*dc_str = "Discovery controller";
+static char			 sys_class_path[FILENAME_MAX + 1] =
+					SYS_CLASS_PATH;
+static char			 nvme_fabrics_path[FILENAME_MAX + 1] =
+					NVME_FABRICS_DEV;
 
 static void shutdown_dem(void)
 {
@@ -97,9 +101,9 @@ static int daemonize(void)
 static void show_help(char *app)
 {
 #ifdef CONFIG_DEBUG
-	const char		*app_args = "{-q} {-d}";
+	const char		*app_args = "{-q} {-d} {-R <sysroot>}";
 #else
-	const char		*app_args = "{-d} {-S}";
+	const char		*app_args = "{-d} {-S} {-R <sysroot>}";
 #endif
 	const char		*hac_args = "{-h <hostnqn>}";
 	const char		*dc_args =
@@ -113,6 +117,8 @@ static void show_help(char *app)
 	print_info("  -d - enable debug prints in log files");
 	print_info("  -S - run as a standalone process (default is daemon)");
 #endif
+	print_info("  -R - find sysfs and %s under sysroot (default /)",
+		   NVME_FABRICS_DEV);
 	print_info("  -h - HostNQN to use to connect to the %s", dc_str);
 	print_info("%s info:", dc_str);
 	print_info("  -t - transport type [ %s ]", valid_trtype_str);
@@ -152,14 +158,33 @@ static int init_dq(struct ctrl_queue *dq)
 	return 0;
 }
 
+/* looks for sysfs and the fabrics device under root rather than /, so the
+ * HAC can run against an emulated tree
+ */
+static int set_sysroot(char *root)
+{
+	int			 len = strlen(root);
+
+	while (len && root[len - 1] == '/')
+		len--;
+
+	if (len + strlen(SYS_CLASS_PATH) > FILENAME_MAX)
+		return -ENAMETOOLONG;
+
+	sprintf(sys_class_path, "%.*s" SYS_CLASS_PATH, len, root);
+	sprintf(nvme_fabrics_path, "%.*s" NVME_FABRICS_DEV, len, root);
+
+	return 0;
+}
+
 static int parse_args(int argc, char *argv[], struct ctrl_queue *dq)
 {
 	struct portid		*portid = dq->portid;
 	int			 opt;
 #ifdef CONFIG_DEBUG
-	const char		*opt_list = "?qdt:f:a:s:h:";
+	const char		*opt_list = "?qdR:t:f:a:s:h:";
 #else
-	const char		*opt_list = "?dSt:f:a:s:h:";
+	const char		*opt_list = "?dSR:t:f:a:s:h:";
 #endif
 
 	if (argc > 1 && strcmp(argv[1], "--help") == 0)
@@ -190,6 +215,12 @@ static int parse_args(int argc, char *argv[], struct ctrl_queue *dq)
 			run_as_daemon = 1;
 			break;
 #endif
+		case 'R':
+			if (set_sysroot(optarg)) {
+				print_info("Invalid sysroot");
+				goto out;
+			}
+			break;
 		case 't':
 			if (!optarg) {
 				print_info("Invalid trtype");
@@ -331,13 +362,13 @@ static int validate_usage(void)
 {
 	FILE			*fd;
 
-	if (getuid() != 0) {
+	if (getuid() != 0 && access(nvme_fabrics_path, W_OK)) {
 		print_info("must be root to allow access to %s",
-			   NVME_FABRICS_DEV);
+			   nvme_fabrics_path);
 		goto out;
 	}
 
-	fd = fopen(NVME_FABRICS_DEV, "r");
+	fd = fopen(nvme_fabrics_path, "r");
 	if (!fd) {
 		print_info("nvme-fabrics kernel module must be loaded");
 		goto out;
@@ -457,101 +488,190 @@ static void fetch_log_pages(struct ctrl_queue *dq)
 		free(log);
 }
 
-static void mark_connected_subsystems(struct ctrl_queue *dq)
+/* a fabrics controller the kernel has, as read from sysfs */
+struct fabrics_ctrl {
+	char			 name[NAME_MAX + 1];
+	char			 nqn[MAX_NQN_SIZE + 1];
+	char			 trtype[CONFIG_TYPE_SIZE + 1];
+	char			 traddr[CONFIG_ADDRESS_SIZE + 1];
+	char			 trsvcid[CONFIG_PORT_SIZE + 1];
+};
+
+static int read_ctl_attr(char *path, int pos, char *attr, char *val, int len)
 {
-	struct subsystem	*subsys;
-	struct logpage		*logpage;
+	FILE			*fd;
+
+	strcpy(path + pos, attr);
+	fd = fopen(path, "r");
+	if (unlikely(!fd))
+		return -errno;
+
+	if (!fgets(val, len, fd))
+		val[0] = 0;
+	fclose(fd);
+
+	*strchrnul(val, '\n') = 0;
+
+	return 0;
+}
+
+/* address reads as traddr=<addr>,trsvcid=<port> */
+static int parse_ctl_address(char *address, struct fabrics_ctrl *ctrl)
+{
+	char			*addr;
+	char			*port;
+
+	addr = strchr(address, '=');
+	if (!addr)
+		return -EINVAL;
+
+	port = strchr(++addr, ',');
+	if (!port)
+		return -EINVAL;
+
+	*port++ = 0;
+	port = strchr(port, '=');
+	if (!port)
+		return -EINVAL;
+
+	strncpy(ctrl->traddr, addr, CONFIG_ADDRESS_SIZE);
+	strncpy(ctrl->trsvcid, port + 1, CONFIG_PORT_SIZE);
+
+	return 0;
+}
+
+static int cmp_fabrics_ctrl(const void *a, const void *b)
+{
+	const struct fabrics_ctrl *x = a, *y = b;
+
+	return strcmp(x->nqn, y->nqn);
+}
+
+/* reads every controller once per pass, sorted by subsystem NQN, rather
+ * than rescanning sysfs for each subsystem in the log pages
+ */
+static int scan_fabrics_ctrls(struct fabrics_ctrl **ctrls)
+{
+	struct fabrics_ctrl	*array = NULL;
+	struct fabrics_ctrl	*ctrl;
 	struct dirent		*entry;
 	DIR			*dir;
-	FILE			*fd;
 	char			 path[FILENAME_MAX + 1];
-	char			 val[MAX_NQN_SIZE + 1];
 	char			 address[CONFIG_ADDRESS_SIZE + 1];
-	char			*port;
-	char			*addr;
+	void			*p;
 	int			 pos;
+	int			 size = 0;
+	int			 n = 0;
+
+	dir = opendir(sys_class_path);
+	if (unlikely(!dir))
+		return -errno;
+
+	for_each_dir(entry, dir) {
+		if (strncmp(entry->d_name, "nvme", 4))
+			continue;
+
+		if (n == size) {
+			size = size ? size * 2 : 64;
+			p = realloc(array, size * sizeof(*array));
+			if (!p) {
+				n = -ENOMEM;
+				break;
+			}
+			array = p;
+		}
 
-	list_for_each_entry(subsys, &dq->target->subsys_list, node) {
-		list_for_each_entry(logpage, &subsys->logpage_list, node)
-			logpage->connected = 0;
+		ctrl = &array[n];
+		memset(ctrl, 0, sizeof(*ctrl));
 
-		dir = opendir(SYS_CLASS_PATH);
-		if (unlikely(!dir))
-			return;
+		pos = snprintf(path, FILENAME_MAX, "%s/%s/", sys_class_path,
+			       entry->d_name);
 
-		for_each_dir(entry, dir) {
-			if (strncmp(entry->d_name, "nvme", 4))
-				continue;
+		if (read_ctl_attr(path, pos, SYS_CLASS_SUBNQN_FILE, ctrl->nqn,
+				  sizeof(ctrl->nqn)) ||
+		    read_ctl_attr(path, pos, SYS_CLASS_ADDR_FILE, address,
+				  sizeof(address)) ||
+		    read_ctl_attr(path, pos, SYS_CLASS_TRTYPE_FILE,
+				  ctrl->trtype, sizeof(ctrl->trtype)) ||
+		    parse_ctl_address(address, ctrl))
+			continue;
 
-			pos = snprintf(path, FILENAME_MAX,  "%s/%s/",
-				      SYS_CLASS_PATH, entry->d_name);
+		strcpy(ctrl->name, entry->d_name);
+		n++;
+	}
 
-			strcpy(path + pos, SYS_CLASS_SUBNQN_FILE);
-			fd = fopen(path, "r");
-			if (unlikely(!fd))
-				continue;
+	closedir(dir);
 
-			fgets(val, sizeof(val), fd);
-			fclose(fd);
+	if (n < 0) {
+		free(array);
+		return n;
+	}
 
-			*strchrnul(val, '\n') = 0;
-			if (strcmp(subsys->nqn, val))
-				continue;
+	if (n)
+		qsort(array, n, sizeof(*array), cmp_fabrics_ctrl);
 
-			strcpy(path + pos, SYS_CLASS_ADDR_FILE);
-			fd = fopen(path, "r");
-			if (unlikely(!fd))
-				continue;
+	*ctrls = array;
 
-			fgets(address, sizeof(address), fd);
-			fclose(fd);
-			*strchrnul(address, '\n') = 0;
+	return n;
+}
 
-			strcpy(path + pos, SYS_CLASS_TRTYPE_FILE);
-			fd = fopen(path, "r");
-			if (unlikely(!fd))
-				continue;
+static void mark_connected_logpage(struct subsystem *subsys,
+				   struct fabrics_ctrl *ctrl)
+{
+	struct logpage		*logpage;
 
-			fgets(val, sizeof(val), fd);
-			fclose(fd);
-			*strchrnul(val, '\n') = 0;
+	list_for_each_entry(logpage, &subsys->logpage_list, node) {
+		if (strcmp(trtype_str(logpage->e.trtype), ctrl->trtype))
+			continue;
+		if (strcmp(logpage->e.traddr, ctrl->traddr))
+			continue;
+		if (strcmp(logpage->e.trsvcid, ctrl->trsvcid))
+			continue;
+		if (logpage->valid == VALID_LOGPAGE) {
+			logpage->connected = 1;
+			print_debug("subsys %s already %s",
+				    subsys->nqn, ctrl->name);
+		} else if (logpage->valid == DELETED_LOGPAGE) {
+			list_del(&logpage->node);
+			print_debug("subsys %s removed", subsys->nqn);
+		}
+		break;
+	}
+}
 
-			addr = index(address, '=') + 1;
-			if (!addr)
-				continue;
+static void mark_connected_subsystems(struct ctrl_queue *dq)
+{
+	struct subsystem	*subsys;
+	struct logpage		*logpage;
+	struct fabrics_ctrl	*ctrls = NULL;
+	int			 lo, hi, mid;
+	int			 n;
 
-			port = index(addr, ',');
-			if (!port)
-				continue;
+	list_for_each_entry(subsys, &dq->target->subsys_list, node)
+		list_for_each_entry(logpage, &subsys->logpage_list, node)
+			logpage->connected = 0;
 
-			*port++ = 0;
-			port = index(port, '=') + 1;
-			if (!port)
-				continue;
+	n = scan_fabrics_ctrls(&ctrls);
+	if (n <= 0)
+		goto out;
 
-			list_for_each_entry(logpage, &subsys->logpage_list,
-					    node) {
-				if (strcmp(trtype_str(logpage->e.trtype), val))
-					continue;
-				if (strcmp(logpage->e.traddr, addr))
-					continue;
-				if (strcmp(logpage->e.trsvcid, port))
-					continue;
-				if (logpage->valid == VALID_LOGPAGE) {
-					logpage->connected = 1;
-					print_debug("subsys %s already %s",
-						   subsys->nqn, entry->d_name);
-				} else if (logpage->valid == DELETED_LOGPAGE) {
-					list_del(&logpage->node);
-					print_debug("subsys %s removed",
-						   subsys->nqn);
-				}
-				break;
-			}
+	list_for_each_entry(subsys, &dq->target->subsys_list, node) {
+		/* first controller of the subsystem, if any */
+		lo = 0;
+		hi = n;
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (strcmp(ctrls[mid].nqn, subsys->nqn) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
 		}
 
-		closedir(dir);
+		for (; lo < n && !strcmp(ctrls[lo].nqn, subsys->nqn); lo++)
+			mark_connected_logpage(subsys, &ctrls[lo]);
 	}
+out:
+	free(ctrls);
 }
 
 static void connect_one_subsystem(struct ctrl_queue *dq)
@@ -565,7 +685,7 @@ static void connect_one_subsystem(struct ctrl_queue *dq)
 			if (logpage->connected)
 				continue;
 
-			fd = fopen(PATH_NVME_FABRICS, "w");
+			fd = fopen(nvme_fabrics_path, "w");
 			if (unlikely(!fd))
 				continue;
 
@@ -40,3 +40,15 @@ int exec_delete_ex(char *url, char *data, int len);
 int exec_put(char *url, char *data, int len);
 int exec_post(char *url, char *data, int len);
 int exec_patch(char *url, char *data, int len);
+
+struct curl_chan;
+struct curl_batch;
+
+struct curl_chan *alloc_curl_chan(void);
+void free_curl_chan(struct curl_chan *chan);
+struct curl_batch *alloc_curl_batch(void);
+void free_curl_batch(struct curl_batch *batch);
+int queue_curl_request(struct curl_batch *batch, struct curl_chan *chan,
+		       const char *method, char *url, char *data, int len);
+int run_curl_batch(struct curl_batch *batch);
+int curl_chan_error(struct curl_chan *chan);
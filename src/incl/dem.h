@@ -56,6 +56,13 @@
 #define SIGNATURE_FILE_FILENAME	"signature"
 #define CONFIG_FILE		(CONFIG_DIR CONFIG_FILENAME)
 #define SIGNATURE_FILE		(CONFIG_DIR SIGNATURE_FILE_FILENAME)
+#define LOG_PAGE_CACHE_FILENAME	"logpages"
+#define LOG_PAGE_CACHE_FILE	(CONFIG_DIR LOG_PAGE_CACHE_FILENAME)
+/* the config journal, its image and the files they are written through */
+#define JOURNAL_SUFFIX		".journal"
+#define IMAGE_SUFFIX		".image"
+#define OLD_FILE_SUFFIX		".old"
+#define NEW_FILE_SUFFIX		".new"
 
 extern int			 stopped;
 
@@ -192,7 +199,8 @@ int send_async_event_request(struct endpoint *ep);
 int send_keep_alive(struct endpoint *ep);
 int send_reset_config(struct endpoint *ep);
 int send_set_config(struct endpoint *ep, int cid, int len, void *data);
-int send_get_config(struct endpoint *ep, int cid, int len, void **data);
+int send_get_config(struct endpoint *ep, int cid, u32 offset, int len,
+		    void **data);
 
 int send_del_target(struct target *target);
 
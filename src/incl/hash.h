@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: DUAL GPL-2.0/BSD */
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* simple hash table functions
+ *
+ * An entry embeds a struct hash_node the way it embeds a linked_list
+ * node and is found by walking the chain for the hash of its key and
+ * comparing the key.  The table doubles once it holds as many entries as
+ * it has buckets; when that fails it carries on with longer chains, so
+ * only hash_init() can fail.
+ */
+
+#define HASH_MIN_SIZE		64
+#define HASH_SEED		5381
+
+struct hash_node {
+	struct hash_node	*next;
+	unsigned int		 hash;
+};
+
+struct hash_table {
+	struct hash_node	**buckets;
+	unsigned int		 size;	/* a power of two */
+	unsigned int		 count;
+};
+
+static inline unsigned int hash_str(const char *str, unsigned int hash)
+{
+	while (*str)
+		hash = hash * 33 + (unsigned char) *str++;
+
+	return hash;
+}
+
+static inline unsigned int hash_int(unsigned int val, unsigned int hash)
+{
+	return (hash ^ val) * 2654435761U;
+}
+
+static inline unsigned int hash_ptr(const void *ptr)
+{
+	uintptr_t		 val = (uintptr_t) ptr;
+
+	return hash_int(val ^ (val >> 31 >> 1), HASH_SEED);
+}
+
+static inline int hash_init(struct hash_table *table)
+{
+	table->buckets = calloc(HASH_MIN_SIZE, sizeof(*table->buckets));
+	if (!table->buckets)
+		return -ENOMEM;
+
+	table->size = HASH_MIN_SIZE;
+	table->count = 0;
+
+	return 0;
+}
+
+static inline void hash_free(struct hash_table *table)
+{
+	free(table->buckets);
+
+	table->buckets = NULL;
+	table->size = 0;
+	table->count = 0;
+}
+
+static inline struct hash_node **hash_bucket(struct hash_table *table,
+					     unsigned int hash)
+{
+	return &table->buckets[hash & (table->size - 1)];
+}
+
+static inline void hash_grow(struct hash_table *table)
+{
+	struct hash_table	 new;
+	struct hash_node	*node;
+	struct hash_node	**bucket;
+	unsigned int		 i;
+
+	new.size = table->size * 2;
+	new.buckets = calloc(new.size, sizeof(*new.buckets));
+	if (!new.buckets)
+		return;
+
+	for (i = 0; i < table->size; i++)
+		while ((node = table->buckets[i])) {
+			table->buckets[i] = node->next;
+			bucket = hash_bucket(&new, node->hash);
+			node->next = *bucket;
+			*bucket = node;
+		}
+
+	free(table->buckets);
+
+	table->buckets = new.buckets;
+	table->size = new.size;
+}
+
+static inline void hash_add(struct hash_table *table, struct hash_node *node,
+			    unsigned int hash)
+{
+	struct hash_node	**bucket;
+
+	if (table->count >= table->size)
+		hash_grow(table);
+
+	bucket = hash_bucket(table, hash);
+
+	node->hash = hash;
+	node->next = *bucket;
+	*bucket = node;
+
+	table->count++;
+}
+
+static inline void hash_del(struct hash_table *table, struct hash_node *node)
+{
+	struct hash_node	**pos;
+
+	for (pos = hash_bucket(table, node->hash); *pos; pos = &(*pos)->next)
+		if (*pos == node) {
+			*pos = node->next;
+			table->count--;
+			return;
+		}
+}
+
+/* complex for_each like for_each_dir, the body only sees the nodes
+ * whose hash matches and must still compare the key
+ */
+#define hash_for_each_possible(table, node, key)			\
+	for (node = *hash_bucket(table, key); node; node = node->next)	\
+		if (node->hash == (key))
+
+#define hash_entry(node, type, member) container_of(node, type, member)
+
+#endif
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: DUAL GPL-2.0/BSD */
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __HTTP_WORKERS_H__
+#define __HTTP_WORKERS_H__
+
+/* a count of 0 handles requests on the mongoose thread as before */
+#define MAX_HTTP_WORKERS	64
+
+/* HTTP/1.1 connections are kept open between requests until they have
+ * been idle this many seconds
+ */
+#define HTTP_IDLE_TIMEOUT	30
+
+struct mg_mgr;
+struct mg_connection;
+struct http_message;
+
+/* response built by a handler, sent by the mongoose thread.  Once
+ * reply_start_chunks() is called the rest of the body is sent with
+ * chunked transfer encoding a piece at a time as it is written, so the
+ * reply never holds more than about REPLY_CHUNK_SIZE of it.
+ */
+#define REPLY_CHUNK_SIZE	16384
+
+struct http_reply {
+	char			*buf;
+	int			 len;
+	int			 size;
+	int			 chunked;
+	int			 chunk;	/* start of the open chunk */
+	int			 failed;
+	int			(*flush)(struct http_reply *reply);
+	void			*priv;
+};
+
+typedef void (*http_handler_t)(struct http_message *hm,
+			       struct http_reply *reply);
+
+int reply_printf(struct http_reply *reply, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+int reply_write(struct http_reply *reply, const char *buf, int len);
+int reply_start_chunks(struct http_reply *reply);
+int reply_end_chunks(struct http_reply *reply);
+
+int default_http_workers(void);
+int init_http_workers(struct mg_mgr *mgr, int count, http_handler_t handler);
+void cleanup_http_workers(void);
+void queue_http_request(struct mg_connection *c, struct http_message *hm);
+void drop_http_request(struct mg_connection *c);
+void expire_http_connection(struct mg_connection *c);
+
+#endif
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: DUAL GPL-2.0/BSD */
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <time.h>
+
+/* Metrics are plain counters bumped with relaxed atomics so the paths
+ * that count them never take a lock; a scrape reads each one on its own
+ * and may see a request in one counter before another.
+ */
+
+/* latency buckets in usec, from 100us to 10s plus +Inf */
+#define HISTOGRAM_BUCKETS	16
+
+struct histogram {
+	unsigned long		 bucket[HISTOGRAM_BUCKETS + 1];
+	unsigned long		 sum;	/* usec */
+};
+
+static inline void count_metric(unsigned long *counter)
+{
+	__atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+static inline void add_metric(long *gauge, long delta)
+{
+	__atomic_add_fetch(gauge, delta, __ATOMIC_RELAXED);
+}
+
+static inline unsigned long read_metric(unsigned long *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static inline long read_gauge(long *gauge)
+{
+	return __atomic_load_n(gauge, __ATOMIC_RELAXED);
+}
+
+static inline unsigned long long metrics_clock(void)
+{
+	struct timespec		 t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec * 1000000ULL + t.tv_nsec / 1000;
+}
+
+/* kept by nvmeof.c and rdma.c which every daemon links */
+extern unsigned long		 connect_failures;
+
+void count_wc_error(int status);
+int rdma_wc_errors(int i, const char **status, unsigned long *count);
+
+/* metrics.c, linked by the daemons with a REST server */
+struct http_message;
+struct http_reply;
+
+typedef void (*metrics_writer_t)(struct http_reply *reply);
+
+void observe_histogram(struct histogram *h, unsigned long long start);
+void observe_http_request(struct http_message *hm, unsigned long long start);
+int is_metrics_request(struct http_message *hm);
+void write_metrics(struct http_reply *reply, metrics_writer_t writer);
+void write_metric_help(struct http_reply *reply, const char *name,
+		       const char *type, const char *help);
+void write_counter(struct http_reply *reply, const char *name,
+		   const char *help, unsigned long value);
+void write_histogram(struct http_reply *reply, const char *name,
+		     const char *help, struct histogram *h);
+void write_histogram_series(struct http_reply *reply, const char *name,
+			    const char *labels, struct histogram *h);
+
+#endif
@@ -488,6 +488,15 @@ enum {
 	nvmf_del_host_config	= 0x0d,
 	nvmf_link_host_config	= 0x0e,
 	nvmf_unlink_host_config	= 0x0f,
+	nvmf_batch_config	= 0x10,
+	nvmf_get_port_state	= 0x11,
+	nvmf_get_subsys_state	= 0x12,
+	nvmf_get_ns_state	= 0x13,
+	nvmf_get_host_state	= 0x14,
+	nvmf_get_host_link_state = 0x15,
+	nvmf_get_port_link_state = 0x16,
+	nvmf_get_nsdev_list	= 0x17,
+	nvmf_get_xport_list	= 0x18,
 };
 
 struct nvmf_resource_config_command {
@@ -495,7 +504,9 @@ struct nvmf_resource_config_command {
 	__u8			rsvd1;
 	__u16			command_id;
 	__u8			fctype;
-	__u8			rsvd2[59];
+	__u8			rsvd2[35];
+	__le32			offset;	/* first entry wanted, paged get ids */
+	__u8			rsvd3[20];
 };
 
 struct nvmf_port_config_entry {
@@ -551,6 +562,54 @@ struct nvmf_link_port_entry {
 	__le16			portid;
 };
 
+/* nvmf_batch_config carries a list of set config entries in one transfer,
+ * each behind a header with its config id.  The SC applies them in order
+ * and stops at the first that fails; it writes the status of each entry
+ * back into its header, entries it did not get to are marked
+ * NVME_SC_ABORT_REQ.  An SC that applies the batch as a transaction rolls
+ * back the entries before a failed one and marks them NVME_SC_ABORT_REQ
+ * too, leaving its config as it was before the batch.
+ */
+#define NVMF_BATCH_CONFIG_SIZE	65536
+#define NVMF_BATCH_CONFIG_ALIGN	8
+
+struct nvmf_batch_config_hdr {
+	__le16			num_entries;
+	__u8			rsvd[6];
+};
+
+struct nvmf_batch_config_entry {
+	__u8			config_id;
+	__u8			rsvd;
+	__le16			status;
+	__le16			len;	/* of data, then padded to ALIGN */
+	__u8			rsvd2[2];
+	__u8			data[];
+};
+
+/* the get state ids report what the SC has in configfs, as the set config
+ * entries that would create it: port, subsys, ns and host config entries
+ * and link host and link port entries.  A reply holds the entries from
+ * the command's offset on that fit the buffer, total says how many there
+ * are so the rest can be asked for.
+ *
+ * nvmf_get_nsdev_list and nvmf_get_xport_list page the same way, with
+ * ns devices and transports entries.  They replace nvmf_get_ns_config and
+ * nvmf_get_xport_config, whose single page reply with a u8 count cannot
+ * hold a large inventory.
+ */
+#define NVMF_GET_STATE_SIZE	65536
+#define NVMF_GET_STATE_SIG	0x54534d44	/* "DMST" */
+
+struct nvmf_get_state_hdr {
+	__le32			signature;
+	__le32			num_entries;
+	__le32			total;
+	__u8			config_id;
+	__u8			rsvd[3];
+	__u8			data[];
+};
+
 struct nvmf_get_transports_entry {
 	__u8			trtype;
 	__u8			adrfam;
@@ -68,6 +68,8 @@ struct xp_ops {
 			struct xp_mr *mr);
 	int (*poll_for_msg)(struct xp_ep *ep, struct xp_qe **qe, void **msg,
 			    int *bytes);
+	int (*wait_for_msg)(struct xp_ep *ep, struct xp_qe **qe, void **msg,
+			    int *bytes, int msec);
 	int (*alloc_key)(struct xp_ep *ep, void *buf, int len,
 			 struct xp_mr **mr);
 	u32 (*remote_key)(struct xp_mr *mr);
@@ -86,6 +86,40 @@
 #define TAG_NEW			"NEW"
 #define TAG_OLD			"OLD"
 
+/* Provisioning job specific */
+#define TAG_JOBS		"Jobs"
+#define TAG_JOB			"Job"
+#define TAG_STATE		"State"
+#define TAG_REQUEST		"Request"
+#define TAG_MESSAGE		"Message"
+#define TAG_WAIT_MS		"WaitMs"
+#define TAG_RUN_MS		"RunMs"
+#define TAG_PENDING		"Pending"
+#define TAG_COMPLETED		"Completed"
+#define TAG_FAILED		"Failed"
+#define TAG_AVG_LATENCY		"AvgLatencyMs"
+#define TAG_MAX_LATENCY		"MaxLatencyMs"
+
+/* Batch specific */
+#define TAG_METHOD		"Method"
+#define TAG_URI			"URI"
+#define TAG_BODY		"Body"
+
+/* List paging specific */
+#define TAG_NEXT		"Next"
+
+/* Change event specific */
+#define TAG_SEQ			"Seq"
+#define TAG_EVENT		"Event"
+#define TAG_ACTION		"Action"
+#define TAG_ADDED		"Added"
+#define TAG_REMOVED		"Removed"
+#define EVENT_SUBSYS		"subsys"
+#define EVENT_NS		"ns"
+#define EVENT_ACL		"acl"
+#define EVENT_LOG_PAGE		"logpage"
+#define EVENT_RESYNC		"resync"
+
 #define URI_GROUP		"group"
 #define URI_TARGET		"target"
 #define URI_HOST		"host"
@@ -98,8 +132,21 @@
 #define URI_SIGNATURE		"signature"
 #define URI_LOG_PAGE		"logpage"
 #define URI_USAGE		"usage"
+#define URI_JOBS		"jobs"
+#define URI_BATCH		"batch"
+#define URI_EVENTS		"events"
+#define URI_METRICS		"metrics"
+#define URI_PARM_ASYNC		"async"
 #define URI_PARM_MODE		"mode="
 #define URI_PARM_FABRIC		"fabric="
+#define URI_PARM_SINCE		"since="
+#define URI_PARM_ALIAS		"alias="
+#define URI_PARM_ADDRESS	"address="
+#define URI_PARM_NQN		"nqn="
+#define URI_PARM_GROUP		"group="
+#define URI_PARM_AFTER		"after="
+#define URI_PARM_LIMIT		"limit="
+#define URI_PARM_SORT		"sort="
 
 #define GROUP_LEN		(sizeof(URI_GROUP) - 1)
 #define TARGET_LEN		(sizeof(URI_TARGET) - 1)
@@ -175,6 +175,7 @@ static inline int list_empty(const struct linked_list *list)
 #define UNUSED(x) ((void) x)
 
 #define min(x, y) ((x < y) ? x : y)
+#define max(x, y) ((x > y) ? x : y)
 
 #define __round_mask(x, y) ((__typeof__(x))((y) - 1))
 #define round_up(x, y) ((((x) - 1) | __round_mask(x, y)) + 1)
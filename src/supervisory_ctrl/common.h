@@ -151,15 +151,33 @@ struct target {
 	int			 kato_countdown;
 };
 
-struct mg_connection;
+/* fills a get state reply, see nvmf_get_state_hdr */
+struct state_walk {
+	void			*entry;	/* next one to fill */
+	int			 size;
+	int			 skip;	/* entries before the offset */
+	int			 room;
+	int			 count;
+	int			 total;
+};
+
+struct http_message;
+struct http_reply;
 
 void shutdown_dem(void);
-void handle_http_request(struct mg_connection *c, void *ev_data);
+void handle_http_request(struct http_message *hm, struct http_reply *reply);
 
 void *interface_thread(void *arg);
 int start_pseudo_target(struct host_iface *iface);
 int run_pseudo_target(struct endpoint *ep, void *id);
 
+int set_sysroot(char *root);
+void close_configfs(void);
+void begin_config_read(void);
+void end_config_read(void);
+void begin_config(void);
+void commit_config(void);
+int rollback_config(void);
 void reset_config(void);
 int create_subsys(char *subsys, int allowany);
 int delete_subsys(char *subsys);
@@ -174,6 +192,14 @@ int link_host_to_subsys(char *subsys, char *host);
 int unlink_host_from_subsys(char *subsys, char *host);
 int link_port_to_subsys(char *subsys, int portid);
 int unlink_port_from_subsys(char *subsys, int portid);
+int get_port_state(struct state_walk *w);
+int get_subsys_state(struct state_walk *w);
+int get_ns_state(struct state_walk *w);
+int get_host_state(struct state_walk *w);
+int get_host_link_state(struct state_walk *w);
+int get_port_link_state(struct state_walk *w);
+int get_nsdev_list(struct state_walk *w);
+int get_xport_list(struct state_walk *w);
 int enumerate_devices(void);
 int enumerate_interfaces(void);
 void free_devices(void);
@@ -37,6 +37,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -78,22 +79,6 @@
 #define MAXPATHLEN		512
 #define MAXSTRLEN		64
 
-#define write_chr(fn, ch)				\
-	do {						\
-		fd = fopen(fn, "w");			\
-		if (fd) {				\
-			fputc(ch, fd);			\
-			fclose(fd);			\
-		}					\
-	} while (0)
-#define write_str(fn, s)				\
-	do {						\
-		fd = fopen(fn, "w");			\
-		if (fd) {				\
-			fputs(s, fd);			\
-			fclose(fd);			\
-		}					\
-	} while (0)
 #define read_str(fn, s)					\
 	do {						\
 		s[0] = 0;				\
@@ -109,6 +94,461 @@
 		}					\
 	} while (0)
 
+/* configfs is changed relative to the directories below, opened on first
+ * use and kept, so an object costs a lookup from there rather than a walk
+ * of the whole path and a chdir in and out for every attribute.
+ */
+enum { CFS_SUBSYS_DIR, CFS_PORTS_DIR, CFS_HOSTS_DIR, NUM_CFS_DIRS };
+
+static char cfs_dir_path[NUM_CFS_DIRS][MAXPATHLEN] = {
+	[CFS_SUBSYS_DIR]	= CFS_PATH CFS_SUBSYS,
+	[CFS_PORTS_DIR]		= CFS_PATH CFS_PORTS,
+	[CFS_HOSTS_DIR]		= CFS_PATH CFS_HOSTS,
+};
+
+static char sysfs_path[MAXPATHLEN] = SYSFS_PATH;
+static char nullb_path[MAXPATHLEN] = NULL_BLK_DEVICE;
+
+/* looks for configfs, sysfs and null_blk under root rather than /, so the
+ * SC can run against an emulated tree.  The device paths written to
+ * configfs are left as the kernel would see them.  Called before configfs
+ * is first used.
+ */
+int set_sysroot(char *root)
+{
+	static const char	*cfs_dir_name[NUM_CFS_DIRS] = {
+		[CFS_SUBSYS_DIR]	= CFS_SUBSYS,
+		[CFS_PORTS_DIR]		= CFS_PORTS,
+		[CFS_HOSTS_DIR]		= CFS_HOSTS,
+	};
+	int			 len = strlen(root);
+	int			 i;
+
+	while (len && root[len - 1] == '/')
+		len--;
+
+	if (len + strlen(CFS_PATH CFS_SUBSYS) >= MAXPATHLEN ||
+	    len + strlen(NULL_BLK_DEVICE) >= MAXPATHLEN)
+		return -ENAMETOOLONG;
+
+	for (i = 0; i < NUM_CFS_DIRS; i++)
+		sprintf(cfs_dir_path[i], "%.*s" CFS_PATH "%s", len, root,
+			cfs_dir_name[i]);
+
+	sprintf(sysfs_path, "%.*s" SYSFS_PATH, len, root);
+	sprintf(nullb_path, "%.*s" NULL_BLK_DEVICE, len, root);
+
+	return 0;
+}
+
+static int cfs_dir_fd[NUM_CFS_DIRS] = { -1, -1, -1 };
+
+/* the REST and in-band threads may race to open one, the loser closes */
+static int cfs_dir(int i)
+{
+	int			 fd;
+	int			 old = -1;
+
+	fd = __atomic_load_n(&cfs_dir_fd[i], __ATOMIC_ACQUIRE);
+	if (fd >= 0)
+		return fd;
+
+	fd = open(cfs_dir_path[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (!__atomic_compare_exchange_n(&cfs_dir_fd[i], &old, fd, false,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		close(fd);
+		fd = old;
+	}
+
+	return fd;
+}
+
+void close_configfs(void)
+{
+	int			 i;
+
+	for (i = 0; i < NUM_CFS_DIRS; i++)
+		if (cfs_dir_fd[i] >= 0) {
+			close(cfs_dir_fd[i]);
+			cfs_dir_fd[i] = -1;
+		}
+}
+
+static DIR *opendirat(int base, const char *path)
+{
+	DIR			*dir;
+	int			 fd;
+
+	fd = openat(base, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	dir = fdopendir(fd);
+	if (!dir)
+		close(fd);
+
+	return dir;
+}
+
+static int write_attr(int base, const char *name, const char *val)
+{
+	ssize_t			 len = strlen(val);
+	ssize_t			 n;
+	int			 fd;
+
+	fd = openat(base, name, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	n = write(fd, val, len);
+	if (n < 0)
+		n = -errno;
+	else
+		n = (n == len) ? 0 : -EIO;
+
+	close(fd);
+
+	return n;
+}
+
+static void read_attr_at(int base, const char *name, char *val)
+{
+	ssize_t			 n;
+	char			*nl;
+	int			 fd;
+
+	val[0] = 0;
+
+	fd = openat(base, name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	n = read(fd, val, MAXSTRLEN - 1);
+	close(fd);
+
+	val[n > 0 ? n : 0] = 0;
+
+	nl = strchr(val, '\n');
+	if (nl)
+		*nl = 0;
+}
+
+/* config transactions
+ *
+ * A set config command may take several configfs steps, and a batch many
+ * more.  Changes are made inside begin_config() and commit_config(); each
+ * step that changes configfs notes how it is undone, and rollback_config()
+ * replays those notes newest first, so a change that fails partway leaves
+ * configfs as it found it rather than needing a reset and a full replay.
+ * A transaction holds the config lock alone, keeping the REST and in-band
+ * threads from interleaving their changes; anything that only walks
+ * configfs shares it inside begin_config_read() and end_config_read() so
+ * it never sees a transaction half done.
+ */
+enum { UNDO_RMDIR, UNDO_MKDIR, UNDO_WRITE, UNDO_UNLINK, UNDO_SYMLINK };
+
+struct cfs_undo {
+	struct linked_list	 node;
+	int			 op;
+	int			 dir;
+	char			*val;	/* attribute value or link target */
+	char			 path[];
+};
+
+static pthread_rwlock_t		 cfs_lock = PTHREAD_RWLOCK_INITIALIZER;
+static LINKED_LIST(cfs_undo_list);
+static bool			 cfs_recording;
+
+/* called inside a transaction, a no-op otherwise */
+static int note_undo(int op, int dir, const char *path, const char *val)
+{
+	struct cfs_undo		*undo;
+	int			 len = strlen(path) + 1;
+
+	if (!cfs_recording)
+		return 0;
+
+	undo = malloc(sizeof(*undo) + len + (val ? strlen(val) + 1 : 0));
+	if (!undo)
+		return -ENOMEM;
+
+	undo->op = op;
+	undo->dir = dir;
+	strcpy(undo->path, path);
+
+	if (val) {
+		undo->val = undo->path + len;
+		strcpy(undo->val, val);
+	} else
+		undo->val = NULL;
+
+	list_add(&undo->node, &cfs_undo_list);
+
+	return 0;
+}
+
+/* drops the notes taken since mark, for a step that did not happen */
+static void drop_undo(struct linked_list *mark)
+{
+	struct cfs_undo		*undo;
+
+	while (cfs_undo_list.next != mark) {
+		undo = list_first_entry(&cfs_undo_list, struct cfs_undo, node);
+		list_del(&undo->node);
+		free(undo);
+	}
+}
+
+void begin_config_read(void)
+{
+	pthread_rwlock_rdlock(&cfs_lock);
+}
+
+void end_config_read(void)
+{
+	pthread_rwlock_unlock(&cfs_lock);
+}
+
+void begin_config(void)
+{
+	pthread_rwlock_wrlock(&cfs_lock);
+	cfs_recording = true;
+}
+
+void commit_config(void)
+{
+	drop_undo(&cfs_undo_list);
+	cfs_recording = false;
+	pthread_rwlock_unlock(&cfs_lock);
+}
+
+static int undo_step(struct cfs_undo *undo)
+{
+	int			 base;
+	int			 ret;
+
+	base = cfs_dir(undo->dir);
+	if (base < 0)
+		return base;
+
+	switch (undo->op) {
+	case UNDO_RMDIR:
+		ret = unlinkat(base, undo->path, AT_REMOVEDIR);
+		break;
+	case UNDO_MKDIR:
+		ret = mkdirat(base, undo->path, 0x755);
+		break;
+	case UNDO_WRITE:
+		return write_attr(base, undo->path, undo->val);
+	case UNDO_UNLINK:
+		ret = unlinkat(base, undo->path, 0);
+		break;
+	case UNDO_SYMLINK:
+		ret = symlinkat(undo->val, base, undo->path);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return ret ? -errno : 0;
+}
+
+/* undoes the steps of the transaction, a step that cannot be undone is
+ * reported and the rest are still tried.  Returns -EIO if any failed.
+ */
+int rollback_config(void)
+{
+	struct cfs_undo		*undo, *next;
+	int			 failed = 0;
+	int			 ret;
+
+	cfs_recording = false;
+
+	list_for_each_entry_safe(undo, next, &cfs_undo_list, node) {
+		ret = undo_step(undo);
+		if (ret) {
+			print_err("could not undo change to %s%s %d",
+				  cfs_dir_path[undo->dir], undo->path, ret);
+			failed++;
+		}
+
+		list_del(&undo->node);
+		free(undo);
+	}
+
+	pthread_rwlock_unlock(&cfs_lock);
+
+	return failed ? -EIO : 0;
+}
+
+/* the steps a transaction is made of */
+
+/* returns 1 if the directory was there already */
+static int cfs_mkdir(int dir, const char *path)
+{
+	int			 base;
+	int			 ret;
+
+	base = cfs_dir(dir);
+	if (base < 0)
+		return base;
+
+	if (mkdirat(base, path, 0x755))
+		return (errno == EEXIST) ? 1 : -errno;
+
+	ret = note_undo(UNDO_RMDIR, dir, path, NULL);
+	if (ret)
+		unlinkat(base, path, AT_REMOVEDIR);
+
+	return ret;
+}
+
+/* the attributes named are noted so the object is restored with them */
+static int cfs_rmdir(int dir, const char *path, const char * const *attrs,
+		     int n)
+{
+	struct linked_list	*mark = cfs_undo_list.next;
+	char			 name[MAXPATHLEN];
+	char			 val[MAXSTRLEN];
+	int			 base;
+	int			 ret = 0;
+
+	base = cfs_dir(dir);
+	if (base < 0)
+		return base;
+
+	/* noted last to first so they are replayed mkdir first */
+	while (cfs_recording && n-- && !ret) {
+		snprintf(name, sizeof(name), "%s/%s", path, attrs[n]);
+		read_attr_at(base, name, val);
+		if (val[0])
+			ret = note_undo(UNDO_WRITE, dir, name, val);
+	}
+
+	if (!ret)
+		ret = note_undo(UNDO_MKDIR, dir, path, NULL);
+
+	if (!ret && unlinkat(base, path, AT_REMOVEDIR))
+		ret = -errno;
+
+	if (ret)
+		drop_undo(mark);
+
+	return (ret == -ENOENT) ? 0 : ret;
+}
+
+static int cfs_symlink(int dir, const char *target, const char *path)
+{
+	int			 base;
+	int			 ret;
+
+	base = cfs_dir(dir);
+	if (base < 0)
+		return base;
+
+	if (symlinkat(target, base, path))
+		return (errno == EEXIST) ? 0 : -errno;
+
+	ret = note_undo(UNDO_UNLINK, dir, path, NULL);
+	if (ret)
+		unlinkat(base, path, 0);
+
+	return ret;
+}
+
+static int cfs_unlink(int dir, const char *path)
+{
+	char			 target[MAXPATHLEN];
+	ssize_t			 len = 0;
+	int			 base;
+	int			 ret;
+
+	base = cfs_dir(dir);
+	if (base < 0)
+		return base;
+
+	if (cfs_recording) {
+		len = readlinkat(base, path, target, sizeof(target) - 1);
+		if (len < 0)
+			return (errno == ENOENT) ? 0 : -errno;
+		target[len] = 0;
+	}
+
+	if (unlinkat(base, path, 0))
+		return (errno == ENOENT) ? 0 : -errno;
+
+	ret = note_undo(UNDO_SYMLINK, dir, path, target);
+	if (ret)
+		symlinkat(target, base, path);
+
+	return ret;
+}
+
+struct cfs_attr {
+	const char		*name;
+	const char		*val;
+};
+
+/* batched form of write_attr(), looks up the object's directory once and
+ * writes the attributes in order, stopping at the first one that fails.
+ * The old values are noted unless the object was made in this transaction,
+ * its removal undoes them.
+ */
+static int write_attrs(int dir, const char *path,
+		       const struct cfs_attr *attrs, int n, bool created)
+{
+	char			 name[MAXPATHLEN];
+	char			 old[MAXSTRLEN] = "";
+	bool			 note = cfs_recording && !created;
+	int			 base;
+	int			 fd;
+	int			 i;
+	int			 ret = 0;
+
+	base = cfs_dir(dir);
+	if (base < 0)
+		return base;
+
+	fd = openat(base, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	for (i = 0; i < n && !ret; i++) {
+		if (note)
+			read_attr_at(fd, attrs[i].name, old);
+
+		ret = write_attr(fd, attrs[i].name, attrs[i].val);
+		if (ret || !note || !old[0] || !strcmp(old, attrs[i].val))
+			continue;
+
+		snprintf(name, sizeof(name), "%s/%s", path, attrs[i].name);
+		ret = note_undo(UNDO_WRITE, dir, name, old);
+		if (ret)
+			write_attr(fd, attrs[i].name, old);
+	}
+
+	close(fd);
+
+	return ret;
+}
+
+static inline int write_one_attr(int dir, const char *path,
+				 const char *name, const char *val)
+{
+	struct cfs_attr		 attr = { name, val };
+
+	return write_attrs(dir, path, &attr, 1, false);
+}
+
+static const char * const subsys_attrs[] = { CFS_ALLOW_ANY };
+static const char * const ns_attrs[] = { CFS_DEV_PATH };
+static const char * const port_attrs[] = {
+	CFS_TR_ADRFAM, CFS_TR_TYPE, CFS_TR_ADDR, CFS_TR_SVCID, CFS_TREQ
+};
+
 /* replace ~ with * in bash
  * # cd /sys/kernel/config/nvmet
  * # rm -f subsystems/~/hosts/~
@@ -118,21 +558,20 @@
  * # rmdir subsystems/~
  * # rmdir ports/~
  * # rmdir hosts/~
+ *
+ * Called inside a transaction; a reset is not undone, so nothing is noted
+ * and the steps already taken stay as they are.
  */
 void reset_config(void)
 {
-	char			 dir[MAXPATHLEN];
 	DIR			*subdir;
 	struct dirent		*entry;
-	int			 ret;
+	bool			 recording = cfs_recording;
 
-	getcwd(dir, sizeof(dir));
+	drop_undo(&cfs_undo_list);
+	cfs_recording = false;
 
-	ret = chdir(CFS_PATH);
-	if (ret)
-		goto out;
-
-	subdir = opendir(CFS_PATH CFS_SUBSYS);
+	subdir = opendir(cfs_dir_path[CFS_SUBSYS_DIR]);
 	if (!subdir)
 		goto ports;
 
@@ -141,7 +580,7 @@ void reset_config(void)
 	closedir(subdir);
 
 ports:
-	subdir = opendir(CFS_PATH CFS_PORTS);
+	subdir = opendir(cfs_dir_path[CFS_PORTS_DIR]);
 	if (!subdir)
 		goto hosts;
 
@@ -150,7 +589,7 @@ ports:
 	closedir(subdir);
 
 hosts:
-	subdir = opendir(CFS_PATH CFS_HOSTS);
+	subdir = opendir(cfs_dir_path[CFS_HOSTS_DIR]);
 	if (!subdir)
 		goto out;
 
@@ -158,74 +597,80 @@ hosts:
 		delete_host(entry->d_name);
 	closedir(subdir);
 out:
-	chdir(dir);
+	cfs_recording = recording;
 }
 
-static void delete_all_allowed_hosts(void)
+static int delete_all_allowed_hosts(char *subsys)
 {
-	char			path[MAXPATHLEN];
+	char			 path[MAXPATHLEN];
 	DIR			*dir;
 	struct dirent		*entry;
+	int			 ret = 0;
 
-	dir = opendir(CFS_ALLOWED);
-	if (dir) {
-		for_each_dir(entry, dir) {
-			sprintf(path, CFS_ALLOWED "%s", entry->d_name);
-			remove(path);
-		}
-		closedir(dir);
+	snprintf(path, sizeof(path), "%s/" CFS_ALLOWED, subsys);
+
+	dir = opendirat(cfs_dir(CFS_SUBSYS_DIR), path);
+	if (!dir)
+		return 0;
+
+	for_each_dir(entry, dir) {
+		snprintf(path, sizeof(path), "%s/" CFS_ALLOWED "%s", subsys,
+			 entry->d_name);
+		ret = cfs_unlink(CFS_SUBSYS_DIR, path);
+		if (ret)
+			break;
 	}
+	closedir(dir);
 
+	return ret;
 }
 
-static void delete_all_ns(void)
+static int delete_all_ns(char *subsys)
 {
-	char			path[MAXPATHLEN];
-	FILE			*fd;
+	char			 path[MAXPATHLEN];
 	DIR			*dir;
 	struct dirent		*entry;
+	int			 ret = 0;
 
-	dir = opendir(CFS_NS);
-	if (dir) {
-		for_each_dir(entry, dir) {
-			sprintf(path, CFS_NS "%s", entry->d_name);
-			chdir(path);
-			write_chr(CFS_ENABLE, FALSE);
-			chdir("../..");
-			rmdir(path);
-		}
-		closedir(dir);
+	snprintf(path, sizeof(path), "%s/" CFS_NS, subsys);
+
+	dir = opendirat(cfs_dir(CFS_SUBSYS_DIR), path);
+	if (!dir)
+		return 0;
+
+	for_each_dir(entry, dir) {
+		ret = delete_ns(subsys, atoi(entry->d_name));
+		if (ret)
+			break;
 	}
+	closedir(dir);
+
+	return ret;
 }
 
-static void unlink_all_ports(char *subsys)
+static int unlink_all_ports(char *subsys)
 {
-	char			path[MAXPATHLEN];
 	DIR			*dir;
-	DIR			*portdir;
 	struct dirent		*entry;
-	struct dirent		*portentry;
+	int			 base;
+	int			 ret = 0;
 
-	chdir(CFS_PATH);
+	base = cfs_dir(CFS_PORTS_DIR);
+	if (base < 0)
+		return 0;
 
-	dir = opendir(CFS_PORTS);
-	if (dir) {
-		for_each_dir(entry, dir) {
-			sprintf(path, CFS_PORTS "%s/" CFS_SUBSYS,
-				entry->d_name);
-			portdir = opendir(path);
-			if (unlikely(!portdir))
-				continue;
-			for_each_dir(portentry, portdir)
-				if (!strcmp(portentry->d_name, subsys)) {
-					sprintf(path,
-						CFS_PORTS "%s/" CFS_SUBSYS "%s",
-						entry->d_name, subsys);
-					remove(path);
-				}
-		}
-		closedir(dir);
+	dir = opendirat(base, ".");
+	if (!dir)
+		return 0;
+
+	for_each_dir(entry, dir) {
+		ret = unlink_port_from_subsys(subsys, atoi(entry->d_name));
+		if (ret)
+			break;
 	}
+	closedir(dir);
+
+	return ret;
 }
 
 /* replace ~ with * in bash
@@ -238,26 +683,31 @@ static void unlink_all_ports(char *subsys)
  */
 int delete_subsys(char *subsys)
 {
-	char			 dir[MAXPATHLEN];
-	char			 path[MAXPATHLEN];
+	struct stat		 st;
+	int			 base;
 	int			 ret;
 
-	getcwd(dir, sizeof(dir));
+	base = cfs_dir(CFS_SUBSYS_DIR);
+	if (base < 0)
+		return 0;
 
-	sprintf(path, CFS_PATH CFS_SUBSYS "%s", subsys);
-	ret = chdir(path);
-	if (ret)
+	if (fstatat(base, subsys, &st, 0))
 		return 0;
 
-	delete_all_allowed_hosts();
-	delete_all_ns();
-	unlink_all_ports(subsys);
+	ret = delete_all_allowed_hosts(subsys);
+	if (ret)
+		return ret;
 
-	chdir(CFS_PATH CFS_SUBSYS);
-	rmdir(subsys);
+	ret = delete_all_ns(subsys);
+	if (ret)
+		return ret;
 
-	chdir(dir);
-	return 0;
+	ret = unlink_all_ports(subsys);
+	if (ret)
+		return ret;
+
+	return cfs_rmdir(CFS_SUBSYS_DIR, subsys, subsys_attrs,
+			 NUM_ENTRIES(subsys_attrs));
 }
 
 /*
@@ -268,32 +718,14 @@ int delete_subsys(char *subsys)
  */
 int create_subsys(char *subsys, int allowany)
 {
-	char			 dir[MAXPATHLEN];
-	FILE			*fd;
+	struct cfs_attr		 attr = { CFS_ALLOW_ANY, allowany ? "1" : "0" };
 	int			 ret;
 
-	getcwd(dir, sizeof(dir));
-
-	ret = chdir(CFS_PATH CFS_SUBSYS);
-	if (ret)
-		return -errno;
-
-	ret = mkdir(subsys, 0x755);
-	if (ret && errno == EEXIST)
-		ret = 0;
-	else if (ret)
-		goto err;
+	ret = cfs_mkdir(CFS_SUBSYS_DIR, subsys);
+	if (ret < 0)
+		return ret;
 
-	chdir(subsys);
-
-	write_chr(CFS_ALLOW_ANY, allowany ? TRUE : FALSE);
-
-	goto out;
-err:
-	ret = -errno;
-out:
-	chdir(dir);
-	return ret;
+	return write_attrs(CFS_SUBSYS_DIR, subsys, &attr, 1, !ret);
 }
 
 /*
@@ -304,41 +736,26 @@ out:
  */
 int create_ns(char *subsys, int nsid, int devid, int devnsid)
 {
-	char			 dir[MAXPATHLEN];
 	char			 path[MAXPATHLEN];
-	FILE			*fd;
+	char			 dev[MAXPATHLEN];
+	struct cfs_attr		 attrs[] = {
+		{ CFS_DEV_PATH,	dev },
+		{ CFS_ENABLE,	"1" },
+	};
 	int			 ret;
 
-	getcwd(dir, sizeof(dir));
-
-	ret = chdir(CFS_PATH CFS_SUBSYS);
-	if (ret)
-		return -errno;
-
 	sprintf(path, "%s/" CFS_NS "%d", subsys, nsid);
-	ret = mkdir(path, 0x755);
-	if (ret && errno == EEXIST)
-		ret = 0;
-	else if (ret)
-		goto err;
-
-	chdir(path);
+	ret = cfs_mkdir(CFS_SUBSYS_DIR, path);
+	if (ret < 0)
+		return ret;
 
 	if (devid == NULLB_DEVID)
-		write_str(CFS_DEV_PATH, NULL_BLK_DEVICE);
-	else {
-		sprintf(path, NVME_DEVICE, devid, devnsid);
-		write_str(CFS_DEV_PATH, path);
-	}
-
-	write_chr(CFS_ENABLE, TRUE);
+		strcpy(dev, NULL_BLK_DEVICE);
+	else
+		sprintf(dev, NVME_DEVICE, devid, devnsid);
 
-	goto out;
-err:
-	ret = -errno;
-out:
-	chdir(dir);
-	return ret;
+	return write_attrs(CFS_SUBSYS_DIR, path, attrs, NUM_ENTRIES(attrs),
+			   !ret);
 }
 
 /*
@@ -348,29 +765,25 @@ out:
  */
 int delete_ns(char *subsys, int nsid)
 {
-	char			 dir[MAXPATHLEN];
 	char			 path[MAXPATHLEN];
-	FILE			*fd;
+	struct stat		 st;
+	int			 base;
 	int			 ret;
 
-	getcwd(dir, sizeof(dir));
-
-	ret = chdir(CFS_PATH CFS_SUBSYS);
-	if (ret)
+	base = cfs_dir(CFS_SUBSYS_DIR);
+	if (base < 0)
 		return 0;
 
 	sprintf(path, "%s/" CFS_NS "%d", subsys, nsid);
-	ret = chdir(path);
-	if (ret)
-		goto out;
+	if (fstatat(base, path, &st, 0))
+		return 0;
 
-	write_chr(CFS_ENABLE, FALSE);
+	ret = write_one_attr(CFS_SUBSYS_DIR, path, CFS_ENABLE, "0");
+	if (ret)
+		return ret;
 
-	chdir("../../..");
-	rmdir(path);
-out:
-	chdir(dir);
-	return 0;
+	return cfs_rmdir(CFS_SUBSYS_DIR, path, ns_attrs,
+			 NUM_ENTRIES(ns_attrs));
 }
 
 /*
@@ -379,20 +792,11 @@ out:
  */
 int create_host(char *host)
 {
-	char			 dir[MAXPATHLEN];
 	int			 ret;
 
-	getcwd(dir, sizeof(dir));
-
-	ret = chdir(CFS_PATH CFS_HOSTS);
-	if (ret)
-		return -errno;
+	ret = cfs_mkdir(CFS_HOSTS_DIR, host);
 
-	ret = mkdir(host, 0x755);
-	if (ret)
-		ret = (errno == EEXIST) ? 0 : -errno;
-	chdir(dir);
-	return ret;
+	return (ret < 0) ? ret : 0;
 }
 
 /*
@@ -401,19 +805,36 @@ int create_host(char *host)
  */
 int delete_host(char *host)
 {
-	char			 dir[MAXPATHLEN];
-	int			 ret;
+	if (cfs_dir(CFS_HOSTS_DIR) < 0)
+		return 0;
 
-	getcwd(dir, sizeof(dir));
+	return cfs_rmdir(CFS_HOSTS_DIR, host, NULL, 0);
+}
 
-	ret = chdir(CFS_PATH CFS_HOSTS);
-	if (ret)
-		return 0;
+/* an existing port that is linked to a subsystem refuses changes, so it
+ * is only taken if it already has the attributes wanted
+ */
+static int match_portid(int base, char *name, struct cfs_attr *attrs,
+			int n)
+{
+	char			 val[MAXSTRLEN];
+	int			 fd;
+	int			 i;
+	int			 ret = 0;
 
-	rmdir(host);
+	fd = openat(base, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
 
-	chdir(dir);
-	return 0;
+	for (i = 0; i < n && !ret; i++) {
+		read_attr_at(fd, attrs[i].name, val);
+		if (strcmp(val, attrs[i].val))
+			ret = -EBUSY;
+	}
+
+	close(fd);
+
+	return ret;
 }
 
 /*
@@ -428,77 +849,37 @@ int delete_host(char *host)
 int create_portid(int portid, char *fam, char *typ, int req, char *addr,
 		  int svcid)
 {
-	char			 dir[MAXPATHLEN];
 	char			 str[8];
-	char			 val[MAXSTRLEN];
-	FILE			*fd;
+	char			 svc[8];
+	struct cfs_attr		 attrs[] = {
+		{ CFS_TR_ADRFAM,	fam },
+		{ CFS_TR_TYPE,		typ },
+		{ CFS_TR_ADDR,		addr },
+		{ CFS_TR_SVCID,		svc },
+		{ CFS_TREQ,		NOT_SPECIFIED },
+	};
+	int			 n = NUM_ENTRIES(attrs);
 	int			 ret;
 
-	getcwd(dir, sizeof(dir));
-
-	ret = chdir(CFS_PATH CFS_PORTS);
-	if (ret)
-		return -errno;
-
 	snprintf(str, sizeof(str) - 1, "%d", portid);
-	ret = mkdir(str, 0x755);
-	if (ret && errno != EEXIST) {
-		ret = -errno;
-		goto out;
-	}
-
-	chdir(str);
+	snprintf(svc, sizeof(svc) - 1, "%d", svcid);
 
-	write_str(CFS_TR_ADRFAM, fam);
-	write_str(CFS_TR_TYPE, typ);
-	write_str(CFS_TR_ADDR, addr);
 	if (req == NVMF_TREQ_REQUIRED)
-		write_str(CFS_TREQ, REQUIRED);
+		attrs[n - 1].val = REQUIRED;
 	else if (req == NVMF_TREQ_NOT_REQUIRED)
-		write_str(CFS_TREQ, NOT_REQUIRED);
-	else
-		write_str(CFS_TREQ, NOT_SPECIFIED);
+		attrs[n - 1].val = NOT_REQUIRED;
 
-	snprintf(str, sizeof(str) - 1, "%d", svcid);
-	write_str(CFS_TR_SVCID, str);
+	ret = cfs_mkdir(CFS_PORTS_DIR, str);
+	if (ret < 0)
+		return ret;
 
 	if (!ret)
-		goto out;
-
-	ret = -EBUSY;
-
-	read_str(CFS_TR_ADRFAM, val);
-	if (strcmp(val, fam))
-		goto out;
-	read_str(CFS_TR_TYPE, val);
-	if (strcmp(val, typ))
-		goto out;
-	read_str(CFS_TR_ADDR, val);
-	if (strcmp(val, addr))
-		goto out;
-	read_str(CFS_TREQ, val);
-	if (req == NVMF_TREQ_REQUIRED) {
-		if (strcmp(val, REQUIRED))
-			goto out;
-	} else if (req == NVMF_TREQ_NOT_REQUIRED) {
-		if (strcmp(val, NOT_REQUIRED))
-			goto out;
-#if 0 // TODO REVIEW THIS
-	} else {
-		if (strcmp(val, NOT_SPECIFIED))
-			goto out;
-#endif
-	}
+		return write_attrs(CFS_PORTS_DIR, str, attrs, n, true);
 
-	snprintf(str, sizeof(str) - 1, "%d", svcid);
-	read_str(CFS_TR_SVCID, val);
-	if (strcmp(val, str))
-		goto out;
+	/* a port that is there already has to match, treq included */
+	write_attrs(CFS_PORTS_DIR, str, attrs, n, false);
 
-	ret = 0;
-out:
-	chdir(dir);
-	return ret;
+	return match_portid(cfs_dir(CFS_PORTS_DIR), str, attrs, n);
 }
 
 /* replace ~ with * in bash
@@ -508,36 +889,36 @@ out:
  */
 int delete_portid(int portid)
 {
-	char			 dir[MAXPATHLEN];
 	char			 path[MAXPATHLEN];
-	char			 file[MAXPATHLEN];
 	DIR			*subdir;
 	struct dirent		*entry;
-	int			 ret;
+	int			 base;
+	int			 ret = 0;
 
-	getcwd(dir, sizeof(dir));
-
-	ret = chdir(CFS_PATH CFS_PORTS);
-	if (ret)
+	base = cfs_dir(CFS_PORTS_DIR);
+	if (base < 0)
 		return 0;
 
 	snprintf(path, sizeof(path) - 1, "%d/" CFS_SUBSYS, portid);
 
-	subdir = opendir(path);
+	subdir = opendirat(base, path);
 	if (!subdir)
-		goto out;
+		return 0;
 
 	for_each_dir(entry, subdir) {
-		sprintf(file, "%s/%s", path, entry->d_name);
-		remove(file);
+		ret = unlink_port_from_subsys(entry->d_name, portid);
+		if (ret)
+			break;
 	}
 	closedir(subdir);
 
+	if (ret)
+		return ret;
+
 	snprintf(path, sizeof(path) - 1, "%d", portid);
-	rmdir(path);
-out:
-	chdir(dir);
-	return 0;
+
+	return cfs_rmdir(CFS_PORTS_DIR, path, port_attrs,
+			 NUM_ENTRIES(port_attrs));
 }
 
 /*
@@ -546,26 +927,13 @@ out:
  */
 int link_host_to_subsys(char *subsys, char *host)
 {
-	char			 dir[MAXPATHLEN];
 	char			 path[MAXPATHLEN];
 	char			 link[MAXPATHLEN];
-	int			 ret;
-
-	getcwd(dir, sizeof(dir));
 
-	ret = chdir(CFS_PATH CFS_SUBSYS);
-	if (ret)
-		return -errno;
-
-	sprintf(path, CFS_PATH CFS_HOSTS "%s", host);
+	snprintf(path, sizeof(path), "%s%s", cfs_dir_path[CFS_HOSTS_DIR], host);
 	sprintf(link, "%s/" CFS_ALLOWED "%s", subsys, host);
 
-	ret = symlink(path, link);
-	if (ret)
-		ret = (errno == EEXIST) ? 0 : -errno;
-
-	chdir(dir);
-	return ret;
+	return cfs_symlink(CFS_SUBSYS_DIR, path, link);
 }
 
 /*
@@ -574,23 +942,11 @@ int link_host_to_subsys(char *subsys, char *host)
  */
 int unlink_host_from_subsys(char *subsys, char *host)
 {
-	char			 dir[MAXPATHLEN];
 	char			 path[MAXPATHLEN];
-	int			 ret;
-
-	getcwd(dir, sizeof(dir));
-
-	ret = chdir(CFS_PATH CFS_SUBSYS);
-	if (ret)
-		return -errno;
 
 	sprintf(path, "%s/" CFS_ALLOWED "%s", subsys, host);
-	ret = remove(path);
-	if (ret)
-		ret = (errno == ENOENT) ? 0 : -errno;
 
-	chdir(dir);
-	return ret;
+	return cfs_unlink(CFS_SUBSYS_DIR, path);
 }
 
 /*
@@ -599,26 +955,14 @@ int unlink_host_from_subsys(char *subsys, char *host)
  */
 int link_port_to_subsys(char *subsys, int portid)
 {
-	char			 dir[MAXPATHLEN];
 	char			 path[MAXPATHLEN];
 	char			 link[MAXPATHLEN];
-	int			 ret;
-
-	getcwd(dir, sizeof(dir));
 
-	ret = chdir(CFS_PATH CFS_PORTS);
-	if (ret)
-		return -errno;
-
-	sprintf(path, CFS_PATH CFS_SUBSYS "%s", subsys);
+	snprintf(path, sizeof(path), "%s%s", cfs_dir_path[CFS_SUBSYS_DIR],
+		 subsys);
 	sprintf(link, "%d/" CFS_SUBSYS "%s", portid, subsys);
 
-	ret = symlink(path, link);
-	if (ret)
-		ret = (errno == EEXIST) ? 0 : -errno;
-
-	chdir(dir);
-	return ret;
+	return cfs_symlink(CFS_PORTS_DIR, path, link);
 }
 
 /*
@@ -627,23 +971,313 @@ int link_port_to_subsys(char *subsys, int portid)
  */
 int unlink_port_from_subsys(char *subsys, int portid)
 {
-	char			 dir[MAXPATHLEN];
 	char			 path[MAXPATHLEN];
-	int			 ret;
 
-	getcwd(dir, sizeof(dir));
+	sprintf(path, "%d/" CFS_SUBSYS "%s", portid, subsys);
 
-	ret = chdir(CFS_PATH CFS_PORTS);
-	if (ret)
-		return -errno;
+	return cfs_unlink(CFS_PORTS_DIR, path);
+}
 
-	sprintf(path, "%d/" CFS_SUBSYS "%s", portid, subsys);
-	ret = remove(path);
-	if (ret)
-		ret = (errno == ENOENT) ? 0 : -errno;
+/* configfs state walkers, each reports one kind of object as the set config
+ * entries that would create it, see nvmf_get_state_hdr.
+ */
 
-	chdir(dir);
-	return ret;
+static void *next_state(struct state_walk *w)
+{
+	void			*entry;
+
+	w->total++;
+
+	if (w->skip) {
+		w->skip--;
+		return NULL;
+	}
+
+	if (!w->room)
+		return NULL;
+
+	entry = w->entry;
+	memset(entry, 0, w->size);
+
+	w->entry += w->size;
+	w->room--;
+	w->count++;
+
+	return entry;
+}
+
+static void read_attr(const char *base, char *name, char *attr, char *val)
+{
+	char			 path[MAXPATHLEN];
+	FILE			*fd;
+
+	snprintf(path, sizeof(path), "%s%s/%s", base, name, attr);
+	read_str(path, val);
+}
+
+int get_port_state(struct state_walk *w)
+{
+	struct nvmf_port_config_entry *port;
+	const char		*base = cfs_dir_path[CFS_PORTS_DIR];
+	char			 val[MAXSTRLEN];
+	char			*name;
+	DIR			*dir;
+	struct dirent		*entry;
+
+	dir = opendir(base);
+	if (!dir)
+		return 0;
+
+	for_each_dir(entry, dir) {
+		port = next_state(w);
+		if (!port)
+			continue;
+
+		name = entry->d_name;
+
+		port->portid = htole16(atoi(name));
+
+		read_attr(base, name, CFS_TR_TYPE, val);
+		port->trtype = to_trtype(val);
+		read_attr(base, name, CFS_TR_ADRFAM, val);
+		port->adrfam = to_adrfam(val);
+		read_attr(base, name, CFS_TREQ, val);
+		if (!strcmp(val, REQUIRED))
+			port->treq = NVMF_TREQ_REQUIRED;
+		else if (!strcmp(val, NOT_REQUIRED))
+			port->treq = NVMF_TREQ_NOT_REQUIRED;
+		else
+			port->treq = NVMF_TREQ_NOT_SPECIFIED;
+
+		read_attr(base, name, CFS_TR_ADDR, port->traddr);
+		read_attr(base, name, CFS_TR_SVCID, val);
+		strncpy(port->trsvcid, val, NVMF_TRSVCID_SIZE - 1);
+	}
+	closedir(dir);
+
+	return 0;
+}
+
+int get_subsys_state(struct state_walk *w)
+{
+	struct nvmf_subsys_config_entry *subsys;
+	char			 val[MAXSTRLEN];
+	DIR			*dir;
+	struct dirent		*entry;
+
+	dir = opendir(cfs_dir_path[CFS_SUBSYS_DIR]);
+	if (!dir)
+		return 0;
+
+	for_each_dir(entry, dir) {
+		subsys = next_state(w);
+		if (!subsys)
+			continue;
+
+		strncpy(subsys->subnqn, entry->d_name,
+			NVMF_NQN_FIELD_LEN - 1);
+
+		read_attr(cfs_dir_path[CFS_SUBSYS_DIR], entry->d_name,
+			  CFS_ALLOW_ANY, val);
+		subsys->allowanyhost = val[0] == TRUE;
+	}
+	closedir(dir);
+
+	return 0;
+}
+
+/* a namespace that is not enabled is left out so it gets set up again, one
+ * on a device other than nvme or null_blk reports a device id that matches
+ * nothing
+ */
+int get_ns_state(struct state_walk *w)
+{
+	struct nvmf_ns_config_entry *ns;
+	char			 path[MAXPATHLEN];
+	char			 val[MAXSTRLEN];
+	DIR			*dir;
+	DIR			*nsdir;
+	struct dirent		*entry;
+	struct dirent		*nsentry;
+	int			 devid, devnsid;
+
+	dir = opendir(cfs_dir_path[CFS_SUBSYS_DIR]);
+	if (!dir)
+		return 0;
+
+	for_each_dir(entry, dir) {
+		if (snprintf(path, sizeof(path), "%s%s/" CFS_NS,
+			     cfs_dir_path[CFS_SUBSYS_DIR],
+			     entry->d_name) >= MAXPATHLEN)
+			continue;
+
+		nsdir = opendir(path);
+		if (!nsdir)
+			continue;
+
+		for_each_dir(nsentry, nsdir) {
+			read_attr(path, nsentry->d_name, CFS_ENABLE, val);
+			if (val[0] != TRUE)
+				continue;
+
+			ns = next_state(w);
+			if (!ns)
+				continue;
+
+			strncpy(ns->subnqn, entry->d_name,
+				NVMF_NQN_FIELD_LEN - 1);
+			ns->nsid = htole32(atoi(nsentry->d_name));
+
+			read_attr(path, nsentry->d_name, CFS_DEV_PATH, val);
+			if (!strcmp(val, NULL_BLK_DEVICE))
+				ns->deviceid = htole32(NVMF_NULLB_DEVID);
+			else if (sscanf(val, NVME_DEVICE, &devid,
+					&devnsid) == 2) {
+				ns->deviceid = htole32(devid);
+				ns->devicensid = htole32(devnsid);
+			} else
+				ns->deviceid = htole32(~0U);
+		}
+		closedir(nsdir);
+	}
+	closedir(dir);
+
+	return 0;
+}
+
+int get_host_state(struct state_walk *w)
+{
+	struct nvmf_host_config_entry *host;
+	DIR			*dir;
+	struct dirent		*entry;
+
+	dir = opendir(cfs_dir_path[CFS_HOSTS_DIR]);
+	if (!dir)
+		return 0;
+
+	for_each_dir(entry, dir) {
+		host = next_state(w);
+		if (host)
+			strncpy(host->hostnqn, entry->d_name,
+				NVMF_NQN_FIELD_LEN - 1);
+	}
+	closedir(dir);
+
+	return 0;
+}
+
+int get_host_link_state(struct state_walk *w)
+{
+	struct nvmf_link_host_entry *link;
+	char			 path[MAXPATHLEN];
+	DIR			*dir;
+	DIR			*hostdir;
+	struct dirent		*entry;
+	struct dirent		*hostentry;
+
+	dir = opendir(cfs_dir_path[CFS_SUBSYS_DIR]);
+	if (!dir)
+		return 0;
+
+	for_each_dir(entry, dir) {
+		if (snprintf(path, sizeof(path), "%s%s/" CFS_ALLOWED,
+			     cfs_dir_path[CFS_SUBSYS_DIR],
+			     entry->d_name) >= MAXPATHLEN)
+			continue;
+
+		hostdir = opendir(path);
+		if (!hostdir)
+			continue;
+
+		for_each_dir(hostentry, hostdir) {
+			link = next_state(w);
+			if (!link)
+				continue;
+
+			strncpy(link->subnqn, entry->d_name,
+				NVMF_NQN_FIELD_LEN - 1);
+			strncpy(link->hostnqn, hostentry->d_name,
+				NVMF_NQN_FIELD_LEN - 1);
+		}
+		closedir(hostdir);
+	}
+	closedir(dir);
+
+	return 0;
+}
+
+int get_port_link_state(struct state_walk *w)
+{
+	struct nvmf_link_port_entry *link;
+	char			 path[MAXPATHLEN];
+	DIR			*dir;
+	DIR			*subdir;
+	struct dirent		*entry;
+	struct dirent		*subentry;
+
+	dir = opendir(cfs_dir_path[CFS_PORTS_DIR]);
+	if (!dir)
+		return 0;
+
+	for_each_dir(entry, dir) {
+		if (snprintf(path, sizeof(path), "%s%s/" CFS_SUBSYS,
+			     cfs_dir_path[CFS_PORTS_DIR],
+			     entry->d_name) >= MAXPATHLEN)
+			continue;
+
+		subdir = opendir(path);
+		if (!subdir)
+			continue;
+
+		for_each_dir(subentry, subdir) {
+			link = next_state(w);
+			if (!link)
+				continue;
+
+			strncpy(link->subnqn, subentry->d_name,
+				NVMF_NQN_FIELD_LEN - 1);
+			link->portid = htole16(atoi(entry->d_name));
+		}
+		closedir(subdir);
+	}
+	closedir(dir);
+
+	return 0;
+}
+
+int get_nsdev_list(struct state_walk *w)
+{
+	struct nvmf_get_ns_devices_entry *entry;
+	struct nsdev		*dev;
+
+	list_for_each_entry(dev, devices, node) {
+		entry = next_state(w);
+		if (!entry)
+			continue;
+
+		entry->devid = dev->devid;
+		entry->nsid = dev->nsid;
+	}
+
+	return 0;
+}
+
+int get_xport_list(struct state_walk *w)
+{
+	struct nvmf_get_transports_entry *entry;
+	struct portid		*xport;
+
+	list_for_each_entry(xport, interfaces, node) {
+		entry = next_state(w);
+		if (!entry)
+			continue;
+
+		entry->trtype = to_trtype(xport->type);
+		entry->adrfam = to_adrfam(xport->family);
+		strncpy(entry->traddr, xport->address, NVMF_TRADDR_SIZE - 1);
+	}
+
+	return 0;
 }
 
 void free_devices(void)
@@ -661,9 +1295,8 @@ void free_devices(void)
 
 int enumerate_devices(void)
 {
-	char			 dir[MAXPATHLEN];
 	char			 path[MAXPATHLEN];
-	char			 buf[5];
+	char			 val[MAXSTRLEN];
 	DIR			*subdir;
 	DIR			*nvmedir;
 	struct dirent		*entry;
@@ -671,64 +1304,50 @@ int enumerate_devices(void)
 	struct nsdev		*device;
 	FILE			*fd;
 	int			 cnt = 0;
-	int			 ret;
-
-	getcwd(dir, sizeof(dir));
 
-	ret = chdir(SYSFS_PATH);
-	if (ret)
-		return -errno;
-
-	nvmedir = opendir(".");
+	nvmedir = opendir(sysfs_path);
 	if (unlikely(!nvmedir))
 		return -errno;
 
 	for_each_dir(entry, nvmedir) {
 		sprintf(path, "%s/" SYSFS_TRANSPORT, entry->d_name);
-		fd = fopen(path, "r");
-		if (!fd)
+		read_attr_at(dirfd(nvmedir), path, val);
+		if (strcmp(val, SYSFS_PCIE))
 			continue;
 
-		fgets(buf, sizeof(buf), fd);
-		if (strncmp(SYSFS_PCIE, buf, sizeof(buf)) == 0) {
-			subdir = opendir(entry->d_name);
-			if (unlikely(!subdir)) {
-				fclose(fd);
-				continue;
-			}
+		subdir = opendirat(dirfd(nvmedir), entry->d_name);
+		if (unlikely(!subdir))
+			continue;
 
-			for_each_dir(subentry, subdir)
-				if (strncmp(subentry->d_name, SYSFS_PREFIX,
-					    SYSFS_PREFIX_LEN) == 0) {
-					device = malloc(sizeof(*device));
-					if (!device) {
-						ret = -ENOMEM;
-						free_devices();
-						fclose(fd);
-						goto out;
-					}
-					sscanf(subentry->d_name, SYSFS_DEVICE,
-					       &device->devid, &device->nsid);
-					print_debug("adding device nvme%dn%d",
-						    device->devid,
-						    device->nsid);
-					list_add_tail(&device->node, devices);
-					cnt++;
+		for_each_dir(subentry, subdir)
+			if (strncmp(subentry->d_name, SYSFS_PREFIX,
+				    SYSFS_PREFIX_LEN) == 0) {
+				device = malloc(sizeof(*device));
+				if (!device) {
+					free_devices();
+					closedir(subdir);
+					closedir(nvmedir);
+					return -ENOMEM;
 				}
-			closedir(subdir);
-		}
-		fclose(fd);
+				sscanf(subentry->d_name, SYSFS_DEVICE,
+				       &device->devid, &device->nsid);
+				print_debug("adding device nvme%dn%d",
+					    device->devid, device->nsid);
+				list_add_tail(&device->node, devices);
+				cnt++;
+			}
+		closedir(subdir);
 	}
 	closedir(nvmedir);
 
-	fd = fopen(NULL_BLK_DEVICE, "r");
+	fd = fopen(nullb_path, "r");
 	if (fd) {
+		fclose(fd);
+
 		device = malloc(sizeof(*device));
 		if (!device) {
-			ret = -ENOMEM;
 			free_devices();
-			fclose(fd);
-			goto out;
+			return -ENOMEM;
 		}
 		device->devid = NULL_BLK_DEVID;
 		device->nsid = 0;
@@ -736,10 +1355,8 @@ int enumerate_devices(void)
 		print_debug("adding device nullb0");
 		list_add_tail(&device->node, devices);
 		cnt++;
-		fclose(fd);
 	}
-out:
-	chdir(dir);
+
 	return cnt;
 }
 
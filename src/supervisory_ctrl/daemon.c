@@ -40,6 +40,7 @@
 
 #include "mongoose.h"
 #include "common.h"
+#include "http_workers.h"
 #include "tags.h"
 #include "ops.h"
 
@@ -52,6 +53,7 @@ int					 stopped;
 int					 debug;
 static int				 signalled;
 static struct mg_serve_http_opts	 s_http_server_opts;
+static int				 s_http_workers = -1;
 static char				*s_http_port;
 struct linked_list			*devices = &device_linked_list;
 struct linked_list			*interfaces = &interface_linked_list;
@@ -82,12 +84,16 @@ static void ev_handler(struct mg_connection *c, int ev, void *ev_data)
 {
 	switch (ev) {
 	case MG_EV_HTTP_REQUEST:
-		handle_http_request(c, ev_data);
+		queue_http_request(c, ev_data);
 		break;
-	case MG_EV_HTTP_CHUNK:
-	case MG_EV_ACCEPT:
 	case MG_EV_CLOSE:
+		drop_http_request(c);
+		break;
 	case MG_EV_POLL:
+		expire_http_connection(c);
+		break;
+	case MG_EV_HTTP_CHUNK:
+	case MG_EV_ACCEPT:
 	case MG_EV_SEND:
 	case MG_EV_RECV:
 		break;
@@ -101,6 +107,8 @@ static void *poll_loop(struct mg_mgr *mgr)
 	while (stopped != 1)
 		mg_mgr_poll(mgr, IDLE_TIMEOUT);
 
+	cleanup_http_workers();
+
 	mg_mgr_free(mgr);
 
 	return NULL;
@@ -141,12 +149,12 @@ static int daemonize(void)
 static void show_help(char *app)
 {
 #ifdef CONFIG_DEBUG
-	const char		*arg_list = "{-q} {-d}";
+	const char		*arg_list = "{-q} {-d} {-R <sysroot>}";
 #else
-	const char		*arg_list = "{-d} {-S}";
+	const char		*arg_list = "{-d} {-S} {-R <sysroot>}";
 #endif
 	const char		*oob_args =
-		"{-p <port>} {-r <root>} {-c <cert_file>}";
+		"{-p <port>} {-r <root>} {-c <cert_file>} {-w <workers>}";
 	const char		*inb_args =
 		"{-t <trtype>} {-f <adrfam>} {-a <traddr>} {-s <trsvcid>}";
 
@@ -161,11 +169,14 @@ static void show_help(char *app)
 	print_info("  -d - enable debug prints in log files");
 	print_info("  -S - run as a standalone process (default is daemon)");
 #endif
+	print_info("  -R - find configfs and sysfs under sysroot (default /)");
 
 	print_info("  Out-of-Band (RESTful) interface:");
 	print_info("  -p - port");
 	print_info("  -r - http root (default %s)", DEFAULT_HTTP_ROOT);
 	print_info("  -c - SSL cert file (default no SSL)");
+	print_info("  -w - request worker threads, 0 to run requests on the");
+	print_info("       server thread (default one per cpu)");
 
 	print_info("  In-Band (Supervisory Controller) interface:");
 	print_info("  -t - transport type [ %s ]", valid_trtype_str);
@@ -230,9 +241,9 @@ static int init_dem(int argc, char *argv[], char **ssl_cert)
 	int			 inb_test;
 	int			 run_as_daemon;
 #ifdef CONFIG_DEBUG
-	const char		*opt_list = "?qdp:r:c:t:f:a:s:";
+	const char		*opt_list = "?qdR:p:r:c:w:t:f:a:s:";
 #else
-	const char		*opt_list = "?dSp:r:c:t:f:a:s:";
+	const char		*opt_list = "?dSR:p:r:c:w:t:f:a:s:";
 #endif
 
 	*ssl_cert = NULL;
@@ -265,6 +276,13 @@ static int init_dem(int argc, char *argv[], char **ssl_cert)
 			run_as_daemon = 0;
 			break;
 #endif
+		case 'R':
+			if (set_sysroot(optarg)) {
+				print_err("sysroot path too long");
+				return 1;
+			}
+			print_info("Using sysroot %s", optarg);
+			break;
 		case 'r':
 			s_http_server_opts.document_root = optarg;
 			break;
@@ -275,6 +293,15 @@ static int init_dem(int argc, char *argv[], char **ssl_cert)
 		case 'c':
 			*ssl_cert = optarg;
 			break;
+		case 'w':
+			s_http_workers = atoi(optarg);
+			if (s_http_workers < 0 ||
+			    s_http_workers > MAX_HTTP_WORKERS) {
+				print_err("workers must be 0 to %d",
+					  MAX_HTTP_WORKERS);
+				return 1;
+			}
+			break;
 		case 't':
 			strncpy(host_iface.type, optarg, CONFIG_TYPE_SIZE);
 			break;
@@ -440,9 +467,15 @@ int main(int argc, char *argv[])
 		if (init_inb_thread(&inb_pthread))
 			goto out3;
 
-	if (s_http_port)
+	if (s_http_port) {
+		if (s_http_workers < 0)
+			s_http_workers = default_http_workers();
+
+		/* if the pool can't start requests are run on the poll thread */
+		init_http_workers(&mgr, s_http_workers, handle_http_request);
+
 		poll_loop(&mgr);
-	else
+	} else
 		wait_for_signalled_shutdown();
 
 	ret = 0;
@@ -455,5 +488,7 @@ out3:
 out2:
 	free_devices();
 out1:
+	close_configfs();
+
 	return ret;
 }
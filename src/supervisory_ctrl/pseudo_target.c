@@ -44,6 +44,7 @@
 
 #define RETRY_COUNT	1200	// 2 min since multiplier of delay timeout
 #define DELAY_TIMEOUT	100	// ms
+#define BURST_TIMEOUT	2	// ms
 #define KATO_INTERVAL	500	// ms per spec
 
 #define NVME_VER ((1 << 16) | (2 << 8) | 1) /* NVMe 1.2.1 */
@@ -189,11 +190,18 @@ static int handle_identify(struct endpoint *ep, struct nvme_command *cmd,
 	return ret;
 }
 
+/* the legacy replies are one page with a u8 count, what does not fit is
+ * only reported by nvmf_get_nsdev_list and nvmf_get_xport_list
+ */
+#define LEGACY_MAX(hdr, entry) \
+	min(255, (int) ((PAGE_SIZE - sizeof(hdr) + 1) / sizeof(entry)))
+
 static int get_nsdev(void *data)
 {
 	struct nvmf_get_ns_devices_hdr *hdr = data;
 	struct nvmf_get_ns_devices_entry *entry;
 	struct nsdev		*dev;
+	int			 max = LEGACY_MAX(*hdr, *entry);
 	int			 cnt = 0;
 
 #ifdef DEBUG_COMMANDS
@@ -203,6 +211,8 @@ static int get_nsdev(void *data)
 	entry = (struct nvmf_get_ns_devices_entry *) &hdr->data;
 
 	list_for_each_entry(dev, devices, node) {
+		if (cnt == max)
+			break;
 		memset(entry, 0, sizeof(*entry));
 		entry->devid = dev->devid;
 		entry->nsid = dev->nsid;
@@ -220,6 +230,7 @@ static int get_xport(void *data)
 	struct nvmf_get_transports_hdr *hdr = data;
 	struct nvmf_get_transports_entry *entry;
 	struct portid		*xport;
+	int			 max = LEGACY_MAX(*hdr, *entry);
 	int			 cnt = 0;
 
 #ifdef DEBUG_COMMANDS
@@ -229,6 +240,8 @@ static int get_xport(void *data)
 	entry = (struct nvmf_get_transports_entry *) &hdr->data;
 
 	list_for_each_entry(xport, interfaces, node) {
+		if (cnt == max)
+			break;
 		memset(entry, 0, sizeof(*entry));
 		entry->trtype = to_trtype(xport->type);
 		entry->adrfam = to_adrfam(xport->family);
@@ -406,6 +419,94 @@ static inline int unlink_host(void *data)
 	return unlink_host_from_subsys(entry->subnqn, entry->hostnqn);
 }
 
+/* answers a get state id with the entries from the command's offset on
+ * that fit the host's buffer
+ */
+static int handle_get_state(struct nvme_command *cmd, struct endpoint *ep,
+			    u64 addr, u64 key, u64 len)
+{
+	struct nvmf_resource_config_command *c = &cmd->config;
+	struct nvmf_get_state_hdr *hdr;
+	struct state_walk	  w;
+	struct xp_mr		 *mr;
+	int			(*walk)(struct state_walk *w);
+	int			  ret;
+
+	switch (c->command_id) {
+	case nvmf_get_port_state:
+		walk = get_port_state;
+		w.size = sizeof(struct nvmf_port_config_entry);
+		break;
+	case nvmf_get_subsys_state:
+		walk = get_subsys_state;
+		w.size = sizeof(struct nvmf_subsys_config_entry);
+		break;
+	case nvmf_get_ns_state:
+		walk = get_ns_state;
+		w.size = sizeof(struct nvmf_ns_config_entry);
+		break;
+	case nvmf_get_host_state:
+		walk = get_host_state;
+		w.size = sizeof(struct nvmf_host_config_entry);
+		break;
+	case nvmf_get_host_link_state:
+		walk = get_host_link_state;
+		w.size = sizeof(struct nvmf_link_host_entry);
+		break;
+	case nvmf_get_nsdev_list:
+		walk = get_nsdev_list;
+		w.size = sizeof(struct nvmf_get_ns_devices_entry);
+		break;
+	case nvmf_get_xport_list:
+		walk = get_xport_list;
+		w.size = sizeof(struct nvmf_get_transports_entry);
+		break;
+	default:
+		walk = get_port_link_state;
+		w.size = sizeof(struct nvmf_link_port_entry);
+	}
+
+	if (len < sizeof(*hdr) || len > NVMF_GET_STATE_SIZE)
+		return NVME_SC_INVALID_FIELD;
+
+	if (posix_memalign((void **) &hdr, PAGE_SIZE, len))
+		return NVME_SC_INTERNAL;
+
+	if (ep->ops->alloc_key(ep->ep, hdr, len, &mr)) {
+		free(hdr);
+		return NVME_SC_INTERNAL;
+	}
+
+	w.entry = hdr->data;
+	w.skip = le32toh(c->offset);
+	w.room = (len - sizeof(*hdr)) / w.size;
+	w.count = 0;
+	w.total = 0;
+
+	begin_config_read();
+	walk(&w);
+	end_config_read();
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->signature = htole32(NVMF_GET_STATE_SIG);
+	hdr->num_entries = htole32(w.count);
+	hdr->total = htole32(w.total);
+	hdr->config_id = c->command_id;
+
+	len = sizeof(*hdr) + w.count * w.size;
+
+	ret = ep->ops->rma_write(ep->ep, hdr, addr, len, key, mr, cmd);
+	if (ret) {
+		print_errno("rma_write failed", ret);
+		ret = NVME_SC_WRITE_FAULT;
+	}
+
+	ep->ops->dealloc_key(mr);
+	free(hdr);
+
+	return ret;
+}
+
 static int handle_get_config(struct nvme_command *cmd, struct endpoint *ep,
 			     u64 addr, u64 key, u64 len)
 {
@@ -419,8 +520,18 @@ static int handle_get_config(struct nvme_command *cmd, struct endpoint *ep,
 	case nvmf_get_xport_config:
 		len = get_xport(ep->data);
 		break;
+	case nvmf_get_port_state:
+	case nvmf_get_subsys_state:
+	case nvmf_get_ns_state:
+	case nvmf_get_host_state:
+	case nvmf_get_host_link_state:
+	case nvmf_get_port_link_state:
+	case nvmf_get_nsdev_list:
+	case nvmf_get_xport_list:
+		return handle_get_state(cmd, ep, addr, key, len);
 	default:
-		print_err("unknown set config id %x", c->command_id);
+		print_err("unknown get config id %x", c->command_id);
+		return NVME_SC_INVALID_FIELD;
 	}
 
 	ret = ep->ops->rma_write(ep->ep, ep->data, addr, len, key,
@@ -440,7 +551,9 @@ static int handle_reset_config(struct nvme_command *cmd)
 
 	switch (c->command_id) {
 	case nvmf_reset_config:
+		begin_config();
 		reset_config();
+		commit_config();
 		ret = 0;
 		break;
 	default:
@@ -451,84 +564,213 @@ static int handle_reset_config(struct nvme_command *cmd)
 	return ret;
 }
 
-static int handle_set_config(struct nvme_command *cmd, struct endpoint *ep,
-			     u64 addr, u64 key, u64 len)
+static int apply_set_config(int id, void *data)
 {
-	struct nvmf_resource_config_command *c = &cmd->config;
 	int			  ret;
 
-	ret = ep->ops->rma_read(ep->ep, ep->data, addr, len, key, ep->data_mr);
-	if (ret) {
-		print_errno("rma_read failed", ret);
-		goto out;
-	}
-
-	switch (c->command_id) {
+	switch (id) {
 	case nvmf_set_port_config:
-		ret = set_portid(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = set_portid(data);
 		break;
 	case nvmf_del_port_config:
-		ret = del_portid(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = del_portid(data);
 		break;
 	case nvmf_link_port_config:
-		ret = link_portid(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = link_portid(data);
 		break;
 	case nvmf_unlink_port_config:
-		ret = unlink_portid(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = unlink_portid(data);
 		break;
 	case nvmf_set_subsys_config:
-		ret = set_subsys(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = set_subsys(data);
 		break;
 	case nvmf_del_subsys_config:
-		ret = del_subsys(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = del_subsys(data);
 		break;
 	case nvmf_set_ns_config:
-		ret = set_ns(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = set_ns(data);
 		break;
 	case nvmf_del_ns_config:
-		ret = del_ns(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = del_ns(data);
 		break;
 	case nvmf_set_host_config:
-		ret = set_host(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = set_host(data);
 		break;
 	case nvmf_del_host_config:
-		ret = del_host(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = del_host(data);
 		break;
 	case nvmf_link_host_config:
-		ret = link_host(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = link_host(data);
 		break;
 	case nvmf_unlink_host_config:
-		ret = unlink_host(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = unlink_host(data);
 		break;
 	default:
-		print_err("unknown set config id %x", c->command_id);
-		ret = NVME_SC_INVALID_FIELD;
+		print_err("unknown set config id %x", id);
+		return NVME_SC_INVALID_FIELD;
 	}
 
+	return ret ? NVME_SC_ACCESS_DENIED : 0;
+}
+
+/* the size of the entry each set config id takes, 0 if it is not one */
+static size_t set_config_size(int id)
+{
+	switch (id) {
+	case nvmf_set_port_config:
+		return sizeof(struct nvmf_port_config_entry);
+	case nvmf_del_port_config:
+		return sizeof(struct nvmf_port_delete_entry);
+	case nvmf_link_port_config:
+	case nvmf_unlink_port_config:
+		return sizeof(struct nvmf_link_port_entry);
+	case nvmf_set_subsys_config:
+		return sizeof(struct nvmf_subsys_config_entry);
+	case nvmf_del_subsys_config:
+		return sizeof(struct nvmf_subsys_delete_entry);
+	case nvmf_set_ns_config:
+		return sizeof(struct nvmf_ns_config_entry);
+	case nvmf_del_ns_config:
+		return sizeof(struct nvmf_ns_delete_entry);
+	case nvmf_set_host_config:
+		return sizeof(struct nvmf_host_config_entry);
+	case nvmf_del_host_config:
+		return sizeof(struct nvmf_host_delete_entry);
+	case nvmf_link_host_config:
+	case nvmf_unlink_host_config:
+		return sizeof(struct nvmf_link_host_entry);
+	default:
+		return 0;
+	}
+}
+
+static inline u64 next_batch_entry(u64 offset,
+				   struct nvmf_batch_config_entry *entry)
+{
+	offset += sizeof(*entry) + le16toh(entry->len);
+
+	return (offset + NVMF_BATCH_CONFIG_ALIGN - 1) &
+		~(u64) (NVMF_BATCH_CONFIG_ALIGN - 1);
+}
+
+/* applies the entries of a nvmf_batch_config in order as one transaction
+ * and writes their status back to the host.  If one fails the entries
+ * before it are rolled back and marked NVME_SC_ABORT_REQ along with the
+ * ones after it.  An entry too short for its config id fails as an
+ * invalid field rather than be read past its end.
+ */
+static int handle_batch_config(struct nvme_command *cmd, struct endpoint *ep,
+			       u64 addr, u64 key, u64 len)
+{
+	struct nvmf_batch_config_hdr	*hdr;
+	struct nvmf_batch_config_entry	*entry;
+	struct xp_mr			*mr;
+	void				*buf;
+	u64				 offset;
+	int				 num, i;
+	int				 failed = 0;
+	int				 status;
+	int				 ret = 0;
+
+	if (len < sizeof(*hdr) || len > NVMF_BATCH_CONFIG_SIZE)
+		return NVME_SC_INVALID_FIELD;
+
+	if (posix_memalign(&buf, PAGE_SIZE, len))
+		return NVME_SC_INTERNAL;
+
+	if (ep->ops->alloc_key(ep->ep, buf, len, &mr)) {
+		free(buf);
+		return NVME_SC_INTERNAL;
+	}
+
+	status = ep->ops->rma_read(ep->ep, buf, addr, len, key, mr);
+	if (status) {
+		print_errno("rma_read failed", status);
+		ret = NVME_SC_DATA_XFER_ERROR;
+		goto out;
+	}
+
+	hdr = buf;
+	num = le16toh(hdr->num_entries);
+	offset = sizeof(*hdr);
+
+	begin_config();
+
+	for (i = 0; i < num; i++) {
+		entry = buf + offset;
+
+		if (offset + sizeof(*entry) > len ||
+		    offset + sizeof(*entry) + le16toh(entry->len) > len) {
+			ret = NVME_SC_INVALID_FIELD;
+			if (!failed)
+				failed = i + 1;
+			break;
+		}
+
+		if (ret)
+			status = NVME_SC_ABORT_REQ;
+		else if (entry->config_id == nvmf_batch_config ||
+			 le16toh(entry->len) <
+			 set_config_size(entry->config_id))
+			status = ret = NVME_SC_INVALID_FIELD;
+		else
+			status = ret = apply_set_config(entry->config_id,
+							entry->data);
+
+		entry->status = htole16(status);
+
+		if (ret && !failed)
+			failed = i + 1;
+
+		offset = next_batch_entry(offset, entry);
+	}
+
+	if (!ret)
+		commit_config();
+	else if (rollback_config())
+		print_err("batch config left partly applied");
+	else
+		for (i = 1, offset = sizeof(*hdr); i < failed; i++) {
+			entry = buf + offset;
+			entry->status = htole16(NVME_SC_ABORT_REQ);
+			offset = next_batch_entry(offset, entry);
+		}
+
+	status = ep->ops->rma_write(ep->ep, buf, addr, len, key, mr, cmd);
+	if (status) {
+		print_errno("rma_write failed", status);
+		if (!ret)
+			ret = NVME_SC_WRITE_FAULT;
+	}
+out:
+	ep->ops->dealloc_key(mr);
+	free(buf);
+
+	return ret;
+}
+
+static int handle_set_config(struct nvme_command *cmd, struct endpoint *ep,
+			     u64 addr, u64 key, u64 len)
+{
+	struct nvmf_resource_config_command *c = &cmd->config;
+	int			  ret;
+
+	if (c->command_id == nvmf_batch_config)
+		return handle_batch_config(cmd, ep, addr, key, len);
+
+	ret = ep->ops->rma_read(ep->ep, ep->data, addr, len, key, ep->data_mr);
+	if (ret) {
+		print_errno("rma_read failed", ret);
+		goto out;
+	}
+
+	begin_config();
+
+	ret = apply_set_config(c->command_id, ep->data);
+	if (!ret)
+		commit_config();
+	else
+		rollback_config();
 out:
 	return ret;
 }
@@ -668,10 +910,12 @@ static void *host_thread(void *arg)
 	struct endpoint		*ep = NULL;
 	struct qe		 qe;
 	struct timeval		 timeval;
+	struct timeval		 served;
 	struct linked_list	 host_list;
 	struct host_conn	*next;
 	struct host_conn	*host;
 	void			*buf;
+	bool			 busy;
 	int			 len;
 	int			 delta;
 	int			 ret;
@@ -701,17 +945,36 @@ static void *host_thread(void *arg)
 		/* Service Host requests */
 		list_for_each_entry_safe(host, next, &host_list, node) {
 			ep = host->ep;
+			busy = false;
 loop:
 			ret = ep->ops->poll_for_msg(ep->ep, &qe.qe, &buf, &len);
+burst:
 			if (!ret) {
 				ret = handle_request(host, &qe, buf, len);
 				if (!ret) {
 					host->countdown	= host->kato;
 					host->timeval	= timeval;
+					gettimeofday(&served, NULL);
+					busy = true;
 					goto loop;
 				}
 			}
 
+			/* an in-band DC sends its next config command as soon
+			 * as it has the response to the last one, sleep on the
+			 * completion channel for it here rather than wait a
+			 * whole DELAY_TIMEOUT round
+			 */
+			if (ret == -EAGAIN && busy && !stopped) {
+				delta = msec_delta(served);
+				if (delta < BURST_TIMEOUT) {
+					ret = ep->ops->wait_for_msg(ep->ep,
+						&qe.qe, &buf, &len,
+						BURST_TIMEOUT - delta);
+					goto burst;
+				}
+			}
+
 			if (ret == -EAGAIN)
 				if (--host->countdown > 0)
 					continue;
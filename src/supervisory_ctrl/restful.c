@@ -37,6 +37,8 @@
 
 #include "common.h"
 #include "tags.h"
+#include "http_workers.h"
+#include "metrics.h"
 
 static const struct mg_str s_get_method = MG_MK_STR("GET");
 static const struct mg_str s_post_method = MG_MK_STR("POST");
@@ -701,9 +703,13 @@ static int handle_target_requests(char *p[], int n, struct http_message *hm,
 
 #define MAX_DEPTH 8
 
-void handle_http_request(struct mg_connection *c, void *ev_data)
+/* requests run on the http workers; GETs only walk configfs so they can
+ * share it while changes to the target config are applied one at a time,
+ * each as a config transaction that is rolled back if it fails.  The lock
+ * is the one the in-band config commands take, see begin_config().
+ */
+void handle_http_request(struct http_message *hm, struct http_reply *reply)
 {
-	struct http_message	*hm = (struct http_message *) ev_data;
 	char			*resp = NULL;
 	char			*uri = NULL;
 	char			*parts[MAX_DEPTH] = { NULL };
@@ -715,6 +721,11 @@ void handle_http_request(struct mg_connection *c, void *ev_data)
 		goto out;
 	}
 
+	if (is_metrics_request(hm)) {
+		write_metrics(reply, NULL);
+		return;
+	}
+
 	resp = malloc(BODY_SZ);
 	if (!resp) {
 		ret = HTTP_ERR_INTERNAL;
@@ -745,26 +756,36 @@ void handle_http_request(struct mg_connection *c, void *ev_data)
 		goto out;
 	}
 
-	ret = handle_target_requests(parts, n+1, hm, resp);
+	if (is_equal(&hm->method, &s_get_method)) {
+		begin_config_read();
+		ret = handle_target_requests(parts, n+1, hm, resp);
+		end_config_read();
+	} else {
+		begin_config();
+
+		ret = handle_target_requests(parts, n+1, hm, resp);
+		if (!ret)
+			commit_config();
+		else
+			rollback_config();
+	}
 out:
 	if (!ret)
-		mg_printf(c, "%s %d OK", HTTP_HDR, HTTP_OK);
+		reply_printf(reply, "%s %d OK", HTTP_HDR, HTTP_OK);
 	else
-		mg_printf(c, "%s %d %s", HTTP_HDR, ret, http_error_str(ret));
+		reply_printf(reply, "%s %d %s", HTTP_HDR, ret, http_error_str(ret));
 
-	mg_printf(c, "\r\nContent-Type: plain/text");
+	reply_printf(reply, "\r\nContent-Type: plain/text");
 	if (resp) {
-		mg_printf(c, "\r\nContent-Length: %ld\r\n", strlen(resp));
-		mg_printf(c, "\r\n%s\r\n\r\n", resp);
+		reply_printf(reply, "\r\nContent-Length: %ld\r\n", strlen(resp));
+		reply_printf(reply, "\r\n%s", resp);
 	} else {
-		mg_printf(c, "\r\nContent-Length: 14\r\n");
-		mg_printf(c, "\r\nInternal Error\r\n\r\n");
+		reply_printf(reply, "\r\nContent-Length: 14\r\n");
+		reply_printf(reply, "\r\nInternal Error");
 	}
 
 	if (uri)
 		free(uri);
 	if (resp)
 		free(resp);
-
-	c->flags = MG_F_SEND_AND_CLOSE;
 }
@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ */
+
+/*
+ * Configfs semantics for the plain directory tree of files/nvmet_emulate.sh.
+ *
+ * Include this ahead of src/supervisory_ctrl/configfs.c and the SC's calls
+ * behave as they would on nvmet's configfs rather than on plain files:
+ *
+ *   mkdir of a subsystem adds its namespaces and allowed_hosts groups, and
+ *   mkdir of a port adds its subsystems group
+ *   rmdir removes the attributes and the empty default groups with the
+ *   object, and fails as configfs does while a group still has children
+ *   an attribute opened for writing is made if the tree does not have it
+ *   yet, and a write replaces its value
+ */
+
+#ifndef __CONFIGFS_EMU_H__
+#define __CONFIGFS_EMU_H__
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define EMU_PATH_SIZE		512
+
+struct emu_group {
+	const char		*parent;
+	const char		*groups[2];
+};
+
+static const struct emu_group emu_groups[] = {
+	{ "/nvmet/subsystems",	{ "namespaces", "allowed_hosts" } },
+	{ "/nvmet/ports",	{ "subsystems", NULL } },
+};
+
+static int emu_dir_path(int dir, char *path)
+{
+	char			 link[32];
+	ssize_t			 len;
+
+	sprintf(link, "/proc/self/fd/%d", dir);
+
+	len = readlink(link, path, EMU_PATH_SIZE - 1);
+	if (len < 0)
+		return -1;
+
+	path[len] = 0;
+
+	return 0;
+}
+
+static int emu_ends_with(const char *str, const char *end)
+{
+	int			 len = strlen(str);
+	int			 n = strlen(end);
+
+	return len >= n && !strcmp(str + len - n, end);
+}
+
+static int emu_mkdirat(int dir, const char *path, mode_t mode)
+{
+	const struct emu_group	*group;
+	char			 parent[EMU_PATH_SIZE];
+	char			 name[EMU_PATH_SIZE];
+	const char		*slash;
+	int			 i, j;
+
+	if (mkdirat(dir, path, mode))
+		return -1;
+
+	slash = strrchr(path, '/');
+	if (slash)
+		snprintf(name, sizeof(name), "/%.*s", (int) (slash - path),
+			 path);
+	else
+		name[0] = 0;
+
+	if (emu_dir_path(dir, parent))
+		return 0;
+
+	strncat(parent, name, sizeof(parent) - strlen(parent) - 1);
+
+	for (i = 0; i < (int) (sizeof(emu_groups) / sizeof(*group)); i++) {
+		group = &emu_groups[i];
+		if (!emu_ends_with(parent, group->parent))
+			continue;
+
+		for (j = 0; j < 2 && group->groups[j]; j++) {
+			snprintf(name, sizeof(name), "%s/%s", path,
+				 group->groups[j]);
+			mkdirat(dir, name, mode);
+		}
+	}
+
+	return 0;
+}
+
+/* the attributes go with the object, a default group only when empty */
+static int emu_unlinkat(int dir, const char *path, int flags)
+{
+	struct dirent		*entry;
+	DIR			*d;
+	int			 fd;
+
+	if (!(flags & AT_REMOVEDIR))
+		return unlinkat(dir, path, flags);
+
+	fd = openat(dir, path, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return -1;
+
+	d = fdopendir(fd);
+	if (!d) {
+		close(fd);
+		return -1;
+	}
+
+	while ((entry = readdir(d))) {
+		if (entry->d_name[0] == '.')
+			continue;
+
+		if (entry->d_type == DT_REG)
+			unlinkat(fd, entry->d_name, 0);
+		else if (entry->d_type == DT_DIR)
+			unlinkat(fd, entry->d_name, AT_REMOVEDIR);
+	}
+
+	closedir(d);
+
+	return unlinkat(dir, path, flags);
+}
+
+static int emu_openat(int dir, const char *path, int flags)
+{
+	if (flags & (O_WRONLY | O_RDWR))
+		flags |= O_CREAT | O_TRUNC;
+
+	return openat(dir, path, flags, 0644);
+}
+
+#define mkdirat(dir, path, mode)	emu_mkdirat(dir, path, mode)
+#define unlinkat(dir, path, flags)	emu_unlinkat(dir, path, flags)
+#define openat(dir, path, flags)	emu_openat(dir, path, flags)
+
+#endif
@@ -0,0 +1,467 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ */
+
+/*
+ * The rest of the DC, as far as src/discovery_ctrl/config.c is concerned,
+ * for the tests that run its in-band config paths against fake_sc.c.
+ *
+ * There is no JSON store, no discovery queues and no OOB SC: the JSON
+ * calls succeed without doing anything, no curl batch is ever made, and
+ * targets are owned by the test, so a reference only counts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/discovery_ctrl/common.h"
+#include "../src/incl/curl.h"
+
+int			 debug;
+int			 curl_show_results;
+int			 num_interfaces;
+struct host_iface	*interfaces;
+
+static LINKED_LIST(aen_reqs);
+static LINKED_LIST(targets);
+static LINKED_LIST(groups);
+static LINKED_LIST(hosts);
+
+struct linked_list	*aen_req_list = &aen_reqs;
+struct linked_list	*target_list = &targets;
+struct linked_list	*group_list = &groups;
+struct linked_list	*host_list = &hosts;
+struct config_index	*config_index;
+struct dc_metrics	 dc_metrics;
+
+void observe_histogram(struct histogram *h, unsigned long long start)
+{
+	(void) h;
+	(void) start;
+}
+
+/* targets */
+
+struct target *alloc_target(char *alias)
+{
+	struct target		*target;
+
+	target = calloc(1, sizeof(*target));
+	if (!target)
+		return NULL;
+
+	INIT_LINKED_LIST(&target->subsys_list);
+	INIT_LINKED_LIST(&target->portid_list);
+	INIT_LINKED_LIST(&target->device_list);
+	INIT_LINKED_LIST(&target->discovery_queue_list);
+	INIT_LINKED_LIST(&target->unattached_logpage_list);
+	INIT_LINKED_LIST(&target->fabric_iface_list);
+	pthread_mutex_init(&target->lock, NULL);
+	strncpy(target->alias, alias, MAX_ALIAS_SIZE);
+	target->refcnt = 1;
+
+	return target;
+}
+
+void get_target(struct target *target)
+{
+	target->refcnt++;
+}
+
+void put_target(struct target *target)
+{
+	target->refcnt--;
+}
+
+struct subsystem *new_subsys(struct target *target, char *nqn)
+{
+	struct subsystem	*subsys;
+
+	subsys = calloc(1, sizeof(*subsys));
+	if (!subsys)
+		return NULL;
+
+	INIT_LINKED_LIST(&subsys->host_list);
+	INIT_LINKED_LIST(&subsys->ns_list);
+	INIT_LINKED_LIST(&subsys->logpage_list);
+	subsys->target = target;
+	strncpy(subsys->nqn, nqn, MAX_NQN_SIZE);
+
+	list_add_tail(&subsys->node, &target->subsys_list);
+
+	return subsys;
+}
+
+int target_refresh(struct target *target)
+{
+	target->refresh++;
+
+	return 0;
+}
+
+void create_discovery_queue(struct target *target, struct subsystem *subsys,
+			    struct portid *portid)
+{
+	(void) target;
+	(void) subsys;
+	(void) portid;
+}
+
+void free_logpage(struct logpage *logpage)
+{
+	free(logpage);
+}
+
+/* the JSON store */
+
+void json_write_lock(void)
+{
+}
+
+void json_unlock(void)
+{
+}
+
+void bump_json_generation(int kind, char *name)
+{
+	(void) kind;
+	(void) name;
+}
+
+json_t *get_json_item(int kind, char *name)
+{
+	(void) kind;
+	(void) name;
+
+	return NULL;
+}
+
+int add_json_group(char *grp, char *resp)
+{
+	(void) grp;
+	(void) resp;
+
+	return 0;
+}
+
+int update_json_group(char *grp, char *data, char *resp, char *new_name)
+{
+	(void) grp;
+	(void) data;
+	(void) resp;
+	(void) new_name;
+
+	return 0;
+}
+
+int del_json_group(char *grp, char *resp)
+{
+	(void) grp;
+	(void) resp;
+
+	return 0;
+}
+
+int set_json_group_member(char *group, char *data, char *alias, char *tag,
+			  char *parent_tag, char *resp, char *_alias)
+{
+	(void) group;
+	(void) data;
+	(void) alias;
+	(void) tag;
+	(void) parent_tag;
+	(void) resp;
+	(void) _alias;
+
+	return 0;
+}
+
+int del_json_group_member(char *group, char *member, char *tag,
+			  char *parent_tag, char *resp)
+{
+	(void) group;
+	(void) member;
+	(void) tag;
+	(void) parent_tag;
+	(void) resp;
+
+	return 0;
+}
+
+int add_json_target(char *alias, char *resp)
+{
+	(void) alias;
+	(void) resp;
+
+	return 0;
+}
+
+int update_json_target(char *alias, char *data, char *resp,
+		       struct target *target)
+{
+	(void) alias;
+	(void) data;
+	(void) resp;
+	(void) target;
+
+	return 0;
+}
+
+int del_json_target(char *alias, char *resp)
+{
+	(void) alias;
+	(void) resp;
+
+	return 0;
+}
+
+int add_json_host(char *alias, char *resp)
+{
+	(void) alias;
+	(void) resp;
+
+	return 0;
+}
+
+int update_json_host(char *alias, char *data, char *resp,
+		     char *newalias, char *nqn)
+{
+	(void) alias;
+	(void) data;
+	(void) resp;
+	(void) newalias;
+	(void) nqn;
+
+	return 0;
+}
+
+int del_json_host(char *alias, char *resp, char *nqn)
+{
+	(void) alias;
+	(void) resp;
+	(void) nqn;
+
+	return 0;
+}
+
+int get_json_host_nqn(char *host, char *nqn)
+{
+	(void) host;
+	(void) nqn;
+
+	return -ENOENT;
+}
+
+int set_json_subsys(char *alias, char *subnqn, char *data, char *resp,
+		    struct subsystem *subsys)
+{
+	(void) alias;
+	(void) subnqn;
+	(void) data;
+	(void) resp;
+	(void) subsys;
+
+	return 0;
+}
+
+int del_json_subsys(char *alias, char *subnqn, char *resp)
+{
+	(void) alias;
+	(void) subnqn;
+	(void) resp;
+
+	return 0;
+}
+
+int set_json_inb_interface(char *target, char *data, char *resp,
+			   union sc_iface *face)
+{
+	(void) target;
+	(void) data;
+	(void) resp;
+	(void) face;
+
+	return 0;
+}
+
+int set_json_oob_interface(char *target, char *data, char *resp,
+			   union sc_iface *face)
+{
+	(void) target;
+	(void) data;
+	(void) resp;
+	(void) face;
+
+	return 0;
+}
+
+int set_json_portid(char *target, int id, char *data, char *resp,
+		    struct portid *portid)
+{
+	(void) target;
+	(void) id;
+	(void) data;
+	(void) resp;
+	(void) portid;
+
+	return 0;
+}
+
+int del_json_portid(char *alias, int id, char *resp)
+{
+	(void) alias;
+	(void) id;
+	(void) resp;
+
+	return 0;
+}
+
+int set_json_ns(char *alias, char *subnqn, char *data, char *resp,
+		struct ns *ns)
+{
+	(void) alias;
+	(void) subnqn;
+	(void) data;
+	(void) resp;
+	(void) ns;
+
+	return 0;
+}
+
+int del_json_ns(char *alias, char *subnqn, int ns, char *resp)
+{
+	(void) alias;
+	(void) subnqn;
+	(void) ns;
+	(void) resp;
+
+	return 0;
+}
+
+int set_json_acl(char *tgt, char *subnqn, char *alias, char *data,
+		 char *resp, char *newalias, char *hostnqn)
+{
+	(void) tgt;
+	(void) subnqn;
+	(void) alias;
+	(void) data;
+	(void) resp;
+	(void) newalias;
+	(void) hostnqn;
+
+	return 0;
+}
+
+int del_json_acl(char *alias, char *subnqn, char *host, char *resp)
+{
+	(void) alias;
+	(void) subnqn;
+	(void) host;
+	(void) resp;
+
+	return 0;
+}
+
+int set_json_oob_nsdevs(struct target *target, json_t *new)
+{
+	(void) target;
+	(void) new;
+
+	return 0;
+}
+
+int set_json_oob_interfaces(struct target *target, json_t *new)
+{
+	(void) target;
+	(void) new;
+
+	return 0;
+}
+
+int set_json_inb_nsdev(struct target *target, struct nsdev *nsdev)
+{
+	(void) target;
+	(void) nsdev;
+
+	return 0;
+}
+
+int set_json_inb_fabric_iface(struct target *target,
+			      struct fabric_iface *iface)
+{
+	(void) target;
+	(void) iface;
+
+	return 0;
+}
+
+/* OOB SCs, never reached with in-band targets */
+
+int exec_get(char *url, char **result)
+{
+	(void) url;
+	(void) result;
+
+	return -ENOTCONN;
+}
+
+int exec_delete(char *url)
+{
+	(void) url;
+
+	return -ENOTCONN;
+}
+
+int exec_post(char *url, char *data, int len)
+{
+	(void) url;
+	(void) data;
+	(void) len;
+
+	return -ENOTCONN;
+}
+
+struct curl_chan *alloc_curl_chan(void)
+{
+	return NULL;
+}
+
+struct curl_batch *alloc_curl_batch(void)
+{
+	return NULL;
+}
+
+void free_curl_batch(struct curl_batch *batch)
+{
+	(void) batch;
+}
+
+int queue_curl_request(struct curl_batch *batch, struct curl_chan *chan,
+		       const char *method, char *url, char *data, int len)
+{
+	(void) batch;
+	(void) chan;
+	(void) method;
+	(void) url;
+	(void) data;
+	(void) len;
+
+	return -ENOTCONN;
+}
+
+int run_curl_batch(struct curl_batch *batch)
+{
+	(void) batch;
+
+	return 0;
+}
+
+int curl_chan_error(struct curl_chan *chan)
+{
+	(void) chan;
+
+	return 0;
+}
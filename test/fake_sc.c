@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/discovery_ctrl/common.h"
+#include "fake_sc.h"
+
+struct fake_sc			 fake_sc;
+
+/* what the SC reports for each get id */
+static struct {
+	void			*entries;
+	int			 size;
+	int			 count;
+} replies[FAKE_SC_IDS];
+
+static struct xp_ops		 fake_ops;
+
+int fake_sc_add(int id, void *entry, int size)
+{
+	void			*p;
+
+	p = realloc(replies[id].entries, (replies[id].count + 1) * size);
+	if (!p)
+		return -ENOMEM;
+
+	memcpy(p + replies[id].count * size, entry, size);
+
+	replies[id].entries = p;
+	replies[id].size = size;
+	replies[id].count++;
+
+	return 0;
+}
+
+void fake_sc_clear(void)
+{
+	int			 i;
+
+	for (i = 0; i < FAKE_SC_IDS; i++) {
+		free(replies[i].entries);
+		memset(&replies[i], 0, sizeof(replies[i]));
+	}
+}
+
+/* a transport error fails one command, as a lost connection would */
+static int take_error(void)
+{
+	int			 ret = fake_sc.error;
+
+	fake_sc.error = 0;
+
+	return ret;
+}
+
+static int get_state(int id, u32 offset, int len, void **data)
+{
+	struct nvmf_get_state_hdr *hdr;
+	int			 size = replies[id].size;
+	int			 n = 0;
+
+	if (posix_memalign((void **) &hdr, PAGE_SIZE, len))
+		return -ENOMEM;
+
+	memset(hdr, 0, len);
+
+	if (offset < (u32) replies[id].count) {
+		n = min(replies[id].count - (int) offset,
+			(int) ((len - sizeof(*hdr)) / size));
+		if (fake_sc.room)
+			n = min(n, fake_sc.room);
+
+		memcpy(hdr->data, replies[id].entries + offset * size,
+		       n * size);
+	}
+
+	hdr->signature = htole32(NVMF_GET_STATE_SIG);
+	hdr->config_id = id;
+	hdr->num_entries = htole32(n);
+	hdr->total = htole32(replies[id].count);
+
+	*data = hdr;
+
+	return 0;
+}
+
+/* the single page reply of the ids the list ids replace, a u8 count and
+ * as many entries as fit
+ */
+static int get_legacy(int id, int len, void **data)
+{
+	u8			*p;
+	int			 size = replies[id].size;
+	int			 n = 0;
+
+	if (posix_memalign((void **) &p, PAGE_SIZE, len))
+		return -ENOMEM;
+
+	memset(p, 0, len);
+
+	if (replies[id].count)
+		n = min(min(replies[id].count, 255), (len - 1) / size);
+
+	p[0] = n;
+	memcpy(p + 1, replies[id].entries, n * size);
+
+	*data = p;
+
+	return 0;
+}
+
+int send_get_config(struct endpoint *ep, int cid, u32 offset, int len,
+		    void **data)
+{
+	int			 ret;
+
+	(void) ep;
+
+	fake_sc.gets++;
+
+	ret = take_error();
+	if (ret)
+		return ret;
+
+	if (cid == nvmf_get_ns_config)
+		return get_legacy(nvmf_get_nsdev_list, len, data);
+
+	if (cid == nvmf_get_xport_config)
+		return get_legacy(nvmf_get_xport_list, len, data);
+
+	if (cid < nvmf_get_port_state || cid >= FAKE_SC_IDS || fake_sc.old)
+		return NVME_SC_INVALID_FIELD;
+
+	return get_state(cid, offset, len, data);
+}
+
+int send_set_config(struct endpoint *ep, int cid, int len, void *data)
+{
+	(void) ep;
+	(void) cid;
+	(void) len;
+	(void) data;
+
+	fake_sc.sets++;
+
+	return take_error() ?: fake_sc.status;
+}
+
+int send_reset_config(struct endpoint *ep)
+{
+	(void) ep;
+
+	fake_sc.resets++;
+
+	return take_error();
+}
+
+int connect_ctrl(struct ctrl_queue *ctrl)
+{
+	(void) ctrl;
+
+	if (fake_sc.connect_error)
+		return fake_sc.connect_error;
+
+	fake_sc.connects++;
+
+	return 0;
+}
+
+void disconnect_ctrl(struct ctrl_queue *ctrl, int shutdown)
+{
+	(void) shutdown;
+
+	fake_sc.disconnects++;
+
+	ctrl->connected = 0;
+}
+
+struct xp_ops *rdma_register_ops(void)
+{
+	return &fake_ops;
+}
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ */
+
+/*
+ * An in-band SC in memory, in place of src/common/nvmeof.c.
+ *
+ * The paged get ids are answered from the entries added for them, a page
+ * at a time as the SC's handle_get_state() does, and the legacy NS device
+ * and transport ids from those of the list ids.  Set and reset config
+ * only count.  Any command can be failed once with a transport error, and
+ * the set configs answered with an NVMe status.
+ */
+
+#ifndef __FAKE_SC_H__
+#define __FAKE_SC_H__
+
+#define FAKE_SC_IDS		32
+
+struct fake_sc {
+	int			 old;	/* predates the paged get ids */
+	int			 room;	/* entries a page, 0 for all that fit */
+	int			 connect_error;
+	int			 error;	/* fails the next command */
+	int			 status;	/* of every set config */
+	int			 connects;
+	int			 disconnects;
+	int			 gets;
+	int			 sets;
+	int			 resets;
+};
+
+extern struct fake_sc		 fake_sc;
+
+int fake_sc_add(int id, void *entry, int size);
+void fake_sc_clear(void);
+
+#endif
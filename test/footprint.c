@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ */
+
+/*
+ * Memory footprint of the DC's ACL links and log pages.
+ *
+ * Builds HOSTS x SUBSYSTEMS ACL links (100k by default) and one log page
+ * per link, once with the fixed size strings the DC used to keep in each
+ * link and log page and once with the interned strings of intern.c, and
+ * prints the struct sizes and the heap each layout took.
+ *
+ *   usage: footprint [<hosts> [<subsystems>]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "../src/discovery_ctrl/common.h"
+
+#define HOSTS		1000
+#define SUBSYSTEMS	100
+
+#define NQN_FMT		"nqn.2014-08.org.nvmexpress:uuid:" \
+			"%08d-%04d-0000-0000-%012d"
+#define ADDR_FMT	"192.168.%d.%d"
+
+/* the layouts before the strings were interned */
+
+struct old_host {
+	struct linked_list	 node;
+	struct subsystem	*subsystem;
+	char			 alias[MAX_ALIAS_SIZE + 1];
+	char			 nqn[MAX_NQN_SIZE + 1];
+};
+
+struct old_logpage {
+	struct linked_list	 node;
+	struct portid		*portid;
+	struct nvmf_disc_rsp_page_entry e;
+	int			 valid;
+	int			 stale;
+	time_t			 fetched;
+};
+
+/* the DC global common.h declares */
+int			 debug;
+
+static size_t heap_used(void)
+{
+	struct mallinfo2	 mi = mallinfo2();
+
+	return mi.uordblks + mi.hblkhd;
+}
+
+static void subsys_nqn(char *nqn, int n)
+{
+	sprintf(nqn, NQN_FMT, 0, 0, n);
+}
+
+static void host_nqn(char *nqn, int n)
+{
+	sprintf(nqn, NQN_FMT, n, 1, 0);
+}
+
+static size_t build_old(struct linked_list *hosts, struct linked_list *logs,
+			int num_hosts, int num_subsys)
+{
+	struct old_host		*host;
+	struct old_logpage	*log;
+	size_t			 start = heap_used();
+	int			 i, j;
+
+	for (i = 0; i < num_hosts; i++)
+		for (j = 0; j < num_subsys; j++) {
+			host = calloc(1, sizeof(*host));
+			log = calloc(1, sizeof(*log));
+			if (!host || !log)
+				return 0;
+
+			sprintf(host->alias, "host%d", i);
+			host_nqn(host->nqn, i);
+			list_add_tail(&host->node, hosts);
+
+			subsys_nqn(log->e.subnqn, j);
+			sprintf(log->e.traddr, ADDR_FMT, j / 256, j % 256);
+			strcpy(log->e.trsvcid, "4420");
+			log->e.portid = 1;
+			log->e.cntlid = 0xffff;
+			log->valid = 1;
+			list_add_tail(&log->node, logs);
+		}
+
+	return heap_used() - start;
+}
+
+static size_t build_new(struct linked_list *hosts, struct linked_list *logs,
+			int num_hosts, int num_subsys)
+{
+	struct host		*host;
+	struct logpage		*log;
+	char			 buf[MAX_NQN_SIZE + 1];
+	size_t			 start = heap_used();
+	int			 i, j;
+
+	for (i = 0; i < num_hosts; i++)
+		for (j = 0; j < num_subsys; j++) {
+			host = calloc(1, sizeof(*host));
+			log = calloc(1, sizeof(*log));
+			if (!host || !log)
+				return 0;
+
+			sprintf(buf, "host%d", i);
+			host->alias = intern(buf);
+			host_nqn(buf, i);
+			host->nqn = intern(buf);
+			list_add_tail(&host->node, hosts);
+
+			subsys_nqn(buf, j);
+			log->e.subnqn = intern(buf);
+			sprintf(buf, ADDR_FMT, j / 256, j % 256);
+			log->e.traddr = intern(buf);
+			log->e.trsvcid = intern("4420");
+			log->e.portid = 1;
+			log->e.cntlid = 0xffff;
+			log->valid = 1;
+			list_add_tail(&log->node, logs);
+
+			if (host->alias < 0 || host->nqn < 0 ||
+			    log->e.subnqn < 0 || log->e.traddr < 0 ||
+			    log->e.trsvcid < 0)
+				return 0;
+		}
+
+	return heap_used() - start;
+}
+
+static void free_old(struct linked_list *hosts, struct linked_list *logs)
+{
+	struct old_host		*host, *next_host;
+	struct old_logpage	*log, *next_log;
+
+	list_for_each_entry_safe(host, next_host, hosts, node) {
+		list_del(&host->node);
+		free(host);
+	}
+
+	list_for_each_entry_safe(log, next_log, logs, node) {
+		list_del(&log->node);
+		free(log);
+	}
+}
+
+static void free_new(struct linked_list *hosts, struct linked_list *logs)
+{
+	struct host		*host, *next_host;
+	struct logpage		*log, *next_log;
+
+	list_for_each_entry_safe(host, next_host, hosts, node) {
+		list_del(&host->node);
+		unintern(host->alias);
+		unintern(host->nqn);
+		free(host);
+	}
+
+	list_for_each_entry_safe(log, next_log, logs, node) {
+		list_del(&log->node);
+		unintern(log->e.subnqn);
+		unintern(log->e.traddr);
+		unintern(log->e.trsvcid);
+		free(log);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	LINKED_LIST(hosts);
+	LINKED_LIST(logs);
+	int			 num_hosts = HOSTS;
+	int			 num_subsys = SUBSYSTEMS;
+	int			 links, count;
+	size_t			 old_heap, new_heap, bytes;
+
+	if (argc > 1)
+		num_hosts = atoi(argv[1]);
+	if (argc > 2)
+		num_subsys = atoi(argv[2]);
+
+	if (num_hosts <= 0 || num_subsys <= 0) {
+		fprintf(stderr, "usage: %s [<hosts> [<subsystems>]]\n",
+			argv[0]);
+		return 1;
+	}
+
+	links = num_hosts * num_subsys;
+
+	printf("%d hosts x %d subsystems = %d ACL links and log pages\n",
+	       num_hosts, num_subsys, links);
+	printf("%-10s %8s %8s %12s %12s\n",
+	       "layout", "host", "logpage", "heap", "per link");
+
+	old_heap = build_old(&hosts, &logs, num_hosts, num_subsys);
+	if (!old_heap)
+		goto nomem;
+
+	printf("%-10s %8zu %8zu %12zu %12zu\n", "strings",
+	       sizeof(struct old_host), sizeof(struct old_logpage),
+	       old_heap, old_heap / links);
+
+	free_old(&hosts, &logs);
+
+	new_heap = build_new(&hosts, &logs, num_hosts, num_subsys);
+	if (!new_heap)
+		goto nomem;
+
+	interned_usage(&count, &bytes);
+
+	printf("%-10s %8zu %8zu %12zu %12zu\n", "interned",
+	       sizeof(struct host), sizeof(struct logpage),
+	       new_heap, new_heap / links);
+	printf("%d interned strings in %zu bytes, included above\n",
+	       count, bytes);
+
+	free_new(&hosts, &logs);
+
+	interned_usage(&count, &bytes);
+	if (count) {
+		fprintf(stderr, "%d interned strings left\n", count);
+		return 1;
+	}
+
+	return 0;
+nomem:
+	fprintf(stderr, "out of memory\n");
+	return 1;
+}
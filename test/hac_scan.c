@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ */
+
+/*
+ * Cost of the HAC's scan for the subsystems it is connected to already.
+ *
+ * Builds a tree with files/nvmet_emulate.sh under <root> holding <ctrls>
+ * fabrics controllers spread over <subsystems>, gives the HAC a log page
+ * for each controller, and times mark_connected_subsystems() against the
+ * tree, best of PASSES.  Every log page should come out connected.
+ *
+ * Put <root> on tmpfs so the numbers are the HAC's rather than the disk's.
+ *
+ *   usage: hac_scan <root> [<ctrls> [<subsystems>]]
+ */
+
+#define main hac_main
+#include "../src/host_auto_connect/daemon.c"
+#undef main
+
+#include <time.h>
+
+#ifndef EMULATE
+#define EMULATE		"../files/nvmet_emulate.sh"
+#endif
+
+#define CTRLS		1000
+#define SUBSYSTEMS	100
+#define PASSES		5
+#define NQN_PREFIX	"nqn.2014-08.org.nvmexpress.emulated:subsys"
+
+static double now_ms(void)
+{
+	struct timespec		 ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int emulate(char *root, int num_ctrls, int num_subsys)
+{
+	char			 cmd[FILENAME_MAX + 128];
+
+	snprintf(cmd, sizeof(cmd), "sh %s -r %s -s %d -c %d >/dev/null",
+		 EMULATE, root, num_subsys, num_ctrls);
+
+	return system(cmd);
+}
+
+/* the log pages match the controllers nvmet_emulate.sh makes */
+static int add_logpages(struct target *target, int num_ctrls,
+			int num_subsys)
+{
+	struct subsystem	**subsys;
+	struct logpage		*logpage;
+	int			 i;
+
+	subsys = calloc(num_subsys, sizeof(*subsys));
+	if (!subsys)
+		return -ENOMEM;
+
+	for (i = 0; i < num_subsys; i++) {
+		subsys[i] = calloc(1, sizeof(**subsys));
+		if (!subsys[i])
+			goto nomem;
+
+		INIT_LINKED_LIST(&subsys[i]->logpage_list);
+		subsys[i]->target = target;
+		sprintf(subsys[i]->nqn, NQN_PREFIX "%d", i);
+		list_add_tail(&subsys[i]->node, &target->subsys_list);
+	}
+
+	for (i = 0; i < num_ctrls; i++) {
+		logpage = calloc(1, sizeof(*logpage));
+		if (!logpage)
+			goto nomem;
+
+		logpage->e.trtype = NVMF_TRTYPE_RDMA;
+		sprintf(logpage->e.traddr, "192.168.%d.%d",
+			i / 65536 % 256, i / 256 % 256);
+		sprintf(logpage->e.trsvcid, "%d", 4420 + i % 256);
+		strcpy(logpage->e.subnqn, subsys[i % num_subsys]->nqn);
+		logpage->valid = VALID_LOGPAGE;
+		list_add_tail(&logpage->node,
+			      &subsys[i % num_subsys]->logpage_list);
+	}
+
+	free(subsys);
+
+	return 0;
+nomem:
+	free(subsys);
+
+	return -ENOMEM;
+}
+
+static int count_connected(struct target *target)
+{
+	struct subsystem	*subsys;
+	struct logpage		*logpage;
+	int			 n = 0;
+
+	list_for_each_entry(subsys, &target->subsys_list, node)
+		list_for_each_entry(logpage, &subsys->logpage_list, node)
+			n += logpage->connected;
+
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	struct ctrl_queue	*dq = &discovery_queue;
+	int			 num_ctrls = CTRLS;
+	int			 num_subsys = SUBSYSTEMS;
+	int			 i, n;
+	double			 ms, best = 0;
+
+	if (argc < 2 || (argc > 2 && (num_ctrls = atoi(argv[2])) <= 0) ||
+	    (argc > 3 && (num_subsys = atoi(argv[3])) <= 0) ||
+	    num_ctrls > 65536) {
+		fprintf(stderr, "usage: %s <root> [<ctrls> [<subsystems>]]\n",
+			argv[0]);
+		fprintf(stderr, "  at most 65536 ctrls\n");
+		return 1;
+	}
+
+	if (set_sysroot(argv[1])) {
+		fprintf(stderr, "root too long\n");
+		return 1;
+	}
+
+	if (emulate(argv[1], num_ctrls, num_subsys)) {
+		fprintf(stderr, "%s failed\n", EMULATE);
+		return 1;
+	}
+
+	if (init_dq(dq) ||
+	    add_logpages(dq->target, num_ctrls, num_subsys)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < PASSES; i++) {
+		ms = now_ms();
+		mark_connected_subsystems(dq);
+		ms = now_ms() - ms;
+		if (!i || ms < best)
+			best = ms;
+	}
+
+	n = count_connected(dq->target);
+
+	printf("%d ctrls, %d subsystems: %.2f ms per pass, %d connected\n",
+	       num_ctrls, num_subsys, best, n);
+
+	return n != num_ctrls;
+}
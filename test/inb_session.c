@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ */
+
+/*
+ * The managed in-band session of a target.
+ *
+ * Pushes set config ops with flush_config_ops() of
+ * src/discovery_ctrl/config.c to fake_sc.c and checks what becomes of
+ * the session and its counters: a push never connects and fails at once
+ * while the session is down, a status from the SC leaves the session up,
+ * and a transport error drops it until it is opened again.
+ *
+ *   usage: inb_session
+ */
+
+#include "../src/discovery_ctrl/config.c"
+
+#include "fake_sc.h"
+
+static struct target		*target;
+
+static int push_host(char *nqn)
+{
+	LINKED_LIST(list);
+	struct nvmf_host_config_entry *entry;
+	int			 len;
+	int			 ret;
+
+	len = build_host_config_inb(nqn, &entry);
+
+	ret = queue_set_config(target, nvmf_set_host_config, len, entry);
+	if (ret)
+		return ret;
+
+	take_config_ops(&list);
+
+	ret = flush_config_ops(&list, NULL);
+
+	free_config_ops(&list);
+
+	return ret;
+}
+
+/* the result of a push and the state of the session after it */
+static int check(const char *what, int ret, int expect, int up,
+		 unsigned long connects, unsigned long drops)
+{
+	struct inb_session	*s = &target->inb_session;
+
+	if (ret != expect) {
+		printf("%s: returned %d, expected %d\n", what, ret, expect);
+		return 1;
+	}
+
+	if (target->sc_iface.inb.connected != up || s->up != up) {
+		printf("%s: session is %s\n", what, up ? "down" : "up");
+		return 1;
+	}
+
+	if (s->connects != connects || (int) s->connects != fake_sc.connects) {
+		printf("%s: %lu connects, expected %lu\n",
+		       what, s->connects, connects);
+		return 1;
+	}
+
+	if (s->drops != drops) {
+		printf("%s: %lu drops, expected %lu\n", what, s->drops, drops);
+		return 1;
+	}
+
+	printf("%s: %d, session %s\n", what, ret, up ? "up" : "down");
+
+	return 0;
+}
+
+int main(void)
+{
+	struct inb_session	*s;
+	struct portid		*portid;
+	int			 sets;
+	int			 ret;
+
+	target = alloc_target("t");
+	target->mgmt_mode = IN_BAND_MGMT;
+	s = &target->inb_session;
+
+	portid = calloc(1, sizeof(*portid));
+	strcpy(portid->type, TRTYPE_STR_RDMA);
+	target->sc_iface.inb.portid = portid;
+
+	ret = check("down", push_host("h1"), -ENOTCONN, 0, 0, 0);
+	if (fake_sc.sets) {
+		printf("down: the SC got a set config\n");
+		ret = 1;
+	}
+
+	fake_sc.connect_error = -ECONNREFUSED;
+	ret |= check("refused", open_inb_session(target), -ECONNREFUSED,
+		     0, 0, 0);
+	if (s->connect_failures != 1 || s->last_error != -ECONNREFUSED) {
+		printf("refused: %lu connect failures, last error %d\n",
+		       s->connect_failures, s->last_error);
+		ret = 1;
+	}
+
+	fake_sc.connect_error = 0;
+	ret |= check("open", open_inb_session(target), 0, 1, 1, 0);
+	ret |= check("open again", open_inb_session(target), 0, 1, 1, 0);
+
+	ret |= check("push", push_host("h1"), 0, 1, 1, 0);
+
+	fake_sc.status = NVME_SC_INVALID_FIELD;
+	ret |= check("status", push_host("h2"), NVME_SC_INVALID_FIELD,
+		     1, 1, 0);
+	fake_sc.status = 0;
+
+	fake_sc.error = -ETIMEDOUT;
+	ret |= check("timeout", push_host("h3"), -ETIMEDOUT, 0, 1, 1);
+	if (fake_sc.disconnects != 1 || s->last_error != -ETIMEDOUT) {
+		printf("timeout: %d disconnects, last error %d\n",
+		       fake_sc.disconnects, s->last_error);
+		ret = 1;
+	}
+
+	sets = fake_sc.sets;
+	ret |= check("dropped", push_host("h3"), -ENOTCONN, 0, 1, 1);
+	if (fake_sc.sets != sets) {
+		printf("dropped: the SC got a set config\n");
+		ret = 1;
+	}
+
+	ret |= check("reopen", open_inb_session(target), 0, 1, 2, 1);
+	ret |= check("push again", push_host("h3"), 0, 1, 2, 1);
+
+	close_inb_session(target, 0);
+	ret |= check("close", 0, 0, 0, 2, 2);
+
+	free(portid);
+
+	return ret;
+}
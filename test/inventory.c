@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ */
+
+/*
+ * Paged reads of the NS device and transport inventories of an in-band SC.
+ *
+ * Runs fetch_inb_config() and apply_inb_config() of
+ * src/discovery_ctrl/config.c over fake_sc.c for inventories of a few
+ * sizes, and checks the target ends up with every device and transport
+ * in the order the SC reported them, in as many round trips as pages.
+ * An SC that predates the list ids is read with the legacy get config
+ * and gives as many as its one page holds.
+ *
+ *   usage: inventory
+ */
+
+#include "../src/discovery_ctrl/config.c"
+
+#include "fake_sc.h"
+
+/* for the legacy reply, a u8 count and a page of entries */
+#define LEGACY_NSDEVS	255
+#define LEGACY_XPORTS	((PAGE_SIZE - 1) / \
+			 sizeof(struct nvmf_get_transports_entry))
+
+#define NSIDS		200
+
+static struct target		*target;
+
+static void sc_inventory(int num_nsdevs, int num_xports)
+{
+	struct nvmf_get_ns_devices_entry nsdev;
+	struct nvmf_get_transports_entry xport;
+	int			 i;
+
+	fake_sc_clear();
+
+	memset(&nsdev, 0, sizeof(nsdev));
+	for (i = 0; i < num_nsdevs; i++) {
+		nsdev.devid = i / NSIDS;
+		nsdev.nsid = i % NSIDS;
+		fake_sc_add(nvmf_get_nsdev_list, &nsdev, sizeof(nsdev));
+	}
+
+	memset(&xport, 0, sizeof(xport));
+	xport.trtype = NVMF_TRTYPE_RDMA;
+	xport.adrfam = NVMF_ADDR_FAMILY_IP4;
+	for (i = 0; i < num_xports; i++) {
+		sprintf(xport.traddr, "10.%d.%d.1", i / 256, i % 256);
+		fake_sc_add(nvmf_get_xport_list, &xport, sizeof(xport));
+	}
+}
+
+static void free_inventory(void)
+{
+	struct nsdev		*nsdev, *next_nsdev;
+	struct fabric_iface	*iface, *next_iface;
+
+	list_for_each_entry_safe(nsdev, next_nsdev, &target->device_list,
+				 node) {
+		list_del(&nsdev->node);
+		free(nsdev);
+	}
+
+	list_for_each_entry_safe(iface, next_iface,
+				 &target->fabric_iface_list, node) {
+		list_del(&iface->node);
+		free(iface);
+	}
+}
+
+/* the devices and transports sc_inventory() made, in order */
+static int check_inventory(int num_nsdevs, int num_xports)
+{
+	struct nsdev		*nsdev;
+	struct fabric_iface	*iface;
+	char			 addr[CONFIG_ADDRESS_SIZE + 1];
+	int			 i = 0;
+
+	list_for_each_entry(nsdev, &target->device_list, node) {
+		if (nsdev->nsdev != i / NSIDS || nsdev->nsid != i % NSIDS)
+			return -1;
+		i++;
+	}
+
+	if (i != num_nsdevs)
+		return -1;
+
+	i = 0;
+	list_for_each_entry(iface, &target->fabric_iface_list, node) {
+		sprintf(addr, "10.%d.%d.1", i / 256, i % 256);
+		if (strcmp(iface->addr, addr))
+			return -1;
+		i++;
+	}
+
+	return (i == num_xports) ? 0 : -1;
+}
+
+static int check(const char *what, int num_nsdevs, int num_xports,
+		 int expect_nsdevs, int expect_xports, int gets)
+{
+	struct target_config	 cfg;
+	int			 ret;
+
+	memset(&cfg, 0, sizeof(cfg));
+
+	fake_sc.gets = 0;
+
+	sc_inventory(num_nsdevs, num_xports);
+
+	ret = fetch_inb_config(target, &cfg);
+	if (!ret)
+		ret = apply_inb_config(target, &cfg);
+	if (ret) {
+		printf("%s: reading the inventory failed %d\n", what, ret);
+		goto out;
+	}
+
+	if (check_inventory(expect_nsdevs, expect_xports)) {
+		printf("%s: read %d NS devices and %d transports, "
+		       "expected %d and %d\n", what, cfg.num_nsdevs,
+		       cfg.num_xports, expect_nsdevs, expect_xports);
+		ret = 1;
+	} else if (fake_sc.gets != gets) {
+		printf("%s: %d round trips, expected %d\n",
+		       what, fake_sc.gets, gets);
+		ret = 1;
+	} else
+		printf("%s: %d NS devices and %d transports in %d round "
+		       "trips\n", what, cfg.num_nsdevs, cfg.num_xports,
+		       fake_sc.gets);
+out:
+	free(cfg.nsdevs);
+	free(cfg.xports);
+	free_inventory();
+
+	return ret;
+}
+
+int main(void)
+{
+	struct portid		*portid;
+	int			 ret;
+
+	target = alloc_target("t");
+	target->mgmt_mode = IN_BAND_MGMT;
+
+	portid = calloc(1, sizeof(*portid));
+	strcpy(portid->type, TRTYPE_STR_RDMA);
+	target->sc_iface.inb.portid = portid;
+
+	if (open_inb_session(target)) {
+		fprintf(stderr, "no session to the fake SC\n");
+		return 1;
+	}
+
+	/* 8190 NS devices and 248 transports a page */
+	ret = check("empty", 0, 0, 0, 0, 2);
+	ret |= check("small", 5, 2, 5, 2, 2);
+	ret |= check("large", 20000, 600, 20000, 600, 6);
+
+	fake_sc.old = 1;
+
+	/* a rejected list id and the legacy id, for each */
+	ret |= check("old SC small", 5, 2, 5, 2, 4);
+	ret |= check("old SC large", 20000, 600, LEGACY_NSDEVS,
+		     LEGACY_XPORTS, 4);
+
+	fake_sc_clear();
+	free(portid);
+
+	return ret;
+}
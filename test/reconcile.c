@@ -0,0 +1,401 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ */
+
+/*
+ * Reconcile of an in-band target against the state its SC reports.
+ *
+ * Runs reconcile_target() of src/discovery_ctrl/config.c over fake_sc.c
+ * three times and checks the changes it queues behind the op: an SC that
+ * has drifted from the config, one in sync with it, and one that predates
+ * the get state ids and is reset and sent the whole config.  The SC pages
+ * its replies two entries at a time so every kind takes a few reads.
+ *
+ *   usage: reconcile
+ */
+
+#include "../src/discovery_ctrl/config.c"
+
+#include "fake_sc.h"
+
+#define PAGE_ROOM	2
+
+static struct config_index	 test_index;
+static struct target		*target;
+
+static void add_portid(int id, char *address, int port_num)
+{
+	struct portid		*portid;
+
+	portid = calloc(1, sizeof(*portid));
+	portid->target = target;
+	portid->portid = id;
+	strcpy(portid->type, TRTYPE_STR_RDMA);
+	strcpy(portid->family, "ipv4");
+	strcpy(portid->address, address);
+	portid->port_num = port_num;
+
+	list_add_tail(&portid->node, &target->portid_list);
+	index_portid(portid);
+}
+
+static struct subsystem *add_subsys(char *nqn)
+{
+	struct subsystem	*subsys;
+
+	subsys = new_subsys(target, nqn);
+	subsys->access = RESTRICTED;
+	index_subsys(subsys);
+
+	return subsys;
+}
+
+static void add_acl(struct subsystem *subsys, char *nqn)
+{
+	struct host		*host;
+
+	host = calloc(1, sizeof(*host));
+	host->subsystem = subsys;
+	host->alias = intern(nqn);
+	host->nqn = intern(nqn);
+
+	list_add_tail(&host->node, &subsys->host_list);
+}
+
+static void add_ns(struct subsystem *subsys, int nsid, int devid, int devns)
+{
+	struct ns		*ns;
+
+	ns = calloc(1, sizeof(*ns));
+	ns->nsid = nsid;
+	ns->devid = devid;
+	ns->devns = devns;
+
+	list_add_tail(&ns->node, &subsys->ns_list);
+}
+
+/* the config: ports 1 and 2, subsystem A for h1 and h2 with a namespace
+ * on device 0, and B for h2 with one on null_blk
+ */
+static void build_config(void)
+{
+	struct subsystem	*subsys;
+
+	target = alloc_target("t");
+	target->mgmt_mode = IN_BAND_MGMT;
+
+	add_portid(1, "192.168.1.1", 4420);
+	add_portid(2, "192.168.2.1", 4420);
+
+	subsys = add_subsys("A");
+	add_acl(subsys, "h1");
+	add_acl(subsys, "h2");
+	add_ns(subsys, 1, 0, 1);
+
+	subsys = add_subsys("B");
+	add_acl(subsys, "h2");
+	add_ns(subsys, 1, NULLB_DEVID, 0);
+
+	target->sc_iface.inb.portid =
+		list_first_entry(&target->portid_list, struct portid, node);
+}
+
+static void sc_port(int id, char *address, char *trsvcid)
+{
+	struct nvmf_port_config_entry e;
+
+	memset(&e, 0, sizeof(e));
+	e.portid = htole16(id);
+	e.trtype = NVMF_TRTYPE_RDMA;
+	e.adrfam = NVMF_ADDR_FAMILY_IP4;
+	e.treq = NVMF_TREQ_NOT_REQUIRED;
+	strcpy(e.traddr, address);
+	strcpy(e.trsvcid, trsvcid);
+
+	fake_sc_add(nvmf_get_port_state, &e, sizeof(e));
+}
+
+static void sc_subsys(char *nqn, int allowanyhost)
+{
+	struct nvmf_subsys_config_entry e;
+
+	memset(&e, 0, sizeof(e));
+	strcpy(e.subnqn, nqn);
+	e.allowanyhost = allowanyhost;
+
+	fake_sc_add(nvmf_get_subsys_state, &e, sizeof(e));
+}
+
+static void sc_ns(char *nqn, int nsid, int devid, int devns)
+{
+	struct nvmf_ns_config_entry e;
+
+	memset(&e, 0, sizeof(e));
+	strcpy(e.subnqn, nqn);
+	e.nsid = htole32(nsid);
+	e.deviceid = htole32(devid);
+	e.devicensid = htole32(devns);
+
+	fake_sc_add(nvmf_get_ns_state, &e, sizeof(e));
+}
+
+static void sc_host(char *nqn)
+{
+	struct nvmf_host_config_entry e;
+
+	memset(&e, 0, sizeof(e));
+	strcpy(e.hostnqn, nqn);
+
+	fake_sc_add(nvmf_get_host_state, &e, sizeof(e));
+}
+
+static void sc_host_link(char *subnqn, char *hostnqn)
+{
+	struct nvmf_link_host_entry e;
+
+	memset(&e, 0, sizeof(e));
+	strcpy(e.subnqn, subnqn);
+	strcpy(e.hostnqn, hostnqn);
+
+	fake_sc_add(nvmf_get_host_link_state, &e, sizeof(e));
+}
+
+static void sc_port_link(char *subnqn, int portid)
+{
+	struct nvmf_link_port_entry e;
+
+	memset(&e, 0, sizeof(e));
+	strcpy(e.subnqn, subnqn);
+	e.portid = htole16(portid);
+
+	fake_sc_add(nvmf_get_port_link_state, &e, sizeof(e));
+}
+
+/* one line per op, for comparing with what the test expects */
+static void describe(struct config_op *op, char *buf)
+{
+	struct nvmf_port_config_entry	*port = op->data;
+	struct nvmf_port_delete_entry	*del = op->data;
+	struct nvmf_ns_config_entry	*ns = op->data;
+	struct nvmf_link_host_entry	*hlink = op->data;
+	struct nvmf_link_port_entry	*plink = op->data;
+
+	if (op->type == OP_RESET_CONFIG) {
+		strcpy(buf, "reset");
+		return;
+	}
+
+	if (op->type == OP_REFRESH) {
+		strcpy(buf, "refresh");
+		return;
+	}
+
+	switch (op->id) {
+	case nvmf_set_port_config:
+		sprintf(buf, "set port %d %s:%s", le16toh(port->portid),
+			port->traddr, port->trsvcid);
+		break;
+	case nvmf_del_port_config:
+		sprintf(buf, "del port %d", le16toh(del->portid));
+		break;
+	case nvmf_set_subsys_config:
+		sprintf(buf, "set subsys %s", (char *) op->data);
+		break;
+	case nvmf_del_subsys_config:
+		sprintf(buf, "del subsys %s", (char *) op->data);
+		break;
+	case nvmf_set_ns_config:
+		sprintf(buf, "set ns %s %d", ns->subnqn, le32toh(ns->nsid));
+		break;
+	case nvmf_del_ns_config:
+		sprintf(buf, "del ns %s %d", ns->subnqn, le32toh(ns->nsid));
+		break;
+	case nvmf_set_host_config:
+		sprintf(buf, "set host %s", (char *) op->data);
+		break;
+	case nvmf_del_host_config:
+		sprintf(buf, "del host %s", (char *) op->data);
+		break;
+	case nvmf_link_host_config:
+		sprintf(buf, "link host %s %s", hlink->subnqn,
+			hlink->hostnqn);
+		break;
+	case nvmf_unlink_host_config:
+		sprintf(buf, "unlink host %s %s", hlink->subnqn,
+			hlink->hostnqn);
+		break;
+	case nvmf_link_port_config:
+		sprintf(buf, "link port %s %d", plink->subnqn,
+			le16toh(plink->portid));
+		break;
+	default:
+		sprintf(buf, "id %d", op->id);
+	}
+}
+
+static int check(const char *what, const char **expect, int gets)
+{
+	LINKED_LIST(list);
+	struct config_op	*op;
+	char			 buf[MAX_NQN_SIZE * 2 + 32];
+	int			 i = 0;
+	int			 ret;
+
+	op = alloc_config_op(target, OP_RECONCILE);
+	list_add_tail(&op->node, &list);
+
+	fake_sc.gets = 0;
+
+	ret = reconcile_target(op);
+	if (ret) {
+		printf("%s: reconcile failed %d\n", what, ret);
+		goto out;
+	}
+
+	list_del(&op->node);
+	free_config_op(op);
+
+	list_for_each_entry(op, &list, node) {
+		describe(op, buf);
+		if (!expect[i] || strcmp(buf, expect[i])) {
+			printf("%s: change %d is '%s', expected '%s'\n",
+			       what, i, buf, expect[i] ? expect[i] : "none");
+			ret = 1;
+			goto out;
+		}
+		i++;
+	}
+
+	if (expect[i]) {
+		printf("%s: missing '%s'\n", what, expect[i]);
+		ret = 1;
+	} else if (gets >= 0 && fake_sc.gets != gets) {
+		printf("%s: %d get state commands, expected %d\n",
+		       what, fake_sc.gets, gets);
+		ret = 1;
+	} else
+		printf("%s: %d changes in %d get state commands\n",
+		       what, i - 1, fake_sc.gets);
+out:
+	free_config_ops(&list);
+
+	return ret;
+}
+
+/* stale links and namespaces of C go with it, port 2 is on another
+ * trsvcid so it is set again and relinked
+ */
+static const char *drifted[] = {
+	"unlink host A h3",
+	"del ns A 2",
+	"del subsys C",
+	"del port 2",
+	"del port 3",
+	"del host h3",
+	"set port 2 192.168.2.1:4420",
+	"set subsys B",
+	"set host h2",
+	"link host A h2",
+	"link port A 2",
+	"link host B h2",
+	"set ns B 1",
+	"link port B 1",
+	"link port B 2",
+	"refresh",
+	NULL
+};
+
+static const char *in_sync[] = {
+	"refresh",
+	NULL
+};
+
+static const char *replayed[] = {
+	"reset",
+	"set port 1 192.168.1.1:4420",
+	"set port 2 192.168.2.1:4420",
+	"set subsys A",
+	"set subsys B",
+	"set host h1",
+	"set host h2",
+	"link host A h1",
+	"link host A h2",
+	"set ns A 1",
+	"link port A 1",
+	"link port A 2",
+	"link host B h2",
+	"set ns B 1",
+	"link port B 1",
+	"link port B 2",
+	"refresh",
+	NULL
+};
+
+int main(void)
+{
+	int			 ret;
+
+	config_index = &test_index;
+	if (init_config_index(config_index)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	build_config();
+
+	if (open_inb_session(target)) {
+		fprintf(stderr, "no session to the fake SC\n");
+		return 1;
+	}
+
+	fake_sc.room = PAGE_ROOM;
+
+	sc_port(1, "192.168.1.1", "4420");
+	sc_port(2, "192.168.2.1", "4421");
+	sc_port(3, "192.168.3.1", "4420");
+	sc_subsys("A", 0);
+	sc_subsys("C", 1);
+	sc_host("h1");
+	sc_host("h3");
+	sc_host_link("A", "h1");
+	sc_host_link("A", "h3");
+	sc_host_link("C", "h1");
+	sc_ns("A", 1, 0, 1);
+	sc_ns("A", 2, 0, 2);
+	sc_ns("C", 1, 0, 3);
+	sc_port_link("A", 1);
+	sc_port_link("A", 2);
+	sc_port_link("C", 1);
+
+	ret = check("drifted", drifted, 10);
+
+	fake_sc_clear();
+
+	sc_port(1, "192.168.1.1", "4420");
+	sc_port(2, "192.168.2.1", "4420");
+	sc_subsys("A", 0);
+	sc_subsys("B", 0);
+	sc_host("h1");
+	sc_host("h2");
+	sc_host_link("A", "h1");
+	sc_host_link("A", "h2");
+	sc_host_link("B", "h2");
+	sc_ns("A", 1, 0, 1);
+	sc_ns("B", 1, NVMF_NULLB_DEVID, 0);
+	sc_port_link("A", 1);
+	sc_port_link("A", 2);
+	sc_port_link("B", 1);
+	sc_port_link("B", 2);
+
+	ret |= check("in sync", in_sync, 8);
+
+	fake_sc.old = 1;
+
+	ret |= check("old SC", replayed, 1);
+
+	fake_sc_clear();
+
+	return ret;
+}
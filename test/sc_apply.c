@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2018 Intel Corporation, Inc. All rights reserved.
+ */
+
+/*
+ * Rate at which the SC applies config to nvmet's configfs.
+ *
+ * Builds a tree with files/nvmet_emulate.sh under <root>, 64 pcie
+ * controllers with 4 namespaces each, null_blk and a port, then runs the
+ * SC's configfs.c against it through configfs_emu.h.  Each run creates
+ * the subsystems, gives each 4 namespaces, a host and a link to the host
+ * and the port, walks the namespace state and the device inventory, and
+ * deletes the subsystems and hosts again, one transaction per step.
+ *
+ * Put <root> on tmpfs so the numbers are the SC's rather than the disk's.
+ *
+ *   usage: sc_apply <root> [<subsystems> [<runs>]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "configfs_emu.h"
+#include "../src/supervisory_ctrl/configfs.c"
+
+#ifndef EMULATE
+#define EMULATE		"../files/nvmet_emulate.sh"
+#endif
+
+#define SUBSYSTEMS	2000
+#define RUNS		3
+#define NS_PER_SUBSYS	4
+#define PCIE_CTRLS	64
+#define PORTID		1
+
+/* the SC globals configfs.c refers to */
+int			 debug;
+struct linked_list	*devices;
+struct linked_list	*interfaces;
+
+static double now_ms(void)
+{
+	struct timespec		 ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int emulate(char *root)
+{
+	char			 cmd[MAXPATHLEN + 128];
+
+	snprintf(cmd, sizeof(cmd), "sh %s -r %s -d %d -m %d -b -p %d",
+		 EMULATE, root, PCIE_CTRLS, NS_PER_SUBSYS, PORTID);
+	strcat(cmd, " >/dev/null");
+
+	return system(cmd);
+}
+
+static int apply(int num_subsys, double *ms)
+{
+	char			 subsys[MAXSTRLEN];
+	char			 host[MAXSTRLEN];
+	double			 start;
+	int			 i, j;
+	int			 ret = 0;
+
+	start = now_ms();
+	begin_config();
+	for (i = 0; i < num_subsys && !ret; i++) {
+		sprintf(subsys, "subsys%d", i);
+		ret = create_subsys(subsys, 0);
+	}
+	commit_config();
+	ms[0] = now_ms() - start;
+
+	start = now_ms();
+	begin_config();
+	for (i = 0; i < num_subsys && !ret; i++) {
+		sprintf(subsys, "subsys%d", i);
+		for (j = 1; j <= NS_PER_SUBSYS && !ret; j++)
+			ret = create_ns(subsys, j, i % PCIE_CTRLS, j);
+	}
+	commit_config();
+	ms[1] = now_ms() - start;
+
+	start = now_ms();
+	begin_config();
+	for (i = 0; i < num_subsys && !ret; i++) {
+		sprintf(subsys, "subsys%d", i);
+		sprintf(host, "host%d", i);
+		ret = create_host(host);
+		if (!ret)
+			ret = link_host_to_subsys(subsys, host);
+		if (!ret)
+			ret = link_port_to_subsys(subsys, PORTID);
+	}
+	commit_config();
+	ms[2] = now_ms() - start;
+
+	return ret;
+}
+
+static int remove_all(int num_subsys, double *ms)
+{
+	char			 name[MAXSTRLEN];
+	double			 start;
+	int			 i;
+	int			 ret = 0;
+
+	start = now_ms();
+	begin_config();
+	for (i = 0; i < num_subsys && !ret; i++) {
+		sprintf(name, "subsys%d", i);
+		ret = delete_subsys(name);
+	}
+	for (i = 0; i < num_subsys && !ret; i++) {
+		sprintf(name, "host%d", i);
+		ret = delete_host(name);
+	}
+	commit_config();
+	*ms = now_ms() - start;
+
+	return ret;
+}
+
+static double walk_state(int (*walk)(struct state_walk *), int size,
+			 int *total)
+{
+	static char		 buf[65536];
+	struct state_walk	 w;
+	double			 start;
+
+	memset(&w, 0, sizeof(w));
+	w.entry = buf;
+	w.size = size;
+	w.room = sizeof(buf) / size;
+
+	start = now_ms();
+	walk(&w);
+	*total = w.total;
+
+	return now_ms() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	LINKED_LIST(device_list);
+	int			 num_subsys = SUBSYSTEMS;
+	int			 runs = RUNS;
+	int			 total;
+	int			 n, ret;
+	double			 ms[3];
+	double			 walk, inventory, removal;
+
+	if (argc < 2 || (argc > 2 && (num_subsys = atoi(argv[2])) <= 0) ||
+	    (argc > 3 && (runs = atoi(argv[3])) <= 0)) {
+		fprintf(stderr, "usage: %s <root> [<subsystems> [<runs>]]\n",
+			argv[0]);
+		return 1;
+	}
+
+	if (set_sysroot(argv[1])) {
+		fprintf(stderr, "root too long\n");
+		return 1;
+	}
+
+	devices = &device_list;
+
+	printf("%d subsystems, %d namespaces, a host and a port each\n",
+	       num_subsys, NS_PER_SUBSYS);
+	printf("%10s %10s %10s %10s %10s %10s\n", "subsys/s", "ns/s",
+	       "links/s", "removal", "ns walk", "inventory");
+
+	while (runs--) {
+		close_configfs();
+		if (emulate(argv[1])) {
+			fprintf(stderr, "%s failed\n", EMULATE);
+			return 1;
+		}
+
+		ret = apply(num_subsys, ms);
+		if (ret) {
+			fprintf(stderr, "apply failed %d\n", ret);
+			return 1;
+		}
+
+		walk = walk_state(get_ns_state,
+				  sizeof(struct nvmf_ns_config_entry), &total);
+		if (total != num_subsys * NS_PER_SUBSYS) {
+			fprintf(stderr, "walked %d namespaces\n", total);
+			return 1;
+		}
+
+		inventory = now_ms();
+		n = enumerate_devices();
+		inventory = now_ms() - inventory;
+		free_devices();
+
+		ret = remove_all(num_subsys, &removal);
+		if (ret) {
+			fprintf(stderr, "removal failed %d\n", ret);
+			return 1;
+		}
+
+		walk_state(get_subsys_state,
+			   sizeof(struct nvmf_subsys_config_entry), &total);
+		if (total) {
+			fprintf(stderr, "%d subsystems left\n", total);
+			return 1;
+		}
+
+		printf("%10.0f %10.0f %10.0f %7.1f ms %7.1f ms %7.2f ms\n",
+		       num_subsys / ms[0] * 1e3,
+		       num_subsys * NS_PER_SUBSYS / ms[1] * 1e3,
+		       num_subsys * 2 / ms[2] * 1e3, removal, walk, inventory);
+	}
+
+	printf("inventory of %d devices\n", n);
+
+	close_configfs();
+
+	return 0;
+}